@@ -1,13 +1,24 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
+#include <X11/Xproto.h>
 #include <X11/keysym.h>
 #include <X11/cursorfont.h>
 #include <X11/extensions/shape.h>
+#include <X11/extensions/Xrender.h>
 #include <X11/Xft/Xft.h>
+#include <fontconfig/fontconfig.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <png.h>
+#ifdef HAVE_COMPOSITE
+#include <X11/extensions/Xcomposite.h>
+#include <X11/extensions/Xdamage.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <time.h>
 #include <stdarg.h>
@@ -15,8 +26,12 @@
 #include <pwd.h>
 #include <ctype.h>
 #include <math.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/select.h>
 
 #define PANEL_HEIGHT 50
 #define BORDER_WIDTH 1
@@ -25,11 +40,31 @@
 #define BUTTON_SPACING 5
 #define FRAME_BORDER 5
 #define RESIZE_HANDLE_SIZE 8
+#define TITLE_LEFT 80               // titlebar text starts right of the buttons
 #define MENU_WIDTH 120
+#define DESKTOP_COUNT 4
+#define DESKTOP_ALL 0xFFFFFFFFUL    // _NET_WM_DESKTOP of windows shown on every desktop
+#define LAYOUT_MASTER_PERCENT 55    // of the work area's width, in master/stack
 #define MENU_ITEM_HEIGHT 30
 #define CORNER_RADIUS 8
+#define LAUNCHER_LIST_TOP 60        // first row of the app list in the launcher
+#define LAUNCHER_LIST_MARGIN 22     // below the list, room for the search hint
+#define LAUNCHER_SCROLL_STEP 40     // pixels per mouse wheel click
 #define SHADOW_OFFSET 4
 #define SHADOW_BLUR 8
+#define SHADOW_OPACITY 0.45
+#define MAX_THEME_TEXTURES 32
+#define MAX_CORNER_MASKS 8
+#define MAX_SHAPE_RADIUS 32
+#define MAX_LOGO_ASSETS 4
+#define PANEL_ICON_SIZE 22         // image icons inside a 30px pinned-app button
+#define LAUNCHER_ICON_SIZE 16
+#define ICON_ATLAS_CELL_WIDTH 42   // a 40x30 task button plus its outline
+#define ICON_ATLAS_CELL_HEIGHT 32
+#define ICON_ATLAS_COLUMNS 8
+#define ICON_ATLAS_ROWS 8
+#define ICON_ATLAS_CELLS (ICON_ATLAS_COLUMNS * ICON_ATLAS_ROWS)
+#define SHAPE_RESIZE_INTERVAL 30 // ms between reshapes during a live resize
 #define ANIMATION_STEPS 10
 #define ANIMATION_DELAY 5000
 
@@ -56,28 +91,249 @@ void debug_log(const char* format, ...) {
     fclose(log_file);
 }
 
+// Font roles understood by every rendering backend
+enum { FONT_FIXED, FONT_REGULAR, FONT_BOLD, FONT_TITLE, FONT_COUNT };
+
+typedef struct Surface Surface;
+typedef struct DrawBatch DrawBatch;
+
+// Pre-rasterized ARGB texture drawn as a nine-slice: the corners are copied
+// as-is and the edges and center are repeated, so one texture serves any size
+enum { TEXTURE_ROUNDED, TEXTURE_SHADOW };
+
+typedef struct {
+    int kind;
+    int radius;
+    unsigned long color;
+    int border;             // corner size in pixels
+    int size;               // master image is size x size (2 * border + 1)
+    unsigned int *pixels;   // premultiplied ARGB master image
+    Pixmap pixmaps[4];
+    Picture corners, hedges, vedges, center;
+    unsigned int last_used; // theme_texture_clock at the last lookup
+} NineSlice;
+
+// Rendering backend. All draw_* routines go through one of these so the
+// same drawing code runs on core X or on XRender (anti-aliased, with alpha).
+// Text is drawn at a baseline, like XDrawString.
+typedef struct {
+    const char *name;
+    int argb_surfaces;  // can draw into 32-bit pixmaps with an alpha channel
+    int (*init_surface)(Surface *s);
+    void (*free_surface)(Surface *s);
+    void (*clear)(Surface *s);
+    void (*fill_rect)(Surface *s, int x, int y, int w, int h, unsigned long color);
+    void (*stroke_rect)(Surface *s, int x, int y, int w, int h, int line_width, unsigned long color);
+    void (*draw_line)(Surface *s, int x1, int y1, int x2, int y2, unsigned long color);
+    void (*fill_rounded_rect)(Surface *s, int x, int y, int w, int h, int r, unsigned long color);
+    void (*fill_polygon)(Surface *s, const XPoint *points, int npoints, unsigned long color);
+    void (*fill_ellipse)(Surface *s, int x, int y, int w, int h, unsigned long color);
+    void (*gradient)(Surface *s, int x, int y, int w, int h,
+                     unsigned long c1, unsigned long c2, int vertical);
+    void (*text)(Surface *s, int x, int y, const char *text, int font, unsigned long color);
+    int (*text_width)(int font, const char *text);
+    int (*font_ascent)(int font);
+    int (*has_font)(int font);  // FONT_FIXED is always available
+    void (*blit)(Surface *dst, Surface *src, int sx, int sy, int w, int h, int dx, int dy);
+    void (*clear_rect)(Surface *s, int x, int y, int w, int h);  // like clear(), for one area
+    // Premultiplied ARGB pixels, composited over the surface
+    void (*draw_image)(Surface *s, const unsigned int *pixels, int w, int h, int x, int y);
+    // Move an area's pixels dy rows down (up when negative), in place
+    void (*scroll_area)(Surface *s, int x, int y, int w, int h, int dy);
+    // Optional: backends without alpha compositing leave these NULL
+    int (*prepare_texture)(NineSlice *t);
+    void (*free_texture)(NineSlice *t);
+    void (*nine_slice)(Surface *s, const NineSlice *t, int x, int y, int w, int h);
+} RenderBackend;
+
+// A drawable plus the per-backend state needed to paint into it
+struct Surface {
+    const RenderBackend *backend;
+    Drawable drawable;
+    int is_window;
+    int argb;               // 32-bit pixmap with its own alpha, clears to transparent
+    int width, height;
+    unsigned long background;
+    unsigned short alpha;   // 0xFFFF = opaque, honoured by XRender only
+    GC gc;
+    XftDraw *xft;
+    Picture picture;
+    unsigned int *pixels;   // headless backend only
+    DrawBatch *batch;       // core backend only, see core_flush_batch
+    unsigned long gc_foreground;    // last foreground set on gc, valid if gc_foreground_set
+    int gc_foreground_set;
+    int pixels_width, pixels_height;
+    int shape_width, shape_height;  // last bounding shape set on the window
+    int shape_radius, shape_corners;
+};
+
+// Which corners of a shaped window are rounded
+enum { SHAPE_TOP = 1, SHAPE_BOTTOM = 2, SHAPE_ALL = 3 };
+
+// Row insets of a rounded corner: row i of the corner starts insets[i]
+// pixels in from the edge. Depends only on the radius, so one table serves
+// every window size.
+typedef struct {
+    int radius;
+    short insets[MAX_SHAPE_RADIUS];
+} CornerMask;
+
+// Diamond logo pre-rendered at one size, blitted wherever it appears
 typedef struct {
+    int size;
+    int pad;            // room for the glow around the diamond
+    Surface surface;
+    Pixmap mask;        // core X only: 1-bit shape of the logo
+} LogoAsset;
+
+// One cell of the panel icon atlas
+typedef struct {
+    char key[256];              // what the cell shows, "" when free
+    unsigned long last_used;
+} IconAtlasCell;
+
+// Panel button faces, pre-rendered side by side in one offscreen surface
+typedef struct {
+    Surface surface;
+    Pixmap mask;                // core X only: 1-bit coverage of every cell
+    GC mask_gc;
+    IconAtlasCell cells[ICON_ATLAS_CELLS];
+    unsigned long clock;        // bumped on every lookup, for LRU eviction
+    int ready;
+} IconAtlas;
+
+// Every atom the WM uses, interned together at startup; see init_atoms
+enum {
+    ATOM_WM_PROTOCOLS,
+    ATOM_WM_DELETE_WINDOW,
+    ATOM_WM_TAKE_FOCUS,
+    ATOM_WM_STATE,
+    ATOM_WM_CHANGE_STATE,
+    ATOM_UTF8_STRING,
+    ATOM_NET_SUPPORTED,
+    ATOM_NET_SUPPORTING_WM_CHECK,
+    ATOM_NET_CLIENT_LIST,
+    ATOM_NET_CLIENT_LIST_STACKING,
+    ATOM_NET_ACTIVE_WINDOW,
+    ATOM_NET_NUMBER_OF_DESKTOPS,
+    ATOM_NET_CURRENT_DESKTOP,
+    ATOM_NET_DESKTOP_NAMES,
+    ATOM_NET_DESKTOP_GEOMETRY,
+    ATOM_NET_DESKTOP_VIEWPORT,
+    ATOM_NET_WORKAREA,
+    ATOM_NET_CLOSE_WINDOW,
+    ATOM_NET_WM_NAME,
+    ATOM_NET_WM_VISIBLE_NAME,
+    ATOM_NET_WM_ICON,
+    ATOM_NET_WM_PID,
+    ATOM_NET_WM_DESKTOP,
+    ATOM_NET_WM_STATE,
+    ATOM_NET_WM_STATE_ABOVE,
+    ATOM_NET_WM_STATE_BELOW,
+    ATOM_NET_WM_STATE_FULLSCREEN,
+    ATOM_NET_WM_STATE_HIDDEN,
+    ATOM_NET_WM_STATE_MAXIMIZED_VERT,
+    ATOM_NET_WM_STATE_MAXIMIZED_HORZ,
+    ATOM_NET_WM_WINDOW_TYPE,
+    ATOM_NET_WM_WINDOW_TYPE_DESKTOP,
+    ATOM_NET_WM_WINDOW_TYPE_DOCK,
+    ATOM_NET_WM_WINDOW_TYPE_DIALOG,
+    ATOM_NET_WM_WINDOW_TYPE_UTILITY,
+    ATOM_NET_WM_WINDOW_TYPE_SPLASH,
+    ATOM_NET_WM_WINDOW_TYPE_NORMAL,
+    ATOM_NET_WM_WINDOW_OPACITY,
+    ATOM_NET_WM_CM_S,
+    ATOM_XROOTPMAP_ID,
+    ATOM_COUNT
+};
+
+// One copy of each distinct title or class name; see intern_string
+typedef struct InternedString {
+    char *text;
+    unsigned int hash;
+    int refs;
+    struct InternedString *next;
+} InternedString;
+
+// Stacking layers, bottom to top; see restack
+enum {
+    LAYER_DESKTOP,
+    LAYER_BELOW,
+    LAYER_NORMAL,
+    LAYER_ABOVE,
+    LAYER_PANEL,
+    LAYER_FULLSCREEN,
+    LAYER_POPUP,
+    LAYER_COUNT
+};
+
+// Frame rectangle a layout assigns to a client
+typedef struct {
+    int x, y, width, height;
+} LayoutRect;
+
+// Places n tiled clients inside area, one rectangle each in client order.
+// Floating has no arrange: windows stay where they are put.
+typedef struct {
+    const char *name;
+    void (*arrange)(int n, LayoutRect area, LayoutRect *out);
+} Layout;
+
+enum {
+    LAYOUT_FLOATING,
+    LAYOUT_MASTER_STACK,
+    LAYOUT_GRID,
+    LAYOUT_DIAMOND,
+    LAYOUT_COUNT
+};
+
+typedef struct Client {
     Window win;
     Window frame;
+    Surface surface;
     int x, y;
     int width, height;
-    int is_mapped;
-    int is_fullscreen;
+    int is_mapped;             // cleared while minimized
+    int is_fullscreen;         // covers the whole screen, above the panel
+    int is_maximized;          // fills the work area
+    int is_floating;           // transients and dialogs, never tiled
+    unsigned long desktop;     // index or DESKTOP_ALL, see set_client_desktop
+    struct Client *desktop_prev, *desktop_next;
+    int ignore_unmaps;         // UnmapNotify events the WM caused, see unmap_client
+    int layer;                 // from the window type and state, see client_layer
     int original_x, original_y;
     int original_width, original_height;
-    char *title;
+    InternedString *title;     // see set_client_title
+    int title_dirty;           // name property changed, see flush_title_updates
+    int frame_stale;           // decorations need repainting, see flush_repaints
+    int state_stale;           // _NET_WM_STATE needs writing, see flush_ewmh
+    unsigned long configure_mask; // ConfigureRequest fields not yet applied
+    int configure_x, configure_y, configure_width, configure_height, configure_stack;
+    InternedString *wm_instance, *wm_class; // WM_CLASS lowercased, NULL if unset
+    pid_t pid;                 // _NET_WM_PID, 0 if unset
+    struct PinnedApp *pinned_app; // see associate_client
+    struct Client *pinned_next;
     int is_active;
     int button_hover; // 0=none, 1=close, 2=minimize, 3=maximize
+    unsigned int *icon;        // _NET_WM_ICON at PANEL_ICON_SIZE, premultiplied
+    int icon_fetched;          // cleared when the property changes
+    unsigned int icon_serial;  // bumped on every change, keys the atlas cell
+    struct Client *prev, *next; // registry order, see register_client
+    struct Client *mru_prev, *mru_next; // focus order, see set_focused_client
 } Client;
 
 typedef struct {
     Window win;
+    Surface surface;
     int x, y;
     int width, height;
+    int tasks_x, tasks_end;     // span of the task buttons, see draw_panel_tasks
 } Panel;
 
 typedef struct {
     Window win;
+    Surface surface;            // offscreen content, see present_popup
+    Surface window_surface;
     int visible;
     int x, y;
     int width, height;
@@ -85,12 +341,18 @@ typedef struct {
     float alpha;
 } Menu;
 
-typedef struct {
+typedef struct PinnedApp {
     char *name;
     char *exec;
     char *icon_path;
     Window icon_win;
     int x_position;
+    InternedString *key;        // interned name, see pinned_app_key
+    char *wm_class;             // WM_CLASS (or StartupWMClass) of its windows
+    InternedString *class_key;  // see pinned_app_class
+    pid_t pid;                  // last launched from the panel
+    Client *clients;            // live windows, chained through pinned_next
+    int client_count;
 } PinnedApp;
 
 typedef struct {
@@ -102,9 +364,137 @@ typedef struct {
 Display *dpy;
 Window root;
 int screen;
-GC gc, panel_gc, title_gc, button_gc, close_gc, minimize_gc, maximize_gc, text_gc, menu_gc;
-Client *clients[100];
-int client_count = 0;
+const RenderBackend *renderer;
+XRenderPictFormat *render_visual_format, *render_mask_format;
+LogoAsset logo_assets[MAX_LOGO_ASSETS];
+int logo_asset_count = 0;
+IconAtlas icon_atlas;
+NineSlice theme_textures[MAX_THEME_TEXTURES];
+int theme_texture_count = 0;
+unsigned int theme_texture_clock = 0;
+int has_shape = 0;
+time_t render_clock_time = 0;  // fixed clock for headless renders
+int compositing = 0;
+int draw_stats = 0;
+const char *atom_names[ATOM_COUNT] = {
+    [ATOM_WM_PROTOCOLS] = "WM_PROTOCOLS",
+    [ATOM_WM_DELETE_WINDOW] = "WM_DELETE_WINDOW",
+    [ATOM_WM_TAKE_FOCUS] = "WM_TAKE_FOCUS",
+    [ATOM_WM_STATE] = "WM_STATE",
+    [ATOM_WM_CHANGE_STATE] = "WM_CHANGE_STATE",
+    [ATOM_UTF8_STRING] = "UTF8_STRING",
+    [ATOM_NET_SUPPORTED] = "_NET_SUPPORTED",
+    [ATOM_NET_SUPPORTING_WM_CHECK] = "_NET_SUPPORTING_WM_CHECK",
+    [ATOM_NET_CLIENT_LIST] = "_NET_CLIENT_LIST",
+    [ATOM_NET_CLIENT_LIST_STACKING] = "_NET_CLIENT_LIST_STACKING",
+    [ATOM_NET_ACTIVE_WINDOW] = "_NET_ACTIVE_WINDOW",
+    [ATOM_NET_NUMBER_OF_DESKTOPS] = "_NET_NUMBER_OF_DESKTOPS",
+    [ATOM_NET_CURRENT_DESKTOP] = "_NET_CURRENT_DESKTOP",
+    [ATOM_NET_DESKTOP_NAMES] = "_NET_DESKTOP_NAMES",
+    [ATOM_NET_DESKTOP_GEOMETRY] = "_NET_DESKTOP_GEOMETRY",
+    [ATOM_NET_DESKTOP_VIEWPORT] = "_NET_DESKTOP_VIEWPORT",
+    [ATOM_NET_WORKAREA] = "_NET_WORKAREA",
+    [ATOM_NET_CLOSE_WINDOW] = "_NET_CLOSE_WINDOW",
+    [ATOM_NET_WM_NAME] = "_NET_WM_NAME",
+    [ATOM_NET_WM_VISIBLE_NAME] = "_NET_WM_VISIBLE_NAME",
+    [ATOM_NET_WM_ICON] = "_NET_WM_ICON",
+    [ATOM_NET_WM_PID] = "_NET_WM_PID",
+    [ATOM_NET_WM_DESKTOP] = "_NET_WM_DESKTOP",
+    [ATOM_NET_WM_STATE] = "_NET_WM_STATE",
+    [ATOM_NET_WM_STATE_ABOVE] = "_NET_WM_STATE_ABOVE",
+    [ATOM_NET_WM_STATE_BELOW] = "_NET_WM_STATE_BELOW",
+    [ATOM_NET_WM_STATE_FULLSCREEN] = "_NET_WM_STATE_FULLSCREEN",
+    [ATOM_NET_WM_STATE_HIDDEN] = "_NET_WM_STATE_HIDDEN",
+    [ATOM_NET_WM_STATE_MAXIMIZED_VERT] = "_NET_WM_STATE_MAXIMIZED_VERT",
+    [ATOM_NET_WM_STATE_MAXIMIZED_HORZ] = "_NET_WM_STATE_MAXIMIZED_HORZ",
+    [ATOM_NET_WM_WINDOW_TYPE] = "_NET_WM_WINDOW_TYPE",
+    [ATOM_NET_WM_WINDOW_TYPE_DESKTOP] = "_NET_WM_WINDOW_TYPE_DESKTOP",
+    [ATOM_NET_WM_WINDOW_TYPE_DOCK] = "_NET_WM_WINDOW_TYPE_DOCK",
+    [ATOM_NET_WM_WINDOW_TYPE_DIALOG] = "_NET_WM_WINDOW_TYPE_DIALOG",
+    [ATOM_NET_WM_WINDOW_TYPE_UTILITY] = "_NET_WM_WINDOW_TYPE_UTILITY",
+    [ATOM_NET_WM_WINDOW_TYPE_SPLASH] = "_NET_WM_WINDOW_TYPE_SPLASH",
+    [ATOM_NET_WM_WINDOW_TYPE_NORMAL] = "_NET_WM_WINDOW_TYPE_NORMAL",
+    [ATOM_NET_WM_WINDOW_OPACITY] = "_NET_WM_WINDOW_OPACITY",
+    [ATOM_NET_WM_CM_S] = "_NET_WM_CM_S%d",  // per screen
+    [ATOM_XROOTPMAP_ID] = "_XROOTPMAP_ID",
+};
+Atom atoms[ATOM_COUNT];
+int titles_dirty = 0;            // some client has title_dirty set
+int configures_pending = 0;      // some client has a configure_mask
+#define STRING_TABLE_MIN 256     // buckets, always a power of two
+
+struct {
+    InternedString **buckets;
+    int size, count;
+} string_table;
+Visual *popup_visual = NULL;     // 32-bit ARGB visual for popups, if any
+Colormap popup_colormap = None;
+CornerMask corner_masks[MAX_CORNER_MASKS];
+int corner_mask_count = 0;
+int corner_mask_oldest = 0;      // next slot to reuse once all are taken
+#define CLIENT_POOL_BLOCK 64     // clients allocated together
+#define CLIENT_INDEX_MIN 256     // slots, always a power of two
+
+typedef struct ClientBlock {
+    struct ClientBlock *next;
+    Client clients[CLIENT_POOL_BLOCK];
+} ClientBlock;
+
+typedef struct {
+    Window key;                  // a client's win or frame, None when empty
+    Client *client;
+} ClientIndexSlot;
+
+// Every managed window. Both the client window and its frame are hashed, so
+// events for either find their Client without a scan.
+struct {
+    Client *head, *tail;         // in the order windows were managed
+    int count;
+    ClientIndexSlot *index;
+    int index_size, index_used;
+    Client *free_clients;        // pooled, chained through next
+    ClientBlock *blocks;
+} client_registry;
+
+typedef struct {
+    Window win;
+    int layer;
+} StackEntry;
+
+// Every top-level window the WM stacks, bottom to top and grouped by layer.
+// This is the authority on stacking order: the server is only ever told.
+struct {
+    StackEntry *entries;
+    int count, capacity;
+    Window *applied;             // top to bottom, as last sent to the server
+    int applied_count;
+} stacking;
+
+// Root window properties waiting to be written; see flush_ewmh
+struct {
+    Window check;                // _NET_SUPPORTING_WM_CHECK
+    int client_list_count;       // clients already in _NET_CLIENT_LIST
+    int client_list_stale;       // a client left, rewrite the whole list
+    int stacking_stale, active_stale, states_stale, desktop_stale;
+} ewmh;
+
+// Virtual desktops; see switch_desktop
+struct {
+    int current;
+    Client *heads[DESKTOP_COUNT + 1]; // one list per desktop, then DESKTOP_ALL
+    int layout[DESKTOP_COUNT];       // LAYOUT_*, see flush_layouts
+    int layout_dirty[DESKTOP_COUNT];
+} desktops;
+int layouts_pending = 0;         // some desktop has layout_dirty set
+int frames_pending = 0;          // some client has frame_stale set
+enum { PANEL_CURRENT, PANEL_TASKS_STALE, PANEL_STALE };
+int panel_pending = PANEL_CURRENT; // what of the panel flush_repaints redraws
+
+// Keyboard focus. Only set_focused_client changes it, and is_active mirrors it.
+struct {
+    Client *focused;
+    Client *mru_head, *mru_tail; // most recently focused first
+} focus;
 Panel panel;
 Menu menu;
 PinnedAppsList pinned_apps = {0};
@@ -134,6 +524,8 @@ unsigned long text_primary, text_secondary;
 
 typedef struct {
     Window win;
+    Surface surface;            // offscreen content, see present_popup
+    Surface window_surface;
     int visible;
     int x, y;
     int width, height;
@@ -146,6 +538,8 @@ WindowControlMenu window_control_menu;
 
 typedef struct {
     Window win;
+    Surface surface;            // offscreen content, see present_popup
+    Surface window_surface;
     int visible;
     int x, y;
     int width, height;
@@ -162,6 +556,7 @@ typedef struct {
     char *icon;
     char *categories;
     char *comment;
+    char *wm_class;             // StartupWMClass, NULL if unset
 } AppInfo;
 
 typedef struct {
@@ -171,8 +566,17 @@ typedef struct {
     int expanded;
 } AppCategory;
 
+// One line of the launcher list: a category header or an app
+typedef struct {
+    int top, height;            // in list coordinates, 0 = top of the first row
+    int item;                   // as returned by get_app_launcher_item_at
+    int category, app;          // app is -1 on a category header
+} LauncherRow;
+
 typedef struct {
     Window win;
+    Surface surface;            // offscreen content, see present_popup
+    Surface window_surface;
     int visible;
     int x, y;
     int width, height;
@@ -182,6 +586,14 @@ typedef struct {
     float alpha;
     char search_text[256];
     int search_mode;
+    LauncherRow *rows;
+    int row_count, row_capacity;
+    int rows_valid;             // cleared whenever categories expand, collapse or filter
+    int list_height;            // of all rows together
+    int scroll;                 // list offset shown at the top of the viewport
+    Surface list_surface;       // the viewport, see draw_launcher_list
+    int list_painted;
+    int painted_scroll, painted_hover;  // what list_surface currently shows
 } AppLauncherMenu;
 
 AppLauncherMenu app_launcher;
@@ -190,20 +602,36 @@ typedef struct {
     XftFont *regular;
     XftFont *bold;
     XftFont *title;
+    XFontStruct *fixed;
 } XftFontSystem;
 
 // Add these global variables after your existing ones
 XftFontSystem xft_fonts;
-XftDraw *xft_draw = NULL;
-XftColor xft_color, xft_panel_color, xft_menu_color, xft_title_color;
+XftColor xft_panel_color, xft_menu_color, xft_title_color;
+
+#define TOOLTIP_FACES 16
+#define TOOLTIP_HEIGHT 30
+#define TOOLTIP_PADDING 10
+
+// A finished tooltip for one label, sized from the font's own extents
+typedef struct {
+    char text[256];             // "" when free
+    int width, height;
+    Surface surface;
+    unsigned long last_used;
+} TooltipFace;
 
 typedef struct {
     Window win;
+    Surface surface;
     int visible;
     int x, y;
     int width, height;
     char text[256];
     PinnedApp *target_app;
+    TooltipFace *face;          // what the window shows
+    TooltipFace faces[TOOLTIP_FACES];
+    unsigned long clock;
 } Tooltip;
 
 Tooltip tooltip;
@@ -219,12 +647,40 @@ void handle_key_press(XKeyEvent *e);
 void manage_window(Window w);
 void unmanage_window(Window w);
 void toggle_fullscreen(Client *c);
+void toggle_maximize(Client *c);
 void resize_window(Client *c, int width, int height);
 void move_window(Client *c, int x, int y);
 void lower_window(Client *c);
+void stack_window(Window w, int layer);
+void unstack_window(Window w);
+void restack();
+void raise_window(Window w, int layer);
+void raise_client(Client *c);
+void focus_client(Client *c);
+void set_focused_client(Client *c);
+void focus_next_client(Client *skip);
+int client_viewable(Client *c);
+int client_on_current_desktop(Client *c);
+void restore_client(Client *c);
+void switch_desktop(int d);
+void set_client_desktop(Client *c, unsigned long d);
+void relink_client_desktop(Client *c, unsigned long d);
+int client_tiled(Client *c);
+void mark_layout_dirty(unsigned long d);
+void send_configure_notify(Client *c);
+void cycle_layout();
+void draw_panel_task_region();
 void close_window(Client *c);
 Client* find_client(Window w);
 char* get_window_title(Window w);
+void flush_title_updates();
+unsigned int string_hash(const char *text);
+void flush_configure_requests();
+void ewmh_client_added(Client *c);
+void ewmh_client_removed();
+void ewmh_client_state_changed(Client *c);
+void flush_ewmh();
+void flush_repaints();
 void setup_mouse_cursor();
 int is_in_close_button(Client *c, int x, int y);
 int is_in_minimize_button(Client *c, int x, int y);
@@ -232,8 +688,11 @@ int is_in_maximize_button(Client *c, int x, int y);
 int is_in_titlebar(Client *c, int x, int y);
 int get_resize_edge(Client *c, int x, int y);
 void send_wm_delete(Window w);
-void draw_clock();
-void draw_diamond_icon(int x, int y, int size);
+void draw_clock(Surface *s);
+void draw_diamond_icon(Surface *s, int x, int y, int size);
+void draw_logo(Surface *s, int x, int y, int size);
+void free_logo_assets();
+void free_icon_atlas();
 int is_window_visible(Client *c);
 void check_clock_update();
 void create_menu();
@@ -252,20 +711,20 @@ int is_in_app_launcher_area(int x, int y);
 int get_app_launcher_item_at(int x, int y);
 void handle_app_launcher_click(int x, int y);
 void free_applications();
-void draw_rounded_rectangle(Drawable d, GC gc, int x, int y, int w, int h, int r);
-void draw_shadow(Drawable d, int x, int y, int w, int h);
+void draw_rounded_rectangle(Surface *s, int x, int y, int w, int h, int r, unsigned long color);
+void draw_shadow(Surface *s, int x, int y, int w, int h);
 void animate_window_move(Client *c, int target_x, int target_y);
 void animate_window_resize(Client *c, int target_w, int target_h);
-void draw_gradient_rect(Drawable d, GC gc, int x, int y, int w, int h, unsigned long c1, unsigned long c2, int vertical);
-void draw_glow_button(Drawable d, int x, int y, int size, unsigned long color, int hover);
+void draw_gradient_rect(Surface *s, int x, int y, int w, int h, unsigned long c1, unsigned long c2, int vertical);
+void draw_glow_button(Surface *s, int x, int y, int size, unsigned long color, int hover);
 void update_button_hover(Client *c, int x, int y);
 void show_operation_feedback(const char* message);
 void create_window_control_menu();
 void show_window_control_menu(int x, int y, Client *c);
 void hide_window_control_menu();
 void draw_window_control_menu();
-void draw_app_launcher_text(int x, int y, const char *text, unsigned long color, XftFont *font);
 void filter_applications_by_search();
+void invalidate_launcher_rows();
 void lock_screen();
 
 // Pinned apps functions
@@ -275,6 +734,8 @@ void save_pinned_apps();
 void load_pinned_apps();
 int is_app_pinned(Client *c);
 void pin_app_to_panel(Client *c);
+void rebuild_pinned_associations();
+void adopt_startup_wm_classes();
 void unpin_app(PinnedApp *app);
 void create_pinned_app_menu();
 void show_pinned_app_menu(int x, int y, PinnedApp *app);
@@ -286,7 +747,37 @@ void show_tooltip(int x, int y, PinnedApp *app);
 void hide_tooltip();
 void draw_tooltip();
 
-int is_app_running(const char *app_name);
+int is_app_running(PinnedApp *app);
+
+// Rendering backends
+void select_render_backend();
+int surface_init(Surface *s, Drawable d, int is_window, int width, int height, unsigned long background);
+int surface_init_argb(Surface *s, int width, int height);
+void surface_free(Surface *s);
+void surface_flush(Surface *s);
+void surface_gc_foreground(Surface *s, unsigned long color);
+void surface_begin_batch(Surface *s);
+void surface_end_batch(Surface *s);
+void surface_resize(Surface *s, int width, int height);
+NineSlice *get_theme_texture(int kind, int radius, unsigned long color);
+void free_theme_textures();
+void shape_window(Surface *s, int width, int height, int radius, int corners);
+void update_frame_shape(Client *c);
+Window create_popup_window(int x, int y, int width, int height, Surface *window, Surface *content);
+void present_popup(Surface *window, Surface *content, float alpha);
+void fade_popup(Surface *window, Surface *content, float *alpha, int fade_in);
+
+// Compositing mode
+int compositor_init();
+void compositor_handle_event(XEvent *ev);
+void compositor_paint();
+void compositor_frame();
+void compositor_shutdown();
+int text_width(int font, const char *text);
+int font_ascent(int font);
+int has_font(int font);
+unsigned int premultiply(unsigned long color, double coverage);
+void init_palette();
 
 // Xft font loading (for anti-aliased fonts)
 void load_xft_fonts() {
@@ -330,3227 +821,8351 @@ void load_xft_fonts() {
     if (!xft_fonts.regular) {
         debug_log("WARNING: No Xft fonts available, using basic fonts");
     }
+
+    // Core font used for FONT_FIXED and as the fallback for missing Xft fonts
+    xft_fonts.fixed = XLoadQueryFont(dpy, "fixed");
+}
+
+XftFont *xft_font(int font) {
+    switch (font) {
+        case FONT_REGULAR: return xft_fonts.regular;
+        case FONT_BOLD: return xft_fonts.bold ? xft_fonts.bold : xft_fonts.regular;
+        case FONT_TITLE: return xft_fonts.title ? xft_fonts.title : xft_fonts.regular;
+        default: return NULL;
+    }
+}
+
+int font_ascent(int font) {
+    return renderer->font_ascent(font);
+}
+
+int has_font(int font) {
+    return renderer->has_font(font);
+}
+
+int text_width(int font, const char *text) {
+    return renderer->text_width(font, text);
+}
+
+XRenderColor to_render_color(unsigned long color, unsigned short alpha) {
+    // XRender colors are premultiplied
+    XRenderColor rc;
+    rc.red = (((color >> 16) & 0xFF) * 257) * (unsigned long)alpha / 0xFFFF;
+    rc.green = (((color >> 8) & 0xFF) * 257) * (unsigned long)alpha / 0xFFFF;
+    rc.blue = ((color & 0xFF) * 257) * (unsigned long)alpha / 0xFFFF;
+    rc.alpha = alpha;
+    return rc;
+}
+
+// ---- Outlines shared by the anti-aliasing backends ----
+
+#define ROUNDED_PATH_POINTS (4 * (8 + 1))
+#define ELLIPSE_PATH_POINTS 32
+
+// Diagonal line: a one pixel wide quad through the pixel centers
+void line_path(XPointDouble *quad, int x1, int y1, int x2, int y2) {
+    double dx = x2 - x1, dy = y2 - y1;
+    double len = sqrt(dx * dx + dy * dy);
+    double nx = -dy / len * 0.5, ny = dx / len * 0.5;
+    quad[0] = (XPointDouble){x1 + 0.5 + nx, y1 + 0.5 + ny};
+    quad[1] = (XPointDouble){x2 + 0.5 + nx, y2 + 0.5 + ny};
+    quad[2] = (XPointDouble){x2 + 0.5 - nx, y2 + 0.5 - ny};
+    quad[3] = (XPointDouble){x1 + 0.5 - nx, y1 + 0.5 - ny};
+}
+
+int rounded_rect_path(XPointDouble *points, int x, int y, int w, int h, int r) {
+    const int segments = 8;
+    double cx[4] = {x + r, x + w - r, x + w - r, x + r};
+    double cy[4] = {y + r, y + r, y + h - r, y + h - r};
+    int n = 0;
+
+    // Corners clockwise from top-left, starting angle 180 degrees
+    for (int corner = 0; corner < 4; corner++) {
+        for (int i = 0; i <= segments; i++) {
+            double angle = M_PI * (1.0 + corner * 0.5 + 0.5 * i / segments);
+            points[n].x = cx[corner] + r * cos(angle);
+            points[n].y = cy[corner] + r * sin(angle);
+            n++;
+        }
+    }
+    return n;
+}
+
+int ellipse_path(XPointDouble *points, int x, int y, int w, int h) {
+    for (int i = 0; i < ELLIPSE_PATH_POINTS; i++) {
+        double angle = 2 * M_PI * i / ELLIPSE_PATH_POINTS;
+        points[i].x = x + w / 2.0 + w / 2.0 * cos(angle);
+        points[i].y = y + h / 2.0 + h / 2.0 * sin(angle);
+    }
+    return ELLIPSE_PATH_POINTS;
+}
+
+// ---- Helpers shared by both X11 backends ----
+
+void x11_clear(Surface *s) {
+    if (s->is_window) {
+        surface_flush(s);
+        XClearWindow(dpy, s->drawable);
+    } else {
+        s->backend->fill_rect(s, 0, 0, s->width, s->height, s->background);
+    }
+}
+
+void x11_clear_rect(Surface *s, int x, int y, int w, int h) {
+    if (w <= 0 || h <= 0) return;
+    if (s->is_window) {
+        surface_flush(s);
+        XClearArea(dpy, s->drawable, x, y, w, h, False);
+    } else {
+        s->backend->fill_rect(s, x, y, w, h, s->background);
+    }
+}
+
+// The server handles the overlap between source and destination
+void x11_scroll_area(Surface *s, int x, int y, int w, int h, int dy) {
+    if (dy <= -h || dy >= h) return;
+    surface_flush(s);
+    int src_y = dy < 0 ? y - dy : y;
+    XCopyArea(dpy, s->drawable, s->drawable, s->gc, x, src_y, w, h - abs(dy), x, src_y + dy);
 }
 
-// Draw text with Xft (anti-aliased)
-void draw_xft_text(Drawable d, int x, int y, const char *text, XftFont *font, unsigned long color) {
-    if (!font) return;
+void x11_text(Surface *s, int x, int y, const char *text, int font, unsigned long color) {
+    XftFont *xf = xft_font(font);
+    surface_flush(s);
 
-    if (!xft_draw) {
-        xft_draw = XftDrawCreate(dpy, d, DefaultVisual(dpy, screen),
-                                 DefaultColormap(dpy, screen));
+    if (!xf) {
+        // 32-bit pixmaps need an opaque alpha byte in the pixel
+        surface_gc_foreground(s, s->argb ? color | 0xFF000000 : color);
+        XDrawString(dpy, s->drawable, s->gc, x, y, text, strlen(text));
+        return;
     }
 
-    if (!xft_draw) {
-        debug_log("ERROR: Could not create Xft draw");
+    // XftDraw wants a visual matching the drawable and 32-bit pixmaps have
+    // none, so their text is composited straight onto the surface picture
+    if (s->argb && s->picture) {
+        XRenderColor render_color = to_render_color(color, 0xFFFF);
+        Picture fill = XRenderCreateSolidFill(dpy, &render_color);
+        XftTextRenderUtf8(dpy, PictOpOver, fill, xf, s->picture, 0, 0, x, y,
+                          (FcChar8 *)text, strlen(text));
+        XRenderFreePicture(dpy, fill);
         return;
     }
 
-    // Convert color to XftColor
-    XRenderColor render_color;
-    render_color.red = ((color >> 16) & 0xFF) * 257;
-    render_color.green = ((color >> 8) & 0xFF) * 257;
-    render_color.blue = (color & 0xFF) * 257;
-    render_color.alpha = 0xFFFF;
+    if (!s->xft) {
+        s->xft = XftDrawCreate(dpy, s->drawable, DefaultVisual(dpy, screen),
+                               DefaultColormap(dpy, screen));
+        if (!s->xft) {
+            debug_log("ERROR: Could not create Xft draw");
+            return;
+        }
+    }
 
+    XRenderColor render_color = to_render_color(color, 0xFFFF);
+    XftColor xft_color;
     if (XftColorAllocValue(dpy, DefaultVisual(dpy, screen),
                           DefaultColormap(dpy, screen),
                           &render_color, &xft_color)) {
-
-        XftDrawStringUtf8(xft_draw, &xft_color, font, x, y + font->ascent,
-                         (XftChar8 *)text, strlen(text));
-
+        XftDrawStringUtf8(s->xft, &xft_color, xf, x, y, (XftChar8 *)text, strlen(text));
         XftColorFree(dpy, DefaultVisual(dpy, screen),
                     DefaultColormap(dpy, screen), &xft_color);
     }
 }
 
-void show_tooltip(int x, int y, PinnedApp *app) {
-    if (!app || !app->name) return;
+int x11_font_ascent(int font) {
+    XftFont *xf = xft_font(font);
+    if (xf) return xf->ascent;
+    return xft_fonts.fixed ? xft_fonts.fixed->ascent : 10;
+}
 
-    tooltip.visible = 1;
-    tooltip.target_app = app;
-    strncpy(tooltip.text, app->name, sizeof(tooltip.text) - 1);
-    tooltip.text[sizeof(tooltip.text) - 1] = '\0';
+int x11_has_font(int font) {
+    return font == FONT_FIXED || xft_font(font) != NULL;
+}
 
-    // Calculate tooltip dimensions
-    int text_len = strlen(tooltip.text);
-    tooltip.width = text_len * 7 + 20;
-    tooltip.height = 30;
+int x11_text_width(int font, const char *text) {
+    XftFont *xf = xft_font(font);
+    if (xf) {
+        XGlyphInfo extents;
+        XftTextExtentsUtf8(dpy, xf, (XftChar8 *)text, strlen(text), &extents);
+        return extents.width;
+    }
+    if (xft_fonts.fixed) return XTextWidth(xft_fonts.fixed, text, strlen(text));
+    return strlen(text) * 6;
+}
 
-    // Position tooltip above the pinned app icon
-    tooltip.x = x - tooltip.width / 2;
-    tooltip.y = panel.y - tooltip.height - 5;
+// ---- GC pool ----
+//
+// Core drawing asks for a GC by style (depth, foreground, line width, clip)
+// instead of reconfiguring the surface's own GC before every request. Each
+// style gets a GC that is set up once and then left alone, so redrawing the
+// same things sends only drawing requests. When the pool is full a new
+// style takes over the least recently used GC with one XChangeGC.
 
-    // Keep tooltip on screen
-    if (tooltip.x < 5) tooltip.x = 5;
-    if (tooltip.x + tooltip.width > DisplayWidth(dpy, screen) - 5) {
-        tooltip.x = DisplayWidth(dpy, screen) - tooltip.width - 5;
+#define GC_POOL_SIZE 64
+
+typedef struct {
+    GC gc;
+    int depth;
+    unsigned long foreground;
+    int line_width;
+    Pixmap clip;
+    int clip_x, clip_y;
+    unsigned long last_used;
+} PooledGC;
+
+struct {
+    PooledGC entries[GC_POOL_SIZE];
+    int count;
+    unsigned long clock;
+    unsigned long changes;      // GC requests sent, for DIAMONDWM_DRAW_STATS
+} gc_pool;
+
+int surface_depth(Surface *s) {
+    return s->argb ? 32 : DefaultDepth(dpy, screen);
+}
+
+GC gc_for_style(Surface *s, unsigned long foreground, int line_width,
+                Pixmap clip, int clip_x, int clip_y) {
+    int depth = surface_depth(s);
+    PooledGC *victim = NULL;
+
+    gc_pool.clock++;
+    for (int i = 0; i < gc_pool.count; i++) {
+        PooledGC *e = &gc_pool.entries[i];
+        if (e->depth == depth && e->foreground == foreground && e->line_width == line_width &&
+            e->clip == clip && e->clip_x == clip_x && e->clip_y == clip_y) {
+            e->last_used = gc_pool.clock;
+            return e->gc;
+        }
+        // Prefer recycling a GC of the right depth, it needs no new GC
+        if (!victim || (e->depth == depth && victim->depth != depth) ||
+            ((e->depth == depth) == (victim->depth == depth) && e->last_used < victim->last_used)) {
+            victim = e;
+        }
     }
 
-    XMoveResizeWindow(dpy, tooltip.win, tooltip.x, tooltip.y, tooltip.width, tooltip.height);
-    XMapWindow(dpy, tooltip.win);
-    XRaiseWindow(dpy, tooltip.win);
+    XGCValues gv;
+    gv.foreground = foreground;
+    gv.line_width = line_width;
+    gv.line_style = LineSolid;
+    gv.cap_style = CapRound;
+    gv.join_style = JoinRound;
+    gv.clip_mask = clip;
+    gv.clip_x_origin = clip_x;
+    gv.clip_y_origin = clip_y;
+    gv.graphics_exposures = False;
+    unsigned long mask = GCForeground | GCLineWidth | GCLineStyle | GCCapStyle | GCJoinStyle |
+                         GCClipMask | GCClipXOrigin | GCClipYOrigin | GCGraphicsExposures;
+
+    PooledGC *e;
+    if (gc_pool.count < GC_POOL_SIZE) {
+        e = &gc_pool.entries[gc_pool.count++];
+        e->gc = XCreateGC(dpy, s->drawable, mask, &gv);
+    } else if (victim->depth == depth) {
+        e = victim;
+        XChangeGC(dpy, e->gc, mask, &gv);
+    } else {
+        e = victim;
+        XFreeGC(dpy, e->gc);
+        e->gc = XCreateGC(dpy, s->drawable, mask, &gv);
+        gc_pool.changes++;
+    }
+    gc_pool.changes++;
+
+    e->depth = depth;
+    e->foreground = foreground;
+    e->line_width = line_width;
+    e->clip = clip;
+    e->clip_x = clip_x;
+    e->clip_y = clip_y;
+    e->last_used = gc_pool.clock;
+    return e->gc;
+}
 
-    draw_tooltip();
+// Call when a clip mask changes or is freed: its id may come back as a
+// different pixmap, and the server may have kept a copy of the old bits
+void gc_pool_forget_clip(Pixmap clip) {
+    for (int i = 0; i < gc_pool.count; i++) {
+        if (gc_pool.entries[i].clip == clip) {
+            XFreeGC(dpy, gc_pool.entries[i].gc);
+            gc_pool.entries[i] = gc_pool.entries[--gc_pool.count];
+            i--;
+        }
+    }
 }
 
-void hide_tooltip() {
-    if (tooltip.visible) {
-        tooltip.visible = 0;
-        tooltip.target_app = NULL;
-        XUnmapWindow(dpy, tooltip.win);
+void free_gc_pool() {
+    for (int i = 0; i < gc_pool.count; i++) XFreeGC(dpy, gc_pool.entries[i].gc);
+    gc_pool.count = 0;
+}
+
+// Copy through a 1-bit mask that covers the source drawable, as the core
+// backend does for artwork it cannot alpha blend
+void blit_masked(Surface *dst, Surface *src, Pixmap mask,
+                 int sx, int sy, int w, int h, int dx, int dy) {
+    surface_flush(src);
+    surface_flush(dst);
+    GC gc = gc_for_style(dst, 0, 1, mask, dx - sx, dy - sy);
+    XCopyArea(dpy, src->drawable, dst->drawable, gc, sx, sy, w, h, dx, dy);
+}
+
+// ---- Core X backend ----
+//
+// Primitives are recorded into a per-surface command buffer and sent with
+// the plural requests, one group per run of primitives sharing a foreground
+// and line width. Order inside a group does not matter: every primitive is
+// opaque paint in the same colour. The buffer is flushed when the state
+// changes, before any request that is not batched (text, copies, images),
+// and after every call unless the caller opened a batch with
+// surface_begin_batch.
+
+#define DRAW_BATCH_SIZE 128
+
+struct DrawBatch {
+    unsigned long color;
+    int line_width;
+    int depth;                  // open surface_begin_batch calls
+    XRectangle fills[DRAW_BATCH_SIZE];
+    XRectangle outlines[DRAW_BATCH_SIZE];
+    XSegment segments[DRAW_BATCH_SIZE];
+    XArc arcs[DRAW_BATCH_SIZE];
+    int fill_count, outline_count, segment_count, arc_count;
+    unsigned long requests;     // sent since the surface was created
+    unsigned long unbatched;    // what one request per primitive would have sent
+    unsigned long batches;
+};
+
+int core_init_surface(Surface *s) {
+    XGCValues gv;
+    unsigned long mask = GCForeground | GCBackground;
+    gv.foreground = s->background;
+    gv.background = s->background;
+    if (xft_fonts.fixed) {
+        gv.font = xft_fonts.fixed->fid;
+        mask |= GCFont;
     }
+    s->gc = XCreateGC(dpy, s->drawable, mask, &gv);
+    s->xft = NULL;
+    s->picture = None;
+    return s->gc != NULL;
 }
 
-void draw_tooltip() {
-    if (!tooltip.visible) return;
+void core_free_surface(Surface *s) {
+    if (s->xft) XftDrawDestroy(s->xft);
+    if (s->gc) XFreeGC(dpy, s->gc);
+    s->xft = NULL;
+    s->gc = NULL;
+}
 
-    XClearWindow(dpy, tooltip.win);
+int core_batch_init_surface(Surface *s) {
+    if (!core_init_surface(s)) return 0;
+    s->batch = calloc(1, sizeof(DrawBatch));
+    if (!s->batch) {
+        core_free_surface(s);
+        return 0;
+    }
+    s->batch->line_width = 1;
+    return 1;
+}
 
-    // Draw rounded background
-    XSetForeground(dpy, menu_gc, 0x2D2D3D);
-    draw_rounded_rectangle(tooltip.win, menu_gc, 0, 0, tooltip.width, tooltip.height, 6);
+void core_batch_free_surface(Surface *s) {
+    surface_flush(s);
+    free(s->batch);
+    s->batch = NULL;
+    core_free_surface(s);
+}
 
-    // Draw border
-    XSetForeground(dpy, menu_gc, accent_color);
-    XDrawRectangle(dpy, tooltip.win, menu_gc, 1, 1, tooltip.width - 3, tooltip.height - 3);
+void core_flush_batch(Surface *s) {
+    DrawBatch *b = s->batch;
+    if (!b->fill_count && !b->outline_count && !b->segment_count && !b->arc_count) return;
 
-    // Draw text
-    XSetForeground(dpy, menu_gc, text_primary);
-    int text_width = XTextWidth(XLoadQueryFont(dpy, "fixed"), tooltip.text, strlen(tooltip.text));
-    int text_x = (tooltip.width - text_width) / 2;
-    int text_y = tooltip.height / 2 + 5;
-    XDrawString(dpy, tooltip.win, menu_gc, text_x, text_y, tooltip.text, strlen(tooltip.text));
+    unsigned long changes = gc_pool.changes;
+    GC gc = gc_for_style(s, b->color, b->line_width, None, 0, 0);
+    b->requests += gc_pool.changes - changes;
+    if (b->fill_count) {
+        XFillRectangles(dpy, s->drawable, gc, b->fills, b->fill_count);
+        b->requests++;
+    }
+    if (b->arc_count) {
+        XFillArcs(dpy, s->drawable, gc, b->arcs, b->arc_count);
+        b->requests++;
+    }
+    if (b->outline_count) {
+        XDrawRectangles(dpy, s->drawable, gc, b->outlines, b->outline_count);
+        b->requests++;
+    }
+    if (b->segment_count) {
+        XDrawSegments(dpy, s->drawable, gc, b->segments, b->segment_count);
+        b->requests++;
+    }
+    b->fill_count = b->outline_count = b->segment_count = b->arc_count = 0;
 }
 
-void set_background() {
-    int result = system("feh --bg-scale /usr/share/backgrounds/* 2>/dev/null &");
-    if (result == -1) {
-        debug_log("WARNING: Failed to set background with feh");
+// Start recording primitives under the given state; a different state
+// sends what is already buffered
+DrawBatch *core_batch(Surface *s, unsigned long color, int line_width) {
+    DrawBatch *b = s->batch;
+    if (b->color != color || b->line_width != line_width) {
+        core_flush_batch(s);
+        b->color = color;
+        b->line_width = line_width;
     }
+    return b;
+}
 
-    Pixmap bg_pixmap = XCreatePixmap(dpy, root,
-                                    DisplayWidth(dpy, screen),
-                                    DisplayHeight(dpy, screen),
-                                    DefaultDepth(dpy, screen));
+// Outside a batch every call is sent as soon as it is recorded
+void core_batch_done(Surface *s) {
+    if (!s->batch->depth) core_flush_batch(s);
+}
 
-    GC bg_gc = XCreateGC(dpy, bg_pixmap, 0, NULL);
+void core_add_fill(Surface *s, int x, int y, int w, int h) {
+    DrawBatch *b = s->batch;
+    if (w <= 0 || h <= 0) return;
+    if (b->fill_count == DRAW_BATCH_SIZE) core_flush_batch(s);
+    b->fills[b->fill_count++] = (XRectangle){x, y, w, h};
+    b->unbatched++;
+}
 
-    // Modern gradient background (dark purple to dark blue)
-    for (int y = 0; y < DisplayHeight(dpy, screen); y++) {
-        float ratio = (float)y / DisplayHeight(dpy, screen);
-        int r = (int)(10 + ratio * 5);
-        int g = (int)(10 + ratio * 15);
-        int b = (int)(20 + ratio * 30);
-        unsigned long color = (r << 16) | (g << 8) | b;
-        XSetForeground(dpy, bg_gc, color);
-        XDrawLine(dpy, bg_pixmap, bg_gc, 0, y, DisplayWidth(dpy, screen), y);
-    }
+void core_add_segment(Surface *s, int x1, int y1, int x2, int y2) {
+    DrawBatch *b = s->batch;
+    if (b->segment_count == DRAW_BATCH_SIZE) core_flush_batch(s);
+    b->segments[b->segment_count++] = (XSegment){x1, y1, x2, y2};
+    b->unbatched++;
+}
 
-    XSetWindowBackgroundPixmap(dpy, root, bg_pixmap);
-    XClearWindow(dpy, root);
+void core_add_arc(Surface *s, int x, int y, int w, int h, int angle1, int angle2) {
+    DrawBatch *b = s->batch;
+    if (w <= 0 || h <= 0) return;
+    if (b->arc_count == DRAW_BATCH_SIZE) core_flush_batch(s);
+    b->arcs[b->arc_count++] = (XArc){x, y, w, h, angle1, angle2};
+    b->unbatched++;
+}
 
-    XFreeGC(dpy, bg_gc);
-    XFreePixmap(dpy, bg_pixmap);
+void core_fill_rect(Surface *s, int x, int y, int w, int h, unsigned long color) {
+    core_batch(s, color, 1)->unbatched++;  // the XSetForeground each call used to send
+    core_add_fill(s, x, y, w, h);
+    core_batch_done(s);
 }
 
-void show_operation_feedback(const char* message) {
-    // Create a temporary toast notification
-    Window toast = XCreateSimpleWindow(dpy, root,
-                                      DisplayWidth(dpy, screen)/2 - 100,
-                                      DisplayHeight(dpy, screen)/2,
-                                      200, 40, 0, accent_color, background_dark);
-    XSelectInput(dpy, toast, ExposureMask);
-    XMapWindow(dpy, toast);
+void core_stroke_rect(Surface *s, int x, int y, int w, int h, int line_width, unsigned long color) {
+    DrawBatch *b = core_batch(s, color, line_width);
+    b->unbatched += line_width != 1 ? 3 : 1;
+    if (w >= 0 && h >= 0) {
+        if (b->outline_count == DRAW_BATCH_SIZE) core_flush_batch(s);
+        b->outlines[b->outline_count++] = (XRectangle){x, y, w, h};
+        b->unbatched++;
+    }
+    core_batch_done(s);
+}
 
-    // Draw message
-    XGCValues toast_gc_vals;
-    toast_gc_vals.foreground = text_primary;
-    toast_gc_vals.background = background_dark;
-    toast_gc_vals.font = XLoadFont(dpy, "fixed");
-    GC toast_gc = XCreateGC(dpy, toast, GCForeground | GCBackground | GCFont, &toast_gc_vals);
+void core_draw_line(Surface *s, int x1, int y1, int x2, int y2, unsigned long color) {
+    core_batch(s, color, 1)->unbatched++;
+    core_add_segment(s, x1, y1, x2, y2);
+    core_batch_done(s);
+}
 
-    XSetForeground(dpy, toast_gc, text_primary);
-    XDrawString(dpy, toast, toast_gc, 10, 25, message, strlen(message));
-    XFlush(dpy);
+void core_fill_rounded_rect(Surface *s, int x, int y, int w, int h, int r, unsigned long color) {
+    core_batch(s, color, 1)->unbatched++;
 
-    // Auto-hide after delay
-    usleep(1500000);
-    XDestroyWindow(dpy, toast);
-    XFreeGC(dpy, toast_gc);
+    // Draw main rectangle
+    core_add_fill(s, x + r, y, w - 2*r, h);
+    core_add_fill(s, x, y + r, w, h - 2*r);
+
+    // Draw corners using arcs
+    core_add_arc(s, x, y, 2*r, 2*r, 90*64, 90*64);
+    core_add_arc(s, x + w - 2*r, y, 2*r, 2*r, 0, 90*64);
+    core_add_arc(s, x, y + h - 2*r, 2*r, 2*r, 180*64, 90*64);
+    core_add_arc(s, x + w - 2*r, y + h - 2*r, 2*r, 2*r, 270*64, 90*64);
+    core_batch_done(s);
 }
 
-void draw_gradient_rect(Drawable d, GC gc, int x, int y, int w, int h, unsigned long c1, unsigned long c2, int vertical) {
-    for (int i = 0; i < (vertical ? h : w); i++) {
-        float ratio = (float)i / (vertical ? h : w);
+// No plural form of XFillPolygon, so polygons are sent on their own
+void core_fill_polygon(Surface *s, const XPoint *points, int npoints, unsigned long color) {
+    core_flush_batch(s);
+    unsigned long changes = gc_pool.changes;
+    GC gc = gc_for_style(s, color, 1, None, 0, 0);
+    XFillPolygon(dpy, s->drawable, gc, (XPoint *)points, npoints, Convex, CoordModeOrigin);
+    s->batch->requests += gc_pool.changes - changes + 1;
+    s->batch->unbatched += 2;
+}
+
+void core_fill_ellipse(Surface *s, int x, int y, int w, int h, unsigned long color) {
+    core_batch(s, color, 1)->unbatched++;
+    core_add_arc(s, x, y, w, h, 0, 360*64);
+    core_batch_done(s);
+}
+
+// Neighbouring lines that round to the same colour share one group
+void core_gradient(Surface *s, int x, int y, int w, int h,
+                   unsigned long c1, unsigned long c2, int vertical) {
+    int r1 = (c1 >> 16) & 0xFF;
+    int g1 = (c1 >> 8) & 0xFF;
+    int b1 = c1 & 0xFF;
 
-        int r1 = (c1 >> 16) & 0xFF;
-        int g1 = (c1 >> 8) & 0xFF;
-        int b1 = c1 & 0xFF;
+    int r2 = (c2 >> 16) & 0xFF;
+    int g2 = (c2 >> 8) & 0xFF;
+    int b2 = c2 & 0xFF;
 
-        int r2 = (c2 >> 16) & 0xFF;
-        int g2 = (c2 >> 8) & 0xFF;
-        int b2 = c2 & 0xFF;
+    for (int i = 0; i < (vertical ? h : w); i++) {
+        float ratio = (float)i / (vertical ? h : w);
 
         int r = r1 + (int)((r2 - r1) * ratio);
         int g = g1 + (int)((g2 - g1) * ratio);
         int b = b1 + (int)((b2 - b1) * ratio);
 
         unsigned long color = (r << 16) | (g << 8) | b;
-        XSetForeground(dpy, gc, color);
+        core_batch(s, color, 1)->unbatched++;
 
         if (vertical) {
-            XDrawLine(dpy, d, gc, x, y + i, x + w, y + i);
+            core_add_segment(s, x, y + i, x + w, y + i);
         } else {
-            XDrawLine(dpy, d, gc, x + i, y, x + i, y + h);
+            core_add_segment(s, x + i, y, x + i, y + h);
         }
     }
+    core_batch_done(s);
 }
 
-void draw_rounded_rectangle(Drawable d, GC gc, int x, int y, int w, int h, int r) {
-    // Draw main rectangle
-    XFillRectangle(dpy, d, gc, x + r, y, w - 2*r, h);
-    XFillRectangle(dpy, d, gc, x, y + r, w, h - 2*r);
+void core_blit(Surface *dst, Surface *src, int sx, int sy, int w, int h, int dx, int dy) {
+    surface_flush(src);
+    surface_flush(dst);
+    XCopyArea(dpy, src->drawable, dst->drawable, dst->gc, sx, sy, w, h, dx, dy);
+}
 
-    // Draw corners using arcs
-    XFillArc(dpy, d, gc, x, y, 2*r, 2*r, 90*64, 90*64);
-    XFillArc(dpy, d, gc, x + w - 2*r, y, 2*r, 2*r, 0, 90*64);
-    XFillArc(dpy, d, gc, x, y + h - 2*r, 2*r, 2*r, 180*64, 90*64);
-    XFillArc(dpy, d, gc, x + w - 2*r, y + h - 2*r, 2*r, 2*r, 270*64, 90*64);
+// No alpha on the server side: read the area back, blend, write it out
+void core_draw_image(Surface *s, const unsigned int *pixels, int w, int h, int x, int y) {
+    int x0 = x < 0 ? 0 : x, y0 = y < 0 ? 0 : y;
+    int x1 = x + w > s->width ? s->width : x + w;
+    int y1 = y + h > s->height ? s->height : y + h;
+    if (x0 >= x1 || y0 >= y1) return;
+
+    surface_flush(s);
+    XImage *image = XGetImage(dpy, s->drawable, x0, y0, x1 - x0, y1 - y0, AllPlanes, ZPixmap);
+    if (!image) return;
+    for (int py = y0; py < y1; py++) {
+        for (int px = x0; px < x1; px++) {
+            unsigned int src = pixels[(py - y) * w + (px - x)];
+            unsigned int inv = 255 - (src >> 24);
+            unsigned long dst = XGetPixel(image, px - x0, py - y0);
+            unsigned int r = ((src >> 16) & 0xFF) + ((dst >> 16) & 0xFF) * inv / 255;
+            unsigned int g = ((src >> 8) & 0xFF) + ((dst >> 8) & 0xFF) * inv / 255;
+            unsigned int b = (src & 0xFF) + (dst & 0xFF) * inv / 255;
+            XPutPixel(image, px - x0, py - y0, (r << 16) | (g << 8) | b);
+        }
+    }
+    XPutImage(dpy, s->drawable, s->gc, image, 0, 0, x0, y0, x1 - x0, y1 - y0);
+    XDestroyImage(image);
 }
 
-void draw_shadow(Drawable d, int x, int y, int w, int h) {
-    // Simple shadow effect using multiple rectangles with decreasing opacity
-    for (int i = 0; i < SHADOW_BLUR; i++) {
-        int alpha = 255 - (i * 32);
-        unsigned long shadow = 0x000000 | ((alpha / 16) << 16) | ((alpha / 16) << 8) | (alpha / 16);
+const RenderBackend core_backend = {
+    "core",
+    0,
+    core_batch_init_surface,
+    core_batch_free_surface,
+    x11_clear,
+    core_fill_rect,
+    core_stroke_rect,
+    core_draw_line,
+    core_fill_rounded_rect,
+    core_fill_polygon,
+    core_fill_ellipse,
+    core_gradient,
+    x11_text,
+    x11_text_width,
+    x11_font_ascent,
+    x11_has_font,
+    core_blit,
+    x11_clear_rect,
+    core_draw_image,
+    x11_scroll_area,
+    NULL,
+    NULL,
+    NULL,
+};
+
+// ---- XRender backend: anti-aliased edges and alpha ----
+
+int xrender_init_surface(Surface *s) {
+    if (!core_init_surface(s)) return 0;
+
+    XRenderPictureAttributes pa;
+    pa.poly_edge = PolyEdgeSmooth;
+    pa.poly_mode = PolyModeImprecise;
+    XRenderPictFormat *format = s->argb ? XRenderFindStandardFormat(dpy, PictStandardARGB32)
+                                        : render_visual_format;
+    s->picture = XRenderCreatePicture(dpy, s->drawable, format,
+                                      CPPolyEdge | CPPolyMode, &pa);
+    return s->picture != None;
+}
 
-        XSetForeground(dpy, gc, shadow);
-        XDrawRectangle(dpy, d, gc,
-                      x + SHADOW_OFFSET - i,
-                      y + SHADOW_OFFSET - i,
-                      w + 2*i,
-                      h + 2*i);
+void xrender_clear(Surface *s) {
+    if (s->argb) {
+        XRenderColor transparent = {0, 0, 0, 0};
+        XRenderFillRectangle(dpy, PictOpSrc, s->picture, &transparent, 0, 0, s->width, s->height);
+    } else {
+        x11_clear(s);
     }
 }
 
-void animate_window_move(Client *c, int target_x, int target_y) {
-    int start_x = c->x;
-    int start_y = c->y;
+void xrender_clear_rect(Surface *s, int x, int y, int w, int h) {
+    if (w <= 0 || h <= 0) return;
+    if (s->argb) {
+        XRenderColor transparent = {0, 0, 0, 0};
+        XRenderFillRectangle(dpy, PictOpSrc, s->picture, &transparent, x, y, w, h);
+    } else {
+        x11_clear_rect(s, x, y, w, h);
+    }
+}
 
-    // Use cubic easing for smoother animation
-    for (int step = 1; step <= ANIMATION_STEPS; step++) {
-        float t = (float)step / ANIMATION_STEPS;
-        // Cubic ease-out
-        t--;
-        float progress = t*t*t + 1;
+void xrender_free_surface(Surface *s) {
+    if (s->picture) XRenderFreePicture(dpy, s->picture);
+    s->picture = None;
+    core_free_surface(s);
+}
 
-        int new_x = start_x + (int)((target_x - start_x) * progress);
-        int new_y = start_y + (int)((target_y - start_y) * progress);
+void xrender_fill_rect(Surface *s, int x, int y, int w, int h, unsigned long color) {
+    if (w <= 0 || h <= 0) return;
+    XRenderColor rc = to_render_color(color, s->alpha);
+    XRenderFillRectangle(dpy, PictOpOver, s->picture, &rc, x, y, w, h);
+}
 
-        XMoveWindow(dpy, c->frame, new_x, new_y);
-        XFlush(dpy);
-        usleep(ANIMATION_DELAY / ANIMATION_STEPS);
-    }
-    c->x = target_x;
-    c->y = target_y;
+// Fill an arbitrary polygon through an A8 mask so the edges are anti-aliased
+void xrender_fill_path(Surface *s, const XPointDouble *points, int npoints, unsigned long color) {
+    if (npoints < 3) return;
+    XRenderColor rc = to_render_color(color, s->alpha);
+    Picture fill = XRenderCreateSolidFill(dpy, &rc);
+    XRenderCompositeDoublePoly(dpy, PictOpOver, fill, s->picture, render_mask_format,
+                               0, 0, 0, 0, points, npoints, 0);
+    XRenderFreePicture(dpy, fill);
 }
 
-void animate_window_resize(Client *c, int target_w, int target_h) {
-    int start_w = c->width;
-    int start_h = c->height;
+void xrender_stroke_rect(Surface *s, int x, int y, int w, int h, int line_width, unsigned long color) {
+    // Same footprint as XDrawRectangle: the outline is centered on the path
+    int ox = x - line_width / 2;
+    int oy = y - line_width / 2;
+    int ow = w + line_width;
+    int oh = h + line_width;
+
+    xrender_fill_rect(s, ox, oy, ow, line_width, color);
+    xrender_fill_rect(s, ox, oy + oh - line_width, ow, line_width, color);
+    xrender_fill_rect(s, ox, oy + line_width, line_width, oh - 2 * line_width, color);
+    xrender_fill_rect(s, ox + ow - line_width, oy + line_width, line_width, oh - 2 * line_width, color);
+}
 
-    for (int step = 1; step <= ANIMATION_STEPS; step++) {
-        float progress = (float)step / ANIMATION_STEPS;
-        progress = 1 - (1 - progress) * (1 - progress);
+void xrender_draw_line(Surface *s, int x1, int y1, int x2, int y2, unsigned long color) {
+    // Axis-aligned lines stay pixel-crisp
+    if (y1 == y2) {
+        xrender_fill_rect(s, x1 < x2 ? x1 : x2, y1, abs(x2 - x1) + 1, 1, color);
+        return;
+    }
+    if (x1 == x2) {
+        xrender_fill_rect(s, x1, y1 < y2 ? y1 : y2, 1, abs(y2 - y1) + 1, color);
+        return;
+    }
 
-        int new_w = start_w + (int)((target_w - start_w) * progress);
-        int new_h = start_h + (int)((target_h - start_h) * progress);
+    XPointDouble quad[4];
+    line_path(quad, x1, y1, x2, y2);
+    xrender_fill_path(s, quad, 4, color);
+}
 
-        c->width = new_w;
-        c->height = new_h;
+void xrender_fill_rounded_rect(Surface *s, int x, int y, int w, int h, int r, unsigned long color) {
+    if (r <= 0) {
+        xrender_fill_rect(s, x, y, w, h, color);
+        return;
+    }
 
-        XResizeWindow(dpy, c->frame, new_w, new_h);
-        XResizeWindow(dpy, c->win, new_w - 2 * FRAME_BORDER,
-                     new_h - TITLEBAR_HEIGHT - 2 * FRAME_BORDER);
+    XPointDouble points[ROUNDED_PATH_POINTS];
+    int n = rounded_rect_path(points, x, y, w, h, r);
+    xrender_fill_path(s, points, n, color);
+}
 
-        draw_window_decorations(c);
-        XFlush(dpy);
-        usleep(ANIMATION_DELAY);
+void xrender_fill_polygon(Surface *s, const XPoint *points, int npoints, unsigned long color) {
+    if (npoints < 3) return;
+    XPointDouble fpoints[npoints];
+    for (int i = 0; i < npoints; i++) {
+        fpoints[i].x = points[i].x;
+        fpoints[i].y = points[i].y;
     }
+    xrender_fill_path(s, fpoints, npoints, color);
 }
 
-void draw_glow_button(Drawable d, int x, int y, int size, unsigned long color, int hover) {
-    if (hover) {
-        // Enhanced glow with multiple layers
-        for (int i = 3; i > 0; i--) {
-            int alpha = 120 - (i * 30);
-            // Simulate alpha by blending with background
-            int r = (color >> 16) & 0xFF;
-            int g = (color >> 8) & 0xFF;
-            int b = color & 0xFF;
+void xrender_fill_ellipse(Surface *s, int x, int y, int w, int h, unsigned long color) {
+    if (w <= 0 || h <= 0) return;
 
-            // Blend with dark background
-            r = (r * alpha + 0x2D * (255 - alpha)) / 255;
-            g = (g * alpha + 0x2D * (255 - alpha)) / 255;
-            b = (b * alpha + 0x2D * (255 - alpha)) / 255;
+    XPointDouble points[ELLIPSE_PATH_POINTS];
+    int n = ellipse_path(points, x, y, w, h);
+    xrender_fill_path(s, points, n, color);
+}
 
-            unsigned long glow_color = (r << 16) | (g << 8) | b;
-            XSetForeground(dpy, button_gc, glow_color);
+void xrender_gradient(Surface *s, int x, int y, int w, int h,
+                      unsigned long c1, unsigned long c2, int vertical) {
+    if (w <= 0 || h <= 0) return;
 
-            XFillArc(dpy, d, button_gc,
-                    x - i, y - i,
-                    size + 2*i, size + 2*i,
-                    0, 360*64);
-        }
+    XLinearGradient line;
+    line.p1.x = XDoubleToFixed(0);
+    line.p1.y = XDoubleToFixed(0);
+    line.p2.x = XDoubleToFixed(vertical ? 0 : w);
+    line.p2.y = XDoubleToFixed(vertical ? h : 0);
+
+    XFixed stops[2] = {XDoubleToFixed(0), XDoubleToFixed(1)};
+    XRenderColor colors[2] = {to_render_color(c1, s->alpha), to_render_color(c2, s->alpha)};
+
+    Picture gradient = XRenderCreateLinearGradient(dpy, &line, stops, colors, 2);
+    XRenderComposite(dpy, PictOpOver, gradient, None, s->picture, 0, 0, 0, 0, x, y, w, h);
+    XRenderFreePicture(dpy, gradient);
+}
+
+void xrender_blit(Surface *dst, Surface *src, int sx, int sy, int w, int h, int dx, int dy) {
+    XRenderComposite(dpy, PictOpOver, src->picture, None, dst->picture,
+                     sx, sy, 0, 0, dx, dy, w, h);
+}
+
+// Copy premultiplied ARGB pixels into a fresh 32-bit pixmap
+Pixmap xrender_upload_pixels(const unsigned int *pixels, int w, int h) {
+    Pixmap pixmap = XCreatePixmap(dpy, root, w, h, 32);
+    GC upload_gc = XCreateGC(dpy, pixmap, 0, NULL);
+    XImage *image = XCreateImage(dpy, DefaultVisual(dpy, screen), 32, ZPixmap, 0,
+                                 (char *)pixels, w, h, 32, 0);
+    if (image) {
+        // Pixels are in host byte order; Xlib swaps if the server differs
+        union { unsigned int i; char c; } order = {1};
+        image->byte_order = order.c ? LSBFirst : MSBFirst;
+        XPutImage(dpy, pixmap, upload_gc, image, 0, 0, 0, 0, w, h);
+        image->data = NULL;
+        XDestroyImage(image);
     }
+    XFreeGC(dpy, upload_gc);
+    return pixmap;
+}
 
-    // Main button
-    XSetForeground(dpy, button_gc, color);
-    XPoint diamond[] = {
-        {x + size/2, y},
-        {x + size, y + size/2},
-        {x + size/2, y + size},
-        {x, y + size/2}
-    };
-    XFillPolygon(dpy, d, button_gc, diamond, 4, Convex, CoordModeOrigin);
+void xrender_draw_image(Surface *s, const unsigned int *pixels, int w, int h, int x, int y) {
+    XRenderPictFormat *argb = XRenderFindStandardFormat(dpy, PictStandardARGB32);
+    if (!argb || w <= 0 || h <= 0) return;
 
-    // Inner highlight for 3D effect
-    if (hover) {
-        XSetForeground(dpy, button_gc, white);
-        XDrawLine(dpy, d, button_gc, x + size/2, y + 1, x + size - 1, y + size/2);
+    Pixmap pixmap = xrender_upload_pixels(pixels, w, h);
+    Picture picture = XRenderCreatePicture(dpy, pixmap, argb, 0, NULL);
+    Picture mask = None;
+    if (s->alpha != 0xFFFF) {
+        XRenderColor rc = {0, 0, 0, s->alpha};
+        mask = XRenderCreateSolidFill(dpy, &rc);
     }
+    XRenderComposite(dpy, PictOpOver, picture, mask, s->picture, 0, 0, 0, 0, x, y, w, h);
+    if (mask) XRenderFreePicture(dpy, mask);
+    XRenderFreePicture(dpy, picture);
+    XFreePixmap(dpy, pixmap);
 }
 
-void update_button_hover(Client *c, int x, int y) {
-    int old_hover = c->button_hover;
-    c->button_hover = 0;
+// Upload a rectangle of the master image into a fresh 32-bit pixmap
+Picture xrender_upload_piece(NineSlice *t, int slot, int sx, int sy, int w, int h, int repeat) {
+    XRenderPictFormat *argb = XRenderFindStandardFormat(dpy, PictStandardARGB32);
+    if (!argb) return None;
 
-    if (is_in_close_button(c, x, y)) {
-        c->button_hover = 1;
-    } else if (is_in_minimize_button(c, x, y)) {
-        c->button_hover = 2;
-    } else if (is_in_maximize_button(c, x, y)) {
-        c->button_hover = 3;
+    unsigned int *data = malloc(sizeof(unsigned int) * w * h);
+    if (!data) return None;
+    for (int y = 0; y < h; y++) {
+        memcpy(data + y * w, t->pixels + (sy + y) * t->size + sx, sizeof(unsigned int) * w);
     }
+    Pixmap pixmap = xrender_upload_pixels(data, w, h);
+    free(data);
 
-    // Only redraw if hover state actually changed
-    if (old_hover != c->button_hover) {
-        draw_window_decorations(c);
-    }
+    XRenderPictureAttributes pa;
+    pa.repeat = repeat ? RepeatNormal : RepeatNone;
+    t->pixmaps[slot] = pixmap;
+    return XRenderCreatePicture(dpy, pixmap, argb, CPRepeat, &pa);
 }
 
-int is_window_visible(Client *c) {
-    if (!c) return 0;
+// Split the master into corners, the two edge strips and the center pixel.
+// Edges and center are constant along their long axis, so repeating them is
+// the same as stretching.
+int xrender_prepare_texture(NineSlice *t) {
+    int b = t->border;
+    t->corners = xrender_upload_piece(t, 0, 0, 0, t->size, t->size, 0);
+    t->hedges = xrender_upload_piece(t, 1, b, 0, 1, t->size, 1);
+    t->vedges = xrender_upload_piece(t, 2, 0, b, t->size, 1, 1);
+    t->center = xrender_upload_piece(t, 3, b, b, 1, 1, 1);
+    return t->corners && t->hedges && t->vedges && t->center;
+}
 
-    int screen_width = DisplayWidth(dpy, screen);
-    int screen_height = DisplayHeight(dpy, screen);
+void xrender_free_texture(NineSlice *t) {
+    Picture *pictures[4] = {&t->corners, &t->hedges, &t->vedges, &t->center};
+    for (int i = 0; i < 4; i++) {
+        if (*pictures[i]) XRenderFreePicture(dpy, *pictures[i]);
+        *pictures[i] = None;
+        if (t->pixmaps[i]) XFreePixmap(dpy, t->pixmaps[i]);
+        t->pixmaps[i] = None;
+    }
+}
 
-    if (c->x >= screen_width || c->y >= screen_height) {
-        return 0;
+void xrender_nine_slice(Surface *s, const NineSlice *t, int x, int y, int w, int h) {
+    int b = t->border;
+    int far = t->size - b;  // first pixel of the right/bottom corners in the master
+    int mw = w - 2 * b, mh = h - 2 * b;
+    Picture dst = s->picture;
+
+    // Surface alpha is applied as a constant mask
+    Picture mask = None;
+    if (s->alpha != 0xFFFF) {
+        XRenderColor rc = {0, 0, 0, s->alpha};
+        mask = XRenderCreateSolidFill(dpy, &rc);
     }
 
-    if (c->x + c->width <= 0 || c->y + c->height <= 0) {
-        return 0;
+    XRenderComposite(dpy, PictOpOver, t->corners, mask, dst, 0, 0, 0, 0, x, y, b, b);
+    XRenderComposite(dpy, PictOpOver, t->corners, mask, dst, far, 0, 0, 0, x + w - b, y, b, b);
+    XRenderComposite(dpy, PictOpOver, t->corners, mask, dst, 0, far, 0, 0, x, y + h - b, b, b);
+    XRenderComposite(dpy, PictOpOver, t->corners, mask, dst, far, far, 0, 0, x + w - b, y + h - b, b, b);
+    if (mw > 0) {
+        XRenderComposite(dpy, PictOpOver, t->hedges, mask, dst, 0, 0, 0, 0, x + b, y, mw, b);
+        XRenderComposite(dpy, PictOpOver, t->hedges, mask, dst, 0, far, 0, 0, x + b, y + h - b, mw, b);
+    }
+    if (mh > 0) {
+        XRenderComposite(dpy, PictOpOver, t->vedges, mask, dst, 0, 0, 0, 0, x, y + b, b, mh);
+        XRenderComposite(dpy, PictOpOver, t->vedges, mask, dst, far, 0, 0, 0, x + w - b, y + b, b, mh);
+    }
+    if (mw > 0 && mh > 0) {
+        XRenderComposite(dpy, PictOpOver, t->center, mask, dst, 0, 0, 0, 0, x + b, y + b, mw, mh);
     }
 
-    return 1;
+    if (mask) XRenderFreePicture(dpy, mask);
 }
 
-void draw_diamond_icon(int x, int y, int size) {
-    int center_x = x + size / 2;
-    int center_y = y + size / 2;
-    float scale_factor = size / 32.0f; // Scale based on original 32px design
+const RenderBackend xrender_backend = {
+    "xrender",
+    1,
+    xrender_init_surface,
+    xrender_free_surface,
+    xrender_clear,
+    xrender_fill_rect,
+    xrender_stroke_rect,
+    xrender_draw_line,
+    xrender_fill_rounded_rect,
+    xrender_fill_polygon,
+    xrender_fill_ellipse,
+    xrender_gradient,
+    x11_text,
+    x11_text_width,
+    x11_font_ascent,
+    x11_has_font,
+    xrender_blit,
+    xrender_clear_rect,
+    xrender_draw_image,
+    x11_scroll_area,
+    xrender_prepare_texture,
+    xrender_free_texture,
+    xrender_nine_slice,
+};
+
+// ---- Headless backend: software rendering into ARGB memory ----
+//
+// Renders without an X server so drawing code can be checked against golden
+// images and timed in a plain build. Pixels are premultiplied ARGB, the same
+// layout XRender uses, and outlines share their geometry with the XRender
+// backend. Text goes through FreeType in DejaVu Sans and DejaVu Sans Mono,
+// unhinted, so the goldens don't depend on which fonts or which FreeType
+// hinting engine the machine has.
+
+#define HEADLESS_LOAD_FLAGS FT_LOAD_NO_HINTING
 
-    // 1. Outer glow effect (multi-layered aurora)
-    for (int i = 6; i > 0; i--) {
-        float alpha = (float)i / 6.0f;
-        int glow_offset = (int)(i * 2 * scale_factor);
+typedef struct {
+    FT_Library library;
+    FT_Face faces[FONT_COUNT];
+} HeadlessFonts;
+
+HeadlessFonts headless_fonts;
+
+// Open `family` at `points` on a 96 dpi screen like Xft's default. NULL
+// unless fontconfig finds that very family rather than a substitute.
+FT_Face headless_open_face(const char *family, int weight, double points, int pixels) {
+    FcPattern *pattern = FcPatternBuild(NULL,
+        FC_FAMILY, FcTypeString, family,
+        FC_WEIGHT, FcTypeInteger, weight,
+        NULL);
+    if (!pattern) return NULL;
+    FcConfigSubstitute(NULL, pattern, FcMatchPattern);
+    FcDefaultSubstitute(pattern);
+
+    FcResult result;
+    FcPattern *match = FcFontMatch(NULL, pattern, &result);
+    FcPatternDestroy(pattern);
+    if (!match) return NULL;
+
+    FcChar8 *file = NULL;
+    int index = 0;
+    FT_Face face = NULL;
+    if (FcPatternGetString(match, FC_FILE, 0, &file) == FcResultMatch) {
+        FcPatternGetInteger(match, FC_INDEX, 0, &index);
+        if (FT_New_Face(headless_fonts.library, (const char *)file, index, &face) != 0) {
+            face = NULL;
+        }
+    }
+    FcPatternDestroy(match);
+    if (!face) return NULL;
 
-        // Aurora effect - purple to blue gradient
-        int r = (int)(138 * alpha + (66 * (1 - alpha)));
-        int g = (int)(43 * alpha + (92 * (1 - alpha)));
-        int b = (int)(226 * alpha + (231 * (1 - alpha)));
-        unsigned long glow_color = (r << 16) | (g << 8) | b;
+    if (!face->family_name || strcmp(face->family_name, family) != 0) {
+        FT_Done_Face(face);
+        return NULL;
+    }
+    if (pixels) {
+        FT_Set_Pixel_Sizes(face, 0, pixels);
+    } else {
+        FT_Set_Char_Size(face, 0, (FT_F26Dot6)(points * 64), 96, 96);
+    }
+    debug_log("Headless font: %s %s", face->family_name, face->style_name);
+    return face;
+}
 
-        XSetForeground(dpy, panel_gc, glow_color);
-        XPoint glow[] = {
-            {center_x, y - glow_offset},
-            {x + size + glow_offset, center_y},
-            {center_x, y + size + glow_offset},
-            {x - glow_offset, center_y}
-        };
-        XDrawLines(dpy, panel.win, panel_gc, glow, 4, CoordModeOrigin);
+int headless_load_fonts() {
+    if (!FcInit() || FT_Init_FreeType(&headless_fonts.library) != 0) return 0;
+
+    // Sizes mirror load_xft_fonts(); FONT_FIXED stands in for the 6x13 core font
+    headless_fonts.faces[FONT_FIXED] = headless_open_face("DejaVu Sans Mono", FC_WEIGHT_REGULAR, 0, 10);
+    headless_fonts.faces[FONT_REGULAR] = headless_open_face("DejaVu Sans", FC_WEIGHT_REGULAR, 8.0, 0);
+    headless_fonts.faces[FONT_BOLD] = headless_open_face("DejaVu Sans", FC_WEIGHT_BOLD, 9.0, 0);
+    headless_fonts.faces[FONT_TITLE] = headless_open_face("DejaVu Sans", FC_WEIGHT_BOLD, 10.0, 0);
+    for (int i = 0; i < FONT_COUNT; i++) {
+        if (!headless_fonts.faces[i]) return 0;
     }
+    return 1;
+}
 
-    // 2. Main diamond body with gradient facets
-    // Pavilion (bottom part - darker base)
-    int pav_offset = (int)(6 * scale_factor);
-    XPoint pavilion[] = {
-        {center_x, center_y + (int)(3 * scale_factor)},
-        {x + size - pav_offset, center_y},
-        {center_x, y + size},
-        {x + pav_offset, center_y}
-    };
-    XSetForeground(dpy, panel_gc, 0x5D3BA8); // Deep purple
-    XFillPolygon(dpy, panel.win, panel_gc, pavilion, 4, Convex, CoordModeOrigin);
+void headless_free_fonts() {
+    for (int i = 0; i < FONT_COUNT; i++) {
+        if (headless_fonts.faces[i]) FT_Done_Face(headless_fonts.faces[i]);
+        headless_fonts.faces[i] = NULL;
+    }
+    if (headless_fonts.library) FT_Done_FreeType(headless_fonts.library);
+    headless_fonts.library = NULL;
+}
 
-    // 3. Crown facets (upper part with highlights)
-    // Left facet
-    int crown_height = (int)(10 * scale_factor);
-    XPoint left_facet[] = {
-        {center_x, y + crown_height},
-        {x + pav_offset, center_y},
-        {center_x, center_y + (int)(3 * scale_factor)}
-    };
-    XSetForeground(dpy, panel_gc, 0x7C3AED); // Medium purple
-    XFillPolygon(dpy, panel.win, panel_gc, left_facet, 3, Convex, CoordModeOrigin);
+FT_Face headless_face(int font) {
+    FT_Face face = headless_fonts.faces[font];
+    if (!face && font != FONT_REGULAR && font != FONT_FIXED) face = headless_fonts.faces[FONT_REGULAR];
+    return face ? face : headless_fonts.faces[FONT_FIXED];
+}
 
-    // Right facet (highlight area)
-    XPoint right_facet[] = {
-        {center_x, y + crown_height},
-        {center_x, center_y + (int)(3 * scale_factor)},
-        {x + size - pav_offset, center_y}
-    };
-    XSetForeground(dpy, panel_gc, 0x9D7BF5); // Light purple highlight
-    XFillPolygon(dpy, panel.win, panel_gc, right_facet, 3, Convex, CoordModeOrigin);
+unsigned int headless_color(unsigned long color, unsigned short alpha) {
+    return premultiply(color, alpha / 65535.0);
+}
 
-    // 4. Table (top flat surface)
-    int table_width = (int)(8 * scale_factor);
-    int table_height = (int)(3 * scale_factor);
-    XPoint table[] = {
-        {center_x - table_width, y + crown_height},
-        {center_x + table_width, y + crown_height},
-        {center_x + table_width - (int)(2 * scale_factor), center_y - table_height},
-        {center_x - table_width + (int)(2 * scale_factor), center_y - table_height}
-    };
-    XSetForeground(dpy, panel_gc, 0xA78BFA); // Lightest purple
-    XFillPolygon(dpy, panel.win, panel_gc, table, 4, Convex, CoordModeOrigin);
+// Source-over for one premultiplied pixel, scaled by coverage 0..255
+void headless_blend(unsigned int *dst, unsigned int src, unsigned int coverage) {
+    if (coverage == 0) return;
+    if (coverage < 255) {
+        unsigned int a = (src >> 24) * coverage / 255;
+        unsigned int r = ((src >> 16) & 0xFF) * coverage / 255;
+        unsigned int g = ((src >> 8) & 0xFF) * coverage / 255;
+        unsigned int b = (src & 0xFF) * coverage / 255;
+        src = (a << 24) | (r << 16) | (g << 8) | b;
+    }
 
-    // 5. Sparkle highlights (realistic light reflection)
-    XSetForeground(dpy, panel_gc, 0xFFFFFF); // Pure white
-    // Main sparkle
-    int sparkle_size = (int)(3 * scale_factor);
-    if (sparkle_size > 0) {
-        XFillArc(dpy, panel.win, panel_gc,
-                center_x - sparkle_size/2, y + (int)(8 * scale_factor),
-                sparkle_size, sparkle_size, 0, 360*64);
+    unsigned int inv = 255 - (src >> 24);
+    if (inv == 0) {
+        *dst = src;
+        return;
     }
-    // Secondary sparkles
-    XDrawPoint(dpy, panel.win, panel_gc, center_x + (int)(5 * scale_factor), y + (int)(12 * scale_factor));
-    XDrawPoint(dpy, panel.win, panel_gc, center_x - (int)(4 * scale_factor), center_y - (int)(2 * scale_factor));
+    unsigned int d = *dst;
+    unsigned int a = (src >> 24) + ((d >> 24) * inv + 127) / 255;
+    unsigned int r = ((src >> 16) & 0xFF) + (((d >> 16) & 0xFF) * inv + 127) / 255;
+    unsigned int g = ((src >> 8) & 0xFF) + (((d >> 8) & 0xFF) * inv + 127) / 255;
+    unsigned int b = (src & 0xFF) + ((d & 0xFF) * inv + 127) / 255;
+    *dst = (a << 24) | (r << 16) | (g << 8) | b;
+}
 
-    // 6. Edge highlights for 3D depth
-    XSetForeground(dpy, panel_gc, 0xE9D5FF); // Very light purple
-    XDrawLine(dpy, panel.win, panel_gc, center_x, y + crown_height,
-              center_x + table_width, y + crown_height); // Top edge
-    XDrawLine(dpy, panel.win, panel_gc, center_x + table_width, y + crown_height,
-              center_x + table_width - (int)(2 * scale_factor), center_y - table_height); // Right-top edge
+// The buffer follows surface_resize() lazily
+int headless_reserve(Surface *s) {
+    if (s->pixels && s->pixels_width == s->width && s->pixels_height == s->height) return 1;
+    free(s->pixels);
+    s->pixels = NULL;
+    s->pixels_width = s->pixels_height = 0;
+    if (s->width <= 0 || s->height <= 0) return 0;
+
+    s->pixels = calloc((size_t)s->width * s->height, sizeof(unsigned int));
+    if (!s->pixels) return 0;
+    s->pixels_width = s->width;
+    s->pixels_height = s->height;
+    return 1;
+}
 
-    // 7. Pavilion shadow for depth
-    XSetForeground(dpy, panel_gc, 0x4C2889); // Dark purple shadow
-    XDrawLine(dpy, panel.win, panel_gc,
-              center_x - (int)(4 * scale_factor), y + size - (int)(2 * scale_factor),
-              center_x + (int)(4 * scale_factor), y + size - (int)(2 * scale_factor));
+int headless_init_surface(Surface *s) {
+    s->pixels = NULL;
+    s->pixels_width = s->pixels_height = 0;
+    return headless_reserve(s);
 }
 
-void draw_clock() {
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    char time_str[6];
+void headless_free_surface(Surface *s) {
+    free(s->pixels);
+    s->pixels = NULL;
+    s->pixels_width = s->pixels_height = 0;
+}
 
-    strftime(time_str, sizeof(time_str), "%H:%M", tm_info);
+void headless_clear(Surface *s) {
+    if (!headless_reserve(s)) return;
+    // Windows clear to their opaque background, ARGB pixmaps to transparent
+    unsigned int fill = s->argb ? 0 : (0xFF000000 | (s->background & 0xFFFFFF));
+    for (int i = 0; i < s->pixels_width * s->pixels_height; i++) s->pixels[i] = fill;
+}
 
-    // Use anti-aliased font for clock
-    if (xft_fonts.regular) {
-        XGlyphInfo extents;
-        XftTextExtents8(dpy, xft_fonts.regular, (XftChar8 *)time_str, strlen(time_str), &extents);
-        int text_width = extents.width;
-        int x = 40 + panel.width - text_width - 180;
-        int y = 17;
+void headless_clear_rect(Surface *s, int x, int y, int w, int h) {
+    if (!headless_reserve(s)) return;
+    int x0 = x < 0 ? 0 : x, y0 = y < 0 ? 0 : y;
+    int x1 = x + w > s->pixels_width ? s->pixels_width : x + w;
+    int y1 = y + h > s->pixels_height ? s->pixels_height : y + h;
+    unsigned int fill = s->argb ? 0 : (0xFF000000 | (s->background & 0xFFFFFF));
 
-        draw_app_launcher_text(x, y, time_str, text_primary, xft_fonts.regular);
-    } else {
-        // Fallback
-        int text_width = XTextWidth(XLoadQueryFont(dpy, "fixed"), time_str, strlen(time_str));
-        int x = panel.width - text_width - 180;
-        XSetForeground(dpy, panel_gc, text_primary);
-        XDrawString(dpy, panel.win, panel_gc, x, 30, time_str, strlen(time_str));
+    for (int py = y0; py < y1; py++) {
+        for (int px = x0; px < x1; px++) s->pixels[py * s->pixels_width + px] = fill;
     }
 }
 
-void check_clock_update() {
-    static time_t last_update = 0;
-    time_t now = time(NULL);
+void headless_scroll_area(Surface *s, int x, int y, int w, int h, int dy) {
+    if (!headless_reserve(s) || dy <= -h || dy >= h) return;
+    int x0 = x < 0 ? 0 : x;
+    int x1 = x + w > s->pixels_width ? s->pixels_width : x + w;
+    if (x0 >= x1) return;
+
+    // Walk against the direction of travel so no row is read after it is overwritten
+    int rows = h - abs(dy);
+    for (int i = 0; i < rows; i++) {
+        int row = dy > 0 ? rows - 1 - i : i;
+        int from_y = (dy < 0 ? y - dy : y) + row, to_y = from_y + dy;
+        if (from_y < 0 || from_y >= s->pixels_height || to_y < 0 || to_y >= s->pixels_height) continue;
+        memmove(&s->pixels[to_y * s->pixels_width + x0], &s->pixels[from_y * s->pixels_width + x0],
+                (x1 - x0) * sizeof(unsigned int));
+    }
+}
 
-    // Only update if minute has changed (not every second)
-    if (now / 60 != last_update / 60) {
-        last_update = now;
-        draw_panel();
+void headless_fill_rect(Surface *s, int x, int y, int w, int h, unsigned long color) {
+    if (!headless_reserve(s)) return;
+    int x0 = x < 0 ? 0 : x, y0 = y < 0 ? 0 : y;
+    int x1 = x + w > s->pixels_width ? s->pixels_width : x + w;
+    int y1 = y + h > s->pixels_height ? s->pixels_height : y + h;
+    unsigned int src = headless_color(color, s->alpha);
+
+    for (int py = y0; py < y1; py++) {
+        unsigned int *row = s->pixels + py * s->pixels_width;
+        for (int px = x0; px < x1; px++) headless_blend(&row[px], src, 255);
     }
 }
 
-void create_menu() {
-    menu.width = MENU_WIDTH;
-    menu.height = MENU_ITEM_HEIGHT * 4;
-    menu.x = panel.width - menu.width - 20;
-    menu.y = panel.y - menu.height;
-    menu.hover_item = -1;
-    menu.alpha = 0.0f;
+// Even-odd scanline fill with 4 sub-scanlines per row and exact horizontal
+// coverage, close to what the server does for XRender trapezoids
+void headless_fill_path(Surface *s, const XPointDouble *points, int npoints, unsigned long color) {
+    if (npoints < 3 || !headless_reserve(s)) return;
 
-    menu.win = XCreateSimpleWindow(dpy, root, menu.x, menu.y,
-                                  menu.width, menu.height, 0,
-                                  white, dark_blue);
+    double min_y = points[0].y, max_y = points[0].y;
+    for (int i = 1; i < npoints; i++) {
+        if (points[i].y < min_y) min_y = points[i].y;
+        if (points[i].y > max_y) max_y = points[i].y;
+    }
+    int y0 = (int)floor(min_y), y1 = (int)ceil(max_y);
+    if (y0 < 0) y0 = 0;
+    if (y1 > s->pixels_height) y1 = s->pixels_height;
+
+    int width = s->pixels_width;
+    float *coverage = calloc(width + 1, sizeof(float));
+    double *crossings = malloc(sizeof(double) * npoints);
+    if (!coverage || !crossings) {
+        free(coverage);
+        free(crossings);
+        return;
+    }
+    unsigned int src = headless_color(color, s->alpha);
+
+    for (int py = y0; py < y1; py++) {
+        int touched = 0;
+        for (int sub = 0; sub < 4; sub++) {
+            double sy = py + (sub + 0.5) / 4;
+            int n = 0;
+            for (int i = 0; i < npoints; i++) {
+                const XPointDouble *a = &points[i], *b = &points[(i + 1) % npoints];
+                if ((a->y <= sy && b->y > sy) || (b->y <= sy && a->y > sy)) {
+                    crossings[n++] = a->x + (sy - a->y) * (b->x - a->x) / (b->y - a->y);
+                }
+            }
+            // Few crossings per scanline; insertion sort is plenty
+            for (int i = 1; i < n; i++) {
+                double v = crossings[i];
+                int j = i - 1;
+                while (j >= 0 && crossings[j] > v) {
+                    crossings[j + 1] = crossings[j];
+                    j--;
+                }
+                crossings[j + 1] = v;
+            }
+            for (int i = 0; i + 1 < n; i += 2) {
+                double xa = crossings[i] < 0 ? 0 : crossings[i];
+                double xb = crossings[i + 1] > width ? width : crossings[i + 1];
+                if (xb <= xa) continue;
+                int ia = (int)xa, ib = (int)xb;
+                if (ia == ib) {
+                    coverage[ia] += (xb - xa) / 4;
+                } else {
+                    coverage[ia] += (ia + 1 - xa) / 4;
+                    for (int px = ia + 1; px < ib; px++) coverage[px] += 0.25f;
+                    if (ib < width) coverage[ib] += (xb - ib) / 4;
+                }
+                touched = 1;
+            }
+        }
+        if (!touched) continue;
+
+        unsigned int *row = s->pixels + py * width;
+        for (int px = 0; px < width; px++) {
+            if (coverage[px] > 0) {
+                float c = coverage[px] > 1 ? 1 : coverage[px];
+                headless_blend(&row[px], src, (unsigned int)(c * 255 + 0.5f));
+                coverage[px] = 0;
+            }
+        }
+    }
 
-    XSelectInput(dpy, menu.win, ButtonPressMask | ExposureMask | PointerMotionMask);
-    menu.visible = 0;
+    free(coverage);
+    free(crossings);
 }
 
-void show_menu() {
-    if (!menu.visible) {
-        int diamondwm_width = 120;
-        menu.x = panel.width - diamondwm_width - 20;
-        menu.y = panel.y - menu.height - 5;
+void headless_stroke_rect(Surface *s, int x, int y, int w, int h, int line_width, unsigned long color) {
+    // Same footprint as XDrawRectangle: the outline is centered on the path
+    int ox = x - line_width / 2;
+    int oy = y - line_width / 2;
+    int ow = w + line_width;
+    int oh = h + line_width;
+
+    headless_fill_rect(s, ox, oy, ow, line_width, color);
+    headless_fill_rect(s, ox, oy + oh - line_width, ow, line_width, color);
+    headless_fill_rect(s, ox, oy + line_width, line_width, oh - 2 * line_width, color);
+    headless_fill_rect(s, ox + ow - line_width, oy + line_width, line_width, oh - 2 * line_width, color);
+}
 
-        XMoveWindow(dpy, menu.win, menu.x, menu.y);
-        XMapWindow(dpy, menu.win);
-        XRaiseWindow(dpy, menu.win);
-        menu.visible = 1;
+void headless_draw_line(Surface *s, int x1, int y1, int x2, int y2, unsigned long color) {
+    if (y1 == y2) {
+        headless_fill_rect(s, x1 < x2 ? x1 : x2, y1, abs(x2 - x1) + 1, 1, color);
+        return;
+    }
+    if (x1 == x2) {
+        headless_fill_rect(s, x1, y1 < y2 ? y1 : y2, 1, abs(y2 - y1) + 1, color);
+        return;
+    }
 
-        // Fade-in animation
-        for (int i = 0; i <= 10; i++) {
-            menu.alpha = (float)i / 10.0f;
-            draw_menu();
-            XFlush(dpy);
-            usleep(10000);
-        }
+    XPointDouble quad[4];
+    line_path(quad, x1, y1, x2, y2);
+    headless_fill_path(s, quad, 4, color);
+}
 
-        XGrabPointer(dpy, root, False, ButtonPressMask, GrabModeAsync,
-                    GrabModeAsync, None, None, CurrentTime);
+void headless_fill_rounded_rect(Surface *s, int x, int y, int w, int h, int r, unsigned long color) {
+    if (r <= 0) {
+        headless_fill_rect(s, x, y, w, h, color);
+        return;
     }
+    XPointDouble points[ROUNDED_PATH_POINTS];
+    int n = rounded_rect_path(points, x, y, w, h, r);
+    headless_fill_path(s, points, n, color);
 }
 
-void hide_menu() {
-    if (menu.visible) {
-        // Fade-out animation
-        for (int i = 10; i >= 0; i--) {
-            menu.alpha = (float)i / 10.0f;
-            draw_menu();
-            XFlush(dpy);
-            usleep(8000);
-        }
+void headless_fill_polygon(Surface *s, const XPoint *points, int npoints, unsigned long color) {
+    if (npoints < 3) return;
+    XPointDouble fpoints[npoints];
+    for (int i = 0; i < npoints; i++) {
+        fpoints[i].x = points[i].x;
+        fpoints[i].y = points[i].y;
+    }
+    headless_fill_path(s, fpoints, npoints, color);
+}
 
-        XUnmapWindow(dpy, menu.win);
-        menu.visible = 0;
-        menu.hover_item = -1;
-        XUngrabPointer(dpy, CurrentTime);
+void headless_fill_ellipse(Surface *s, int x, int y, int w, int h, unsigned long color) {
+    if (w <= 0 || h <= 0) return;
+    XPointDouble points[ELLIPSE_PATH_POINTS];
+    int n = ellipse_path(points, x, y, w, h);
+    headless_fill_path(s, points, n, color);
+}
+
+void headless_gradient(Surface *s, int x, int y, int w, int h,
+                       unsigned long c1, unsigned long c2, int vertical) {
+    if (w <= 0 || h <= 0) return;
+    int steps = vertical ? h : w;
+
+    for (int i = 0; i < steps; i++) {
+        // Sampled at pixel centers, like an XRender linear gradient
+        double t = (i + 0.5) / steps;
+        int r = (int)(((c1 >> 16) & 0xFF) + (((int)((c2 >> 16) & 0xFF) - (int)((c1 >> 16) & 0xFF)) * t) + 0.5);
+        int g = (int)(((c1 >> 8) & 0xFF) + (((int)((c2 >> 8) & 0xFF) - (int)((c1 >> 8) & 0xFF)) * t) + 0.5);
+        int b = (int)((c1 & 0xFF) + (((int)(c2 & 0xFF) - (int)(c1 & 0xFF)) * t) + 0.5);
+        unsigned long color = (r << 16) | (g << 8) | b;
+
+        if (vertical) {
+            headless_fill_rect(s, x, y + i, w, 1, color);
+        } else {
+            headless_fill_rect(s, x + i, y, 1, h, color);
+        }
     }
 }
 
-void draw_menu() {
-    if (!menu.visible) return;
+// Decode one UTF-8 sequence; malformed bytes come back as themselves
+unsigned int utf8_next(const char **p) {
+    const unsigned char *s = (const unsigned char *)*p;
+    unsigned int c = *s++;
+    int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+    if (extra) c &= 0x3F >> extra;
+    while (extra-- > 0 && (*s & 0xC0) == 0x80) c = (c << 6) | (*s++ & 0x3F);
+    *p = (const char *)s;
+    return c;
+}
 
-    XClearWindow(dpy, menu.win);
+void headless_text(Surface *s, int x, int y, const char *text, int font, unsigned long color) {
+    FT_Face face = headless_face(font);
+    if (!face || !headless_reserve(s)) return;
+    unsigned int src = headless_color(color, s->alpha);
+
+    int pen_x = x;
+    const char *p = text;
+    while (*p) {
+        unsigned int c = utf8_next(&p);
+        if (FT_Load_Char(face, c, HEADLESS_LOAD_FLAGS | FT_LOAD_RENDER) != 0) continue;
+
+        FT_GlyphSlot glyph = face->glyph;
+        FT_Bitmap *bitmap = &glyph->bitmap;
+        int gx = pen_x + glyph->bitmap_left;
+        int gy = y - glyph->bitmap_top;
+
+        for (unsigned int row = 0; row < bitmap->rows; row++) {
+            int py = gy + (int)row;
+            if (py < 0 || py >= s->pixels_height) continue;
+            for (unsigned int col = 0; col < bitmap->width; col++) {
+                int px = gx + (int)col;
+                if (px < 0 || px >= s->pixels_width) continue;
+                unsigned int coverage = bitmap->buffer[row * bitmap->pitch + col];
+                headless_blend(&s->pixels[py * s->pixels_width + px], src, coverage);
+            }
+        }
+        pen_x += glyph->advance.x >> 6;
+    }
+}
 
-    // Draw rounded background with gradient
-    XSetForeground(dpy, menu_gc, menu_bg);
-    draw_rounded_rectangle(menu.win, menu_gc, 0, 0, menu.width, menu.height, CORNER_RADIUS);
+int headless_text_width(int font, const char *text) {
+    FT_Face face = headless_face(font);
+    if (!face) return strlen(text) * 6;
 
-    // Draw subtle border
-    XSetForeground(dpy, menu_gc, accent_color);
-    XDrawRectangle(dpy, menu.win, menu_gc, 1, 1, menu.width - 3, menu.height - 3);
+    int width = 0;
+    const char *p = text;
+    while (*p) {
+        unsigned int c = utf8_next(&p);
+        if (FT_Load_Char(face, c, HEADLESS_LOAD_FLAGS) == 0) width += face->glyph->advance.x >> 6;
+    }
+    return width;
+}
 
-    char *items[] = {"Terminal", "Lock", "Logout", "Shutdown"};
+int headless_font_ascent(int font) {
+    FT_Face face = headless_face(font);
+    return face ? (int)((face->size->metrics.ascender + 63) >> 6) : 10;
+}
 
-    for (int i = 0; i < 4; i++) {
-        int y = i * MENU_ITEM_HEIGHT;
+int headless_has_font(int font) {
+    if (font == FONT_FIXED) return 1;
+    return headless_fonts.faces[font] || headless_fonts.faces[FONT_REGULAR];
+}
 
-        // Hover effect
-        if (menu.hover_item == i) {
-            XSetForeground(dpy, menu_gc, menu_hover_bg);
-            draw_rounded_rectangle(menu.win, menu_gc, 2, y + 2, menu.width - 4, MENU_ITEM_HEIGHT - 4, 4);
+void headless_blit(Surface *dst, Surface *src, int sx, int sy, int w, int h, int dx, int dy) {
+    if (!src->pixels || !headless_reserve(dst)) return;
+
+    for (int row = 0; row < h; row++) {
+        int from_y = sy + row, to_y = dy + row;
+        if (from_y < 0 || from_y >= src->pixels_height || to_y < 0 || to_y >= dst->pixels_height) continue;
+        for (int col = 0; col < w; col++) {
+            int from_x = sx + col, to_x = dx + col;
+            if (from_x < 0 || from_x >= src->pixels_width || to_x < 0 || to_x >= dst->pixels_width) continue;
+            headless_blend(&dst->pixels[to_y * dst->pixels_width + to_x],
+                           src->pixels[from_y * src->pixels_width + from_x], 255);
         }
+    }
+}
 
-        if (i > 0) {
-            XSetForeground(dpy, menu_gc, 0x404040);
-            XDrawLine(dpy, menu.win, menu_gc, 10, y, menu.width - 10, y);
+void headless_draw_image(Surface *s, const unsigned int *pixels, int w, int h, int x, int y) {
+    if (!headless_reserve(s)) return;
+    unsigned int coverage = s->alpha >> 8;
+
+    for (int row = 0; row < h; row++) {
+        int to_y = y + row;
+        if (to_y < 0 || to_y >= s->pixels_height) continue;
+        for (int col = 0; col < w; col++) {
+            int to_x = x + col;
+            if (to_x < 0 || to_x >= s->pixels_width) continue;
+            headless_blend(&s->pixels[to_y * s->pixels_width + to_x], pixels[row * w + col], coverage);
         }
-
-        XSetForeground(dpy, menu_gc, text_primary);
-        int text_width = XTextWidth(XLoadQueryFont(dpy, "fixed"), items[i], strlen(items[i]));
-        int text_x = (menu.width - text_width) / 2;
-        int text_y = y + (MENU_ITEM_HEIGHT / 2) + 5;
-
-        XDrawString(dpy, menu.win, menu_gc, text_x, text_y, items[i], strlen(items[i]));
     }
 }
 
-int is_in_diamondwm_area(int x, int y) {
-    int diamond_size = 20;
-    int text_width = XTextWidth(XLoadQueryFont(dpy, "fixed"), "DiamondWM", 9);
-    int total_width = diamond_size + 5 + text_width;
+int headless_prepare_texture(NineSlice *t) {
+    return 1;  // Sampled straight from the master image
+}
 
-    int area_x = panel.width - total_width - 20;
-    int area_y = 10;
-    int area_height = 30;
+void headless_free_texture(NineSlice *t) {
+}
 
-    return (x >= area_x && x <= area_x + total_width &&
-            y >= area_y && y <= area_y + area_height);
+// Map each destination pixel back into the master: corners one to one,
+// everything between them onto the middle row or column
+void headless_nine_slice(Surface *s, const NineSlice *t, int x, int y, int w, int h) {
+    if (!headless_reserve(s)) return;
+    int b = t->border;
+    unsigned int coverage = s->alpha >> 8;
+
+    for (int row = 0; row < h; row++) {
+        int py = y + row;
+        if (py < 0 || py >= s->pixels_height) continue;
+        int ty = row < b ? row : (row >= h - b ? t->size - (h - row) : b);
+        for (int col = 0; col < w; col++) {
+            int px = x + col;
+            if (px < 0 || px >= s->pixels_width) continue;
+            int tx = col < b ? col : (col >= w - b ? t->size - (w - col) : b);
+            headless_blend(&s->pixels[py * s->pixels_width + px],
+                           t->pixels[ty * t->size + tx], coverage);
+        }
+    }
 }
 
-int is_in_menu_area(int x, int y) {
-    if (!menu.visible) return 0;
+const RenderBackend headless_backend = {
+    "headless",
+    1,
+    headless_init_surface,
+    headless_free_surface,
+    headless_clear,
+    headless_fill_rect,
+    headless_stroke_rect,
+    headless_draw_line,
+    headless_fill_rounded_rect,
+    headless_fill_polygon,
+    headless_fill_ellipse,
+    headless_gradient,
+    headless_text,
+    headless_text_width,
+    headless_font_ascent,
+    headless_has_font,
+    headless_blit,
+    headless_clear_rect,
+    headless_draw_image,
+    headless_scroll_area,
+    headless_prepare_texture,
+    headless_free_texture,
+    headless_nine_slice,
+};
+
+// Pick the rendering backend once, from the extensions the server offers.
+// DIAMONDWM_RENDER=core forces the core X backend.
+void select_render_backend() {
+    int event_base, error_base, major = 0, minor = 0;
+    const char *forced = getenv("DIAMONDWM_RENDER");
+
+    renderer = &core_backend;
+    draw_stats = getenv("DIAMONDWM_DRAW_STATS") != NULL;
+
+    if (forced && strcmp(forced, "core") == 0) {
+        debug_log("Render backend forced to core X");
+        return;
+    }
 
-    return (x >= menu.x && x <= menu.x + menu.width &&
-            y >= menu.y && y <= menu.y + menu.height);
+    // Gradients and solid fills need RENDER 0.10
+    if (XRenderQueryExtension(dpy, &event_base, &error_base) &&
+        XRenderQueryVersion(dpy, &major, &minor) &&
+        (major > 0 || minor >= 10)) {
+        render_visual_format = XRenderFindVisualFormat(dpy, DefaultVisual(dpy, screen));
+        render_mask_format = XRenderFindStandardFormat(dpy, PictStandardA8);
+        if (render_visual_format && render_mask_format) {
+            renderer = &xrender_backend;
+        }
+    }
+
+    debug_log("Render backend: %s (RENDER %d.%d)", renderer->name, major, minor);
 }
 
-int get_menu_item_at(int x, int y) {
-    if (!menu.visible) return -1;
+int surface_setup(Surface *s, Drawable d, int is_window, int argb,
+                  int width, int height, unsigned long background) {
+    s->backend = renderer;
+    s->drawable = d;
+    s->is_window = is_window;
+    s->argb = argb;
+    s->width = width;
+    s->height = height;
+    s->background = background;
+    s->alpha = 0xFFFF;
+    s->gc = NULL;
+    s->xft = NULL;
+    s->picture = None;
+    s->pixels = NULL;
+    s->pixels_width = s->pixels_height = 0;
+    s->batch = NULL;
+    s->gc_foreground_set = 0;
+    s->shape_width = s->shape_height = 0;
+    s->shape_radius = s->shape_corners = 0;
+
+    if (!s->backend->init_surface(s)) {
+        debug_log("ERROR: Could not initialise %s surface for drawable %lu", s->backend->name, d);
+        return 0;
+    }
+    return 1;
+}
 
-    int relative_x = x - menu.x;
-    int relative_y = y - menu.y;
+int surface_init(Surface *s, Drawable d, int is_window, int width, int height, unsigned long background) {
+    return surface_setup(s, d, is_window, 0, width, height, background);
+}
 
-    if (relative_x < 0 || relative_x > menu.width ||
-        relative_y < 0 || relative_y > menu.height) {
-        return -1;
+// Offscreen surface on a new 32-bit pixmap, for backends with argb_surfaces.
+// The caller owns the pixmap (s->drawable) and frees it after surface_free.
+int surface_init_argb(Surface *s, int width, int height) {
+    // The headless backend keeps its pixels in memory
+    Pixmap pixmap = dpy ? XCreatePixmap(dpy, root, width, height, 32) : None;
+    if (!surface_setup(s, pixmap, 0, 1, width, height, 0)) {
+        if (pixmap) XFreePixmap(dpy, pixmap);
+        return 0;
     }
+    return 1;
+}
 
-    return relative_y / MENU_ITEM_HEIGHT;
+void surface_free(Surface *s) {
+    if (s->backend) s->backend->free_surface(s);
+    s->backend = NULL;
 }
 
-void load_applications() {
-    debug_log("=== STARTING APPLICATION LOADING ===");
+// The surface's own GC still serves copies and core text; skip no-op changes
+void surface_gc_foreground(Surface *s, unsigned long color) {
+    if (s->gc_foreground_set && s->gc_foreground == color) return;
+    XSetForeground(dpy, s->gc, color);
+    s->gc_foreground = color;
+    s->gc_foreground_set = 1;
+}
 
-    const char *desktop_dirs[] = {
-        "/usr/share/applications",
-        "/usr/local/share/applications",
-        "/home/%s/.local/share/applications",
-        NULL
-    };
-
-    typedef struct {
-        const char *category;
-        const char *name;
-    } CategoryMap;
+// Send primitives the backend is still holding, before anything reads or
+// copies the drawable behind its back
+void surface_flush(Surface *s) {
+    if (s->batch) core_flush_batch(s);
+}
 
-    CategoryMap category_map[] = {
-        {"AudioVideo", "Multimedia"},
-        {"Audio", "Audio"},
-        {"Video", "Video"},
-        {"Development", "Development"},
-        {"Education", "Education"},
-        {"Game", "Games"},
-        {"Graphics", "Graphics"},
-        {"Network", "Internet"},
-        {"Office", "Office"},
-        {"Science", "Science"},
-        {"Settings", "Settings"},
-        {"System", "System"},
-        {"Utility", "Utilities"},
-        {"GTK", "GTK Apps"},
-        {"Qt", "Qt Apps"},
-        {"XFCE", "XFCE Apps"},
-        {"GNOME", "GNOME Apps"},
-        {"KDE", "KDE Apps"},
-        {NULL, NULL}
-    };
+// Between these calls the core backend keeps grouping primitives across
+// draw calls. DIAMONDWM_DRAW_STATS=1 reports the saving every 100 batches.
+void surface_begin_batch(Surface *s) {
+    if (s->batch) s->batch->depth++;
+}
 
-    char username[100];
-    struct passwd *pw = getpwuid(getuid());
-    if (pw) {
-        strncpy(username, pw->pw_name, sizeof(username)-1);
-        username[sizeof(username)-1] = '\0';
-    } else {
-        strcpy(username, "user");
+void surface_end_batch(Surface *s) {
+    DrawBatch *b = s->batch;
+    if (!b || --b->depth > 0) return;
+    core_flush_batch(s);
+    b->batches++;
+    if (draw_stats && b->batches % 100 == 0) {
+        printf("draw: drawable 0x%lx, %lu batches, %lu requests instead of %lu\n",
+               s->drawable, b->batches, b->requests, b->unbatched);
+        fflush(stdout);
     }
-    debug_log("Loading apps for user: %s", username);
+}
 
-    int total_files = 0;
-    for (int i = 0; desktop_dirs[i] != NULL; i++) {
-        char path[512];
-        if (strstr(desktop_dirs[i], "%s")) {
-            snprintf(path, sizeof(path), desktop_dirs[i], username);
-        } else {
-            strcpy(path, desktop_dirs[i]);
-        }
+void surface_resize(Surface *s, int width, int height) {
+    s->width = width;
+    s->height = height;
+}
 
-        debug_log("Scanning directory: %s", path);
+unsigned int premultiply(unsigned long color, double coverage) {
+    unsigned int a = (unsigned int)(coverage * 255 + 0.5);
+    unsigned int r = ((color >> 16) & 0xFF) * a / 255;
+    unsigned int g = ((color >> 8) & 0xFF) * a / 255;
+    unsigned int b = (color & 0xFF) * a / 255;
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
 
-        DIR *dir = opendir(path);
-        if (!dir) {
-            debug_log("  Cannot open directory: %s", path);
-            continue;
+// Rounded rectangle filling the whole master, corners sampled 4x4 per pixel
+void rasterize_rounded_texture(NineSlice *t) {
+    int r = t->radius;
+    double inner_lo = r, inner_hi = t->size - r;
+
+    for (int py = 0; py < t->size; py++) {
+        for (int px = 0; px < t->size; px++) {
+            int inside = 0;
+            for (int sy = 0; sy < 4; sy++) {
+                for (int sx = 0; sx < 4; sx++) {
+                    double fx = px + (sx + 0.5) / 4, fy = py + (sy + 0.5) / 4;
+                    double dx = fx < inner_lo ? inner_lo - fx : (fx > inner_hi ? fx - inner_hi : 0);
+                    double dy = fy < inner_lo ? inner_lo - fy : (fy > inner_hi ? fy - inner_hi : 0);
+                    if (dx * dx + dy * dy <= (double)r * r) inside++;
+                }
+            }
+            t->pixels[py * t->size + px] = premultiply(t->color, inside / 16.0);
         }
+    }
+}
 
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL) {
-            if (strstr(entry->d_name, ".desktop")) {
-                total_files++;
-            }
+// Coverage of a box blurred with a gaussian, along one axis
+double shadow_falloff(double p, double lo, double hi, double sigma) {
+    return 0.5 * (erf((p - lo) / (sigma * M_SQRT2)) - erf((p - hi) / (sigma * M_SQRT2)));
+}
+
+// Gaussian-blurred box inset by SHADOW_BLUR from the master's edges. The
+// blur is separable, so each pixel is the product of two 1D falloffs.
+void rasterize_shadow_texture(NineSlice *t) {
+    double sigma = SHADOW_BLUR / 3.0;
+    double lo = SHADOW_BLUR, hi = t->size - SHADOW_BLUR;
+
+    for (int py = 0; py < t->size; py++) {
+        double fy = shadow_falloff(py + 0.5, lo, hi, sigma);
+        for (int px = 0; px < t->size; px++) {
+            double fx = shadow_falloff(px + 0.5, lo, hi, sigma);
+            t->pixels[py * t->size + px] = premultiply(t->color, SHADOW_OPACITY * fx * fy);
         }
-        closedir(dir);
     }
+}
 
-    debug_log("Found %d total .desktop files", total_files);
+void free_theme_texture(NineSlice *t) {
+    if (!t->pixels) return;
+    renderer->free_texture(t);
+    free(t->pixels);
+    t->pixels = NULL;
+}
 
-    if (total_files == 0) {
-        debug_log("ERROR: No .desktop files found!");
-        app_launcher.category_count = 0;
-        app_launcher.categories = NULL;
-        return;
+// Theme textures are built on first use and kept until the theme changes;
+// once the cache is full the least recently used one is rebuilt. Returns NULL
+// when the backend cannot composite textures, in which case callers fall back
+// to plain primitives.
+NineSlice *get_theme_texture(int kind, int radius, unsigned long color) {
+    if (!renderer->nine_slice || radius <= 0) return NULL;
+
+    theme_texture_clock++;
+    for (int i = 0; i < theme_texture_count; i++) {
+        NineSlice *t = &theme_textures[i];
+        if (t->kind == kind && t->radius == radius && t->color == color) {
+            t->last_used = theme_texture_clock;
+            return t->pixels ? t : NULL;
+        }
     }
 
-    AppInfo *all_apps = malloc(sizeof(AppInfo) * total_files);
-    if (!all_apps) {
-        debug_log("ERROR: Failed to allocate memory for %d apps", total_files);
-        return;
+    NineSlice *t;
+    if (theme_texture_count < MAX_THEME_TEXTURES) {
+        t = &theme_textures[theme_texture_count++];
+    } else {
+        // Callers draw with a texture right away, so none is held across this
+        t = &theme_textures[0];
+        for (int i = 1; i < theme_texture_count; i++) {
+            if (theme_textures[i].last_used < t->last_used) t = &theme_textures[i];
+        }
+        free_theme_texture(t);
     }
-    memset(all_apps, 0, sizeof(AppInfo) * total_files);
 
-    int app_index = 0;
+    // Failed builds stay in the cache with no pixels so they are not retried
+    memset(t, 0, sizeof(*t));
+    t->last_used = theme_texture_clock;
+    t->kind = kind;
+    t->radius = radius;
+    t->color = color;
+    t->border = kind == TEXTURE_SHADOW ? 2 * radius : radius;
+    t->size = 2 * t->border + 1;
+    t->pixels = malloc(sizeof(unsigned int) * t->size * t->size);
+    if (!t->pixels) return NULL;
+
+    if (kind == TEXTURE_SHADOW) {
+        rasterize_shadow_texture(t);
+    } else {
+        rasterize_rounded_texture(t);
+    }
 
-    for (int i = 0; desktop_dirs[i] != NULL; i++) {
-        char path[512];
-        if (strstr(desktop_dirs[i], "%s")) {
-            snprintf(path, sizeof(path), desktop_dirs[i], username);
-        } else {
-            strcpy(path, desktop_dirs[i]);
-        }
+    if (!renderer->prepare_texture(t)) {
+        debug_log("ERROR: Could not upload %s texture (radius %d)",
+                  kind == TEXTURE_SHADOW ? "shadow" : "rounded", radius);
+        renderer->free_texture(t);
+        free(t->pixels);
+        t->pixels = NULL;
+        return NULL;
+    }
 
-        DIR *dir = opendir(path);
-        if (!dir) continue;
+    debug_log("Built %s texture: radius %d, color %06lx",
+              kind == TEXTURE_SHADOW ? "shadow" : "rounded", radius, color);
+    return t;
+}
 
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL) {
-            if (strstr(entry->d_name, ".desktop")) {
-                char filepath[1024];
-                snprintf(filepath, sizeof(filepath), "%s/%s", path, entry->d_name);
+const CornerMask *get_corner_mask(int radius) {
+    for (int i = 0; i < corner_mask_count; i++) {
+        if (corner_masks[i].radius == radius) return &corner_masks[i];
+    }
 
-                FILE *file = fopen(filepath, "r");
-                if (!file) {
-                    debug_log("  Cannot open file: %s", filepath);
-                    continue;
-                }
+    // Reuse the oldest slot once full; only a handful of radii are in use
+    CornerMask *m;
+    if (corner_mask_count < MAX_CORNER_MASKS) {
+        m = &corner_masks[corner_mask_count++];
+    } else {
+        m = &corner_masks[corner_mask_oldest];
+        corner_mask_oldest = (corner_mask_oldest + 1) % MAX_CORNER_MASKS;
+    }
+    m->radius = radius;
+    for (int i = 0; i < radius; i++) {
+        // First pixel whose center lies inside the corner circle
+        double dy = radius - (i + 0.5);
+        m->insets[i] = (short)ceil(radius - sqrt((double)radius * radius - dy * dy) - 0.5);
+    }
+    return m;
+}
 
-                AppInfo app = {0};
-                char line[512];
-                int in_desktop_entry = 0;
-                int is_application = 0;
-                int hidden = 0;
-                int no_display = 0;
+// Set a rounded bounding shape on a popup or frame. The shape is sent as
+// one banded rectangle list and skipped entirely when nothing changed.
+void shape_window(Surface *s, int width, int height, int radius, int corners) {
+    if (!has_shape || !s->is_window || width <= 0 || height <= 0) return;
 
-                debug_log("  Parsing: %s", entry->d_name);
+    if (radius > width / 2) radius = width / 2;
+    if (radius > height / 2) radius = height / 2;
+    if (radius > MAX_SHAPE_RADIUS) radius = MAX_SHAPE_RADIUS;
+    if (radius <= 0) corners = 0;
 
-                while (fgets(line, sizeof(line), file)) {
-                    line[strcspn(line, "\n")] = 0;
-                    char *end = line + strlen(line) - 1;
-                    while (end > line && isspace(*end)) end--;
-                    *(end + 1) = 0;
+    if (s->shape_width == width && s->shape_height == height &&
+        s->shape_radius == radius && s->shape_corners == corners) {
+        return;
+    }
 
-                    if (strcmp(line, "[Desktop Entry]") == 0) {
-                        in_desktop_entry = 1;
-                        continue;
-                    } else if (line[0] == '[' && line[strlen(line)-1] == ']') {
-                        in_desktop_entry = 0;
-                        continue;
-                    }
+    if (!corners) {
+        // Square window: drop the shape instead of sending one big rectangle
+        if (s->shape_corners) {
+            XShapeCombineMask(dpy, s->drawable, ShapeBounding, 0, 0, None, ShapeSet);
+        }
+    } else {
+        const CornerMask *m = get_corner_mask(radius);
+        XRectangle rects[2 * MAX_SHAPE_RADIUS + 1];
+        int n = 0;
+        int top = (corners & SHAPE_TOP) ? radius : 0;
+        int bottom = (corners & SHAPE_BOTTOM) ? radius : 0;
+
+        for (int i = 0; i < top; i++) {
+            rects[n++] = (XRectangle){m->insets[i], i, width - 2 * m->insets[i], 1};
+        }
+        rects[n++] = (XRectangle){0, top, width, height - top - bottom};
+        for (int i = bottom - 1; i >= 0; i--) {
+            rects[n++] = (XRectangle){m->insets[i], height - 1 - i, width - 2 * m->insets[i], 1};
+        }
+        XShapeCombineRectangles(dpy, s->drawable, ShapeBounding, 0, 0,
+                                rects, n, ShapeSet, YXBanded);
+    }
 
-                    if (!in_desktop_entry) continue;
+    s->shape_width = width;
+    s->shape_height = height;
+    s->shape_radius = radius;
+    s->shape_corners = corners;
+}
 
-                    if (strncmp(line, "Type=", 5) == 0) {
-                        if (strstr(line + 5, "Application")) {
-                            is_application = 1;
-                        } else {
-                            break;
-                        }
-                    }
+// Frames round their top corners unless fullscreen. While the user drags a
+// resize edge the shape follows at most every SHAPE_RESIZE_INTERVAL ms; the
+// button release applies the final size.
+void update_frame_shape(Client *c) {
+    if (window_resizing && resized_client == c) {
+        static struct timeval last_reshape;
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        long elapsed = (now.tv_sec - last_reshape.tv_sec) * 1000 +
+                       (now.tv_usec - last_reshape.tv_usec) / 1000;
+        if (elapsed < SHAPE_RESIZE_INTERVAL) return;
+        last_reshape = now;
+    }
 
-                    if (strncmp(line, "Hidden=", 7) == 0) {
-                        if (strstr(line + 7, "true")) {
-                            hidden = 1;
-                            break;
-                        }
-                    }
+    shape_window(&c->surface, c->width, c->height,
+                 c->is_fullscreen ? 0 : CORNER_RADIUS, SHAPE_TOP);
+}
 
-                    if (strncmp(line, "NoDisplay=", 10) == 0) {
-                        if (strstr(line + 10, "true")) {
-                            no_display = 1;
-                            break;
-                        }
-                    }
+// ---- Popup windows ----
+//
+// Menus and the launcher paint into an offscreen copy of their content and
+// present it with one copy or composite, so fade steps and exposes never
+// re-run the draw code. On a 32-bit visual the window carries real alpha;
+// otherwise the opacity goes to the compositing manager through
+// _NET_WM_WINDOW_OPACITY.
+
+#define POPUP_FADE_STEPS 10
+
+// Look for a 32-bit visual with an alpha channel, once
+Visual *find_popup_visual() {
+    static int searched = 0;
+    if (searched) return popup_visual;
+    searched = 1;
+    if (!renderer->argb_surfaces) return NULL;
+
+    XVisualInfo wanted;
+    wanted.screen = screen;
+    wanted.depth = 32;
+    wanted.class = TrueColor;
+    int count = 0;
+    XVisualInfo *infos = XGetVisualInfo(dpy, VisualScreenMask | VisualDepthMask | VisualClassMask,
+                                        &wanted, &count);
+    for (int i = 0; i < count && !popup_visual; i++) {
+        XRenderPictFormat *format = XRenderFindVisualFormat(dpy, infos[i].visual);
+        if (format && format->type == PictTypeDirect && format->direct.alphaMask) {
+            popup_visual = infos[i].visual;
+        }
+    }
+    if (infos) XFree(infos);
 
-                    if (strncmp(line, "Name=", 5) == 0 && !app.name) {
-                        app.name = strdup(line + 5);
-                    }
+    if (popup_visual) {
+        popup_colormap = XCreateColormap(dpy, root, popup_visual, AllocNone);
+    }
+    debug_log("Popup visual: %s", popup_visual ? "32-bit ARGB" : "default");
+    return popup_visual;
+}
 
-                    if (strncmp(line, "Exec=", 5) == 0 && !app.exec) {
-                        char *exec_cmd = line + 5;
-                        char clean_exec[512];
-                        char *dest = clean_exec;
+// `window` presents the popup; `content` is what its draw code paints into
+Window create_popup_window(int x, int y, int width, int height, Surface *window, Surface *content) {
+    Window win;
+    int argb = find_popup_visual() != NULL;
+
+    if (argb) {
+        XSetWindowAttributes wa;
+        wa.colormap = popup_colormap;
+        wa.background_pixel = 0;
+        wa.border_pixel = 0;
+        win = XCreateWindow(dpy, root, x, y, width, height, 0, 32, InputOutput, popup_visual,
+                            CWColormap | CWBackPixel | CWBorderPixel, &wa);
+    } else {
+        win = XCreateSimpleWindow(dpy, root, x, y, width, height, 0, white, dark_blue);
+    }
+    surface_setup(window, win, 1, argb, width, height, dark_blue);
 
-                        for (char *src = exec_cmd; *src && (dest - clean_exec) < 510; src++) {
-                            if (*src == '%' && *(src+1)) {
-                                src++;
-                                continue;
-                            }
-                            if (*src == ' ' && (src == exec_cmd || *(src-1) == ' ')) {
-                                continue;
-                            }
-                            *dest++ = *src;
-                        }
-                        *dest = '\0';
+    if (renderer->argb_surfaces) {
+        surface_init_argb(content, width, height);
+    } else {
+        Pixmap pixmap = XCreatePixmap(dpy, root, width, height, DefaultDepth(dpy, screen));
+        surface_init(content, pixmap, 0, width, height, dark_blue);
+    }
+    return win;
+}
 
-                        if (dest > clean_exec && *(dest-1) == ' ') {
-                            *(dest-1) = '\0';
-                        }
+int compositing_manager_running() {
+    if (compositing) return 1;
+    return XGetSelectionOwner(dpy, atoms[ATOM_NET_WM_CM_S]) != None;
+}
 
-                        app.exec = strdup(clean_exec);
-                    }
+// Copy the content to the window at the given opacity
+void present_popup(Surface *window, Surface *content, float alpha) {
+    if (!window->backend) return;  // headless renders have no window
+
+    surface_flush(content);
+    int w = content->width, h = content->height;
+    if (window->argb) {
+        Picture mask = None;
+        if (alpha < 1.0f) {
+            XRenderColor rc = {0, 0, 0, (unsigned short)(alpha * 0xFFFF)};
+            mask = XRenderCreateSolidFill(dpy, &rc);
+        }
+        XRenderComposite(dpy, PictOpSrc, content->picture, mask, window->picture,
+                         0, 0, 0, 0, 0, 0, w, h);
+        if (mask) XRenderFreePicture(dpy, mask);
+        return;
+    }
 
-                    if (strncmp(line, "Categories=", 11) == 0 && !app.categories) {
-                        app.categories = strdup(line + 11);
-                    }
+    if (window->picture) {
+        XRenderComposite(dpy, PictOpSrc, content->picture, None, window->picture,
+                         0, 0, 0, 0, 0, 0, w, h);
+    } else {
+        XCopyArea(dpy, content->drawable, window->drawable, window->gc, 0, 0, w, h, 0, 0);
+    }
 
-                    if (strncmp(line, "Comment=", 8) == 0 && !app.comment) {
-                        app.comment = strdup(line + 8);
-                    }
+    Atom opacity_atom = atoms[ATOM_NET_WM_WINDOW_OPACITY];
+    if (alpha < 1.0f) {
+        unsigned long opacity = (unsigned long)(alpha * 0xFFFFFFFFu);
+        XChangeProperty(dpy, window->drawable, opacity_atom, XA_CARDINAL, 32,
+                        PropModeReplace, (unsigned char *)&opacity, 1);
+    } else {
+        XDeleteProperty(dpy, window->drawable, opacity_atom);
+    }
+}
 
-                    if (strncmp(line, "Icon=", 5) == 0 && !app.icon) {
-                        app.icon = strdup(line + 5);
-                    }
-                }
+// Fade a mapped popup in or out. Nothing can show partial opacity without a
+// compositing manager, so then the popup just appears or disappears.
+void fade_popup(Surface *window, Surface *content, float *alpha, int fade_in) {
+    if (compositing_manager_running()) {
+        for (int i = 0; i <= POPUP_FADE_STEPS; i++) {
+            *alpha = (float)(fade_in ? i : POPUP_FADE_STEPS - i) / POPUP_FADE_STEPS;
+            present_popup(window, content, *alpha);
+            if (compositing) {
+                compositor_frame();
+            } else {
+                XFlush(dpy);
+            }
+            usleep(fade_in ? 10000 : 8000);
+        }
+    }
 
-                fclose(file);
+    *alpha = fade_in ? 1.0f : 0.0f;
+    if (fade_in) present_popup(window, content, *alpha);
+}
 
-                if (is_application && !hidden && !no_display && app.name && app.exec) {
-                    if (!app.categories) {
-                        app.categories = strdup("Utility");
-                    }
+void free_theme_textures() {
+    for (int i = 0; i < theme_texture_count; i++) free_theme_texture(&theme_textures[i]);
+    theme_texture_count = 0;
+}
 
-                    if (!app.comment) {
-                        app.comment = strdup("");
-                    }
+// ---- Compositing mode (DIAMONDWM_COMPOSITE=1) ----
+//
+// Top-level windows are redirected offscreen with Composite. Damage reports
+// which parts of them changed; those parts are repainted bottom to top into
+// a back buffer through XRender and then copied to the composite overlay
+// window. Windows hidden behind opaque windows are never painted.
 
-                    if (!app.icon) {
-                        app.icon = strdup("");
-                    }
+#ifdef HAVE_COMPOSITE
 
-                    all_apps[app_index++] = app;
-                    debug_log("    ✓ Loaded: %s -> %s (Categories: %s)",
-                             app.name, app.exec, app.categories);
-                } else {
-                    debug_log("    ✗ Skipped: %s (is_app=%d, hidden=%d, no_display=%d, has_name=%d, has_exec=%d)",
-                             entry->d_name, is_application, hidden, no_display,
-                             app.name != NULL, app.exec != NULL);
-                    if (app.name) free(app.name);
-                    if (app.exec) free(app.exec);
-                    if (app.categories) free(app.categories);
-                    if (app.comment) free(app.comment);
-                    if (app.icon) free(app.icon);
-                }
-            }
-        }
-        closedir(dir);
+typedef struct {
+    Window id;
+    int x, y, width, height, border;
+    int mapped;
+    int input_only;
+    int argb;                   // visual has an alpha channel
+    unsigned short opacity;     // from _NET_WM_WINDOW_OPACITY
+    int damaged;                // damage not yet subtracted
+    Damage damage;
+    Pixmap pixmap;
+    Picture picture;
+    XRenderPictFormat *format;
+    Region shape;               // bounding shape, window relative; NULL if rectangular
+    Region clip;                // visible part during a paint
+} CompWindow;
+
+typedef struct {
+    int damage_event_base, damage_error_base;
+    int shape_event_base;
+    Window overlay;
+    Window cm_owner;
+    Picture overlay_picture;
+    Surface back;
+    Picture root_tile;
+    Region damage;              // screen coordinates, pending repaint
+    CompWindow **windows;       // stacking order, bottom first
+    int window_count, window_capacity;
+    int show_stats;
+    long frames, painted, skipped;
+    double paint_ms;
+} Compositor;
+
+Compositor comp;
+
+int comp_find_index(Window id) {
+    for (int i = 0; i < comp.window_count; i++) {
+        if (comp.windows[i]->id == id) return i;
     }
+    return -1;
+}
 
-    debug_log("Successfully parsed %d applications", app_index);
+CompWindow *comp_find(Window id) {
+    int i = comp_find_index(id);
+    return i >= 0 ? comp.windows[i] : NULL;
+}
 
-    if (app_index == 0) {
-        debug_log("ERROR: No valid applications found after parsing!");
-        free(all_apps);
-        app_launcher.category_count = 0;
-        app_launcher.categories = NULL;
-        return;
+int comp_has_shadow(CompWindow *w) {
+    if (w->argb) return 0;
+    if (w->id == menu.win || w->id == app_launcher.win || w->id == window_control_menu.win ||
+        w->id == pinned_app_menu.win || w->id == tooltip.win) {
+        return 1;
     }
+    Client *c = find_client(w->id);
+    return c && c->frame == w->id && !c->is_fullscreen;
+}
 
-    int category_count = 0;
-    for (int i = 0; category_map[i].category != NULL; i++) {
-        category_count++;
+int comp_is_opaque(CompWindow *w) {
+    return !w->argb && w->opacity == 0xFFFF;
+}
+
+// Area a window covers on screen, including its shadow
+void comp_damage_window(CompWindow *w) {
+    XRectangle r;
+    r.x = w->x;
+    r.y = w->y;
+    r.width = w->width + 2 * w->border;
+    r.height = w->height + 2 * w->border;
+    if (comp_has_shadow(w)) {
+        r.x += SHADOW_OFFSET - SHADOW_BLUR;
+        r.y += SHADOW_OFFSET - SHADOW_BLUR;
+        r.width += 2 * SHADOW_BLUR;
+        r.height += 2 * SHADOW_BLUR;
     }
+    XUnionRectWithRegion(&r, comp.damage, comp.damage);
+}
 
-    app_launcher.categories = malloc(sizeof(AppCategory) * category_count);
-    if (!app_launcher.categories) {
-        debug_log("ERROR: Failed to allocate categories");
-        for (int i = 0; i < app_index; i++) {
-            free(all_apps[i].name);
-            free(all_apps[i].exec);
-            free(all_apps[i].categories);
-            free(all_apps[i].comment);
-            free(all_apps[i].icon);
+void comp_damage_screen() {
+    XRectangle r = {0, 0, DisplayWidth(dpy, screen), DisplayHeight(dpy, screen)};
+    XUnionRectWithRegion(&r, comp.damage, comp.damage);
+}
+
+// Screen region the window itself occupies, honouring its bounding shape
+Region comp_window_region(CompWindow *w) {
+    Region region = XCreateRegion();
+    if (w->shape) {
+        XUnionRegion(w->shape, region, region);
+        XOffsetRegion(region, w->x + w->border, w->y + w->border);
+    } else {
+        XRectangle r = {w->x, w->y, w->width + 2 * w->border, w->height + 2 * w->border};
+        XUnionRectWithRegion(&r, region, region);
+    }
+    return region;
+}
+
+void comp_fetch_shape(CompWindow *w) {
+    if (w->shape) XDestroyRegion(w->shape);
+    w->shape = NULL;
+    if (!has_shape) return;
+
+    int count = 0, ordering;
+    XRectangle *rects = XShapeGetRectangles(dpy, w->id, ShapeBounding, &count, &ordering);
+    if (!rects) return;
+
+    // A single rectangle covering the window is the same as no shape
+    int full = count == 1 && rects[0].x == -w->border && rects[0].y == -w->border &&
+               rects[0].width == w->width + 2 * w->border &&
+               rects[0].height == w->height + 2 * w->border;
+    if (!full) {
+        w->shape = XCreateRegion();
+        for (int i = 0; i < count; i++) {
+            XUnionRectWithRegion(&rects[i], w->shape, w->shape);
         }
-        free(all_apps);
-        return;
     }
+    XFree(rects);
+}
 
-    app_launcher.category_count = category_count;
+void comp_fetch_opacity(CompWindow *w) {
+    Atom type;
+    int format;
+    unsigned long nitems, bytes_after;
+    unsigned char *data = NULL;
 
-    for (int i = 0; i < category_count; i++) {
-        app_launcher.categories[i].category_name = strdup(category_map[i].name);
-        app_launcher.categories[i].apps = NULL;
-        app_launcher.categories[i].app_count = 0;
-        app_launcher.categories[i].expanded = 0;
+    w->opacity = 0xFFFF;
+    if (XGetWindowProperty(dpy, w->id, atoms[ATOM_NET_WM_WINDOW_OPACITY], 0, 1, False, XA_CARDINAL,
+                           &type, &format, &nitems, &bytes_after, &data) == Success && data) {
+        if (nitems == 1 && format == 32) {
+            w->opacity = (unsigned short)(*(unsigned long *)data >> 16);
+        }
+        XFree(data);
     }
+}
 
-    for (int i = 0; i < app_index; i++) {
-        char *categories = strdup(all_apps[i].categories);
-        char *token = strtok(categories, ";");
+void comp_release_pixmap(CompWindow *w) {
+    if (w->picture) XRenderFreePicture(dpy, w->picture);
+    if (w->pixmap) XFreePixmap(dpy, w->pixmap);
+    w->picture = None;
+    w->pixmap = None;
+}
 
-        while (token) {
-            char clean_token[100];
-            char *dest = clean_token;
-            for (char *src = token; *src && (dest - clean_token) < 99; src++) {
-                if (!isspace(*src)) {
-                    *dest++ = *src;
-                }
-            }
-            *dest = '\0';
+// The offscreen pixmap changes on every map and resize, so it is named lazily
+int comp_bind_pixmap(CompWindow *w) {
+    if (w->picture) return 1;
+    if (!w->format) return 0;
 
-            for (int j = 0; j < category_count; j++) {
-                if (strcasecmp(clean_token, category_map[j].category) == 0) {
-                    app_launcher.categories[j].app_count++;
-                    break;
-                }
-            }
-            token = strtok(NULL, ";");
-        }
-        free(categories);
+    w->pixmap = XCompositeNameWindowPixmap(dpy, w->id);
+    if (!w->pixmap) return 0;
+
+    XRenderPictureAttributes pa;
+    pa.subwindow_mode = IncludeInferiors;
+    w->picture = XRenderCreatePicture(dpy, w->pixmap, w->format, CPSubwindowMode, &pa);
+    return w->picture != None;
+}
+
+void comp_add_window(Window id, int on_top) {
+    if (id == comp.overlay || id == comp.cm_owner || comp_find(id)) return;
+
+    XWindowAttributes wa;
+    if (!XGetWindowAttributes(dpy, id, &wa)) return;
+
+    CompWindow *w = calloc(1, sizeof(CompWindow));
+    if (!w) return;
+    w->id = id;
+    w->x = wa.x;
+    w->y = wa.y;
+    w->width = wa.width;
+    w->height = wa.height;
+    w->border = wa.border_width;
+    w->mapped = wa.map_state == IsViewable;
+    w->input_only = wa.class == InputOnly;
+
+    if (!w->input_only) {
+        w->format = XRenderFindVisualFormat(dpy, wa.visual);
+        w->argb = w->format && w->format->type == PictTypeDirect && w->format->direct.alphaMask;
+        w->damage = XDamageCreate(dpy, id, XDamageReportDeltaRectangles);
+        XSelectInput(dpy, id, wa.your_event_mask | PropertyChangeMask);
+        if (has_shape) XShapeSelectInput(dpy, id, ShapeNotifyMask);
+        comp_fetch_opacity(w);
+        comp_fetch_shape(w);
     }
 
-    for (int i = 0; i < category_count; i++) {
-        if (app_launcher.categories[i].app_count > 0) {
-            app_launcher.categories[i].apps = malloc(sizeof(AppInfo) * app_launcher.categories[i].app_count);
-            if (!app_launcher.categories[i].apps) {
-                debug_log("ERROR: Failed to allocate apps for category %s",
-                         app_launcher.categories[i].category_name);
-                app_launcher.categories[i].app_count = 0;
-            } else {
-                app_launcher.categories[i].app_count = 0;
-            }
+    if (comp.window_count == comp.window_capacity) {
+        int capacity = comp.window_capacity ? comp.window_capacity * 2 : 64;
+        CompWindow **windows = realloc(comp.windows, sizeof(CompWindow *) * capacity);
+        if (!windows) {
+            if (w->damage) XDamageDestroy(dpy, w->damage);
+            free(w);
+            return;
         }
+        comp.windows = windows;
+        comp.window_capacity = capacity;
     }
 
-    for (int i = 0; i < app_index; i++) {
-        char *categories = strdup(all_apps[i].categories);
-        char *token = strtok(categories, ";");
-        int assigned = 0;
+    if (on_top) {
+        comp.windows[comp.window_count++] = w;
+    } else {
+        memmove(comp.windows + 1, comp.windows, sizeof(CompWindow *) * comp.window_count);
+        comp.windows[0] = w;
+        comp.window_count++;
+    }
 
-        while (token && !assigned) {
-            char clean_token[100];
-            char *dest = clean_token;
-            for (char *src = token; *src && (dest - clean_token) < 99; src++) {
-                if (!isspace(*src)) {
-                    *dest++ = *src;
-                }
-            }
-            *dest = '\0';
+    if (w->mapped) comp_damage_window(w);
+}
 
-            for (int j = 0; j < category_count; j++) {
-                if (strcasecmp(clean_token, category_map[j].category) == 0) {
-                    if (app_launcher.categories[j].apps) {
-                        int idx = app_launcher.categories[j].app_count++;
-                        app_launcher.categories[j].apps[idx] = all_apps[i];
-                        assigned = 1;
-                        debug_log("  Assigned '%s' to category '%s'",
-                                 all_apps[i].name, app_launcher.categories[j].category_name);
-                    }
-                    break;
-                }
-            }
-            token = strtok(NULL, ";");
-        }
+void comp_remove_window(Window id, int destroyed) {
+    int i = comp_find_index(id);
+    if (i < 0) return;
 
-        if (!assigned) {
-            for (int j = 0; j < category_count; j++) {
-                if (strcasecmp(category_map[j].category, "Utility") == 0) {
-                    if (app_launcher.categories[j].apps) {
-                        int idx = app_launcher.categories[j].app_count++;
-                        app_launcher.categories[j].apps[idx] = all_apps[i];
-                        debug_log("  Assigned '%s' to default category 'Utilities'", all_apps[i].name);
-                    }
-                    break;
-                }
-            }
-        }
+    CompWindow *w = comp.windows[i];
+    if (w->mapped) comp_damage_window(w);
 
-        free(categories);
+    comp_release_pixmap(w);
+    // The server frees the damage object along with a destroyed window
+    if (w->damage && !destroyed) XDamageDestroy(dpy, w->damage);
+    if (w->shape) XDestroyRegion(w->shape);
+    free(w);
+
+    memmove(comp.windows + i, comp.windows + i + 1,
+            sizeof(CompWindow *) * (comp.window_count - i - 1));
+    comp.window_count--;
+}
+
+// Move a window to just above `above` (None = bottom of the stack)
+void comp_restack(Window id, Window above) {
+    int from = comp_find_index(id);
+    if (from < 0) return;
+
+    CompWindow *w = comp.windows[from];
+    memmove(comp.windows + from, comp.windows + from + 1,
+            sizeof(CompWindow *) * (comp.window_count - from - 1));
+    comp.window_count--;
+
+    int to = 0;
+    if (above != None) {
+        int sibling = comp_find_index(above);
+        to = sibling >= 0 ? sibling + 1 : comp.window_count;
     }
+    memmove(comp.windows + to + 1, comp.windows + to,
+            sizeof(CompWindow *) * (comp.window_count - to));
+    comp.windows[to] = w;
+    comp.window_count++;
+}
 
-    free(all_apps);
+void comp_update_root_tile() {
+    if (comp.root_tile) XRenderFreePicture(dpy, comp.root_tile);
+    comp.root_tile = None;
 
-    debug_log("=== APPLICATION LOADING SUMMARY ===");
-    int total_loaded_apps = 0;
-    int non_empty_categories = 0;
+    Atom type;
+    int format;
+    unsigned long nitems, bytes_after;
+    unsigned char *data = NULL;
+    Pixmap pixmap = None;
+    int owned = 0;
 
-    for (int i = 0; i < category_count; i++) {
-        if (app_launcher.categories[i].app_count > 0) {
-            non_empty_categories++;
-            total_loaded_apps += app_launcher.categories[i].app_count;
-            debug_log("Category: %s - %d apps",
-                     app_launcher.categories[i].category_name,
-                     app_launcher.categories[i].app_count);
-        }
+    if (XGetWindowProperty(dpy, root, atoms[ATOM_XROOTPMAP_ID], 0, 1, False, XA_PIXMAP,
+                           &type, &format, &nitems, &bytes_after, &data) == Success && data) {
+        if (nitems == 1 && format == 32) pixmap = *(Pixmap *)data;
+        XFree(data);
     }
 
-    debug_log("TOTAL: %d applications in %d categories", total_loaded_apps, non_empty_categories);
-    debug_log("=== APPLICATION LOADING COMPLETE ===");
+    // No wallpaper published: a flat tile in the background colour
+    if (!pixmap) {
+        pixmap = XCreatePixmap(dpy, root, 1, 1, DefaultDepth(dpy, screen));
+        GC tile_gc = XCreateGC(dpy, pixmap, 0, NULL);
+        XSetForeground(dpy, tile_gc, bg_gradient_start);
+        XFillRectangle(dpy, pixmap, tile_gc, 0, 0, 1, 1);
+        XFreeGC(dpy, tile_gc);
+        owned = 1;
+    }
+
+    XRenderPictureAttributes pa;
+    pa.repeat = RepeatNormal;
+    comp.root_tile = XRenderCreatePicture(dpy, pixmap, render_visual_format, CPRepeat, &pa);
+    if (owned) XFreePixmap(dpy, pixmap);
 }
 
-void draw_diamond_to_window(Window win, GC gc, int x, int y, int size) {
-    int center_x = x + size / 2;
-    int center_y = y + size / 2;
-    float scale_factor = size / 32.0f;
+void comp_set_clip(Picture picture, Region region) {
+    if (region) {
+        XRenderSetPictureClipRegion(dpy, picture, region);
+    } else {
+        XRenderPictureAttributes pa;
+        pa.clip_mask = None;
+        XRenderChangePicture(dpy, picture, CPClipMask, &pa);
+    }
+}
 
-    // Save original values
-    GC original_panel_gc = panel_gc;
-    Window original_panel_win = panel.win;
+// Returns 1 when compositing is running
+int compositor_init() {
+    const char *enabled = getenv("DIAMONDWM_COMPOSITE");
+    if (!enabled || strcmp(enabled, "1") != 0) return 0;
 
-    // Use provided window and GC
-    panel_gc = gc;
-    panel.win = win;
+    int event_base, error_base, major = 0, minor = 0;
+    if (renderer != &xrender_backend) {
+        debug_log("Compositing needs the XRender backend, staying uncomposited");
+        return 0;
+    }
+    if (!XCompositeQueryExtension(dpy, &event_base, &error_base) ||
+        !XCompositeQueryVersion(dpy, &major, &minor) || (major == 0 && minor < 3)) {
+        debug_log("Composite 0.3 not available, staying uncomposited");
+        return 0;
+    }
+    if (!XDamageQueryExtension(dpy, &comp.damage_event_base, &comp.damage_error_base)) {
+        debug_log("Damage not available, staying uncomposited");
+        return 0;
+    }
 
-    // Draw the diamond
-    draw_diamond_icon(x, y, size);
+    // Only one compositing manager per screen
+    Atom cm_atom = atoms[ATOM_NET_WM_CM_S];
+    if (XGetSelectionOwner(dpy, cm_atom) != None) {
+        debug_log("Another compositing manager is running, staying uncomposited");
+        return 0;
+    }
+    comp.cm_owner = XCreateSimpleWindow(dpy, root, 0, 0, 1, 1, 0, None, None);
+    XSetSelectionOwner(dpy, cm_atom, comp.cm_owner, CurrentTime);
+
+    int shape_error_base;
+    if (has_shape) XShapeQueryExtension(dpy, &comp.shape_event_base, &shape_error_base);
+
+    comp.show_stats = getenv("DIAMONDWM_COMPOSITE_STATS") != NULL;
+    comp.damage = XCreateRegion();
+
+    int width = DisplayWidth(dpy, screen);
+    int height = DisplayHeight(dpy, screen);
+
+    // The overlay sits above every window; make it transparent to input
+    comp.overlay = XCompositeGetOverlayWindow(dpy, root);
+    XShapeCombineRectangles(dpy, comp.overlay, ShapeInput, 0, 0, NULL, 0, ShapeSet, Unsorted);
+    XSelectInput(dpy, comp.overlay, ExposureMask);
+    comp.overlay_picture = XRenderCreatePicture(dpy, comp.overlay, render_visual_format, 0, NULL);
+
+    Pixmap back = XCreatePixmap(dpy, root, width, height, DefaultDepth(dpy, screen));
+    surface_init(&comp.back, back, 0, width, height, bg_gradient_start);
+
+    XWindowAttributes root_attrs;
+    XGetWindowAttributes(dpy, root, &root_attrs);
+    XSelectInput(dpy, root, root_attrs.your_event_mask | PropertyChangeMask | ExposureMask);
+    comp_update_root_tile();
+
+    // Grab the server so no window appears between the query and the redirect
+    XGrabServer(dpy);
+    XCompositeRedirectSubwindows(dpy, root, CompositeRedirectManual);
+    Window root_return, parent_return, *children = NULL;
+    unsigned int nchildren = 0;
+    if (XQueryTree(dpy, root, &root_return, &parent_return, &children, &nchildren)) {
+        for (unsigned int i = 0; i < nchildren; i++) {
+            comp_add_window(children[i], 1);
+        }
+        if (children) XFree(children);
+    }
+    XUngrabServer(dpy);
 
-    // Restore original values
-    panel_gc = original_panel_gc;
-    panel.win = original_panel_win;
+    comp_damage_screen();
+    compositing = 1;
+    debug_log("Compositing enabled (Composite %d.%d), %d windows", major, minor, comp.window_count);
+    return 1;
 }
 
-void lock_screen() {
-    debug_log("Creating enhanced lock screen with modern diamond logo");
+void compositor_handle_event(XEvent *ev) {
+    CompWindow *w;
+
+    if (ev->type == comp.damage_event_base + XDamageNotify) {
+        XDamageNotifyEvent *de = (XDamageNotifyEvent *)ev;
+        w = comp_find(de->drawable);
+        if (!w || !w->mapped) return;
+        XRectangle r = de->area;
+        r.x += w->x + w->border;
+        r.y += w->y + w->border;
+        XUnionRectWithRegion(&r, comp.damage, comp.damage);
+        w->damaged = 1;
+        return;
+    }
 
-    // Create a fullscreen lock window
-    Window lock_win = XCreateSimpleWindow(dpy, root, 0, 0,
-                                         DisplayWidth(dpy, screen),
-                                         DisplayHeight(dpy, screen),
-                                         0, black, background_dark);
+    if (has_shape && ev->type == comp.shape_event_base + ShapeNotify) {
+        XShapeEvent *se = (XShapeEvent *)ev;
+        w = comp_find(se->window);
+        if (w && se->kind == ShapeBounding) {
+            if (w->mapped) comp_damage_window(w);
+            comp_fetch_shape(w);
+            if (w->mapped) comp_damage_window(w);
+        }
+        return;
+    }
 
-    // Create a GC for the lock screen
-    XGCValues lock_gc_vals;
-    lock_gc_vals.foreground = text_primary;
-    lock_gc_vals.background = background_dark;
-    GC lock_gc = XCreateGC(dpy, lock_win, GCForeground | GCBackground, &lock_gc_vals);
+    switch (ev->type) {
+        case CreateNotify:
+            if (ev->xcreatewindow.parent == root) comp_add_window(ev->xcreatewindow.window, 1);
+            break;
 
-    // Grab keyboard and pointer
-    XGrabKeyboard(dpy, root, True, GrabModeAsync, GrabModeAsync, CurrentTime);
-    XGrabPointer(dpy, root, True, ButtonPressMask | PointerMotionMask,
-                 GrabModeAsync, GrabModeAsync, None, None, CurrentTime);
+        case DestroyNotify:
+            comp_remove_window(ev->xdestroywindow.window, 1);
+            break;
 
-    // Map the lock window
-    XMapWindow(dpy, lock_win);
-    XRaiseWindow(dpy, lock_win);
+        case ReparentNotify:
+            if (ev->xreparent.parent == root) {
+                comp_add_window(ev->xreparent.window, 1);
+            } else {
+                comp_remove_window(ev->xreparent.window, 0);
+            }
+            break;
 
-    int screen_width = DisplayWidth(dpy, screen);
-    int screen_height = DisplayHeight(dpy, screen);
-    int center_x = screen_width / 2;
-    int center_y = screen_height / 2;
+        case MapNotify:
+            w = comp_find(ev->xmap.window);
+            if (w) {
+                w->mapped = 1;
+                comp_release_pixmap(w);
+                comp_fetch_opacity(w);
+                comp_damage_window(w);
+            }
+            break;
 
-    // Create Xft draw for anti-aliased text
-    XftDraw *lock_xft_draw = XftDrawCreate(dpy, lock_win,
-                                          DefaultVisual(dpy, screen),
-                                          DefaultColormap(dpy, screen));
+        case UnmapNotify:
+            w = comp_find(ev->xunmap.window);
+            if (w && w->mapped) {
+                comp_damage_window(w);
+                w->mapped = 0;
+                comp_release_pixmap(w);
+            }
+            break;
 
-    // Draw modern diamond logo (same as panel) - manually draw since we can't use panel_gc
-    int diamond_size = 120;
-    int diamond_x = center_x - diamond_size / 2;
-    int diamond_y = center_y - diamond_size / 2 - 80;
+        case ConfigureNotify:
+            w = comp_find(ev->xconfigure.window);
+            if (w) {
+                XConfigureEvent *ce = &ev->xconfigure;
+                if (w->mapped) comp_damage_window(w);
+                if (ce->width != w->width || ce->height != w->height || ce->border_width != w->border) {
+                    comp_release_pixmap(w);
+                }
+                w->x = ce->x;
+                w->y = ce->y;
+                w->width = ce->width;
+                w->height = ce->height;
+                w->border = ce->border_width;
+                comp_restack(w->id, ce->above);
+                if (w->mapped) comp_damage_window(w);
+            } else if (ev->xconfigure.window == root) {
+                comp_damage_screen();
+            }
+            break;
 
-    // Draw the full diamond icon similar to panel but with lock screen dimensions
-    draw_diamond_to_window(lock_win, lock_gc, diamond_x, diamond_y, diamond_size);
+        case CirculateNotify:
+            w = comp_find(ev->xcirculate.window);
+            if (w) {
+                if (ev->xcirculate.place == PlaceOnTop) {
+                    comp_restack(w->id, comp.windows[comp.window_count - 1]->id);
+                } else {
+                    comp_restack(w->id, None);
+                }
+                if (w->mapped) comp_damage_window(w);
+            }
+            break;
 
-    // Draw "DiamondWM" text with anti-aliased font
-    char *title = "DiamondWM";
-    if (xft_fonts.title) {
-        XGlyphInfo extents;
-        XftTextExtents8(dpy, xft_fonts.title, (XftChar8 *)title, strlen(title), &extents);
-        int title_width = extents.width;
-        int title_x = center_x - title_width / 2;
-        int title_y = center_y + 40;
+        case PropertyNotify:
+            if (ev->xproperty.window == root && ev->xproperty.atom == atoms[ATOM_XROOTPMAP_ID]) {
+                comp_update_root_tile();
+                comp_damage_screen();
+            } else if (ev->xproperty.atom == atoms[ATOM_NET_WM_WINDOW_OPACITY]) {
+                w = comp_find(ev->xproperty.window);
+                if (w) {
+                    comp_fetch_opacity(w);
+                    if (w->mapped) comp_damage_window(w);
+                }
+            }
+            break;
+
+        case Expose:
+            if (ev->xexpose.window == comp.overlay || ev->xexpose.window == root) {
+                XRectangle r = {ev->xexpose.x, ev->xexpose.y, ev->xexpose.width, ev->xexpose.height};
+                XUnionRectWithRegion(&r, comp.damage, comp.damage);
+            }
+            break;
+    }
+}
+
+// Repaint everything damaged since the last call. Called once the event
+// queue is drained, so a burst of damage costs a single frame.
+void compositor_paint() {
+    if (!compositing || XEmptyRegion(comp.damage)) return;
 
-        XRenderColor title_color;
-        title_color.red = ((text_primary >> 16) & 0xFF) * 257;
-        title_color.green = ((text_primary >> 8) & 0xFF) * 257;
-        title_color.blue = (text_primary & 0xFF) * 257;
-        title_color.alpha = 0xFFFF;
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
 
-        XftColor xft_title;
-        if (XftColorAllocValue(dpy, DefaultVisual(dpy, screen),
-                              DefaultColormap(dpy, screen),
-                              &title_color, &xft_title)) {
-            XftDrawStringUtf8(lock_xft_draw, &xft_title, xft_fonts.title,
-                             title_x, title_y + xft_fonts.title->ascent, (XftChar8 *)title, strlen(title));
-            XftColorFree(dpy, DefaultVisual(dpy, screen),
-                        DefaultColormap(dpy, screen), &xft_title);
+    // Start tracking new damage before reading the window pixmaps
+    for (int i = 0; i < comp.window_count; i++) {
+        if (comp.windows[i]->damaged) {
+            XDamageSubtract(dpy, comp.windows[i]->damage, None, None);
+            comp.windows[i]->damaged = 0;
         }
     }
 
-    // Draw lock message with anti-aliased font
-    char *message = "Press any key to unlock";
-    if (xft_fonts.regular) {
-        XGlyphInfo extents;
-        XftTextExtents8(dpy, xft_fonts.regular, (XftChar8 *)message, strlen(message), &extents);
-        int msg_width = extents.width;
-        int msg_x = center_x - msg_width / 2;
-        int msg_y = center_y + 80;
+    Region damage = comp.damage;
+    comp.damage = XCreateRegion();
+    Region remaining = XCreateRegion();
+    XUnionRegion(damage, remaining, remaining);
+    Picture back = comp.back.picture;
+
+    // Top to bottom: each window gets the damage not yet covered by opaque
+    // windows above it. Opaque windows are painted straight away.
+    for (int i = comp.window_count - 1; i >= 0; i--) {
+        CompWindow *w = comp.windows[i];
+        if (!w->mapped || w->input_only) continue;
+
+        int shadowed = comp_has_shadow(w);
+        int margin = shadowed ? SHADOW_BLUR + SHADOW_OFFSET : 0;
+        if (XRectInRegion(remaining, w->x - margin, w->y - margin,
+                          w->width + 2 * w->border + 2 * margin,
+                          w->height + 2 * w->border + 2 * margin) == RectangleOut) {
+            comp.skipped++;
+            continue;
+        }
+        if (!comp_bind_pixmap(w)) continue;
+
+        Region shape = comp_window_region(w);
+        w->clip = XCreateRegion();
+        XUnionRegion(remaining, w->clip, w->clip);
+
+        if (comp_is_opaque(w)) {
+            Region visible = XCreateRegion();
+            XIntersectRegion(remaining, shape, visible);
+            comp_set_clip(back, visible);
+            XRenderComposite(dpy, PictOpSrc, w->picture, None, back, 0, 0, 0, 0,
+                             w->x, w->y, w->width + 2 * w->border, w->height + 2 * w->border);
+            XDestroyRegion(visible);
+            XSubtractRegion(remaining, shape, remaining);
+        }
+        XDestroyRegion(shape);
+        comp.painted++;
+    }
+
+    // Wallpaper shows through wherever no opaque window landed
+    comp_set_clip(back, remaining);
+    XRenderComposite(dpy, PictOpSrc, comp.root_tile, None, back, 0, 0, 0, 0, 0, 0,
+                     DisplayWidth(dpy, screen), DisplayHeight(dpy, screen));
+
+    // Bottom to top: shadows and translucent windows blend over what is below
+    for (int i = 0; i < comp.window_count; i++) {
+        CompWindow *w = comp.windows[i];
+        if (!w->clip) continue;
+
+        Region shape = comp_window_region(w);
+        if (comp_has_shadow(w)) {
+            Region outside = XCreateRegion();
+            XSubtractRegion(w->clip, shape, outside);
+            comp_set_clip(back, outside);
+            draw_shadow(&comp.back, w->x, w->y, w->width + 2 * w->border, w->height + 2 * w->border);
+            XDestroyRegion(outside);
+        }
 
-        XRenderColor msg_color;
-        msg_color.red = ((text_secondary >> 16) & 0xFF) * 257;
-        msg_color.green = ((text_secondary >> 8) & 0xFF) * 257;
-        msg_color.blue = (text_secondary & 0xFF) * 257;
-        msg_color.alpha = 0xFFFF;
+        if (!comp_is_opaque(w)) {
+            Region visible = XCreateRegion();
+            XIntersectRegion(w->clip, shape, visible);
+            comp_set_clip(back, visible);
 
-        XftColor xft_msg;
-        if (XftColorAllocValue(dpy, DefaultVisual(dpy, screen),
-                              DefaultColormap(dpy, screen),
-                              &msg_color, &xft_msg)) {
-            XftDrawStringUtf8(lock_xft_draw, &xft_msg, xft_fonts.regular,
-                             msg_x, msg_y + xft_fonts.regular->ascent, (XftChar8 *)message, strlen(message));
-            XftColorFree(dpy, DefaultVisual(dpy, screen),
-                        DefaultColormap(dpy, screen), &xft_msg);
+            Picture mask = None;
+            if (w->opacity != 0xFFFF) {
+                XRenderColor rc = {0, 0, 0, w->opacity};
+                mask = XRenderCreateSolidFill(dpy, &rc);
+            }
+            XRenderComposite(dpy, PictOpOver, w->picture, mask, back, 0, 0, 0, 0,
+                             w->x, w->y, w->width + 2 * w->border, w->height + 2 * w->border);
+            if (mask) XRenderFreePicture(dpy, mask);
+            XDestroyRegion(visible);
         }
+
+        XDestroyRegion(shape);
+        XDestroyRegion(w->clip);
+        w->clip = NULL;
     }
 
+    // Present only the damaged area
+    comp_set_clip(back, NULL);
+    comp_set_clip(comp.overlay_picture, damage);
+    XRenderComposite(dpy, PictOpSrc, back, None, comp.overlay_picture, 0, 0, 0, 0, 0, 0,
+                     DisplayWidth(dpy, screen), DisplayHeight(dpy, screen));
     XFlush(dpy);
 
-    // Wait for any key press to unlock
-    XEvent ev;
-    int unlocked = 0;
+    XDestroyRegion(remaining);
+    XDestroyRegion(damage);
 
-    while (!unlocked) {
-        XNextEvent(dpy, &ev);
+    gettimeofday(&end, NULL);
+    comp.paint_ms += (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
+    comp.frames++;
 
-        if (ev.type == KeyPress || ev.type == ButtonPress) {
-            unlocked = 1;
-        }
+    if (comp.show_stats && comp.frames % 100 == 0) {
+        printf("composite: %ld frames, %.3f ms/frame, %.1f windows painted, %.1f occluded skipped\n",
+               comp.frames, comp.paint_ms / comp.frames,
+               (double)comp.painted / comp.frames, (double)comp.skipped / comp.frames);
+        fflush(stdout);
     }
+}
 
-    // Cleanup
-    XftDrawDestroy(lock_xft_draw);
-    XUngrabKeyboard(dpy, CurrentTime);
-    XUngrabPointer(dpy, CurrentTime);
-    XUnmapWindow(dpy, lock_win);
-    XDestroyWindow(dpy, lock_win);
-    XFreeGC(dpy, lock_gc);
+// Events the main loop only passes on to the compositor, so a blocking
+// animation may handle them itself. They must still be taken in queue
+// order: a MapNotify handled ahead of an older UnmapNotify or CreateNotify
+// for the same window would leave the compositor with a stale view of it.
+Bool comp_private_event(Display *d, XEvent *ev, XPointer arg) {
+    return ev->type == comp.damage_event_base + XDamageNotify ||
+           (has_shape && ev->type == comp.shape_event_base + ShapeNotify) ||
+           ev->type == MapNotify || ev->type == ConfigureNotify;
+}
 
-    show_operation_feedback("Screen unlocked");
-    debug_log("Enhanced lock screen deactivated");
+// Paint a frame from inside an animation that blocks the main loop
+void compositor_frame() {
+    if (!compositing) return;
+
+    XEvent ev;
+    XSync(dpy, False);
+    // Only from the head of the queue; the first event the main loop must
+    // see ends the catch-up, and everything behind it waits with it
+    while (XEventsQueued(dpy, QueuedAlready) > 0) {
+        XPeekEvent(dpy, &ev);
+        if (!comp_private_event(dpy, &ev, NULL)) break;
+        XNextEvent(dpy, &ev);
+        compositor_handle_event(&ev);
+    }
+    compositor_paint();
 }
 
+void compositor_shutdown() {
+    if (!compositing) return;
 
-void create_app_launcher() {
-    load_applications();
+    while (comp.window_count > 0) {
+        comp_remove_window(comp.windows[comp.window_count - 1]->id, 0);
+    }
+    free(comp.windows);
+    comp.windows = NULL;
+    comp.window_capacity = 0;
+
+    XCompositeUnredirectSubwindows(dpy, root, CompositeRedirectManual);
+    XRenderFreePicture(dpy, comp.overlay_picture);
+    XCompositeReleaseOverlayWindow(dpy, root);
+    if (comp.root_tile) XRenderFreePicture(dpy, comp.root_tile);
+    Pixmap back = comp.back.drawable;
+    surface_free(&comp.back);
+    XFreePixmap(dpy, back);
+    XDestroyRegion(comp.damage);
+    XDestroyWindow(dpy, comp.cm_owner);
+    compositing = 0;
+}
 
-    app_launcher.width = 350;
-    app_launcher.height = 600;
-    app_launcher.x = 100;
-    app_launcher.y = 100;
-    app_launcher.hover_item = -1;
-    app_launcher.alpha = 0.0f;
-    app_launcher.search_mode = 0;
-    app_launcher.search_text[0] = '\0';
+#else
 
-    app_launcher.win = XCreateSimpleWindow(dpy, root, app_launcher.x, app_launcher.y,
-                                          app_launcher.width, app_launcher.height, 0,
-                                          white, dark_blue);
+int compositor_init() {
+    if (getenv("DIAMONDWM_COMPOSITE")) {
+        debug_log("Built without Composite/Damage support, staying uncomposited");
+    }
+    return 0;
+}
 
-    // ADD KeyPressMask to receive keyboard events
-    XSelectInput(dpy, app_launcher.win, ButtonPressMask | ExposureMask | PointerMotionMask | KeyPressMask);
-    app_launcher.visible = 0;
+void compositor_handle_event(XEvent *ev) {
+}
 
-    debug_log("App launcher created: %dx%d", app_launcher.width, app_launcher.height);
+void compositor_paint() {
 }
 
-void show_app_launcher(int x, int y) {
-    if (!app_launcher.visible) {
-        int screen_width = DisplayWidth(dpy, screen);
-        int screen_height = DisplayHeight(dpy, screen);
+void compositor_frame() {
+}
 
-        app_launcher.x = x;
-        app_launcher.y = y;
+void compositor_shutdown() {
+}
 
-        if (app_launcher.x + app_launcher.width > screen_width) {
-            app_launcher.x = screen_width - app_launcher.width - 10;
-        }
-        if (app_launcher.y + app_launcher.height > screen_height) {
-            app_launcher.y = screen_height - app_launcher.height - 10;
-        }
+#endif
 
-        debug_log("show_app_launcher: positioning at %d,%d (clicked at %d,%d)",
-                 app_launcher.x, app_launcher.y, x, y);
+// ---- Tooltips ----
+//
+// Each label is measured and painted once into its own pixmap. Showing a
+// tooltip is then a move, a map and one blit, which keeps hovering along
+// the pinned apps cheap.
 
-        XMoveWindow(dpy, app_launcher.win, app_launcher.x, app_launcher.y);
-        XMapWindow(dpy, app_launcher.win);
-        XRaiseWindow(dpy, app_launcher.win);
-        app_launcher.visible = 1;
+// Xft when it loaded, the core fixed font otherwise
+int tooltip_font() {
+    return has_font(FONT_REGULAR) ? FONT_REGULAR : FONT_FIXED;
+}
 
-        // GRAB THE KEYBOARD with proper error handling
-        int grab_result = XGrabKeyboard(dpy, root, False, GrabModeAsync, GrabModeAsync, CurrentTime);
-        if (grab_result != GrabSuccess) {
-            debug_log("WARNING: Could not grab keyboard, search may not work properly");
-        }
+void paint_tooltip_face(TooltipFace *face) {
+    Surface *s = &face->surface;
+    surface_begin_batch(s);
+    s->backend->clear(s);
 
-        // Fade-in animation
-        for (int i = 0; i <= 10; i++) {
-            app_launcher.alpha = (float)i / 10.0f;
-            draw_app_launcher();
-            XFlush(dpy);
-            usleep(10000);
-        }
+    // Draw rounded background
+    draw_rounded_rectangle(s, 0, 0, face->width, face->height, 6, 0x2D2D3D);
 
-        XGrabPointer(dpy, root, False, ButtonPressMask, GrabModeAsync,
-                    GrabModeAsync, None, None, CurrentTime);
-    }
+    // Draw border
+    s->backend->stroke_rect(s, 1, 1, face->width - 3, face->height - 3, 1, accent_color);
+
+    // Draw text
+    int font = tooltip_font();
+    int width = text_width(font, face->text);
+    int text_x = (face->width - width) / 2;
+    int text_y = font == FONT_FIXED ? face->height / 2 + 5 : (face->height + font_ascent(font)) / 2;
+    s->backend->text(s, text_x, text_y, face->text, font, text_primary);
+    surface_end_batch(s);
 }
 
-void hide_app_launcher() {
-    if (app_launcher.visible) {
-        // Fade-out animation
-        for (int i = 10; i >= 0; i--) {
-            app_launcher.alpha = (float)i / 10.0f;
-            draw_app_launcher();
-            XFlush(dpy);
-            usleep(8000);
-        }
+void free_tooltip_face(TooltipFace *face) {
+    if (!face->surface.backend) return;
+    Pixmap pixmap = face->surface.drawable;
+    surface_free(&face->surface);
+    if (pixmap) XFreePixmap(dpy, pixmap);
+}
 
-        XUnmapWindow(dpy, app_launcher.win);
-        app_launcher.visible = 0;
-        app_launcher.hover_item = -1;
-        app_launcher.search_mode = 0;
-        app_launcher.search_text[0] = '\0';
+// The face for text, painting it into the least recently used slot if needed
+TooltipFace *get_tooltip_face(const char *text) {
+    TooltipFace *victim = &tooltip.faces[0];
 
-        // UNGRAB THE KEYBOARD when hiding
-        XUngrabKeyboard(dpy, CurrentTime);
-        XUngrabPointer(dpy, CurrentTime);
+    tooltip.clock++;
+    for (int i = 0; i < TOOLTIP_FACES; i++) {
+        TooltipFace *face = &tooltip.faces[i];
+        if (face->text[0] && strcmp(face->text, text) == 0) {
+            face->last_used = tooltip.clock;
+            return face;
+        }
+        if (face->last_used < victim->last_used) victim = face;
     }
+
+    free_tooltip_face(victim);
+    snprintf(victim->text, sizeof(victim->text), "%s", text);
+    victim->width = text_width(tooltip_font(), victim->text) + 2 * TOOLTIP_PADDING;
+    victim->height = TOOLTIP_HEIGHT;
+    victim->last_used = tooltip.clock;
+
+    // The headless backend keeps its pixels in memory
+    Pixmap pixmap = dpy ? XCreatePixmap(dpy, root, victim->width, victim->height,
+                                        DefaultDepth(dpy, screen)) : None;
+    if (!surface_init(&victim->surface, pixmap, 0, victim->width, victim->height, dark_blue)) {
+        if (pixmap) XFreePixmap(dpy, pixmap);
+        victim->text[0] = '\0';
+        return NULL;
+    }
+    paint_tooltip_face(victim);
+    return victim;
 }
 
-// Add this function to filter applications based on search text
-void filter_applications_by_search() {
-    if (app_launcher.search_text[0] == '\0') {
-        // If search is empty, show all categories expanded
-        for (int i = 0; i < app_launcher.category_count; i++) {
-            if (app_launcher.categories[i].app_count > 0) {
-                app_launcher.categories[i].expanded = 1;
-            }
-        }
-        return;
+void free_tooltip_faces() {
+    for (int i = 0; i < TOOLTIP_FACES; i++) {
+        free_tooltip_face(&tooltip.faces[i]);
+        tooltip.faces[i].text[0] = '\0';
     }
+    tooltip.face = NULL;
+}
 
-    // Convert search text to lowercase for case-insensitive search
-    char search_lower[256];
-    strncpy(search_lower, app_launcher.search_text, sizeof(search_lower)-1);
-    search_lower[sizeof(search_lower)-1] = '\0';
-    for (char *p = search_lower; *p; p++) *p = tolower(*p);
+void show_tooltip(int x, int y, PinnedApp *app) {
+    if (!app || !app->name) return;
 
-    // Filter applications based on search text
-    for (int i = 0; i < app_launcher.category_count; i++) {
-        AppCategory *cat = &app_launcher.categories[i];
-        int match_count = 0;
+    TooltipFace *face = get_tooltip_face(app->name);
+    if (!face) return;
 
-        // Count matching apps in this category
-        for (int j = 0; j < cat->app_count; j++) {
-            char app_name_lower[256];
-            strncpy(app_name_lower, cat->apps[j].name, sizeof(app_name_lower)-1);
-            app_name_lower[sizeof(app_name_lower)-1] = '\0';
-            for (char *p = app_name_lower; *p; p++) *p = tolower(*p);
+    tooltip.visible = 1;
+    tooltip.target_app = app;
+    tooltip.face = face;
+    strncpy(tooltip.text, app->name, sizeof(tooltip.text) - 1);
+    tooltip.text[sizeof(tooltip.text) - 1] = '\0';
+    tooltip.width = face->width;
+    tooltip.height = face->height;
 
-            if (strstr(app_name_lower, search_lower) != NULL) {
-                match_count++;
-            }
-        }
+    // Position tooltip above the pinned app icon
+    tooltip.x = x - tooltip.width / 2;
+    tooltip.y = panel.y - tooltip.height - 5;
 
-        // Expand category only if it has matching apps
-        cat->expanded = (match_count > 0);
+    // Keep tooltip on screen
+    if (tooltip.x < 5) tooltip.x = 5;
+    if (tooltip.x + tooltip.width > DisplayWidth(dpy, screen) - 5) {
+        tooltip.x = DisplayWidth(dpy, screen) - tooltip.width - 5;
     }
-}
 
+    XMoveResizeWindow(dpy, tooltip.win, tooltip.x, tooltip.y, tooltip.width, tooltip.height);
+    XMapWindow(dpy, tooltip.win);
+    raise_window(tooltip.win, LAYER_POPUP);
 
-void draw_app_launcher_text(int x, int y, const char *text, unsigned long color, XftFont *font) {
-    if (font && xft_draw) {
-        XRenderColor render_color;
-        render_color.red = ((color >> 16) & 0xFF) * 257;
-        render_color.green = ((color >> 8) & 0xFF) * 257;
-        render_color.blue = (color & 0xFF) * 257;
-        render_color.alpha = 0xFFFF;
+    draw_tooltip();
+}
 
-        XftColor xft_color;
-        if (XftColorAllocValue(dpy, DefaultVisual(dpy, screen),
-                              DefaultColormap(dpy, screen),
-                              &render_color, &xft_color)) {
-            // Add font ascent to Y coordinate for proper vertical alignment
-            XftDrawStringUtf8(xft_draw, &xft_color, font, x, y + font->ascent,
-                             (XftChar8 *)text, strlen(text));
-            XftColorFree(dpy, DefaultVisual(dpy, screen),
-                        DefaultColormap(dpy, screen), &xft_color);
-        }
+void hide_tooltip() {
+    if (tooltip.visible) {
+        tooltip.visible = 0;
+        tooltip.target_app = NULL;
+        XUnmapWindow(dpy, tooltip.win);
     }
 }
 
-void draw_app_launcher() {
-    if (!app_launcher.visible) return;
-
-    XClearWindow(dpy, app_launcher.win);
-
-    // Modern background with rounded corners
-    XSetForeground(dpy, menu_gc, background_dark);
-    draw_rounded_rectangle(app_launcher.win, menu_gc, 0, 0, app_launcher.width, app_launcher.height, CORNER_RADIUS);
+void draw_tooltip() {
+    if (!tooltip.visible || !tooltip.face) return;
 
-    // Draw border with accent color
-    XSetForeground(dpy, menu_gc, accent_color);
-    XDrawRectangle(dpy, app_launcher.win, menu_gc, 1, 1, app_launcher.width - 3, app_launcher.height - 3);
+    Surface *s = &tooltip.surface;
+    surface_resize(s, tooltip.width, tooltip.height);
+    shape_window(s, tooltip.width, tooltip.height, 6, SHAPE_ALL);
+    s->backend->blit(s, &tooltip.face->surface, 0, 0, tooltip.width, tooltip.height, 0, 0);
+}
 
-    // Draw search bar
-    if (app_launcher.search_mode) {
-        XSetForeground(dpy, menu_gc, accent_color);
-    } else {
-        XSetForeground(dpy, menu_gc, 0x3D3D4D);
+void set_background() {
+    int result = system("feh --bg-scale /usr/share/backgrounds/* 2>/dev/null &");
+    if (result == -1) {
+        debug_log("WARNING: Failed to set background with feh");
     }
-    XFillRectangle(dpy, app_launcher.win, menu_gc, 10, 10, app_launcher.width-20, 30);
 
-    XSetForeground(dpy, menu_gc, app_launcher.search_mode ? accent_color : 0x555555);
-    XDrawRectangle(dpy, app_launcher.win, menu_gc, 10, 10, app_launcher.width-20, 30);
+    Pixmap bg_pixmap = XCreatePixmap(dpy, root,
+                                    DisplayWidth(dpy, screen),
+                                    DisplayHeight(dpy, screen),
+                                    DefaultDepth(dpy, screen));
 
-    XSetForeground(dpy, menu_gc, text_primary);
-    if (app_launcher.search_text[0] == '\0') {
-        XDrawString(dpy, app_launcher.win, menu_gc, 20, 30, "Search applications...", 21);
-    } else {
-        XDrawString(dpy, app_launcher.win, menu_gc, 20, 30, app_launcher.search_text, strlen(app_launcher.search_text));
+    GC bg_gc = XCreateGC(dpy, bg_pixmap, 0, NULL);
 
-        // Show cursor when in search mode
-        if (app_launcher.search_mode) {
-            int text_width = XTextWidth(XLoadQueryFont(dpy, "fixed"), app_launcher.search_text, strlen(app_launcher.search_text));
-            XDrawLine(dpy, app_launcher.win, menu_gc, 20 + text_width, 15, 20 + text_width, 25);
+    // Modern gradient background (dark purple to dark blue). The colour
+    // changes only every few dozen rows, so each run is one rectangle.
+    int height = DisplayHeight(dpy, screen);
+    int run_start = 0;
+    unsigned long run_color = 0;
+    for (int y = 0; y <= height; y++) {
+        unsigned long color = run_color;
+        if (y < height) {
+            float ratio = (float)y / height;
+            int r = (int)(10 + ratio * 5);
+            int g = (int)(10 + ratio * 15);
+            int b = (int)(20 + ratio * 30);
+            color = (r << 16) | (g << 8) | b;
         }
-    }
-
-    // Draw title with search info - FIXED TRUNCATION
-    XSetForeground(dpy, menu_gc, text_primary);
-    if (app_launcher.search_text[0] != '\0') {
-        char title[256];  // INCREASED BUFFER SIZE
-        // Truncate search text if too long for display
-        char display_search[50];
-        strncpy(display_search, app_launcher.search_text, sizeof(display_search)-1);
-        display_search[sizeof(display_search)-1] = '\0';
-        if (strlen(app_launcher.search_text) > sizeof(display_search)-1) {
-            strcpy(display_search + sizeof(display_search)-4, "...");
+        if (y > 0 && (y == height || color != run_color)) {
+            XSetForeground(dpy, bg_gc, run_color);
+            XFillRectangle(dpy, bg_pixmap, bg_gc, 0, run_start, DisplayWidth(dpy, screen), y - run_start);
+            run_start = y;
         }
-        snprintf(title, sizeof(title), "Search: '%s'", display_search);
-        XDrawString(dpy, app_launcher.win, menu_gc, 10, 55, title, strlen(title));
-    } else {
-        XDrawString(dpy, app_launcher.win, menu_gc, 10, 55, "Applications", 12);
+        run_color = color;
     }
 
-    XSetForeground(dpy, menu_gc, 0x404040);
-    XDrawLine(dpy, app_launcher.win, menu_gc, 0, 60, app_launcher.width, 60);
+    XSetWindowBackgroundPixmap(dpy, root, bg_pixmap);
+    XClearWindow(dpy, root);
 
-    int y_pos = 75;
+    // Publish the wallpaper so the compositor (and pseudo-transparent
+    // clients) can paint it; the pixmap must outlive this call for that
+    XChangeProperty(dpy, root, atoms[ATOM_XROOTPMAP_ID], XA_PIXMAP, 32, PropModeReplace,
+                    (unsigned char *)&bg_pixmap, 1);
 
-    // Draw categories and apps with modern styling
-    for (int i = 0; i < app_launcher.category_count; i++) {
-        AppCategory *cat = &app_launcher.categories[i];
+    XFreeGC(dpy, bg_gc);
+}
 
-        if (cat->app_count == 0) continue;
-        if (!cat->expanded) continue; // Skip non-expanded categories
+void show_operation_feedback(const char* message) {
+    // Create a temporary toast notification
+    Window toast = XCreateSimpleWindow(dpy, root,
+                                      DisplayWidth(dpy, screen)/2 - 100,
+                                      DisplayHeight(dpy, screen)/2,
+                                      200, 40, 0, accent_color, background_dark);
+    XSelectInput(dpy, toast, ExposureMask);
+    XMapWindow(dpy, toast);
 
-        // Draw category name
-        char category_text[100];
-        snprintf(category_text, sizeof(category_text), "%s (%d)", cat->category_name, cat->app_count);
+    // Draw message
+    XGCValues toast_gc_vals;
+    toast_gc_vals.foreground = text_primary;
+    toast_gc_vals.background = background_dark;
+    toast_gc_vals.font = XLoadFont(dpy, "fixed");
+    GC toast_gc = XCreateGC(dpy, toast, GCForeground | GCBackground | GCFont, &toast_gc_vals);
 
-        // Hover effect for category
-        if (app_launcher.hover_item == (i << 16)) {
-            XSetForeground(dpy, menu_gc, menu_hover_bg);
-            draw_rounded_rectangle(app_launcher.win, menu_gc, 15, y_pos - 15,
-                                  app_launcher.width - 30, 20, 4);
-        }
+    XSetForeground(dpy, toast_gc, text_primary);
+    XDrawString(dpy, toast, toast_gc, 10, 25, message, strlen(message));
+    XFlush(dpy);
 
-        XSetForeground(dpy, menu_gc, text_primary);
-        XDrawString(dpy, app_launcher.win, menu_gc, 20, y_pos, category_text, strlen(category_text));
-        y_pos += 25;
+    // Auto-hide after delay
+    usleep(1500000);
+    XDestroyWindow(dpy, toast);
+    XFreeGC(dpy, toast_gc);
+}
 
-        // Draw apps
-        for (int j = 0; j < cat->app_count; j++) {
-            // Hover effect for apps
-            if (app_launcher.hover_item == ((i << 16) | (j + 1))) {
-                XSetForeground(dpy, menu_gc, menu_hover_bg);
-                draw_rounded_rectangle(app_launcher.win, menu_gc, 35, y_pos - 15,
-                                      app_launcher.width - 45, 20, 4);
-            }
+void draw_gradient_rect(Surface *s, int x, int y, int w, int h, unsigned long c1, unsigned long c2, int vertical) {
+    s->backend->gradient(s, x, y, w, h, c1, c2, vertical);
+}
 
-            XSetForeground(dpy, menu_gc, text_secondary);
-            XDrawString(dpy, app_launcher.win, menu_gc, 40, y_pos,
-                       cat->apps[j].name, strlen(cat->apps[j].name));
-            y_pos += 20;
+void draw_rounded_rectangle(Surface *s, int x, int y, int w, int h, int r, unsigned long color) {
+    // The cached texture already has anti-aliased corners, so this is nine
+    // blits instead of tessellating the outline on every call
+    if (w >= 2 * r && h >= 2 * r) {
+        NineSlice *t = get_theme_texture(TEXTURE_ROUNDED, r, color);
+        if (t) {
+            s->backend->nine_slice(s, t, x, y, w, h);
+            return;
         }
+    }
+    s->backend->fill_rounded_rect(s, x, y, w, h, r, color);
+}
 
-        y_pos += 5;
-
-        if (y_pos > app_launcher.height - 20) break;
+// Drop shadow cast by the rectangle x,y,w,h: it falls outside the rectangle,
+// offset down and to the right
+void draw_shadow(Surface *s, int x, int y, int w, int h) {
+    if (w >= 2 * SHADOW_BLUR && h >= 2 * SHADOW_BLUR) {
+        NineSlice *t = get_theme_texture(TEXTURE_SHADOW, SHADOW_BLUR, shadow_color);
+        if (t) {
+            s->backend->nine_slice(s, t,
+                                   x + SHADOW_OFFSET - SHADOW_BLUR,
+                                   y + SHADOW_OFFSET - SHADOW_BLUR,
+                                   w + 2 * SHADOW_BLUR,
+                                   h + 2 * SHADOW_BLUR);
+            return;
+        }
     }
 
-    // Show search instructions
-    if (app_launcher.search_mode) {
-        XSetForeground(dpy, menu_gc, text_secondary);
-        XDrawString(dpy, app_launcher.win, menu_gc, 10, app_launcher.height - 10,
-                   "Press Enter to launch first result, Esc to cancel", 50);
+    // Simple shadow effect using multiple rectangles with decreasing opacity
+    for (int i = 0; i < SHADOW_BLUR; i++) {
+        int alpha = 255 - (i * 32);
+        unsigned long shadow = 0x000000 | ((alpha / 16) << 16) | ((alpha / 16) << 8) | (alpha / 16);
+
+        s->backend->stroke_rect(s,
+                                x + SHADOW_OFFSET - i,
+                                y + SHADOW_OFFSET - i,
+                                w + 2*i,
+                                h + 2*i, 1, shadow);
     }
 }
 
-int is_in_app_launcher_area(int x, int y) {
-    if (!app_launcher.visible) return 0;
+void animate_window_move(Client *c, int target_x, int target_y) {
+    int start_x = c->x;
+    int start_y = c->y;
 
-    int result = (x >= app_launcher.x && x <= app_launcher.x + app_launcher.width &&
-                 y >= app_launcher.y && y <= app_launcher.y + app_launcher.height);
+    // Use cubic easing for smoother animation
+    for (int step = 1; step <= ANIMATION_STEPS; step++) {
+        float t = (float)step / ANIMATION_STEPS;
+        // Cubic ease-out
+        t--;
+        float progress = t*t*t + 1;
 
-    debug_log("is_in_app_launcher_area: checking %d,%d against [%d,%d - %d,%d] -> %d",
-             x, y, app_launcher.x, app_launcher.y,
-             app_launcher.x + app_launcher.width, app_launcher.y + app_launcher.height,
-             result);
+        int new_x = start_x + (int)((target_x - start_x) * progress);
+        int new_y = start_y + (int)((target_y - start_y) * progress);
 
-    return result;
+        XMoveWindow(dpy, c->frame, new_x, new_y);
+        XFlush(dpy);
+        usleep(ANIMATION_DELAY / ANIMATION_STEPS);
+    }
+    c->x = target_x;
+    c->y = target_y;
 }
 
-int get_app_launcher_item_at(int x, int y) {
-    if (!app_launcher.visible) return -1;
+void animate_window_resize(Client *c, int target_w, int target_h) {
+    int start_w = c->width;
+    int start_h = c->height;
 
-    int relative_x = x - app_launcher.x;
-    int relative_y = y - app_launcher.y;
+    for (int step = 1; step <= ANIMATION_STEPS; step++) {
+        float progress = (float)step / ANIMATION_STEPS;
+        progress = 1 - (1 - progress) * (1 - progress);
 
-    debug_log("get_app_launcher_item_at: abs(%d,%d) -> rel(%d,%d) in window %dx%d",
-             x, y, relative_x, relative_y, app_launcher.width, app_launcher.height);
+        int new_w = start_w + (int)((target_w - start_w) * progress);
+        int new_h = start_h + (int)((target_h - start_h) * progress);
 
-    if (relative_x < 0 || relative_x > app_launcher.width ||
-        relative_y < 0 || relative_y > app_launcher.height) {
-        debug_log("  -> Outside app launcher bounds");
-        return -1;
-    }
+        c->width = new_w;
+        c->height = new_h;
 
-    // Check if click is in search area
-    if (relative_y >= 10 && relative_y <= 40) {
-        debug_log("  -> In search area");
-        return -2; // Special value for search area
-    }
+        XResizeWindow(dpy, c->frame, new_w, new_h);
+        XResizeWindow(dpy, c->win, new_w - 2 * FRAME_BORDER,
+                     new_h - TITLEBAR_HEIGHT - 2 * FRAME_BORDER);
 
-    if (relative_y < 65) {
-        debug_log("  -> In title area (y=%d)", relative_y);
-        return -1;
+        draw_window_decorations(c);
+        XFlush(dpy);
+        usleep(ANIMATION_DELAY);
     }
+}
 
-    int y_pos = 75;
-    int category_index = 0;
-
-    for (int i = 0; i < app_launcher.category_count; i++) {
-        AppCategory *cat = &app_launcher.categories[i];
-        if (cat->app_count == 0) continue;
+void draw_glow_button(Surface *s, int x, int y, int size, unsigned long color, int hover) {
+    if (hover) {
+        // Enhanced glow with multiple layers
+        for (int i = 3; i > 0; i--) {
+            int alpha = 120 - (i * 30);
+            // Simulate alpha by blending with background
+            int r = (color >> 16) & 0xFF;
+            int g = (color >> 8) & 0xFF;
+            int b = color & 0xFF;
 
-        debug_log("  Checking category %s at y_pos=%d", cat->category_name, y_pos);
+            // Blend with dark background
+            r = (r * alpha + 0x2D * (255 - alpha)) / 255;
+            g = (g * alpha + 0x2D * (255 - alpha)) / 255;
+            b = (b * alpha + 0x2D * (255 - alpha)) / 255;
 
-        if (relative_y >= y_pos && relative_y <= y_pos + 20) {
-            debug_log("  -> Clicked category %d: %s", category_index, cat->category_name);
-            return category_index << 16;
+            unsigned long glow_color = (r << 16) | (g << 8) | b;
+            s->backend->fill_ellipse(s, x - i, y - i, size + 2*i, size + 2*i, glow_color);
         }
-        y_pos += 25;
+    }
 
-        if (cat->expanded) {
-            for (int j = 0; j < cat->app_count; j++) {
-                debug_log("    Checking app %s at y_pos=%d", cat->apps[j].name, y_pos);
-                if (relative_y >= y_pos && relative_y <= y_pos + 20) {
-                    debug_log("    -> Clicked app %d in category %d", j, category_index);
-                    return (category_index << 16) | (j + 1);
-                }
-                y_pos += 20;
-            }
-        }
+    // Main button
+    XPoint diamond[] = {
+        {x + size/2, y},
+        {x + size, y + size/2},
+        {x + size/2, y + size},
+        {x, y + size/2}
+    };
+    s->backend->fill_polygon(s, diamond, 4, color);
 
-        y_pos += 5;
-        category_index++;
+    // Inner highlight for 3D effect
+    if (hover) {
+        s->backend->draw_line(s, x + size/2, y + 1, x + size - 1, y + size/2, white);
+    }
+}
+
+void update_button_hover(Client *c, int x, int y) {
+    int old_hover = c->button_hover;
+    c->button_hover = 0;
 
-        if (y_pos > app_launcher.height - 20) break;
+    if (is_in_close_button(c, x, y)) {
+        c->button_hover = 1;
+    } else if (is_in_minimize_button(c, x, y)) {
+        c->button_hover = 2;
+    } else if (is_in_maximize_button(c, x, y)) {
+        c->button_hover = 3;
     }
 
-    debug_log("  -> No item found at relative_y=%d", relative_y);
-    return -1;
+    // Only redraw if hover state actually changed
+    if (old_hover != c->button_hover) {
+        draw_window_decorations(c);
+    }
 }
 
-void handle_app_launcher_click(int x, int y) {
-    int item = get_app_launcher_item_at(x, y);
+int is_window_visible(Client *c) {
+    if (!c) return 0;
 
-    debug_log("App launcher click: item=0x%x at %d,%d", item, x, y);
+    int screen_width = DisplayWidth(dpy, screen);
+    int screen_height = DisplayHeight(dpy, screen);
 
-    if (item == -1) {
-        hide_app_launcher();
-        return;
+    if (c->x >= screen_width || c->y >= screen_height) {
+        return 0;
     }
 
-    if (item == -2) {
-        // Clicked search area - toggle search mode
-        app_launcher.search_mode = !app_launcher.search_mode;
-        if (app_launcher.search_mode) {
-            show_operation_feedback("Search mode activated - type to search");
-        }
-        draw_app_launcher();
-        return;
+    if (c->x + c->width <= 0 || c->y + c->height <= 0) {
+        return 0;
     }
 
-    if (item < 0x10000) {
-        int cat_index = item;
-        int actual_cat_index = -1;
-        int count = 0;
+    return 1;
+}
 
-        for (int i = 0; i < app_launcher.category_count; i++) {
-            if (app_launcher.categories[i].app_count > 0) {
-                if (count == cat_index) {
-                    actual_cat_index = i;
-                    break;
-                }
-                count++;
-            }
-        }
+void draw_diamond_icon(Surface *s, int x, int y, int size) {
+    int center_x = x + size / 2;
+    int center_y = y + size / 2;
+    float scale_factor = size / 32.0f; // Scale based on original 32px design
 
-        if (actual_cat_index != -1) {
-            app_launcher.categories[actual_cat_index].expanded =
-                !app_launcher.categories[actual_cat_index].expanded;
-            debug_log("Toggled category %s (index %d, expanded=%d)",
-                     app_launcher.categories[actual_cat_index].category_name,
-                     actual_cat_index, app_launcher.categories[actual_cat_index].expanded);
-            draw_app_launcher();
-        } else {
-            debug_log("ERROR: Could not find category for index %d", cat_index);
-        }
-    } else {
-        int cat_index = (item >> 16) & 0xFFFF;
-        int app_index = (item & 0xFFFF) - 1;
+    // 1. Outer glow effect (multi-layered aurora)
+    for (int i = 6; i > 0; i--) {
+        float alpha = (float)i / 6.0f;
+        int glow_offset = (int)(i * 2 * scale_factor);
 
-        debug_log("App clicked: category=%d, app=%d", cat_index, app_index);
+        // Aurora effect - purple to blue gradient
+        int r = (int)(138 * alpha + (66 * (1 - alpha)));
+        int g = (int)(43 * alpha + (92 * (1 - alpha)));
+        int b = (int)(226 * alpha + (231 * (1 - alpha)));
+        unsigned long glow_color = (r << 16) | (g << 8) | b;
 
-        int actual_cat_index = -1;
-        int count = 0;
-        for (int i = 0; i < app_launcher.category_count; i++) {
-            if (app_launcher.categories[i].app_count > 0) {
-                if (count == cat_index) {
-                    actual_cat_index = i;
-                    break;
-                }
-                count++;
-            }
+        XPoint glow[] = {
+            {center_x, y - glow_offset},
+            {x + size + glow_offset, center_y},
+            {center_x, y + size + glow_offset},
+            {x - glow_offset, center_y}
+        };
+        for (int j = 0; j < 3; j++) {
+            s->backend->draw_line(s, glow[j].x, glow[j].y, glow[j + 1].x, glow[j + 1].y, glow_color);
         }
+    }
 
-        if (actual_cat_index != -1 &&
-            app_index >= 0 &&
-            app_index < app_launcher.categories[actual_cat_index].app_count) {
+    // 2. Main diamond body with gradient facets
+    // Pavilion (bottom part - darker base)
+    int pav_offset = (int)(6 * scale_factor);
+    XPoint pavilion[] = {
+        {center_x, center_y + (int)(3 * scale_factor)},
+        {x + size - pav_offset, center_y},
+        {center_x, y + size},
+        {x + pav_offset, center_y}
+    };
+    s->backend->fill_polygon(s, pavilion, 4, 0x5D3BA8); // Deep purple
 
-            AppInfo *app = &app_launcher.categories[actual_cat_index].apps[app_index];
-            debug_log("Launching: %s -> %s", app->name, app->exec);
+    // 3. Crown facets (upper part with highlights)
+    // Left facet
+    int crown_height = (int)(10 * scale_factor);
+    XPoint left_facet[] = {
+        {center_x, y + crown_height},
+        {x + pav_offset, center_y},
+        {center_x, center_y + (int)(3 * scale_factor)}
+    };
+    s->backend->fill_polygon(s, left_facet, 3, 0x7C3AED); // Medium purple
 
-            pid_t pid = fork();
-            if (pid == 0) {
-                setsid();
-                execl("/bin/sh", "sh", "-c", app->exec, NULL);
-                exit(0);
-            } else if (pid > 0) {
-                show_operation_feedback("Application launched");
-                hide_app_launcher();
-            } else {
-                debug_log("ERROR: Failed to fork for application launch");
-                show_operation_feedback("Failed to launch application");
-            }
-        } else {
-            debug_log("ERROR: Invalid app selection: cat_index=%d, actual_cat_index=%d, app_index=%d",
-                     cat_index, actual_cat_index, app_index);
-        }
+    // Right facet (highlight area)
+    XPoint right_facet[] = {
+        {center_x, y + crown_height},
+        {center_x, center_y + (int)(3 * scale_factor)},
+        {x + size - pav_offset, center_y}
+    };
+    s->backend->fill_polygon(s, right_facet, 3, 0x9D7BF5); // Light purple highlight
+
+    // 4. Table (top flat surface)
+    int table_width = (int)(8 * scale_factor);
+    int table_height = (int)(3 * scale_factor);
+    XPoint table[] = {
+        {center_x - table_width, y + crown_height},
+        {center_x + table_width, y + crown_height},
+        {center_x + table_width - (int)(2 * scale_factor), center_y - table_height},
+        {center_x - table_width + (int)(2 * scale_factor), center_y - table_height}
+    };
+    s->backend->fill_polygon(s, table, 4, 0xA78BFA); // Lightest purple
+
+    // 5. Sparkle highlights (realistic light reflection)
+    // Main sparkle
+    int sparkle_size = (int)(3 * scale_factor);
+    if (sparkle_size > 0) {
+        s->backend->fill_ellipse(s, center_x - sparkle_size/2, y + (int)(8 * scale_factor),
+                                 sparkle_size, sparkle_size, 0xFFFFFF); // Pure white
     }
-}
+    // Secondary sparkles
+    s->backend->fill_rect(s, center_x + (int)(5 * scale_factor), y + (int)(12 * scale_factor), 1, 1, 0xFFFFFF);
+    s->backend->fill_rect(s, center_x - (int)(4 * scale_factor), center_y - (int)(2 * scale_factor), 1, 1, 0xFFFFFF);
 
-void free_applications() {
-    for (int i = 0; i < app_launcher.category_count; i++) {
-        AppCategory *cat = &app_launcher.categories[i];
+    // 6. Edge highlights for 3D depth
+    s->backend->draw_line(s, center_x, y + crown_height,
+                          center_x + table_width, y + crown_height, 0xE9D5FF); // Top edge
+    s->backend->draw_line(s, center_x + table_width, y + crown_height,
+                          center_x + table_width - (int)(2 * scale_factor), center_y - table_height,
+                          0xE9D5FF); // Right-top edge
 
-        free(cat->category_name);
+    // 7. Pavilion shadow for depth
+    s->backend->draw_line(s,
+                          center_x - (int)(4 * scale_factor), y + size - (int)(2 * scale_factor),
+                          center_x + (int)(4 * scale_factor), y + size - (int)(2 * scale_factor),
+                          0x4C2889); // Dark purple shadow
+}
 
-        for (int j = 0; j < cat->app_count; j++) {
-            free(cat->apps[j].name);
-            free(cat->apps[j].exec);
-            free(cat->apps[j].categories);
-            if (cat->apps[j].comment) free(cat->apps[j].comment);
-            if (cat->apps[j].icon) free(cat->apps[j].icon);
+// Derive a clip mask for artwork drawn over black on the core backend. The
+// logo and panel faces never use pure black, so every other pixel is theirs.
+Pixmap build_key_mask(Surface *s, int x, int y, int w, int h) {
+    surface_flush(s);
+    XImage *image = XGetImage(dpy, s->drawable, x, y, w, h, AllPlanes, ZPixmap);
+    if (!image) return None;
+
+    int stride = (w + 7) / 8;
+    char *bits = calloc(stride * h, 1);
+    if (bits) {
+        for (int py = 0; py < h; py++) {
+            for (int px = 0; px < w; px++) {
+                if (XGetPixel(image, px, py) != black) bits[py * stride + px / 8] |= 1 << (px % 8);
+            }
         }
-
-        if (cat->apps) free(cat->apps);
     }
+    XDestroyImage(image);
+    if (!bits) return None;
 
-    if (app_launcher.categories) free(app_launcher.categories);
+    Pixmap mask = XCreateBitmapFromData(dpy, root, bits, w, h);
+    free(bits);
+    return mask;
 }
 
-// Pinned Apps Functions Implementation
+LogoAsset *get_logo_asset(int size) {
+    for (int i = 0; i < logo_asset_count; i++) {
+        if (logo_assets[i].size == size) return &logo_assets[i];
+    }
+    if (logo_asset_count >= MAX_LOGO_ASSETS) return NULL;
 
-char* get_panel_config_path() {
-    static char path[512];
-    struct passwd *pw = getpwuid(getuid());
-    const char *home = pw ? pw->pw_dir : getenv("HOME");
+    LogoAsset *a = &logo_assets[logo_asset_count];
+    memset(a, 0, sizeof(*a));
+    a->size = size;
+    a->pad = (int)ceil(12 * size / 32.0) + 1;  // widest glow layer
+    int dim = size + 2 * a->pad;
 
-    snprintf(path, sizeof(path), "%s/.diamondwm/pinned_apps.conf", home);
-    return path;
-}
+    if (renderer->argb_surfaces) {
+        if (!surface_init_argb(&a->surface, dim, dim)) return NULL;
+    } else {
+        Pixmap pixmap = XCreatePixmap(dpy, root, dim, dim, DefaultDepth(dpy, screen));
+        if (!surface_init(&a->surface, pixmap, 0, dim, dim, black)) {
+            XFreePixmap(dpy, pixmap);
+            return NULL;
+        }
+    }
 
-void ensure_config_dir() {
-    struct passwd *pw = getpwuid(getuid());
-    const char *home = pw ? pw->pw_dir : getenv("HOME");
-    char dir_path[512];
+    a->surface.backend->clear(&a->surface);
+    draw_diamond_icon(&a->surface, a->pad, a->pad, size);
+    if (!a->surface.argb) a->mask = build_key_mask(&a->surface, 0, 0, dim, dim);
 
-    snprintf(dir_path, sizeof(dir_path), "%s/.diamondwm", home);
-    mkdir(dir_path, 0755);
+    logo_asset_count++;
+    debug_log("Cached %dpx diamond logo (%dx%d pixmap)", size, dim, dim);
+    return a;
 }
 
-void save_pinned_apps() {
-    ensure_config_dir();
-    FILE *file = fopen(get_panel_config_path(), "w");
-    if (!file) {
-        debug_log("ERROR: Could not save pinned apps to %s", get_panel_config_path());
+// Same footprint as draw_diamond_icon, but a single blit after the first call
+void draw_logo(Surface *s, int x, int y, int size) {
+    LogoAsset *a = get_logo_asset(size);
+    if (!a) {
+        draw_diamond_icon(s, x, y, size);
         return;
     }
 
-    for (int i = 0; i < pinned_apps.app_count; i++) {
-        fprintf(file, "%s|%s|%s\n",
-                pinned_apps.apps[i].name ? pinned_apps.apps[i].name : "",
-                pinned_apps.apps[i].exec ? pinned_apps.apps[i].exec : "",
-                pinned_apps.apps[i].icon_path ? pinned_apps.apps[i].icon_path : "");
-
-        debug_log("Saved pinned app: %s -> %s",
-                 pinned_apps.apps[i].name ? pinned_apps.apps[i].name : "NULL",
-                 pinned_apps.apps[i].exec ? pinned_apps.apps[i].exec : "NULL");
+    int dim = a->surface.width;
+    if (a->mask) {
+        blit_masked(s, &a->surface, a->mask, 0, 0, dim, dim, x - a->pad, y - a->pad);
+    } else {
+        s->backend->blit(s, &a->surface, 0, 0, dim, dim, x - a->pad, y - a->pad);
     }
+}
 
-    fclose(file);
-    debug_log("Saved %d pinned apps to %s", pinned_apps.app_count, get_panel_config_path());
+void free_logo_assets() {
+    for (int i = 0; i < logo_asset_count; i++) {
+        Pixmap pixmap = logo_assets[i].surface.drawable;
+        surface_free(&logo_assets[i].surface);
+        if (pixmap) XFreePixmap(dpy, pixmap);
+        if (logo_assets[i].mask) {
+            gc_pool_forget_clip(logo_assets[i].mask);
+            XFreePixmap(dpy, logo_assets[i].mask);
+        }
+    }
+    logo_asset_count = 0;
 }
 
-void load_pinned_apps() {
-    FILE *file = fopen(get_panel_config_path(), "r");
-    if (!file) {
-        debug_log("No pinned apps config found at %s", get_panel_config_path());
-        return;
-    }
-
-    char line[1024];
-    while (fgets(line, sizeof(line), file)) {
-        line[strcspn(line, "\n")] = 0;
-
-        // Skip empty lines
-        if (strlen(line) == 0) continue;
+// ---- Icon service ----
+//
+// Resolves Icon= values (theme names or absolute paths) through the XDG icon
+// theme directories and decodes PNG and XPM files on worker threads, so the
+// main thread never waits for the disk. The first worker builds a
+// name-to-path index of the theme directories, or loads the one saved in
+// ~/.cache/diamondwm/icons.index if no theme directory has changed since;
+// lookups after that are a hash probe. Scaled icons are kept in
+// ~/.cache/diamondwm/icons.cache, found through a hash table of source path
+// and size stored in the file, and valid while the source's mtime and file
+// size are unchanged. The file is mmap'ed at start, so on a warm start no
+// icon is decoded at all.
+
+#define ICON_WORKERS 2
+#define ICON_INDEX_MIN 1024         // slots; power of two
+#define ICON_INDEX_MAGIC "DWMINDEX1"
+#define ICON_PREFERRED_SOURCE 32    // smallest theme size that scales down well
+#define ICON_CACHE_MAGIC "DWMICON2"
+
+enum { ICON_PENDING, ICON_READY, ICON_MISSING };
+
+typedef struct IconEntry {
+    char *name;                 // Icon= value as given
+    int size;
+    int state;
+    unsigned int *pixels;       // size x size premultiplied ARGB
+    int mapped;                 // pixels live in the cache mapping
+    char path[256];             // resolved source file, for the cache
+    long long mtime, file_size;
+    unsigned int hash;          // of name and size, see icon_entry_hash
+    struct IconEntry *next_job;
+    struct IconEntry *hash_next;
+} IconEntry;
 
-        debug_log("Reading pinned app line: '%s'", line);
-
-        char *name = strtok(line, "|");
-        char *exec = strtok(NULL, "|");
-        char *icon_path = strtok(NULL, "|");
+typedef struct {
+    char *name;
+    char *path;
+    int score;                  // lower is a better source
+} IconIndexSlot;
 
-        debug_log("Parsed: name='%s', exec='%s', icon_path='%s'",
-                 name ? name : "NULL",
-                 exec ? exec : "NULL",
-                 icon_path ? icon_path : "NULL");
+typedef struct {
+    char *path;
+    long long mtime;            // nanoseconds, -1 if missing
+} IconIndexDir;
 
-        if (name && strlen(name) > 0) {
-            // Add to pinned apps
-            if (pinned_apps.app_count >= pinned_apps.max_apps) {
-                pinned_apps.max_apps += 10;
-                pinned_apps.apps = realloc(pinned_apps.apps, sizeof(PinnedApp) * pinned_apps.max_apps);
-            }
+// On-disk cache: header, hash table, records, then the pixels of every record
+typedef struct {
+    char magic[8];
+    unsigned int count;
+    unsigned int table_size;    // power of two, at least twice count
+} IconCacheHeader;
 
-            PinnedApp *app = &pinned_apps.apps[pinned_apps.app_count++];
-            app->name = strdup(name);
+typedef struct {
+    char path[256];
+    long long mtime, file_size;
+    unsigned int size;
+    unsigned int offset;        // of the pixels, from the start of the file
+    unsigned int hash;          // icon_cache_hash of path and size
+    unsigned int reserved;
+} IconCacheRecord;
+
+// What icon_cache_write stores: an icon decoded now or one carried over
+typedef struct {
+    const char *path;
+    long long mtime, file_size;
+    unsigned int size;
+    unsigned int hash;
+    const unsigned int *pixels;
+} IconCacheItem;
+
+struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t workers[ICON_WORKERS];
+    int worker_count;
+    int started, stopping;
+    IconEntry **entries;
+    int entry_count, entry_capacity;
+    IconEntry **buckets;        // entry_capacity of them, by icon_entry_hash
+    IconEntry *queue, *queue_tail;
+    int busy;
+    int arrived;                // icons became ready since the last poll
+    int dirty;                  // decoded icons not yet in the disk cache
+    int writing;
+    IconIndexSlot *index;       // open addressing, index_size slots
+    int index_size, index_count;
+    IconIndexDir *dirs;         // scanned while building the index
+    int dir_count, dir_capacity;
+    const unsigned char *cache_map;
+    size_t cache_map_size;
+} icons = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+pthread_once_t icon_index_once = PTHREAD_ONCE_INIT;
+
+// Load a PNG as straight RGBA bytes; caller frees
+unsigned char *read_png(const char *path, int *width, int *height) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png ? png_create_info_struct(png) : NULL;
+    unsigned char *volatile data = NULL;
+    if (!png || !info || setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, &info, NULL);
+        free(data);
+        fclose(file);
+        return NULL;
+    }
 
-            // If exec is empty, try to guess it from the name
-            if (exec && strlen(exec) > 0) {
-                app->exec = strdup(exec);
-            } else {
-                // Guess the command from the app name
-                if (strstr(name, "Firefox") || strstr(name, "Mozilla")) {
-                    app->exec = strdup("firefox");
-                } else if (strstr(name, "Pulsar")) {
-                    app->exec = strdup("pulsar");
-                } else if (strstr(name, "xterm") || strstr(name, "XTerm")) {
-                    app->exec = strdup("xterm");
-                } else if (strstr(name, "Terminal")) {
-                    app->exec = strdup("xterm");
-                } else {
-                    // Fallback: use the name in lowercase
-                    app->exec = malloc(strlen(name) + 1);
-                    if (app->exec) {
-                        strcpy(app->exec, name);
-                        // Convert to lowercase and remove spaces
-                        for (char *p = app->exec; *p; p++) {
-                            *p = tolower(*p);
-                            if (*p == ' ') *p = '-';
-                        }
-                    }
-                }
-                debug_log("Guessed exec for '%s': %s", name, app->exec);
+    png_init_io(png, file);
+    png_read_info(png, info);
+
+    // Normalise whatever is on disk to 8-bit RGBA
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_gray_to_rgb(png);
+    png_set_add_alpha(png, 0xFF, PNG_FILLER_AFTER);
+    // Adam7 images need every row read once per pass
+    int passes = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+
+    *width = png_get_image_width(png, info);
+    *height = png_get_image_height(png, info);
+    data = malloc((size_t)4 * *width * *height);
+    if (data) {
+        for (int pass = 0; pass < passes; pass++) {
+            for (int y = 0; y < *height; y++) {
+                png_read_row(png, data + (size_t)4 * y * *width, NULL);
             }
-
-            app->icon_path = icon_path ? strdup(icon_path) : NULL;
-            app->icon_win = 0;
-            app->x_position = 0;
-
-            debug_log("Loaded pinned app: '%s' -> '%s'", name, app->exec);
         }
+        png_read_end(png, NULL);
     }
 
+    png_destroy_read_struct(&png, &info, NULL);
     fclose(file);
-    debug_log("Loaded %d pinned apps total", pinned_apps.app_count);
+    return data;
 }
 
+// XPM colour value to straight RGBA; only the forms icons actually use
+unsigned int xpm_color(const char *value) {
+    static const struct { const char *name; unsigned int rgb; } names[] = {
+        {"black", 0x000000}, {"white", 0xFFFFFF}, {"red", 0xFF0000},
+        {"green", 0x00FF00}, {"blue", 0x0000FF}, {"yellow", 0xFFFF00},
+        {"gray", 0xBEBEBE}, {"grey", 0xBEBEBE}
+    };
 
-int is_app_pinned(Client *c) {
-    if (!c || !c->title) return 0;
-
-    for (int i = 0; i < pinned_apps.app_count; i++) {
-        if (pinned_apps.apps[i].name && strcmp(pinned_apps.apps[i].name, c->title) == 0) {
-            return 1;
+    if (strcasecmp(value, "none") == 0) return 0;
+    if (value[0] == '#') {
+        unsigned long v = strtoul(value + 1, NULL, 16);
+        int digits = strspn(value + 1, "0123456789abcdefABCDEF");
+        if (digits == 12) {
+            v = ((v >> 40) & 0xFF) << 16 | ((v >> 24) & 0xFF) << 8 | ((v >> 8) & 0xFF);
+        } else if (digits == 3) {
+            v = ((v >> 8) & 0xF) * 0x110000 | ((v >> 4) & 0xF) * 0x1100 | (v & 0xF) * 0x11;
         }
+        return (unsigned int)(v & 0xFFFFFF) << 8 | 0xFF;
     }
-    return 0;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcasecmp(value, names[i].name) == 0) return names[i].rgb << 8 | 0xFF;
+    }
+    return 0x808080FF;
 }
 
-void pin_app_to_panel(Client *c) {
-    if (!c || !c->title || is_app_pinned(c)) {
-        debug_log("App already pinned or invalid client");
-        return;
-    }
+// Load an XPM3 file as straight RGBA bytes; caller frees
+unsigned char *read_xpm(const char *path, int *width, int *height) {
+    FILE *file = fopen(path, "r");
+    if (!file) return NULL;
 
-    // Try to get the executable command from the window
-    char *exec_cmd = NULL;
+    // Every quoted string in order: values, colours, then pixel rows
+    char **strings = NULL;
+    int count = 0, capacity = 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), file)) {
+        char *start = strchr(line, '"');
+        if (!start) continue;
+        char *end = strchr(start + 1, '"');
+        if (!end) continue;
+        *end = '\0';
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = realloc(strings, sizeof(char *) * capacity);
+            if (!grown) break;
+            strings = grown;
+        }
+        strings[count++] = strdup(start + 1);
+    }
+    fclose(file);
 
-    // Method 1: Try to get _NET_WM_PID and then get command from /proc
-    Atom net_wm_pid = XInternAtom(dpy, "_NET_WM_PID", False);
-    Atom type;
-    int format;
-    unsigned long nitems, bytes_after;
     unsigned char *data = NULL;
-
-    if (XGetWindowProperty(dpy, c->win, net_wm_pid, 0, 1, False,
-                          XA_CARDINAL, &type, &format, &nitems, &bytes_after, &data) == Success) {
-        if (data && nitems > 0) {
-            pid_t pid = *(pid_t*)data;
-            debug_log("Found PID for window: %d", pid);
-
-            // Try to get command from /proc
-            char proc_path[256];
-            snprintf(proc_path, sizeof(proc_path), "/proc/%d/cmdline", pid);
-            FILE *proc_file = fopen(proc_path, "r");
-            if (proc_file) {
-                char cmdline[1024];
-                if (fgets(cmdline, sizeof(cmdline), proc_file)) {
-                    // cmdline is null-separated, get the first part (executable name)
-                    exec_cmd = strdup(cmdline);
-                    // Extract just the basename
-                    char *basename = strrchr(exec_cmd, '/');
-                    if (basename) {
-                        basename++; // Skip the '/'
-                        free(exec_cmd);
-                        exec_cmd = strdup(basename);
-                    }
-                    debug_log("Found command from PID: %s", exec_cmd);
+    int w, h, ncolors, cpp;
+    if (count > 0 && sscanf(strings[0], "%d %d %d %d", &w, &h, &ncolors, &cpp) == 4 &&
+        w > 0 && h > 0 && ncolors > 0 && cpp > 0 && cpp <= 4 && count >= 1 + ncolors + h) {
+        unsigned int *colors = calloc(ncolors, sizeof(unsigned int));
+        data = colors ? calloc((size_t)4 * w * h, 1) : NULL;
+
+        for (int i = 0; data && i < ncolors; i++) {
+            // "<chars> c <value>" among other visual keys
+            char *spec = strings[1 + i];
+            if ((int)strlen(spec) < cpp) continue;
+            char *saveptr = NULL;
+            for (char *key = strtok_r(spec + cpp, " \t", &saveptr); key;
+                 key = strtok_r(NULL, " \t", &saveptr)) {
+                if (strcmp(key, "c") == 0) {
+                    char *value = strtok_r(NULL, " \t", &saveptr);
+                    if (value) colors[i] = xpm_color(value);
+                    break;
                 }
-                fclose(proc_file);
             }
-            XFree(data);
         }
-    }
 
-    // Method 2: If we couldn't get from PID, try to guess from window title
-    if (!exec_cmd) {
-        // Common application mappings
-        if (strstr(c->title, "Firefox") || strstr(c->title, "Mozilla")) {
-            exec_cmd = strdup("firefox");
-        } else if (strstr(c->title, "Pulsar")) {
-            exec_cmd = strdup("pulsar");
-        } else if (strstr(c->title, "xterm") || strstr(c->title, "XTerm")) {
-            exec_cmd = strdup("xterm");
-        } else if (strstr(c->title, "Terminal")) {
-            exec_cmd = strdup("xterm");
-        } else {
-            // Fallback: use the title in lowercase as command
-            exec_cmd = malloc(strlen(c->title) + 1);
-            if (exec_cmd) {
-                strcpy(exec_cmd, c->title);
-                // Convert to lowercase and remove spaces
-                for (char *p = exec_cmd; *p; p++) {
-                    *p = tolower(*p);
-                    if (*p == ' ') *p = '-';
+        for (int y = 0; data && y < h; y++) {
+            const char *row = strings[1 + ncolors + y];
+            int row_length = strlen(row);
+            for (int x = 0; x < w && (x + 1) * cpp <= row_length; x++) {
+                const char *code = row + x * cpp;
+                for (int i = 0; i < ncolors; i++) {
+                    if (strncmp(strings[1 + i], code, cpp) == 0) {
+                        unsigned char *p = data + ((size_t)y * w + x) * 4;
+                        p[0] = colors[i] >> 24;
+                        p[1] = (colors[i] >> 16) & 0xFF;
+                        p[2] = (colors[i] >> 8) & 0xFF;
+                        p[3] = colors[i] & 0xFF;
+                        break;
+                    }
                 }
             }
         }
-        debug_log("Guessed command from title: %s", exec_cmd);
+        free(colors);
+        *width = w;
+        *height = h;
     }
 
-    // Method 3: If all else fails, use a safe default
-    if (!exec_cmd) {
-        exec_cmd = strdup(c->title);
-        debug_log("Using title as fallback command: %s", exec_cmd);
-    }
+    for (int i = 0; i < count; i++) free(strings[i]);
+    free(strings);
+    return data;
+}
 
-    // Add to pinned apps
-    if (pinned_apps.app_count >= pinned_apps.max_apps) {
-        pinned_apps.max_apps += 10;
-        pinned_apps.apps = realloc(pinned_apps.apps, sizeof(PinnedApp) * pinned_apps.max_apps);
+// Box filter a straight RGBA image into a size x size premultiplied icon,
+// keeping its aspect ratio; caller frees. Both passes are plain integer sums
+// over contiguous rows, which the compiler vectorizes.
+unsigned int *scale_icon(const unsigned char *rgba, int width, int height, int size) {
+    unsigned int *icon = calloc((size_t)size * size, sizeof(unsigned int));
+    if (!icon || width <= 0 || height <= 0) return icon;
+
+    int longest = width > height ? width : height;
+    int out_w = (width * size + longest / 2) / longest;
+    int out_h = (height * size + longest / 2) / longest;
+    if (out_w < 1) out_w = 1;
+    if (out_h < 1) out_h = 1;
+    int off_x = (size - out_w) / 2, off_y = (size - out_h) / 2;
+
+    // Horizontal pass: premultiplied channel sums per output column
+    unsigned int *rows = calloc((size_t)height * out_w * 4, sizeof(unsigned int));
+    unsigned int *sums = calloc((size_t)out_w * 4, sizeof(unsigned int));
+    int *span_x = malloc(sizeof(int) * out_w);
+    if (!rows || !sums || !span_x) {
+        free(rows);
+        free(sums);
+        free(span_x);
+        return icon;
     }
 
-    PinnedApp *app = &pinned_apps.apps[pinned_apps.app_count++];
-    app->name = strdup(c->title);
-    app->exec = exec_cmd;
-    app->icon_path = NULL;
-    app->icon_win = 0;
-    app->x_position = 0;
+    for (int y = 0; y < height; y++) {
+        const unsigned char *src = rgba + (size_t)y * width * 4;
+        unsigned int *dst = rows + (size_t)y * out_w * 4;
+        for (int ox = 0; ox < out_w; ox++) {
+            int x0 = ox * width / out_w, x1 = (ox + 1) * width / out_w;
+            if (x1 <= x0) x1 = x0 + 1;
+            span_x[ox] = x1 - x0;
+            for (int x = x0; x < x1; x++) {
+                const unsigned char *p = src + x * 4;
+                dst[ox * 4] += p[0] * p[3];
+                dst[ox * 4 + 1] += p[1] * p[3];
+                dst[ox * 4 + 2] += p[2] * p[3];
+                dst[ox * 4 + 3] += p[3];
+            }
+        }
+    }
 
-    // Save to config
-    save_pinned_apps();
+    // Vertical pass: add up the rows covered by each output row
+    for (int oy = 0; oy < out_h; oy++) {
+        int y0 = oy * height / out_h, y1 = (oy + 1) * height / out_h;
+        if (y1 <= y0) y1 = y0 + 1;
+        memset(sums, 0, sizeof(unsigned int) * out_w * 4);
+        for (int y = y0; y < y1; y++) {
+            const unsigned int *row = rows + (size_t)y * out_w * 4;
+            for (int i = 0; i < out_w * 4; i++) sums[i] += row[i];
+        }
 
-    // Redraw panel to show new pinned app
-    draw_panel();
+        unsigned int *out = icon + (off_y + oy) * size + off_x;
+        for (int ox = 0; ox < out_w; ox++) {
+            unsigned int n = span_x[ox] * (y1 - y0);
+            unsigned int r = sums[ox * 4] / (255 * n);
+            unsigned int g = sums[ox * 4 + 1] / (255 * n);
+            unsigned int b = sums[ox * 4 + 2] / (255 * n);
+            unsigned int a = sums[ox * 4 + 3] / n;
+            out[ox] = a << 24 | r << 16 | g << 8 | b;
+        }
+    }
 
-    debug_log("Pinned app to panel: %s -> %s", c->title, exec_cmd);
+    free(rows);
+    free(sums);
+    free(span_x);
+    return icon;
 }
 
-void unpin_app(PinnedApp *app) {
-    // Find and remove the app
-    for (int i = 0; i < pinned_apps.app_count; i++) {
-        if (&pinned_apps.apps[i] == app) {
-            debug_log("Unpinning app at index %d: %s", i, app->name);
+unsigned int icon_name_hash(const char *name) {
+    unsigned int hash = 2166136261u;  // FNV-1a
+    for (; *name; name++) hash = (hash ^ (unsigned char)*name) * 16777619u;
+    return hash;
+}
 
-            free(pinned_apps.apps[i].name);
-            free(pinned_apps.apps[i].exec);
-            free(pinned_apps.apps[i].icon_path);
+int icon_index_grow() {
+    int size = icons.index_size ? icons.index_size * 2 : ICON_INDEX_MIN;
+    IconIndexSlot *index = calloc(size, sizeof(IconIndexSlot));
+    if (!index) return 0;
+
+    for (int i = 0; i < icons.index_size; i++) {
+        IconIndexSlot *old = &icons.index[i];
+        if (!old->name) continue;
+        unsigned int slot = icon_name_hash(old->name) & (size - 1);
+        while (index[slot].name) slot = (slot + 1) & (size - 1);
+        index[slot] = *old;
+    }
+    free(icons.index);
+    icons.index = index;
+    icons.index_size = size;
+    return 1;
+}
 
-            // Shift remaining apps
-            for (int j = i; j < pinned_apps.app_count - 1; j++) {
-                pinned_apps.apps[j] = pinned_apps.apps[j + 1];
+// Keep the best-scoring file seen for an icon name
+void icon_index_put(const char *name, const char *path, int score) {
+    // Grow at three quarters full, so probes stay short and always end
+    if ((icons.index_count + 1) * 4 > icons.index_size * 3 && !icon_index_grow()) return;
+
+    unsigned int i = icon_name_hash(name) & (icons.index_size - 1);
+    for (;; i = (i + 1) & (icons.index_size - 1)) {
+        IconIndexSlot *slot = &icons.index[i];
+        if (!slot->name) {
+            slot->name = strdup(name);
+            slot->path = strdup(path);
+            slot->score = score;
+            icons.index_count++;
+            return;
+        }
+        if (strcmp(slot->name, name) == 0) {
+            if (score < slot->score) {
+                free(slot->path);
+                slot->path = strdup(path);
+                slot->score = score;
             }
-            pinned_apps.app_count--;
-
-            save_pinned_apps();
-            draw_panel();
-            debug_log("Unpinned app: %s, new count: %d", app->name, pinned_apps.app_count);
             return;
         }
     }
-    debug_log("ERROR: App not found for unpinning: %s", app->name);
 }
 
-int is_app_running(const char *app_name) {
-    for (int i = 0; i < client_count; i++) {
-        if (clients[i] && clients[i]->title &&
-            strstr(clients[i]->title, app_name) != NULL) {
-            return 1;
-        }
-    }
-    return 0;
-}
+void icon_index_add(const char *file, const char *path, int score) {
+    const char *ext = strrchr(file, '.');
+    if (!ext || (strcasecmp(ext, ".png") != 0 && strcasecmp(ext, ".xpm") != 0)) return;
 
-void create_pinned_app_menu() {
-    pinned_app_menu.width = MENU_WIDTH;
-    pinned_app_menu.height = MENU_ITEM_HEIGHT * 5;
-    pinned_app_menu.x = 0;
-    pinned_app_menu.y = 0;
-    pinned_app_menu.hover_item = -1;
-    pinned_app_menu.alpha = 0.0f;
-    pinned_app_menu.target_pinned_app = NULL;
+    char name[256];
+    int length = ext - file;
+    if (length <= 0 || length >= (int)sizeof(name)) return;
+    memcpy(name, file, length);
+    name[length] = '\0';
+    icon_index_put(name, path, score);
+}
 
-    pinned_app_menu.win = XCreateSimpleWindow(dpy, root,
-                                             pinned_app_menu.x,
-                                             pinned_app_menu.y,
-                                             pinned_app_menu.width,
-                                             pinned_app_menu.height,
-                                             0, white, dark_blue);
+void icon_index_free() {
+    for (int i = 0; i < icons.index_size; i++) {
+        free(icons.index[i].name);
+        free(icons.index[i].path);
+    }
+    free(icons.index);
+    icons.index = NULL;
+    icons.index_size = icons.index_count = 0;
+}
 
-    XSelectInput(dpy, pinned_app_menu.win, ButtonPressMask | ExposureMask | PointerMotionMask);
-    pinned_app_menu.visible = 0;
+// Modification time of a directory in nanoseconds, -1 if it is missing
+long long icon_dir_mtime(const char *dir) {
+    struct stat st;
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) return -1;
+    return (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
 }
 
-void show_pinned_app_menu(int x, int y, PinnedApp *app) {
-    if (!pinned_app_menu.visible && app) {
-        pinned_app_menu.target_pinned_app = app;
+// Every directory a scan looked at, so a saved index can be checked
+void icon_index_note_dir(const char *dir, long long mtime) {
+    if (icons.dir_count == icons.dir_capacity) {
+        int capacity = icons.dir_capacity ? icons.dir_capacity * 2 : 64;
+        IconIndexDir *grown = realloc(icons.dirs, sizeof(IconIndexDir) * capacity);
+        if (!grown) return;
+        icons.dirs = grown;
+        icons.dir_capacity = capacity;
+    }
+    icons.dirs[icons.dir_count].path = strdup(dir);
+    icons.dirs[icons.dir_count].mtime = mtime;
+    icons.dir_count++;
+}
 
-        // Position ABOVE the pinned app icon
-        pinned_app_menu.x = x;
-        pinned_app_menu.y = panel.y - pinned_app_menu.height - 5;
+// Theme directories nest <size>/<context> or <context>/<size>; the size is
+// whichever component reads as "48x48" or "48". Only directories are
+// stat'ed, and only when readdir can't tell what an entry is.
+void icon_index_scan(const char *dir, int depth, int size, int rank) {
+    long long mtime = icon_dir_mtime(dir);
+    icon_index_note_dir(dir, mtime);
+    DIR *d = mtime >= 0 ? opendir(dir) : NULL;
+    if (!d) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        if (entry->d_name[0] == '.') continue;
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
 
-        // Keep menu on screen horizontally
-        if (pinned_app_menu.x + pinned_app_menu.width > DisplayWidth(dpy, screen)) {
-            pinned_app_menu.x = DisplayWidth(dpy, screen) - pinned_app_menu.width;
+        int is_dir = entry->d_type == DT_DIR;
+        if (depth < 2 && (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)) {
+            struct stat st;
+            if (stat(path, &st) != 0) continue;
+            is_dir = S_ISDIR(st.st_mode);
         }
-        if (pinned_app_menu.x < 0) {
-            pinned_app_menu.x = 0;
+        if (is_dir) {
+            if (depth < 2) {
+                int n = atoi(entry->d_name);
+                icon_index_scan(path, depth + 1, n > 0 ? n : size, rank);
+            }
+        } else if (size > 0) {
+            // Prefer the smallest source at or above ICON_PREFERRED_SOURCE
+            int distance = size >= ICON_PREFERRED_SOURCE ? size - ICON_PREFERRED_SOURCE
+                                                         : (ICON_PREFERRED_SOURCE - size) * 4;
+            icon_index_add(entry->d_name, path, rank * 100000 + distance);
         }
+    }
+    closedir(d);
+}
 
-        XMoveWindow(dpy, pinned_app_menu.win, pinned_app_menu.x, pinned_app_menu.y);
-        XMapWindow(dpy, pinned_app_menu.win);
-        XRaiseWindow(dpy, pinned_app_menu.win);
-        pinned_app_menu.visible = 1;
-
-        // Fade-in animation
-        for (int i = 0; i <= 10; i++) {
-            pinned_app_menu.alpha = (float)i / 10.0f;
-            draw_pinned_app_menu();
-            XFlush(dpy);
-            usleep(10000);
+void icon_cache_path(char *path, size_t size, const char *file, int make_dir);
+
+// The saved index is a text file: the magic line, the scan roots, every
+// directory scanned with its mtime, then one line per icon name. It is
+// used only if the roots are the same and no directory has changed.
+int icon_index_load(const char *roots) {
+    char path[512];
+    icon_cache_path(path, sizeof(path), "icons.index", 0);
+    FILE *file = fopen(path, "r");
+    if (!file) return 0;
+
+    char line[2048];
+    int valid = fgets(line, sizeof(line), file) && strcmp(line, ICON_INDEX_MAGIC "\n") == 0;
+    size_t roots_length = strlen(roots);
+    char *saved_roots = malloc(roots_length + 1);
+    valid = valid && saved_roots && fread(saved_roots, 1, roots_length, file) == roots_length &&
+            memcmp(saved_roots, roots, roots_length) == 0;
+    free(saved_roots);
+
+    while (valid && fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = '\0';
+        char *saveptr = NULL;
+        char *kind = strtok_r(line, "\t", &saveptr);
+        char *value = strtok_r(NULL, "\t", &saveptr);
+        char *name = strtok_r(NULL, "\t", &saveptr);
+        char *rest = strtok_r(NULL, "\t", &saveptr);
+        if (!kind || !value || !name) {
+            valid = 0;
+        } else if (strcmp(kind, "D") == 0) {
+            valid = icon_dir_mtime(name) == atoll(value);
+        } else if (strcmp(kind, "I") == 0 && rest) {
+            icon_index_put(name, rest, atoi(value));
+        } else {
+            valid = 0;
         }
-
-        XGrabPointer(dpy, root, False, ButtonPressMask, GrabModeAsync,
-                    GrabModeAsync, None, None, CurrentTime);
     }
-}
+    fclose(file);
 
+    if (!valid) icon_index_free();
+    return valid;
+}
 
-void hide_pinned_app_menu() {
-    if (pinned_app_menu.visible) {
-        // Fade-out animation
-        for (int i = 10; i >= 0; i--) {
-            pinned_app_menu.alpha = (float)i / 10.0f;
-            draw_pinned_app_menu();
-            XFlush(dpy);
-            usleep(8000);
-        }
+// Written to a temporary file and renamed, like the icon cache
+void icon_index_save(const char *roots) {
+    char path[512], temp[520];
+    icon_cache_path(path, sizeof(path), "icons.index", 1);
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE *file = fopen(temp, "w");
+    if (!file) return;
+
+    fprintf(file, "%s\n%s", ICON_INDEX_MAGIC, roots);
+    int complete = 1;
+    for (int i = 0; i < icons.dir_count; i++) {
+        if (strpbrk(icons.dirs[i].path, "\t\n")) complete = 0;
+        fprintf(file, "D\t%lld\t%s\n", icons.dirs[i].mtime, icons.dirs[i].path);
+    }
+    for (int i = 0; i < icons.index_size; i++) {
+        IconIndexSlot *slot = &icons.index[i];
+        if (!slot->name) continue;
+        if (strpbrk(slot->name, "\t\n") || strpbrk(slot->path, "\t\n")) complete = 0;
+        fprintf(file, "I\t%d\t%s\t%s\n", slot->score, slot->name, slot->path);
+    }
 
-        XUnmapWindow(dpy, pinned_app_menu.win);
-        pinned_app_menu.visible = 0;
-        pinned_app_menu.hover_item = -1;
-        pinned_app_menu.target_pinned_app = NULL;
-        XUngrabPointer(dpy, CurrentTime);
+    // A name the format can't hold would be lost on the next start
+    if (fclose(file) == 0 && complete) {
+        rename(temp, path);
+        debug_log("Icon index: saved %d names from %d directories", icons.index_count, icons.dir_count);
+    } else {
+        unlink(temp);
     }
 }
 
-void draw_pinned_app_menu() {
-    if (!pinned_app_menu.visible) return;
+// Runs once, on the first worker that needs it
+void icon_index_build() {
+    const char *home = getenv("HOME");
+    const char *data_home = getenv("XDG_DATA_HOME");
+    const char *data_dirs = getenv("XDG_DATA_DIRS");
+    if (!data_dirs || !data_dirs[0]) data_dirs = "/usr/local/share:/usr/share";
+
+    // Search order of the icon theme spec
+    char bases[16][256];
+    int base_count = 0;
+    if (data_home && data_home[0]) {
+        snprintf(bases[base_count++], sizeof(bases[0]), "%s/icons", data_home);
+    } else if (home) {
+        snprintf(bases[base_count++], sizeof(bases[0]), "%s/.local/share/icons", home);
+    }
+    if (home) snprintf(bases[base_count++], sizeof(bases[0]), "%s/.icons", home);
+    char *dirs = strdup(data_dirs);
+    char *saveptr = NULL;
+    for (char *dir = dirs ? strtok_r(dirs, ":", &saveptr) : NULL; dir && base_count < 16;
+         dir = strtok_r(NULL, ":", &saveptr)) {
+        snprintf(bases[base_count++], sizeof(bases[0]), "%s/icons", dir);
+    }
+    free(dirs);
+
+    // The user's theme wins over hicolor, hicolor over loose pixmaps
+    const char *theme = getenv("DIAMONDWM_ICON_THEME");
+    const char *themes[2] = {theme && theme[0] ? theme : NULL, "hicolor"};
+    struct { char path[512]; int depth, size, rank; } scans[2 * 16 + 1];
+    int scan_count = 0;
+    for (int t = 0; t < 2; t++) {
+        if (!themes[t]) continue;
+        for (int b = 0; b < base_count; b++) {
+            snprintf(scans[scan_count].path, sizeof(scans[0].path), "%.255s/%.200s", bases[b], themes[t]);
+            scans[scan_count].depth = 0;
+            scans[scan_count].size = 0;
+            scans[scan_count].rank = t;
+            scan_count++;
+        }
+    }
+    snprintf(scans[scan_count].path, sizeof(scans[0].path), "/usr/share/pixmaps");
+    scans[scan_count].depth = 2;
+    scans[scan_count].size = ICON_PREFERRED_SOURCE;
+    scans[scan_count].rank = 2;
+    scan_count++;
+
+    // The roots, as they lead the saved index
+    char roots[sizeof(scans)];
+    size_t length = 0;
+    for (int i = 0; i < scan_count; i++) {
+        length += snprintf(roots + length, sizeof(roots) - length, "R\t%d\t%d\t%d\t%s\n",
+                           scans[i].depth, scans[i].size, scans[i].rank, scans[i].path);
+    }
 
-    XClearWindow(dpy, pinned_app_menu.win);
+    if (icon_index_load(roots)) {
+        debug_log("Icon index: %d names loaded", icons.index_count);
+        return;
+    }
+    for (int i = 0; i < scan_count; i++) {
+        icon_index_scan(scans[i].path, scans[i].depth, scans[i].size, scans[i].rank);
+    }
+    icon_index_save(roots);
 
-    // Draw rounded background with gradient
-    XSetForeground(dpy, menu_gc, menu_bg);
-    draw_rounded_rectangle(pinned_app_menu.win, menu_gc, 0, 0,
-                          pinned_app_menu.width, pinned_app_menu.height,
-                          CORNER_RADIUS);
+    for (int i = 0; i < icons.dir_count; i++) free(icons.dirs[i].path);
+    free(icons.dirs);
+    icons.dirs = NULL;
+    icons.dir_count = icons.dir_capacity = 0;
+}
 
-    // Draw subtle border
-    XSetForeground(dpy, menu_gc, accent_color);
-    XDrawRectangle(dpy, pinned_app_menu.win, menu_gc, 1, 1,
-                   pinned_app_menu.width - 3, pinned_app_menu.height - 3);
+const char *icon_index_lookup(const char *name) {
+    if (!icons.index) return NULL;
+    unsigned int i = icon_name_hash(name) & (icons.index_size - 1);
+    for (;; i = (i + 1) & (icons.index_size - 1)) {
+        if (!icons.index[i].name) return NULL;
+        if (strcmp(icons.index[i].name, name) == 0) return icons.index[i].path;
+    }
+}
 
-    // Check if app is already running and find its window
-    Client *target_client = NULL;
-    if (pinned_app_menu.target_pinned_app && pinned_app_menu.target_pinned_app->name) {
-        for (int i = 0; i < client_count; i++) {
-            if (clients[i] && clients[i]->title &&
-                strcmp(clients[i]->title, pinned_app_menu.target_pinned_app->name) == 0) {
-                target_client = clients[i];
-                break;
-            }
-        }
-    }
-
-    int is_running = (target_client != NULL);
-    char *items[5];
-
-    if (is_running) {
-        items[0] = "Show Windows";
-        items[1] = "Maximize";
-        items[2] = "Minimize";
-        items[3] = "Close";
-        items[4] = "Unpin from Panel";
+void icon_cache_path(char *path, size_t size, const char *file, int make_dir) {
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char dir[256];
+    if (cache_home && cache_home[0]) {
+        snprintf(dir, sizeof(dir), "%s/diamondwm", cache_home);
     } else {
-        items[0] = "Launch";
-        items[1] = ""; // Empty for non-running apps
-        items[2] = ""; // Empty for non-running apps
-        items[3] = ""; // Empty for non-running apps
-        items[4] = "Unpin from Panel";
+        snprintf(dir, sizeof(dir), "%s/.cache/diamondwm", home ? home : "/tmp");
+    }
+    if (make_dir) {
+        char parent[256];
+        snprintf(parent, sizeof(parent), "%s", dir);
+        char *slash = strrchr(parent, '/');
+        if (slash) {
+            *slash = '\0';
+            mkdir(parent, 0755);
+        }
+        mkdir(dir, 0755);
     }
+    snprintf(path, size, "%s/%s", dir, file);
+}
 
-    for (int i = 0; i < 5; i++) {
-        // Skip empty menu items for non-running apps
-        if (!is_running && (i == 1 || i == 2 || i == 3)) continue;
+unsigned int icon_cache_hash(const char *path, unsigned int size) {
+    return (icon_name_hash(path) ^ size) * 2654435761u;
+}
 
-        int y = i * MENU_ITEM_HEIGHT;
+// Table slots hold a record index plus one; zero is empty
+const unsigned int *icon_cache_table(const IconCacheHeader *header) {
+    return (const unsigned int *)(header + 1);
+}
 
-        // Hover effect
-        if (pinned_app_menu.hover_item == i) {
-            XSetForeground(dpy, menu_gc, menu_hover_bg);
-            draw_rounded_rectangle(pinned_app_menu.win, menu_gc, 2, y + 2,
-                                  pinned_app_menu.width - 4, MENU_ITEM_HEIGHT - 4, 4);
-        }
+const IconCacheRecord *icon_cache_records(const IconCacheHeader *header) {
+    return (const IconCacheRecord *)(icon_cache_table(header) + header->table_size);
+}
 
-        if (i > 0 && strlen(items[i]) > 0 && strlen(items[i-1]) > 0) {
-            XSetForeground(dpy, menu_gc, 0x404040);
-            XDrawLine(dpy, pinned_app_menu.win, menu_gc, 10, y,
-                     pinned_app_menu.width - 10, y);
+void icon_cache_map() {
+    char path[512];
+    icon_cache_path(path, sizeof(path), "icons.cache", 0);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(IconCacheHeader)) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            const IconCacheHeader *header = map;
+            size_t records_end = sizeof(IconCacheHeader) +
+                                 (size_t)header->table_size * sizeof(unsigned int) +
+                                 (size_t)header->count * sizeof(IconCacheRecord);
+            unsigned int table_size = header->table_size;
+            if (memcmp(header->magic, ICON_CACHE_MAGIC, 8) == 0 && records_end <= (size_t)st.st_size &&
+                table_size && (table_size & (table_size - 1)) == 0 && header->count < table_size) {
+                icons.cache_map = map;
+                icons.cache_map_size = st.st_size;
+                debug_log("Icon cache: %u icons mapped from %s", header->count, path);
+            } else {
+                munmap(map, st.st_size);
+            }
         }
-
-        XSetForeground(dpy, menu_gc, text_primary);
-        int text_width = XTextWidth(XLoadQueryFont(dpy, "fixed"), items[i], strlen(items[i]));
-        int text_x = (pinned_app_menu.width - text_width) / 2;
-        int text_y = y + (MENU_ITEM_HEIGHT / 2) + 5;
-
-        XDrawString(dpy, pinned_app_menu.win, menu_gc, text_x, text_y,
-                   items[i], strlen(items[i]));
     }
+    close(fd);
 }
 
-void free_pinned_apps() {
-    for (int i = 0; i < pinned_apps.app_count; i++) {
-        free(pinned_apps.apps[i].name);
-        free(pinned_apps.apps[i].exec);
-        free(pinned_apps.apps[i].icon_path);
+// The mapped record for path at size x size whatever its mtime, or NULL
+const IconCacheRecord *icon_cache_lookup(const char *path, int size) {
+    if (!icons.cache_map) return NULL;
+    const IconCacheHeader *header = (const IconCacheHeader *)icons.cache_map;
+    const unsigned int *table = icon_cache_table(header);
+    const IconCacheRecord *records = icon_cache_records(header);
+    unsigned int hash = icon_cache_hash(path, size);
+
+    // The table is never full, but a corrupt file could be: probe it once
+    unsigned int mask = header->table_size - 1;
+    for (unsigned int i = hash & mask, probes = 0; probes <= mask; i = (i + 1) & mask, probes++) {
+        unsigned int slot = table[i];
+        if (slot == 0) return NULL;
+        if (slot > header->count) continue;
+        const IconCacheRecord *r = &records[slot - 1];
+        // Never read past a record's path
+        if (r->hash == hash && r->size == (unsigned int)size && r->path[sizeof(r->path) - 1] == '\0' &&
+            strcmp(r->path, path) == 0) {
+            return r;
+        }
     }
-    free(pinned_apps.apps);
+    return NULL;
 }
 
-void create_panel() {
-    int screen_width = DisplayWidth(dpy, screen);
-    int screen_height = DisplayHeight(dpy, screen);
-
-    debug_log("Screen dimensions: %dx%d", screen_width, screen_height);
-
-    panel.width = screen_width;
-    panel.height = PANEL_HEIGHT;
-    panel.x = 0;
-    panel.y = screen_height - PANEL_HEIGHT;
-
-    panel.win = XCreateSimpleWindow(dpy, root, panel.x, panel.y,
-                                   panel.width, panel.height, 0,
-                                   dark_blue, dark_blue);
-    debug_log("Panel window created: %lu", panel.win);
-
-    XSelectInput(dpy, panel.win, ButtonPressMask | ButtonReleaseMask |
-                 PointerMotionMask | ExposureMask);
-    XMapWindow(dpy, panel.win);
-    debug_log("Panel window mapped");
+const unsigned int *icon_cache_pixels(const IconCacheRecord *r) {
+    size_t pixel_bytes = (size_t)r->size * r->size * sizeof(unsigned int);
+    if ((size_t)r->offset + pixel_bytes > icons.cache_map_size) return NULL;
+    return (const unsigned int *)(icons.cache_map + r->offset);
+}
 
-    XLowerWindow(dpy, panel.win);
-    debug_log("Panel lowered to bottom");
+// Pixels for an unchanged source file straight from the mapping, or NULL
+const unsigned int *icon_cache_find(const char *path, long long mtime, long long file_size, int size) {
+    const IconCacheRecord *r = icon_cache_lookup(path, size);
+    if (!r || r->mtime != mtime || r->file_size != file_size) return NULL;
+    return icon_cache_pixels(r);
 }
 
-void setup_mouse_cursor() {
-    debug_log("Setting up mouse cursor");
+// Rewrite the cache with every icon decoded so far, plus the mapped ones
+// not asked for this session whose source is unchanged. Written to a
+// temporary file and renamed, so the mapping in use stays valid.
+void icon_cache_write(IconEntry **ready, int count) {
+    const IconCacheHeader *old = (const IconCacheHeader *)icons.cache_map;
+    int old_count = old ? old->count : 0;
+    IconCacheItem *items = malloc(sizeof(IconCacheItem) * (count + old_count));
+    if (!items) return;
+
+    int item_count = 0;
+    for (int i = 0; i < count; i++) {
+        IconCacheItem *item = &items[item_count++];
+        item->path = ready[i]->path;
+        item->mtime = ready[i]->mtime;
+        item->file_size = ready[i]->file_size;
+        item->size = ready[i]->size;
+        item->pixels = ready[i]->pixels;
+    }
+    for (int i = 0; i < old_count; i++) {
+        const IconCacheRecord *r = &icon_cache_records(old)[i];
+        struct stat st;
+        if (r->path[sizeof(r->path) - 1] != '\0' || stat(r->path, &st) != 0 ||
+            st.st_mtime != r->mtime || st.st_size != r->file_size) {
+            continue;
+        }
+        const unsigned int *pixels = icon_cache_pixels(r);
+        if (!pixels) continue;
+        IconCacheItem *item = &items[item_count++];
+        item->path = r->path;
+        item->mtime = r->mtime;
+        item->file_size = r->file_size;
+        item->size = r->size;
+        item->pixels = pixels;
+    }
 
-    Cursor cursor = XCreateFontCursor(dpy, XC_left_ptr);
+    // Hash every item; an icon decoded now wins over its carried-over copy
+    unsigned int table_size = 16;
+    while (table_size < 2 * (unsigned int)item_count) table_size *= 2;
+    unsigned int *table = calloc(table_size, sizeof(unsigned int));
+    if (!table) {
+        free(items);
+        return;
+    }
+    int kept = 0;
+    for (int i = 0; i < item_count; i++) {
+        IconCacheItem *item = &items[i];
+        item->hash = icon_cache_hash(item->path, item->size);
+        unsigned int slot = item->hash & (table_size - 1);
+        int duplicate = 0;
+        for (; table[slot]; slot = (slot + 1) & (table_size - 1)) {
+            IconCacheItem *other = &items[table[slot] - 1];
+            if (other->hash == item->hash && other->size == item->size &&
+                strcmp(other->path, item->path) == 0) {
+                duplicate = 1;
+                break;
+            }
+        }
+        if (duplicate) continue;
+        items[kept] = *item;
+        table[slot] = ++kept;
+    }
 
-    XDefineCursor(dpy, root, cursor);
-    XDefineCursor(dpy, panel.win, cursor);
-    XDefineCursor(dpy, menu.win, cursor);
-    XDefineCursor(dpy, app_launcher.win, cursor);
-    XDefineCursor(dpy, window_control_menu.win, cursor);
-    XDefineCursor(dpy, pinned_app_menu.win, cursor);
+    char path[512], temp[520];
+    icon_cache_path(path, sizeof(path), "icons.cache", 1);
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE *file = fopen(temp, "wb");
+    if (!file) {
+        free(table);
+        free(items);
+        return;
+    }
 
-    debug_log("Mouse cursor initialization complete");
+    IconCacheHeader header;
+    memcpy(header.magic, ICON_CACHE_MAGIC, 8);
+    header.count = kept;
+    header.table_size = table_size;
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(table, sizeof(unsigned int), table_size, file);
+
+    unsigned int offset = sizeof(header) + table_size * sizeof(unsigned int) + kept * sizeof(IconCacheRecord);
+    for (int i = 0; i < kept; i++) {
+        IconCacheRecord r;
+        memset(&r, 0, sizeof(r));
+        snprintf(r.path, sizeof(r.path), "%s", items[i].path);
+        r.mtime = items[i].mtime;
+        r.file_size = items[i].file_size;
+        r.size = items[i].size;
+        r.offset = offset;
+        r.hash = items[i].hash;
+        fwrite(&r, sizeof(r), 1, file);
+        offset += items[i].size * items[i].size * sizeof(unsigned int);
+    }
+    for (int i = 0; i < kept; i++) {
+        fwrite(items[i].pixels, sizeof(unsigned int), items[i].size * items[i].size, file);
+    }
+    free(table);
+    free(items);
+
+    if (fclose(file) == 0) {
+        rename(temp, path);
+        debug_log("Icon cache: wrote %d icons", kept);
+    } else {
+        unlink(temp);
+    }
 }
 
-void draw_panel() {
-    XClearWindow(dpy, panel.win);
+// Resolve, then take the icon from the cache or decode it. Runs unlocked on
+// a worker; the entry is not visible to the main thread until it is READY.
+void icon_resolve(IconEntry *e) {
+    pthread_once(&icon_index_once, icon_index_build);
 
-    // Modern panel with gradient
-    draw_gradient_rect(panel.win, panel_gc, 0, 0, panel.width, panel.height,
-                      background_dark, background_light, 1);
+    const char *source = NULL;
+    if (e->name[0] == '/') {
+        source = e->name;
+    } else {
+        // Some desktop files give a file name instead of an icon name
+        char name[256];
+        snprintf(name, sizeof(name), "%s", e->name);
+        char *ext = strrchr(name, '.');
+        if (ext && (strcasecmp(ext, ".png") == 0 || strcasecmp(ext, ".xpm") == 0)) *ext = '\0';
+        source = icon_index_lookup(name);
+    }
 
-    int x = 10;
+    struct stat st;
+    if (!source || stat(source, &st) != 0) return;
+    snprintf(e->path, sizeof(e->path), "%s", source);
+    e->mtime = st.st_mtime;
+    e->file_size = st.st_size;
 
-    // Draw pinned apps first - FIXED VERSION
-    debug_log("Drawing %d pinned apps", pinned_apps.app_count);
-    for (int i = 0; i < pinned_apps.app_count; i++) {
-        if (!pinned_apps.apps[i].name) continue;
+    const unsigned int *cached = icon_cache_find(e->path, e->mtime, e->file_size, e->size);
+    if (cached) {
+        e->pixels = (unsigned int *)cached;
+        e->mapped = 1;
+        return;
+    }
 
-        pinned_apps.apps[i].x_position = x;
+    int width = 0, height = 0;
+    const char *ext = strrchr(source, '.');
+    unsigned char *rgba = ext && strcasecmp(ext, ".xpm") == 0 ? read_xpm(source, &width, &height)
+                                                              : read_png(source, &width, &height);
+    if (!rgba) return;
+    e->pixels = scale_icon(rgba, width, height, e->size);
+    free(rgba);
+}
 
-        // Check if app is running
-        int is_running = is_app_running(pinned_apps.apps[i].name);
+void *icon_worker(void *arg) {
+    pthread_mutex_lock(&icons.lock);
+    while (1) {
+        while (!icons.queue && !icons.stopping) pthread_cond_wait(&icons.wake, &icons.lock);
+        if (icons.stopping) break;
+
+        IconEntry *e = icons.queue;
+        icons.queue = e->next_job;
+        if (!icons.queue) icons.queue_tail = NULL;
+        icons.busy++;
+        pthread_mutex_unlock(&icons.lock);
+
+        icon_resolve(e);
+
+        pthread_mutex_lock(&icons.lock);
+        e->state = e->pixels ? ICON_READY : ICON_MISSING;
+        if (e->pixels && !e->mapped) icons.dirty = 1;
+        icons.arrived = 1;
+        icons.busy--;
+
+        // Persist once the queue runs dry, not after every icon
+        if (!icons.queue && !icons.busy && icons.dirty && !icons.writing) {
+            IconEntry **ready = malloc(sizeof(IconEntry *) * icons.entry_count);
+            int count = 0;
+            for (int i = 0; ready && i < icons.entry_count; i++) {
+                if (icons.entries[i]->state == ICON_READY) ready[count++] = icons.entries[i];
+            }
+            icons.dirty = 0;
+            icons.writing = 1;
+            pthread_mutex_unlock(&icons.lock);
+            if (ready) icon_cache_write(ready, count);
+            free(ready);
+            pthread_mutex_lock(&icons.lock);
+            icons.writing = 0;
+        }
+    }
+    pthread_mutex_unlock(&icons.lock);
+    return NULL;
+}
 
-        // Draw pinned app icon with different color for running apps
-        if (is_running) {
-            XSetForeground(dpy, panel_gc, button_green); // Green for running
+// Called with the lock held
+void icon_service_start() {
+    icons.started = 1;
+    icon_cache_map();
+    for (int i = 0; i < ICON_WORKERS; i++) {
+        if (pthread_create(&icons.workers[icons.worker_count], NULL, icon_worker, NULL) == 0) {
+            icons.worker_count++;
         } else {
-            XSetForeground(dpy, panel_gc, accent_color); // Normal color for not running
+            debug_log("ERROR: Could not start icon worker %d", i);
         }
-        draw_rounded_rectangle(panel.win, panel_gc, x, 10, 30, 30, 6);
-
-        // Draw border
-        XSetForeground(dpy, panel_gc, is_running ? 0x88FF88 : accent_light);
-        XDrawRectangle(dpy, panel.win, panel_gc, x, 10, 30, 30);
-
-        // Draw app initial or simple representation
-        XSetForeground(dpy, panel_gc, text_primary);
-        if (pinned_apps.apps[i].name && strlen(pinned_apps.apps[i].name) > 0) {
-            char initial[2] = {toupper(pinned_apps.apps[i].name[0]), '\0'};
-            int text_width = XTextWidth(XLoadQueryFont(dpy, "fixed"), initial, 1);
-            int text_x = x + (30 - text_width) / 2;
-            int text_y = 28; // Centered vertically
-            XDrawString(dpy, panel.win, panel_gc, text_x, text_y, initial, 1);
+    }
+}
 
-            debug_log("Drawing pinned app '%s' at position %d (running: %d)",
-                     pinned_apps.apps[i].name, x, is_running);
-        }
+unsigned int icon_entry_hash(const char *name, int size) {
+    return (string_hash(name) ^ (unsigned int)size) * 16777619u;
+}
 
-        x += 40;
+// Room for one more entry; the buckets grow with the entry array, so
+// chains stay about one entry long. Called with the lock held.
+int icon_entries_reserve() {
+    if (icons.entry_count < icons.entry_capacity) return 1;
+
+    int capacity = icons.entry_capacity ? icons.entry_capacity * 2 : 64; // power of two
+    IconEntry **grown = realloc(icons.entries, sizeof(IconEntry *) * capacity);
+    if (!grown) return 0;
+    icons.entries = grown;
+    IconEntry **buckets = calloc(capacity, sizeof(IconEntry *));
+    if (!buckets) return 0;
+
+    for (int i = 0; i < icons.entry_count; i++) {
+        IconEntry *e = icons.entries[i];
+        IconEntry **bucket = &buckets[e->hash & (capacity - 1)];
+        e->hash_next = *bucket;
+        *bucket = e;
     }
+    free(icons.buckets);
+    icons.buckets = buckets;
+    icons.entry_capacity = capacity;
+    return 1;
+}
 
-    // Draw separator if there are both pinned apps and window buttons
-    if (pinned_apps.app_count > 0) {
-        XSetForeground(dpy, panel_gc, 0x555555);
-        XDrawLine(dpy, panel.win, panel_gc, x, 15, x, 35);
-        x += 10;
+// The icon for an Icon= value at size x size, or NULL while it is still
+// being looked up (or if there is none). Never blocks on the disk. Runs for
+// every icon on every repaint, so the lookup is one hash chain.
+const unsigned int *icon_service_get(const char *name, int size) {
+    if (!name || !name[0]) return NULL;
+
+    const unsigned int *pixels = NULL;
+    unsigned int hash = icon_entry_hash(name, size);
+    pthread_mutex_lock(&icons.lock);
+    IconEntry *e = NULL;
+    if (icons.buckets) {
+        for (e = icons.buckets[hash & (icons.entry_capacity - 1)]; e; e = e->hash_next) {
+            if (e->hash == hash && e->size == size && strcmp(e->name, name) == 0) break;
+        }
     }
 
-    // Draw client icons/buttons with modern styling
-    int window_index = 1;
-    for (int i = 0; i < client_count; i++) {
-        if (clients[i] && clients[i]->is_mapped && !is_app_pinned(clients[i])) {
-            // Modern app icon with rounded corners
-            XSetForeground(dpy, panel_gc, 0x3D3D4D);
-            draw_rounded_rectangle(panel.win, panel_gc, x, 10, 40, 30, 6);
-
-            // Border with accent color for active window
-            if (clients[i]->is_active) {
-                XSetForeground(dpy, panel_gc, accent_color);
-                XSetLineAttributes(dpy, panel_gc, 2, LineSolid, CapRound, JoinRound);
-            } else {
-                XSetForeground(dpy, panel_gc, 0x555555);
-                XSetLineAttributes(dpy, panel_gc, 1, LineSolid, CapRound, JoinRound);
-            }
-            XDrawRectangle(dpy, panel.win, panel_gc, x, 10, 40, 30);
-            XSetLineAttributes(dpy, panel_gc, 1, LineSolid, CapRound, JoinRound);
-
-            // Draw window identifier with anti-aliased font
-            char label[10];
-            snprintf(label, sizeof(label), "%d", window_index++);
-
-            // Center the number in the button - use smaller font
-            int text_x = x + 18;
-            int text_y = 17; // Better vertical centering for smaller font
-
-            // Use a smaller font for the window numbers
-            if (xft_fonts.regular) {
-                draw_xft_text(panel.win, text_x, text_y, label, xft_fonts.regular,
-                             clients[i]->is_active ? text_primary : text_secondary);
+    if (!e && !icons.stopping) {
+        e = icon_entries_reserve() ? calloc(1, sizeof(IconEntry)) : NULL;
+        if (e) {
+            e->name = strdup(name);
+            e->size = size;
+            e->state = ICON_PENDING;
+            e->hash = hash;
+            IconEntry **bucket = &icons.buckets[hash & (icons.entry_capacity - 1)];
+            e->hash_next = *bucket;
+            *bucket = e;
+            icons.entries[icons.entry_count++] = e;
+            if (icons.queue_tail) {
+                icons.queue_tail->next_job = e;
             } else {
-                // Fallback to original font if Xft not available
-                XSetForeground(dpy, panel_gc, clients[i]->is_active ? text_primary : text_secondary);
-                XDrawString(dpy, panel.win, panel_gc, x + 15, 30, label, strlen(label));
+                icons.queue = e;
             }
-            x += 50;
+            icons.queue_tail = e;
+            if (!icons.started) icon_service_start();
+            pthread_cond_signal(&icons.wake);
         }
     }
 
-    // Draw DiamondWM area with modern styling
-    int diamond_size = 15;
-    int diamond_x = panel.width - 120;
-    int diamond_y = (PANEL_HEIGHT - diamond_size) / 2;
+    if (e && e->state == ICON_READY) pixels = e->pixels;
+    pthread_mutex_unlock(&icons.lock);
+    return pixels;
+}
 
-    draw_diamond_icon(diamond_x, diamond_y, diamond_size);
+// Main loop: 1 if icons became available since the last call
+int icon_service_poll() {
+    if (!icons.started) return 0;
+    pthread_mutex_lock(&icons.lock);
+    int arrived = icons.arrived;
+    icons.arrived = 0;
+    pthread_mutex_unlock(&icons.lock);
+    return arrived;
+}
 
-    // Draw "DiamondWM" text with proper positioning
-    int text_x = diamond_x + diamond_size + 10;
-    int text_y = 17; // Better vertical alignment
+void icon_service_shutdown() {
+    if (!icons.started) return;
 
-    // Use regular font instead of title font for proper size
-    if (xft_fonts.regular) {
-        draw_xft_text(panel.win, text_x, text_y, "DiamondWM", xft_fonts.regular, text_primary);
-    } else {
-      // Fallback to original font if Xft not available
-      XSetForeground(dpy, panel_gc, text_primary);
-      XDrawString(dpy, panel.win, panel_gc, text_x, 30, "DiamondWM", 9);
-  }
+    pthread_mutex_lock(&icons.lock);
+    icons.stopping = 1;
+    pthread_cond_broadcast(&icons.wake);
+    pthread_mutex_unlock(&icons.lock);
+    for (int i = 0; i < icons.worker_count; i++) pthread_join(icons.workers[i], NULL);
 
-  draw_clock();
+    for (int i = 0; i < icons.entry_count; i++) {
+        if (!icons.entries[i]->mapped) free(icons.entries[i]->pixels);
+        free(icons.entries[i]->name);
+        free(icons.entries[i]);
+    }
+    free(icons.entries);
+    free(icons.buckets);
+    icon_index_free();
+    if (icons.cache_map) munmap((void *)icons.cache_map, icons.cache_map_size);
 }
 
-void draw_window_decorations(Client *c) {
-  if (!c || !c->frame) return;
+// ---- Panel icon atlas ----
+//
+// Each panel button face (a pinned-app tile with its icon or initial, a task
+// tile with its number) is painted once into a cell of a single offscreen
+// surface and then drawn with one blit. Cells are keyed by what they show;
+// when the atlas is full the least recently used cell is repainted.
 
-  debug_log("Drawing modern decorations for window %lu", c->win);
+int icon_atlas_init() {
+    if (icon_atlas.ready) return 1;
 
-  XClearWindow(dpy, c->frame);
+    int width = ICON_ATLAS_COLUMNS * ICON_ATLAS_CELL_WIDTH;
+    int height = ICON_ATLAS_ROWS * ICON_ATLAS_CELL_HEIGHT;
+    if (renderer->argb_surfaces) {
+        if (!surface_init_argb(&icon_atlas.surface, width, height)) return 0;
+    } else {
+        Pixmap pixmap = XCreatePixmap(dpy, root, width, height, DefaultDepth(dpy, screen));
+        if (!surface_init(&icon_atlas.surface, pixmap, 0, width, height, black)) {
+            XFreePixmap(dpy, pixmap);
+            return 0;
+        }
+        icon_atlas.mask = XCreatePixmap(dpy, root, width, height, 1);
+        icon_atlas.mask_gc = XCreateGC(dpy, icon_atlas.mask, 0, NULL);
+    }
+    icon_atlas.surface.backend->clear(&icon_atlas.surface);
+    icon_atlas.ready = 1;
+    return 1;
+}
 
-  // Draw shadow effect
-  draw_shadow(c->frame, 0, 0, c->width, c->height);
+void icon_atlas_origin(int cell, int *x, int *y) {
+    *x = (cell % ICON_ATLAS_COLUMNS) * ICON_ATLAS_CELL_WIDTH;
+    *y = (cell / ICON_ATLAS_COLUMNS) * ICON_ATLAS_CELL_HEIGHT;
+}
 
-  // Enhanced window activation feedback
-  if (c->is_active) {
-      // Brighter gradient and border for active window
-      draw_gradient_rect(c->frame, title_gc, 0, 0, c->width, TITLEBAR_HEIGHT,
-                        accent_color, 0x5D5D7D, 1);
-      XSetForeground(dpy, gc, accent_color);
-      XSetLineAttributes(dpy, gc, 2, LineSolid, CapRound, JoinRound);
-  } else {
-      // More subtle for inactive windows
-      draw_gradient_rect(c->frame, title_gc, 0, 0, c->width, TITLEBAR_HEIGHT,
-                        titlebar_gray, 0x2D2D2D, 1);
-      XSetForeground(dpy, gc, 0x606060);
-      XSetLineAttributes(dpy, gc, 1, LineSolid, CapRound, JoinRound);
-  }
-  XDrawRectangle(dpy, c->frame, gc, 0, 0, c->width - 1, c->height - 1);
-  XSetLineAttributes(dpy, gc, 1, LineSolid, CapRound, JoinRound);
+// The cell showing `key`, or -1 without an atlas. A cell that had to be
+// claimed comes back cleared with *fresh set: paint the face at
+// icon_atlas_origin() + 1 and call icon_atlas_commit().
+int icon_atlas_lookup(const char *key, int *fresh) {
+    if (!icon_atlas_init()) return -1;
+
+    icon_atlas.clock++;
+    int victim = 0;
+    for (int i = 0; i < ICON_ATLAS_CELLS; i++) {
+        IconAtlasCell *cell = &icon_atlas.cells[i];
+        if (cell->key[0] && strcmp(cell->key, key) == 0) {
+            cell->last_used = icon_atlas.clock;
+            *fresh = 0;
+            return i;
+        }
+        // Free cells were never used, so they go first
+        if (cell->last_used < icon_atlas.cells[victim].last_used) victim = i;
+    }
 
-  // Draw window title
-  if (c->title) {
-      char display_title[256];
-      if (strlen(c->title) > 30) {
-          strncpy(display_title, c->title, 27);
-          strcpy(display_title + 27, "...");
-      } else {
-          strcpy(display_title, c->title);
-      }
+    IconAtlasCell *cell = &icon_atlas.cells[victim];
+    if (cell->key[0]) debug_log("Icon atlas: evicting '%s' for '%s'", cell->key, key);
+    snprintf(cell->key, sizeof(cell->key), "%s", key);
+    cell->last_used = icon_atlas.clock;
 
-      int text_width = XTextWidth(XLoadQueryFont(dpy, "fixed"), display_title, strlen(display_title));
-      int title_x = 80;
-      int title_available_width = c->width - 100;
+    int x, y;
+    icon_atlas_origin(victim, &x, &y);
+    icon_atlas.surface.backend->clear_rect(&icon_atlas.surface, x, y,
+                                           ICON_ATLAS_CELL_WIDTH, ICON_ATLAS_CELL_HEIGHT);
+    *fresh = 1;
+    return victim;
+}
 
-      if (text_width < title_available_width) {
-          title_x = 80 + (title_available_width - text_width) / 2;
-      }
+// Core X has no alpha: record the painted cell's coverage in the mask
+void icon_atlas_commit(int cell) {
+    if (!icon_atlas.mask) return;
 
-      int title_y = TITLEBAR_HEIGHT / 2 + 5;
+    int x, y;
+    icon_atlas_origin(cell, &x, &y);
+    Pixmap bits = build_key_mask(&icon_atlas.surface, x, y,
+                                 ICON_ATLAS_CELL_WIDTH, ICON_ATLAS_CELL_HEIGHT);
+    if (!bits) return;
+    XCopyArea(dpy, bits, icon_atlas.mask, icon_atlas.mask_gc, 0, 0,
+              ICON_ATLAS_CELL_WIDTH, ICON_ATLAS_CELL_HEIGHT, x, y);
+    XFreePixmap(dpy, bits);
+    gc_pool_forget_clip(icon_atlas.mask);  // pooled GCs may hold the old bits
+}
 
-      XSetForeground(dpy, text_gc, c->is_active ? text_primary : text_secondary);
-      XDrawString(dpy, c->frame, text_gc, title_x, title_y, display_title, strlen(display_title));
-  } else {
-      XSetForeground(dpy, text_gc, c->is_active ? text_primary : text_secondary);
-      XDrawString(dpy, c->frame, text_gc, 80, TITLEBAR_HEIGHT / 2 + 5, "Untitled", 8);
-  }
+// Draw a cell so that the face painted at origin + 1 lands at (x, y)
+void icon_atlas_draw(Surface *s, int cell, int x, int y) {
+    int cx, cy;
+    icon_atlas_origin(cell, &cx, &cy);
+    x -= 1;
+    y -= 1;
 
-  // Draw modern glow buttons with hover effects
-  int button_y = (TITLEBAR_HEIGHT - BUTTON_SIZE) / 2;
+    if (icon_atlas.mask) {
+        blit_masked(s, &icon_atlas.surface, icon_atlas.mask, cx, cy,
+                    ICON_ATLAS_CELL_WIDTH, ICON_ATLAS_CELL_HEIGHT, x, y);
+    } else {
+        s->backend->blit(s, &icon_atlas.surface, cx, cy,
+                         ICON_ATLAS_CELL_WIDTH, ICON_ATLAS_CELL_HEIGHT, x, y);
+    }
+}
 
-  // Close button with hover effect
-  draw_glow_button(c->frame, 15, button_y, BUTTON_SIZE, button_red, c->button_hover == 1);
+void free_icon_atlas() {
+    if (!icon_atlas.ready) return;
+    Pixmap pixmap = icon_atlas.surface.drawable;
+    surface_free(&icon_atlas.surface);
+    if (pixmap) XFreePixmap(dpy, pixmap);
+    if (icon_atlas.mask_gc) XFreeGC(dpy, icon_atlas.mask_gc);
+    if (icon_atlas.mask) {
+        gc_pool_forget_clip(icon_atlas.mask);
+        XFreePixmap(dpy, icon_atlas.mask);
+    }
+    memset(&icon_atlas, 0, sizeof(icon_atlas));
+}
 
-  // Minimize button with hover effect
-  draw_glow_button(c->frame, 15 + BUTTON_SIZE + BUTTON_SPACING, button_y, BUTTON_SIZE, button_yellow, c->button_hover == 2);
+// An icon from the icon service, uploaded to a cell the first time it is
+// drawn. Draws nothing until the icon is available.
+void draw_atlas_icon(Surface *s, int x, int y, const char *name, int size) {
+    const unsigned int *icon = icon_service_get(name, size);
+    if (!icon) return;
+
+    char key[256];
+    snprintf(key, sizeof(key), "icon:%d:%s", size, name);
+    int fresh;
+    int cell = icon_atlas_lookup(key, &fresh);
+    if (cell < 0) {
+        s->backend->draw_image(s, icon, size, size, x, y);
+        return;
+    }
+    if (fresh) {
+        int cx, cy;
+        icon_atlas_origin(cell, &cx, &cy);
+        icon_atlas.surface.backend->draw_image(&icon_atlas.surface, icon, size, size, cx + 1, cy + 1);
+        icon_atlas_commit(cell);
+    }
+    icon_atlas_draw(s, cell, x, y);
+}
 
-  // Maximize button with hover effect
-  draw_glow_button(c->frame, 15 + 2*(BUTTON_SIZE + BUTTON_SPACING), button_y, BUTTON_SIZE, button_green, c->button_hover == 3);
+// _NET_WM_ICON is a list of width, height and width * height ARGB pixels,
+// often at several sizes and hundreds of KB in total. Walk the headers two
+// values at a time and transfer only the pixels of the best fit: the
+// smallest image at least `size` across, else the largest there is.
+unsigned int *fetch_net_wm_icon(Window w, int size) {
+    Atom type;
+    int format;
+    unsigned long nitems, bytes_after;
+    unsigned char *data = NULL;
+    long offset = 0, best_offset = -1;
+    unsigned long best_w = 0, best_h = 0;
+
+    for (int images = 0; images < 16; images++) {
+        if (XGetWindowProperty(dpy, w, atoms[ATOM_NET_WM_ICON], offset, 2, False, XA_CARDINAL,
+                               &type, &format, &nitems, &bytes_after, &data) != Success) break;
+        if (!data || nitems < 2 || format != 32) {
+            if (data) XFree(data);
+            break;
+        }
+        unsigned long width = ((unsigned long *)data)[0], height = ((unsigned long *)data)[1];
+        XFree(data);
+        data = NULL;
+        if (width == 0 || height == 0 || width > 1024 || height > 1024) break;
+        if (bytes_after < width * height * 4) break;  // truncated property
+
+        unsigned long side = width > height ? width : height;
+        unsigned long best_side = best_w > best_h ? best_w : best_h;
+        int fits = side >= (unsigned long)size, best_fits = best_side >= (unsigned long)size;
+        if (best_offset < 0 || (fits && (!best_fits || side < best_side)) ||
+            (!fits && !best_fits && side > best_side)) {
+            best_offset = offset;
+            best_w = width;
+            best_h = height;
+        }
 
-  // Draw separator between titlebar and content
-  XSetForeground(dpy, gc, 0x404040);
-  XDrawLine(dpy, c->frame, gc, 0, TITLEBAR_HEIGHT, c->width, TITLEBAR_HEIGHT);
-}
+        offset += 2 + width * height;
+        if (bytes_after == width * height * 4) break;  // that was the last image
+    }
+    if (best_offset < 0) return NULL;
 
-int is_in_close_button(Client *c, int x, int y) {
-  int button_y = (TITLEBAR_HEIGHT - BUTTON_SIZE) / 2;
-  return (x >= 15 && x <= 15 + BUTTON_SIZE &&
-          y >= button_y && y <= button_y + BUTTON_SIZE);
+    if (XGetWindowProperty(dpy, w, atoms[ATOM_NET_WM_ICON], best_offset + 2, best_w * best_h, False,
+                           XA_CARDINAL, &type, &format, &nitems, &bytes_after, &data) != Success) {
+        return NULL;
+    }
+    unsigned int *icon = NULL;
+    unsigned char *rgba = nitems == best_w * best_h ? malloc(4 * nitems) : NULL;
+    if (rgba) {
+        // Format 32 properties arrive as longs, whatever their size
+        const unsigned long *argb = (const unsigned long *)data;
+        for (unsigned long i = 0; i < nitems; i++) {
+            rgba[4 * i] = (argb[i] >> 16) & 0xFF;
+            rgba[4 * i + 1] = (argb[i] >> 8) & 0xFF;
+            rgba[4 * i + 2] = argb[i] & 0xFF;
+            rgba[4 * i + 3] = (argb[i] >> 24) & 0xFF;
+        }
+        icon = scale_icon(rgba, best_w, best_h, size);
+        free(rgba);
+    }
+    if (data) XFree(data);
+    return icon;
 }
 
-int is_in_minimize_button(Client *c, int x, int y) {
-  int button_y = (TITLEBAR_HEIGHT - BUTTON_SIZE) / 2;
-  int button_x = 15 + BUTTON_SIZE + BUTTON_SPACING;
-  return (x >= button_x && x <= button_x + BUTTON_SIZE &&
-          y >= button_y && y <= button_y + BUTTON_SIZE);
+// Fetched on first paint and kept until the property changes
+const unsigned int *client_icon(Client *c) {
+    if (!c->icon_fetched && dpy) {
+        c->icon = fetch_net_wm_icon(c->win, PANEL_ICON_SIZE);
+        c->icon_fetched = 1;
+        debug_log("Fetched _NET_WM_ICON for window %lu: %s", c->win, c->icon ? "yes" : "none");
+    }
+    return c->icon;
 }
 
-int is_in_maximize_button(Client *c, int x, int y) {
-  int button_y = (TITLEBAR_HEIGHT - BUTTON_SIZE) / 2;
-  int button_x = 15 + 2*(BUTTON_SIZE + BUTTON_SPACING);
-  return (x >= button_x && x <= button_x + BUTTON_SIZE &&
-          y >= button_y && y <= button_y + BUTTON_SIZE);
+void invalidate_client_icon(Client *c) {
+    free(c->icon);
+    c->icon = NULL;
+    c->icon_fetched = 0;
+    c->icon_serial++;
 }
 
-int is_in_titlebar(Client *c, int x, int y) {
-  return (y >= 0 && y <= TITLEBAR_HEIGHT);
+void paint_pinned_face(Surface *s, int x, int y, PinnedApp *app, int running,
+                       const unsigned int *icon) {
+    draw_rounded_rectangle(s, x, y, 30, 30, 6, running ? button_green : accent_color);
+    s->backend->stroke_rect(s, x, y, 30, 30, 1, running ? 0x88FF88 : accent_light);
+
+    if (icon) {
+        int inset = (30 - PANEL_ICON_SIZE) / 2;
+        s->backend->draw_image(s, icon, PANEL_ICON_SIZE, PANEL_ICON_SIZE, x + inset, y + inset);
+    } else if (app->name[0]) {
+        // No icon (yet): show the app's initial
+        char initial[2] = {toupper(app->name[0]), '\0'};
+        int text_x = x + (30 - text_width(FONT_FIXED, initial)) / 2;
+        s->backend->text(s, text_x, y + 18, initial, FONT_FIXED, text_primary);
+    }
 }
 
-int get_resize_edge(Client *c, int x, int y) {
-  if (!c) return -1;
-
-  // Check corners first
-  if (x < RESIZE_HANDLE_SIZE && y < RESIZE_HANDLE_SIZE) return 4; // top-left
-  if (x >= c->width - RESIZE_HANDLE_SIZE && y < RESIZE_HANDLE_SIZE) return 5; // top-right
-  if (x < RESIZE_HANDLE_SIZE && y >= c->height - RESIZE_HANDLE_SIZE) return 6; // bottom-left
-  if (x >= c->width - RESIZE_HANDLE_SIZE && y >= c->height - RESIZE_HANDLE_SIZE) return 7; // bottom-right
+void paint_task_face(Surface *s, int x, int y, const char *label, int active,
+                     const unsigned int *icon) {
+    draw_rounded_rectangle(s, x, y, 40, 30, 6, 0x3D3D4D);
 
-  // Check edges
-  if (x < RESIZE_HANDLE_SIZE) return 0; // left
-  if (x >= c->width - RESIZE_HANDLE_SIZE) return 1; // right
-  if (y < RESIZE_HANDLE_SIZE) return 2; // top
-  if (y >= c->height - RESIZE_HANDLE_SIZE) return 3; // bottom
+    // Border with accent color for active window
+    if (active) {
+        s->backend->stroke_rect(s, x, y, 40, 30, 2, accent_color);
+    } else {
+        s->backend->stroke_rect(s, x, y, 40, 30, 1, 0x555555);
+    }
 
-  return -1; // not on resize edge
+    unsigned long color = active ? text_primary : text_secondary;
+    if (icon) {
+        s->backend->draw_image(s, icon, PANEL_ICON_SIZE, PANEL_ICON_SIZE,
+                               x + (40 - PANEL_ICON_SIZE) / 2, y + (30 - PANEL_ICON_SIZE) / 2);
+    } else if (has_font(FONT_REGULAR)) {
+        s->backend->text(s, x + 18, y + 7 + font_ascent(FONT_REGULAR), label, FONT_REGULAR, color);
+    } else {
+        // Fallback to original font if Xft not available
+        s->backend->text(s, x + 15, y + 20, label, FONT_FIXED, color);
+    }
 }
 
-void send_wm_delete(Window w) {
-  Atom wm_protocols = XInternAtom(dpy, "WM_PROTOCOLS", False);
-  Atom wm_delete_window = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
-  Atom *protocols;
-  int num_protocols;  // Changed from unsigned long to int
+void draw_clock(Surface *s) {
+    time_t now = render_clock_time ? render_clock_time : time(NULL);
+    struct tm *tm_info = localtime(&now);
+    char time_str[6];
 
-  if (XGetWMProtocols(dpy, w, &protocols, &num_protocols)) {
-      for (int i = 0; i < num_protocols; i++) {  // Changed from unsigned long to int
-          if (protocols[i] == wm_delete_window) {
-              XEvent ev;
-              ev.type = ClientMessage;
-              ev.xclient.window = w;
-              ev.xclient.message_type = wm_protocols;
-              ev.xclient.format = 32;
-              ev.xclient.data.l[0] = wm_delete_window;
-              ev.xclient.data.l[1] = CurrentTime;
-              XSendEvent(dpy, w, False, NoEventMask, &ev);
-              XFree(protocols);
-              return;
-          }
-      }
-      XFree(protocols);
-  }
+    strftime(time_str, sizeof(time_str), "%H:%M", tm_info);
 
-  // Fallback: kill the client
-  XKillClient(dpy, w);
+    // Use anti-aliased font for clock
+    int width = text_width(FONT_REGULAR, time_str);
+    if (has_font(FONT_REGULAR)) {
+        int x = 40 + panel.width - width - 180;
+        s->backend->text(s, x, 17 + font_ascent(FONT_REGULAR), time_str, FONT_REGULAR, text_primary);
+    } else {
+        // Fallback
+        int x = panel.width - width - 180;
+        s->backend->text(s, x, 30, time_str, FONT_FIXED, text_primary);
+    }
 }
 
-void handle_button_press(XButtonEvent *e) {
-    debug_log("Button press on window %lu (button=%d) at screen coords %d,%d",
-             e->window, e->button, e->x_root, e->y_root);
+void check_clock_update() {
+    static time_t last_update = 0;
+    time_t now = time(NULL);
 
-    // Handle app launcher visibility FIRST
-    if (app_launcher.visible) {
-        debug_log("App launcher visible, checking if click is inside...");
-        if (is_in_app_launcher_area(e->x_root, e->y_root)) {
-            debug_log("Click INSIDE app launcher at %d,%d", e->x_root, e->y_root);
-            handle_app_launcher_click(e->x_root, e->y_root);
-            return;
-        } else {
-            debug_log("Click OUTSIDE app launcher at %d,%d", e->x_root, e->y_root);
-            hide_app_launcher();
-        }
+    // Only update if minute has changed (not every second)
+    if (now / 60 != last_update / 60) {
+        last_update = now;
+        draw_panel();
     }
+}
 
-    // ===== Check for pinned app menu =====
-    if (pinned_app_menu.visible) {
-        if (e->x_root >= pinned_app_menu.x &&
-            e->x_root <= pinned_app_menu.x + pinned_app_menu.width &&
-            e->y_root >= pinned_app_menu.y &&
-            e->y_root <= pinned_app_menu.y + pinned_app_menu.height) {
-
-            int relative_y = e->y_root - pinned_app_menu.y;
-            int item = relative_y / MENU_ITEM_HEIGHT;
-
-            debug_log("Pinned app menu clicked: item=%d", item);
-
-            if (item >= 0 && item < 5 && pinned_app_menu.target_pinned_app) {
-                PinnedApp *app = pinned_app_menu.target_pinned_app;
+void create_menu() {
+    menu.width = MENU_WIDTH;
+    menu.height = MENU_ITEM_HEIGHT * 4;
+    menu.x = panel.width - menu.width - 20;
+    menu.y = panel.y - menu.height;
+    menu.hover_item = -1;
+    menu.alpha = 0.0f;
 
-                // Find the client window for this app
-                Client *target_client = NULL;
-                for (int i = 0; i < client_count; i++) {
-                    if (clients[i] && clients[i]->title &&
-                        strcmp(clients[i]->title, app->name) == 0) {
-                        target_client = clients[i];
-                        break;
-                    }
-                }
+    menu.win = create_popup_window(menu.x, menu.y, menu.width, menu.height,
+                                   &menu.window_surface, &menu.surface);
 
-                int is_running = (target_client != NULL);
+    XSelectInput(dpy, menu.win, ButtonPressMask | ExposureMask | PointerMotionMask);
+    menu.visible = 0;
+}
 
-                // Adjust item index for non-running apps (skip empty slots)
-                int actual_item = item;
-                if (!is_running) {
-                    if (item >= 1 && item <= 3) {
-                        // Skip empty slots for non-running apps
-                        hide_pinned_app_menu();
-                        return;
-                    } else if (item == 4) {
-                        actual_item = 1; // Unpin is the only option after Launch
-                    }
-                }
+void show_menu() {
+    if (!menu.visible) {
+        int diamondwm_width = 120;
+        menu.x = panel.width - diamondwm_width - 20;
+        menu.y = panel.y - menu.height - 5;
 
-                switch (actual_item) {
-                    case 0: // Launch/Show Windows
-                        if (is_running) {
-                            // Show all windows of this app
-                            if (target_client->is_mapped) {
-                                XRaiseWindow(dpy, target_client->frame);
-                                XSetInputFocus(dpy, target_client->win, RevertToPointerRoot, CurrentTime);
-                                target_client->is_active = 1;
-                                draw_window_decorations(target_client);
-                            } else {
-                                // Window was minimized, show it
-                                XMapWindow(dpy, target_client->frame);
-                                XMapWindow(dpy, target_client->win);
-                                target_client->is_mapped = 1;
-                                XRaiseWindow(dpy, target_client->frame);
-                                XSetInputFocus(dpy, target_client->win, RevertToPointerRoot, CurrentTime);
-                            }
-                            show_operation_feedback("App windows shown");
-                        } else {
-                            // Launch the app
-                            if (app->exec && strlen(app->exec) > 0) {
-                                debug_log("Launching pinned app: %s", app->exec);
-                                pid_t pid = fork();
-                                if (pid == 0) {
-                                    setsid();
-                                    execl("/bin/sh", "sh", "-c", app->exec, NULL);
-                                    exit(0);
-                                } else if (pid > 0) {
-                                    show_operation_feedback("App launched");
-                                } else {
-                                    debug_log("ERROR: Failed to fork for pinned app launch");
-                                    show_operation_feedback("Failed to launch app");
-                                }
-                            }
-                        }
-                        break;
+        XMoveWindow(dpy, menu.win, menu.x, menu.y);
+        menu.visible = 1;
+        menu.alpha = 0.0f;
+        draw_menu();
+        XMapWindow(dpy, menu.win);
+        raise_window(menu.win, LAYER_POPUP);
 
-                    case 1: // Maximize (only for running apps)
-                        if (is_running && target_client) {
-                            debug_log("Maximizing window from pinned app menu");
-                            show_operation_feedback(target_client->is_fullscreen ? "Window restored" : "Window maximized");
-                            toggle_fullscreen(target_client);
-                        }
-                        break;
+        // Fade-in: the content is drawn once, each step only presents it
+        fade_popup(&menu.window_surface, &menu.surface, &menu.alpha, 1);
 
-                    case 2: // Minimize (only for running apps)
-                        if (is_running && target_client) {
-                            debug_log("Minimizing window from pinned app menu");
-                            show_operation_feedback("Window minimized");
-                            lower_window(target_client);
-                        }
-                        break;
+        XGrabPointer(dpy, root, False, ButtonPressMask, GrabModeAsync,
+                    GrabModeAsync, None, None, CurrentTime);
+    }
+}
 
-                    case 3: // Close (only for running apps)
-                        if (is_running && target_client) {
-                            debug_log("Closing window from pinned app menu");
-                            show_operation_feedback("Window closed");
-                            close_window(target_client);
-                        }
-                        break;
+void hide_menu() {
+    if (menu.visible) {
+        // Fade-out animation
+        fade_popup(&menu.window_surface, &menu.surface, &menu.alpha, 0);
 
-                    case 4: // Unpin from Panel
-                        debug_log("Unpinning app: %s", app->name);
-                        unpin_app(app);
-                        show_operation_feedback("App unpinned");
-                        break;
-                }
-            }
-            hide_pinned_app_menu();
-            return;
-        } else {
-            // Click outside menu - hide it
-            hide_pinned_app_menu();
-        }
+        XUnmapWindow(dpy, menu.win);
+        menu.visible = 0;
+        menu.hover_item = -1;
+        XUngrabPointer(dpy, CurrentTime);
     }
+}
 
-    // ===== Check if click is on a WINDOW FRAME first =====
-    for (int i = 0; i < client_count; i++) {
-        if (clients[i] && clients[i]->frame == e->window) {
-            Client *c = clients[i];
-            debug_log("Click on frame %lu at %d,%d", c->frame, e->x, e->y);
+void draw_menu() {
+    if (!menu.visible) return;
 
-            // Check for resize edges first
-            int edge = get_resize_edge(c, e->x, e->y);
-            if (edge != -1 && e->button == Button1) {
-                debug_log("Resize edge %d clicked", edge);
-                window_resizing = 1;
-                resized_client = c;
-                resize_start_x = e->x_root;
-                resize_start_y = e->y_root;
-                resize_start_width = c->width;
-                resize_start_height = c->height;
-                resize_edge = edge;
+    Surface *s = &menu.surface;
+    shape_window(&menu.window_surface, menu.width, menu.height, CORNER_RADIUS, SHAPE_ALL);
+    s->backend->clear(s);
+    surface_begin_batch(s);
 
-                Cursor resize_cursor;
-                switch (edge) {
-                    case 0: case 1: resize_cursor = XCreateFontCursor(dpy, XC_sb_h_double_arrow); break;
-                    case 2: case 3: resize_cursor = XCreateFontCursor(dpy, XC_sb_v_double_arrow); break;
-                    case 4: case 7: resize_cursor = XCreateFontCursor(dpy, XC_top_left_corner); break;
-                    case 5: case 6: resize_cursor = XCreateFontCursor(dpy, XC_top_right_corner); break;
-                    default: resize_cursor = XCreateFontCursor(dpy, XC_left_ptr);
-                }
-                XDefineCursor(dpy, c->frame, resize_cursor);
-                return;
-            }
+    // Draw rounded background with gradient
+    draw_rounded_rectangle(s, 0, 0, menu.width, menu.height, CORNER_RADIUS, menu_bg);
 
-            // Check for titlebar buttons
-            if (is_in_titlebar(c, e->x, e->y)) {
-                // Handle close button
-                if (is_in_close_button(c, e->x, e->y)) {
-                    if (e->button == Button1) {
-                        debug_log("Close button clicked for window: %s", c->title);
-                        show_operation_feedback("Closing window...");
-                        close_window(c);
-                        return;
-                    }
-                    return;
-                }
+    // Draw subtle border
+    s->backend->stroke_rect(s, 1, 1, menu.width - 3, menu.height - 3, 1, accent_color);
 
-                // Handle minimize button
-                if (is_in_minimize_button(c, e->x, e->y)) {
-                    if (e->button == Button1) {
-                        debug_log("Minimize button clicked for window: %s", c->title);
-                        show_operation_feedback("Window minimized");
-                        lower_window(c);
-                        return;
-                    }
-                    return;
-                }
+    char *items[] = {"Terminal", "Lock", "Logout", "Shutdown"};
 
-                // Handle maximize button
-                if (is_in_maximize_button(c, e->x, e->y)) {
-                    if (e->button == Button1) {
-                        debug_log("Maximize button clicked for window: %s", c->title);
-                        show_operation_feedback(c->is_fullscreen ? "Window restored" : "Window maximized");
-                        toggle_fullscreen(c);
-                        return;
-                    }
-                    return;
-                }
+    for (int i = 0; i < 4; i++) {
+        int y = i * MENU_ITEM_HEIGHT;
 
-                // If we get here, it's a click on the titlebar but not on any button
-                if (e->button == Button1) {
-                    debug_log("Titlebar clicked (not on buttons) - starting window drag");
-                    XRaiseWindow(dpy, c->frame);
-                    XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
-                    c->is_active = 1;
-                    draw_window_decorations(c);
+        // Hover effect
+        if (menu.hover_item == i) {
+            draw_rounded_rectangle(s, 2, y + 2, menu.width - 4, MENU_ITEM_HEIGHT - 4, 4, menu_hover_bg);
+        }
 
-                    window_dragging = 1;
-                    dragged_client = c;
-                    drag_win_start_x = c->x;
-                    drag_win_start_y = c->y;
-                    drag_offset_x = e->x_root - c->x;
-                    drag_offset_y = e->y_root - c->y;
+        if (i > 0) {
+            s->backend->draw_line(s, 10, y, menu.width - 10, y, 0x404040);
+        }
 
-                    debug_log("Window drag started: client=%lu, start_pos=%d,%d, offset=%d,%d",
-                             c->win, drag_win_start_x, drag_win_start_y, drag_offset_x, drag_offset_y);
+        int width = text_width(FONT_FIXED, items[i]);
+        int text_x = (menu.width - width) / 2;
+        int text_y = y + (MENU_ITEM_HEIGHT / 2) + 5;
 
-                    Cursor move_cursor = XCreateFontCursor(dpy, XC_fleur);
-                    XDefineCursor(dpy, c->frame, move_cursor);
-                    return;
-                }
-            }
-            break;
-        }
+        s->backend->text(s, text_x, text_y, items[i], FONT_FIXED, text_primary);
     }
 
-    // ===== THEN check if click is on panel =====
-    if (e->window == panel.win) {
-        debug_log("Click on panel at %d,%d", e->x, e->y);
-
-        // FIRST: Check if click is on DiamondWM area (this should be checked before pinned apps)
-        if (is_in_diamondwm_area(e->x, e->y)) {
-            debug_log("DiamondWM area clicked - toggling menu (currently visible=%d)", menu.visible);
-            if (menu.visible) {
-                hide_menu();
-            } else {
-                show_menu();
-            }
-            return; // Return immediately after handling DiamondWM area click
-        }
+    surface_end_batch(s);
+    present_popup(&menu.window_surface, s, menu.alpha);
+}
 
-        // SECOND: Check pinned apps on panel
-        for (int i = 0; i < pinned_apps.app_count; i++) {
-            if (e->x >= pinned_apps.apps[i].x_position &&
-                e->x <= pinned_apps.apps[i].x_position + 30 &&
-                e->y >= 10 && e->y <= 40) {
+int is_in_diamondwm_area(int x, int y) {
+    int diamond_size = 20;
+    int total_width = diamond_size + 5 + text_width(FONT_FIXED, "DiamondWM");
 
-                debug_log("Pinned app clicked: %s", pinned_apps.apps[i].name);
-                hide_tooltip(); // Hide tooltip on click
+    int area_x = panel.width - total_width - 20;
+    int area_y = 10;
+    int area_height = 30;
 
-                if (e->button == Button3) {
-                    // Right click - show menu
-                    show_pinned_app_menu(panel.x + pinned_apps.apps[i].x_position,
-                                        panel.y + 10, &pinned_apps.apps[i]);
-                    return;
-                } else if (e->button == Button1) {
-                    // Left click - check if app is running
-                    int is_running = 0;
-                    PinnedApp *app = &pinned_apps.apps[i];
+    return (x >= area_x && x <= area_x + total_width &&
+            y >= area_y && y <= area_y + area_height);
+}
 
-                    for (int j = 0; j < client_count; j++) {
-                        if (clients[j] && clients[j]->title &&
-                            strcmp(clients[j]->title, app->name) == 0) {
-                            is_running = 1;
-                            // Show all windows of this app
-                            if (clients[j]->is_mapped) {
-                                XRaiseWindow(dpy, clients[j]->frame);
-                                XSetInputFocus(dpy, clients[j]->win, RevertToPointerRoot, CurrentTime);
-                                clients[j]->is_active = 1;
-                                draw_window_decorations(clients[j]);
-                            } else {
-                                // Window was minimized, show it
-                                XMapWindow(dpy, clients[j]->frame);
-                                XMapWindow(dpy, clients[j]->win);
-                                clients[j]->is_mapped = 1;
-                                XRaiseWindow(dpy, clients[j]->frame);
-                                XSetInputFocus(dpy, clients[j]->win, RevertToPointerRoot, CurrentTime);
-                            }
-                            show_operation_feedback("App windows shown");
-                            break;
-                        }
-                    }
+int is_in_menu_area(int x, int y) {
+    if (!menu.visible) return 0;
 
-                    // If not running, launch it
-                    if (!is_running && app->exec && strlen(app->exec) > 0) {
-                        debug_log("Launching pinned app: %s", app->exec);
-                        pid_t pid = fork();
-                        if (pid == 0) {
-                            setsid();
-                            execl("/bin/sh", "sh", "-c", app->exec, NULL);
-                            exit(0);
-                        } else if (pid > 0) {
-                            show_operation_feedback("App launched");
-                        } else {
-                            debug_log("ERROR: Failed to fork for pinned app launch");
-                            show_operation_feedback("Failed to launch app");
-                        }
-                    }
-                }
-                return;
-            }
-        }
+    return (x >= menu.x && x <= menu.x + menu.width &&
+            y >= menu.y && y <= menu.y + menu.height);
+}
 
-        // THIRD: Check for window control menu (non-pinned apps)
-        // Check window buttons for non-pinned apps
-        int x = 10 + pinned_apps.app_count * 40;
-        if (pinned_apps.app_count > 0) x += 10; // Add separator space
+int get_menu_item_at(int x, int y) {
+    if (!menu.visible) return -1;
 
-        int window_index = 1;
-        for (int i = 0; i < client_count; i++) {
-            if (clients[i] && clients[i]->is_mapped && !is_app_pinned(clients[i])) {
-                if (e->x >= x && e->x <= x + 40 && e->y >= 10 && e->y <= 40) {
-                    debug_log("Panel button clicked for client %d", i);
+    int relative_x = x - menu.x;
+    int relative_y = y - menu.y;
 
-                    // RIGHT click - show control menu ABOVE this specific button
-                    if (e->button == Button3) {
-                        int menu_x = panel.x + x;
-                        int menu_y = panel.y;
-                        show_window_control_menu(menu_x, menu_y, clients[i]);
-                        return;
-                    }
+    if (relative_x < 0 || relative_x > menu.width ||
+        relative_y < 0 || relative_y > menu.height) {
+        return -1;
+    }
 
-                    // LEFT click - activate and show window
-                    if (!is_window_visible(clients[i])) {
-                        debug_log("Window %d is not visible, repositioning to 10,10", i);
+    return relative_y / MENU_ITEM_HEIGHT;
+}
 
-                        int screen_width = DisplayWidth(dpy, screen);
-                        int screen_height = DisplayHeight(dpy, screen);
+void load_applications() {
+    debug_log("=== STARTING APPLICATION LOADING ===");
 
-                        int max_width = screen_width - 20;
-                        int max_height = screen_height - PANEL_HEIGHT - 20;
+    const char *desktop_dirs[] = {
+        "/usr/share/applications",
+        "/usr/local/share/applications",
+        "/home/%s/.local/share/applications",
+        NULL
+    };
 
-                        if (clients[i]->width > max_width || clients[i]->height > max_height) {
-                            int new_width = (clients[i]->width > max_width) ? max_width : clients[i]->width;
-                            int new_height = (clients[i]->height > max_height) ? max_height : clients[i]->height;
+    typedef struct {
+        const char *category;
+        const char *name;
+    } CategoryMap;
 
-                            debug_log("Resizing window from %dx%d to %dx%d",
-                                     clients[i]->width, clients[i]->height, new_width, new_height);
+    CategoryMap category_map[] = {
+        {"AudioVideo", "Multimedia"},
+        {"Audio", "Audio"},
+        {"Video", "Video"},
+        {"Development", "Development"},
+        {"Education", "Education"},
+        {"Game", "Games"},
+        {"Graphics", "Graphics"},
+        {"Network", "Internet"},
+        {"Office", "Office"},
+        {"Science", "Science"},
+        {"Settings", "Settings"},
+        {"System", "System"},
+        {"Utility", "Utilities"},
+        {"GTK", "GTK Apps"},
+        {"Qt", "Qt Apps"},
+        {"XFCE", "XFCE Apps"},
+        {"GNOME", "GNOME Apps"},
+        {"KDE", "KDE Apps"},
+        {NULL, NULL}
+    };
 
-                            resize_window(clients[i], new_width, new_height);
-                        }
+    char username[100];
+    struct passwd *pw = getpwuid(getuid());
+    if (pw) {
+        strncpy(username, pw->pw_name, sizeof(username)-1);
+        username[sizeof(username)-1] = '\0';
+    } else {
+        strcpy(username, "user");
+    }
+    debug_log("Loading apps for user: %s", username);
 
-                        move_window(clients[i], 10, 10);
-                        debug_log("Window repositioned to 10,10 with size %dx%d",
-                                 clients[i]->width, clients[i]->height);
-                    }
+    int total_files = 0;
+    for (int i = 0; desktop_dirs[i] != NULL; i++) {
+        char path[512];
+        if (strstr(desktop_dirs[i], "%s")) {
+            snprintf(path, sizeof(path), desktop_dirs[i], username);
+        } else {
+            strcpy(path, desktop_dirs[i]);
+        }
 
-                    XRaiseWindow(dpy, clients[i]->frame);
-                    XSetInputFocus(dpy, clients[i]->win, RevertToPointerRoot, CurrentTime);
-                    clients[i]->is_active = 1;
-                    draw_window_decorations(clients[i]);
-                    show_operation_feedback("Window activated");
-                    break;
-                }
-                x += 50;
-                window_index++;
-            }
+        debug_log("Scanning directory: %s", path);
+
+        DIR *dir = opendir(path);
+        if (!dir) {
+            debug_log("  Cannot open directory: %s", path);
+            continue;
         }
 
-        // Start panel drag if clicked on empty area
-        if (e->button == Button1 && !menu.visible && !app_launcher.visible && !window_control_menu.visible && !pinned_app_menu.visible) {
-            panel_dragging = 1;
-            drag_start_x = e->x_root;
-            drag_start_y = e->y_root;
-            debug_log("Panel dragging started at %d,%d", drag_start_x, drag_start_y);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strstr(entry->d_name, ".desktop")) {
+                total_files++;
+            }
         }
+        closedir(dir);
+    }
+
+    debug_log("Found %d total .desktop files", total_files);
+
+    if (total_files == 0) {
+        debug_log("ERROR: No .desktop files found!");
+        app_launcher.category_count = 0;
+        app_launcher.categories = NULL;
         return;
     }
 
-    // ===== Check for window control menu =====
-    if (window_control_menu.visible) {
-        if (e->x_root >= window_control_menu.x &&
-            e->x_root <= window_control_menu.x + window_control_menu.width &&
-            e->y_root >= window_control_menu.y &&
-            e->y_root <= window_control_menu.y + window_control_menu.height) {
+    AppInfo *all_apps = malloc(sizeof(AppInfo) * total_files);
+    if (!all_apps) {
+        debug_log("ERROR: Failed to allocate memory for %d apps", total_files);
+        return;
+    }
+    memset(all_apps, 0, sizeof(AppInfo) * total_files);
 
-            int relative_y = e->y_root - window_control_menu.y;
-            int item = relative_y / MENU_ITEM_HEIGHT;
+    int app_index = 0;
 
-            debug_log("Window control menu clicked: item=%d", item);
+    for (int i = 0; desktop_dirs[i] != NULL; i++) {
+        char path[512];
+        if (strstr(desktop_dirs[i], "%s")) {
+            snprintf(path, sizeof(path), desktop_dirs[i], username);
+        } else {
+            strcpy(path, desktop_dirs[i]);
+        }
 
-            if (item >= 0 && item < 4 && window_control_menu.target_client) {
-                Client *c = window_control_menu.target_client;
-                switch (item) {
-                    case 0: // Pin to Panel
-                        debug_log("Pin to Panel clicked");
-                        hide_window_control_menu();
-                        pin_app_to_panel(c);
-                        show_operation_feedback("App pinned to panel");
-                        return;
-                    case 1: // Maximize
-                        debug_log("Maximize clicked");
-                        hide_window_control_menu();
-                        toggle_fullscreen(c);
-                        show_operation_feedback(c->is_fullscreen ? "Window maximized" : "Window restored");
-                        return;
-                    case 2: // Minimize
-                        debug_log("Minimize clicked");
-                        hide_window_control_menu();
-                        lower_window(c);
-                        show_operation_feedback("Window minimized");
-                        return;
-                    case 3: // Close
-                        debug_log("Close clicked");
-                        hide_window_control_menu();
-                        close_window(c);
-                        show_operation_feedback("Window closed");
-                        return;
+        DIR *dir = opendir(path);
+        if (!dir) continue;
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strstr(entry->d_name, ".desktop")) {
+                char filepath[1024];
+                snprintf(filepath, sizeof(filepath), "%s/%s", path, entry->d_name);
+
+                FILE *file = fopen(filepath, "r");
+                if (!file) {
+                    debug_log("  Cannot open file: %s", filepath);
+                    continue;
                 }
-            }
-            hide_window_control_menu();
-            return;
-        } else {
-            hide_window_control_menu();
+
+                AppInfo app = {0};
+                char line[512];
+                int in_desktop_entry = 0;
+                int is_application = 0;
+                int hidden = 0;
+                int no_display = 0;
+
+                debug_log("  Parsing: %s", entry->d_name);
+
+                while (fgets(line, sizeof(line), file)) {
+                    line[strcspn(line, "\n")] = 0;
+                    char *end = line + strlen(line) - 1;
+                    while (end > line && isspace(*end)) end--;
+                    *(end + 1) = 0;
+
+                    if (strcmp(line, "[Desktop Entry]") == 0) {
+                        in_desktop_entry = 1;
+                        continue;
+                    } else if (line[0] == '[' && line[strlen(line)-1] == ']') {
+                        in_desktop_entry = 0;
+                        continue;
+                    }
+
+                    if (!in_desktop_entry) continue;
+
+                    if (strncmp(line, "Type=", 5) == 0) {
+                        if (strstr(line + 5, "Application")) {
+                            is_application = 1;
+                        } else {
+                            break;
+                        }
+                    }
+
+                    if (strncmp(line, "Hidden=", 7) == 0) {
+                        if (strstr(line + 7, "true")) {
+                            hidden = 1;
+                            break;
+                        }
+                    }
+
+                    if (strncmp(line, "NoDisplay=", 10) == 0) {
+                        if (strstr(line + 10, "true")) {
+                            no_display = 1;
+                            break;
+                        }
+                    }
+
+                    if (strncmp(line, "Name=", 5) == 0 && !app.name) {
+                        app.name = strdup(line + 5);
+                    }
+
+                    if (strncmp(line, "Exec=", 5) == 0 && !app.exec) {
+                        char *exec_cmd = line + 5;
+                        char clean_exec[512];
+                        char *dest = clean_exec;
+
+                        for (char *src = exec_cmd; *src && (dest - clean_exec) < 510; src++) {
+                            if (*src == '%' && *(src+1)) {
+                                src++;
+                                continue;
+                            }
+                            if (*src == ' ' && (src == exec_cmd || *(src-1) == ' ')) {
+                                continue;
+                            }
+                            *dest++ = *src;
+                        }
+                        *dest = '\0';
+
+                        if (dest > clean_exec && *(dest-1) == ' ') {
+                            *(dest-1) = '\0';
+                        }
+
+                        app.exec = strdup(clean_exec);
+                    }
+
+                    if (strncmp(line, "Categories=", 11) == 0 && !app.categories) {
+                        app.categories = strdup(line + 11);
+                    }
+
+                    if (strncmp(line, "Comment=", 8) == 0 && !app.comment) {
+                        app.comment = strdup(line + 8);
+                    }
+
+                    if (strncmp(line, "Icon=", 5) == 0 && !app.icon) {
+                        app.icon = strdup(line + 5);
+                    }
+
+                    if (strncmp(line, "StartupWMClass=", 15) == 0 && !app.wm_class) {
+                        app.wm_class = strdup(line + 15);
+                    }
+                }
+
+                fclose(file);
+
+                if (is_application && !hidden && !no_display && app.name && app.exec) {
+                    if (!app.categories) {
+                        app.categories = strdup("Utility");
+                    }
+
+                    if (!app.comment) {
+                        app.comment = strdup("");
+                    }
+
+                    if (!app.icon) {
+                        app.icon = strdup("");
+                    }
+
+                    all_apps[app_index++] = app;
+                    debug_log("    ✓ Loaded: %s -> %s (Categories: %s)",
+                             app.name, app.exec, app.categories);
+                } else {
+                    debug_log("    ✗ Skipped: %s (is_app=%d, hidden=%d, no_display=%d, has_name=%d, has_exec=%d)",
+                             entry->d_name, is_application, hidden, no_display,
+                             app.name != NULL, app.exec != NULL);
+                    if (app.name) free(app.name);
+                    if (app.exec) free(app.exec);
+                    if (app.categories) free(app.categories);
+                    if (app.comment) free(app.comment);
+                    if (app.icon) free(app.icon);
+                    free(app.wm_class);
+                }
+            }
+        }
+        closedir(dir);
+    }
+
+    debug_log("Successfully parsed %d applications", app_index);
+
+    if (app_index == 0) {
+        debug_log("ERROR: No valid applications found after parsing!");
+        free(all_apps);
+        app_launcher.category_count = 0;
+        app_launcher.categories = NULL;
+        return;
+    }
+
+    int category_count = 0;
+    for (int i = 0; category_map[i].category != NULL; i++) {
+        category_count++;
+    }
+
+    app_launcher.categories = malloc(sizeof(AppCategory) * category_count);
+    if (!app_launcher.categories) {
+        debug_log("ERROR: Failed to allocate categories");
+        for (int i = 0; i < app_index; i++) {
+            free(all_apps[i].name);
+            free(all_apps[i].exec);
+            free(all_apps[i].categories);
+            free(all_apps[i].comment);
+            free(all_apps[i].icon);
+            free(all_apps[i].wm_class);
+        }
+        free(all_apps);
+        return;
+    }
+
+    app_launcher.category_count = category_count;
+
+    for (int i = 0; i < category_count; i++) {
+        app_launcher.categories[i].category_name = strdup(category_map[i].name);
+        app_launcher.categories[i].apps = NULL;
+        app_launcher.categories[i].app_count = 0;
+        app_launcher.categories[i].expanded = 0;
+    }
+
+    for (int i = 0; i < app_index; i++) {
+        char *categories = strdup(all_apps[i].categories);
+        char *token = strtok(categories, ";");
+
+        while (token) {
+            char clean_token[100];
+            char *dest = clean_token;
+            for (char *src = token; *src && (dest - clean_token) < 99; src++) {
+                if (!isspace(*src)) {
+                    *dest++ = *src;
+                }
+            }
+            *dest = '\0';
+
+            for (int j = 0; j < category_count; j++) {
+                if (strcasecmp(clean_token, category_map[j].category) == 0) {
+                    app_launcher.categories[j].app_count++;
+                    break;
+                }
+            }
+            token = strtok(NULL, ";");
+        }
+        free(categories);
+    }
+
+    for (int i = 0; i < category_count; i++) {
+        if (app_launcher.categories[i].app_count > 0) {
+            app_launcher.categories[i].apps = malloc(sizeof(AppInfo) * app_launcher.categories[i].app_count);
+            if (!app_launcher.categories[i].apps) {
+                debug_log("ERROR: Failed to allocate apps for category %s",
+                         app_launcher.categories[i].category_name);
+                app_launcher.categories[i].app_count = 0;
+            } else {
+                app_launcher.categories[i].app_count = 0;
+            }
+        }
+    }
+
+    for (int i = 0; i < app_index; i++) {
+        char *categories = strdup(all_apps[i].categories);
+        char *token = strtok(categories, ";");
+        int assigned = 0;
+
+        while (token && !assigned) {
+            char clean_token[100];
+            char *dest = clean_token;
+            for (char *src = token; *src && (dest - clean_token) < 99; src++) {
+                if (!isspace(*src)) {
+                    *dest++ = *src;
+                }
+            }
+            *dest = '\0';
+
+            for (int j = 0; j < category_count; j++) {
+                if (strcasecmp(clean_token, category_map[j].category) == 0) {
+                    if (app_launcher.categories[j].apps) {
+                        int idx = app_launcher.categories[j].app_count++;
+                        app_launcher.categories[j].apps[idx] = all_apps[i];
+                        assigned = 1;
+                        debug_log("  Assigned '%s' to category '%s'",
+                                 all_apps[i].name, app_launcher.categories[j].category_name);
+                    }
+                    break;
+                }
+            }
+            token = strtok(NULL, ";");
+        }
+
+        if (!assigned) {
+            for (int j = 0; j < category_count; j++) {
+                if (strcasecmp(category_map[j].category, "Utility") == 0) {
+                    if (app_launcher.categories[j].apps) {
+                        int idx = app_launcher.categories[j].app_count++;
+                        app_launcher.categories[j].apps[idx] = all_apps[i];
+                        debug_log("  Assigned '%s' to default category 'Utilities'", all_apps[i].name);
+                    }
+                    break;
+                }
+            }
+        }
+
+        free(categories);
+    }
+
+    free(all_apps);
+
+    debug_log("=== APPLICATION LOADING SUMMARY ===");
+    int total_loaded_apps = 0;
+    int non_empty_categories = 0;
+
+    for (int i = 0; i < category_count; i++) {
+        if (app_launcher.categories[i].app_count > 0) {
+            non_empty_categories++;
+            total_loaded_apps += app_launcher.categories[i].app_count;
+            debug_log("Category: %s - %d apps",
+                     app_launcher.categories[i].category_name,
+                     app_launcher.categories[i].app_count);
+        }
+    }
+
+    debug_log("TOTAL: %d applications in %d categories", total_loaded_apps, non_empty_categories);
+    debug_log("=== APPLICATION LOADING COMPLETE ===");
+}
+
+void lock_screen() {
+    debug_log("Creating enhanced lock screen with modern diamond logo");
+
+    // Create a fullscreen lock window
+    Window lock_win = XCreateSimpleWindow(dpy, root, 0, 0,
+                                         DisplayWidth(dpy, screen),
+                                         DisplayHeight(dpy, screen),
+                                         0, black, background_dark);
+
+    // Drawing surface for the lock screen
+    Surface lock_surface;
+    surface_init(&lock_surface, lock_win, 1, DisplayWidth(dpy, screen), DisplayHeight(dpy, screen),
+                 background_dark);
+
+    // Grab keyboard and pointer
+    XGrabKeyboard(dpy, root, True, GrabModeAsync, GrabModeAsync, CurrentTime);
+    XGrabPointer(dpy, root, True, ButtonPressMask | PointerMotionMask,
+                 GrabModeAsync, GrabModeAsync, None, None, CurrentTime);
+
+    // Map the lock window
+    XMapWindow(dpy, lock_win);
+    raise_window(lock_win, LAYER_POPUP);
+
+    int screen_width = DisplayWidth(dpy, screen);
+    int screen_height = DisplayHeight(dpy, screen);
+    int center_x = screen_width / 2;
+    int center_y = screen_height / 2;
+
+    // Draw modern diamond logo (same as panel)
+    int diamond_size = 120;
+    int diamond_x = center_x - diamond_size / 2;
+    int diamond_y = center_y - diamond_size / 2 - 80;
+
+    draw_logo(&lock_surface, diamond_x, diamond_y, diamond_size);
+
+    // Draw "DiamondWM" text with anti-aliased font
+    char *title = "DiamondWM";
+    if (has_font(FONT_TITLE)) {
+        int title_x = center_x - text_width(FONT_TITLE, title) / 2;
+        int title_y = center_y + 40;
+        lock_surface.backend->text(&lock_surface, title_x, title_y + font_ascent(FONT_TITLE),
+                                   title, FONT_TITLE, text_primary);
+    }
+
+    // Draw lock message with anti-aliased font
+    char *message = "Press any key to unlock";
+    if (has_font(FONT_REGULAR)) {
+        int msg_x = center_x - text_width(FONT_REGULAR, message) / 2;
+        int msg_y = center_y + 80;
+        lock_surface.backend->text(&lock_surface, msg_x, msg_y + font_ascent(FONT_REGULAR),
+                                   message, FONT_REGULAR, text_secondary);
+    }
+
+    XFlush(dpy);
+
+    // Wait for any key press to unlock
+    XEvent ev;
+    int unlocked = 0;
+
+    while (!unlocked) {
+        XNextEvent(dpy, &ev);
+
+        if (ev.type == KeyPress || ev.type == ButtonPress) {
+            unlocked = 1;
+        }
+    }
+
+    // Cleanup
+    surface_free(&lock_surface);
+    XUngrabKeyboard(dpy, CurrentTime);
+    XUngrabPointer(dpy, CurrentTime);
+    XUnmapWindow(dpy, lock_win);
+    unstack_window(lock_win);
+    XDestroyWindow(dpy, lock_win);
+
+    show_operation_feedback("Screen unlocked");
+    debug_log("Enhanced lock screen deactivated");
+}
+
+
+void create_app_launcher() {
+    load_applications();
+    adopt_startup_wm_classes();
+
+    app_launcher.width = 350;
+    app_launcher.height = 600;
+    app_launcher.x = 100;
+    app_launcher.y = 100;
+    app_launcher.hover_item = -1;
+    app_launcher.alpha = 0.0f;
+    app_launcher.search_mode = 0;
+    app_launcher.search_text[0] = '\0';
+
+    app_launcher.win = create_popup_window(app_launcher.x, app_launcher.y,
+                                           app_launcher.width, app_launcher.height,
+                                           &app_launcher.window_surface, &app_launcher.surface);
+
+    // ADD KeyPressMask to receive keyboard events
+    XSelectInput(dpy, app_launcher.win, ButtonPressMask | ExposureMask | PointerMotionMask | KeyPressMask);
+    app_launcher.visible = 0;
+
+    debug_log("App launcher created: %dx%d", app_launcher.width, app_launcher.height);
+}
+
+void show_app_launcher(int x, int y) {
+    if (!app_launcher.visible) {
+        int screen_width = DisplayWidth(dpy, screen);
+        int screen_height = DisplayHeight(dpy, screen);
+
+        app_launcher.x = x;
+        app_launcher.y = y;
+
+        if (app_launcher.x + app_launcher.width > screen_width) {
+            app_launcher.x = screen_width - app_launcher.width - 10;
+        }
+        if (app_launcher.y + app_launcher.height > screen_height) {
+            app_launcher.y = screen_height - app_launcher.height - 10;
+        }
+
+        debug_log("show_app_launcher: positioning at %d,%d (clicked at %d,%d)",
+                 app_launcher.x, app_launcher.y, x, y);
+
+        XMoveWindow(dpy, app_launcher.win, app_launcher.x, app_launcher.y);
+        app_launcher.visible = 1;
+        app_launcher.alpha = 0.0f;
+        draw_app_launcher();
+        XMapWindow(dpy, app_launcher.win);
+        raise_window(app_launcher.win, LAYER_POPUP);
+
+        // GRAB THE KEYBOARD with proper error handling
+        int grab_result = XGrabKeyboard(dpy, root, False, GrabModeAsync, GrabModeAsync, CurrentTime);
+        if (grab_result != GrabSuccess) {
+            debug_log("WARNING: Could not grab keyboard, search may not work properly");
+        }
+
+        // Fade-in: the content is drawn once, each step only presents it
+        fade_popup(&app_launcher.window_surface, &app_launcher.surface, &app_launcher.alpha, 1);
+
+        XGrabPointer(dpy, root, False, ButtonPressMask, GrabModeAsync,
+                    GrabModeAsync, None, None, CurrentTime);
+    }
+}
+
+void hide_app_launcher() {
+    if (app_launcher.visible) {
+        // Fade-out animation
+        fade_popup(&app_launcher.window_surface, &app_launcher.surface, &app_launcher.alpha, 0);
+
+        XUnmapWindow(dpy, app_launcher.win);
+        app_launcher.visible = 0;
+        app_launcher.hover_item = -1;
+        app_launcher.search_mode = 0;
+        app_launcher.search_text[0] = '\0';
+        app_launcher.scroll = 0;
+
+        // UNGRAB THE KEYBOARD when hiding
+        XUngrabKeyboard(dpy, CurrentTime);
+        XUngrabPointer(dpy, CurrentTime);
+    }
+}
+
+// Add this function to filter applications based on search text
+void filter_applications_by_search() {
+    invalidate_launcher_rows();
+
+    if (app_launcher.search_text[0] == '\0') {
+        // If search is empty, show all categories expanded
+        for (int i = 0; i < app_launcher.category_count; i++) {
+            if (app_launcher.categories[i].app_count > 0) {
+                app_launcher.categories[i].expanded = 1;
+            }
+        }
+        return;
+    }
+
+    // Convert search text to lowercase for case-insensitive search
+    char search_lower[256];
+    strncpy(search_lower, app_launcher.search_text, sizeof(search_lower)-1);
+    search_lower[sizeof(search_lower)-1] = '\0';
+    for (char *p = search_lower; *p; p++) *p = tolower(*p);
+
+    // Filter applications based on search text
+    for (int i = 0; i < app_launcher.category_count; i++) {
+        AppCategory *cat = &app_launcher.categories[i];
+        int match_count = 0;
+
+        // Count matching apps in this category
+        for (int j = 0; j < cat->app_count; j++) {
+            char app_name_lower[256];
+            strncpy(app_name_lower, cat->apps[j].name, sizeof(app_name_lower)-1);
+            app_name_lower[sizeof(app_name_lower)-1] = '\0';
+            for (char *p = app_name_lower; *p; p++) *p = tolower(*p);
+
+            if (strstr(app_name_lower, search_lower) != NULL) {
+                match_count++;
+            }
+        }
+
+        // Expand category only if it has matching apps
+        cat->expanded = (match_count > 0);
+    }
+}
+
+// ---- Launcher list ----
+//
+// Only the rows inside the viewport are drawn. The rows are laid out once
+// into a table of offsets whenever the list changes shape, and drawing and
+// hit testing look them up there. list_surface keeps the visible slice:
+// scrolling shifts the pixels already in it and paints only the rows that
+// came into view, and a hover change repaints just the two rows involved.
+
+int launcher_viewport_height() {
+    return app_launcher.height - LAUNCHER_LIST_TOP - LAUNCHER_LIST_MARGIN;
+}
+
+void invalidate_launcher_rows() {
+    app_launcher.rows_valid = 0;
+}
+
+int add_launcher_row(int top, int height, int item, int category, int app) {
+    if (app_launcher.row_count == app_launcher.row_capacity) {
+        int capacity = app_launcher.row_capacity ? app_launcher.row_capacity * 2 : 64;
+        LauncherRow *rows = realloc(app_launcher.rows, capacity * sizeof(LauncherRow));
+        if (!rows) {
+            debug_log("ERROR: Failed to grow launcher rows to %d", capacity);
+            return 0;
+        }
+        app_launcher.rows = rows;
+        app_launcher.row_capacity = capacity;
+    }
+    LauncherRow *row = &app_launcher.rows[app_launcher.row_count++];
+    row->top = top;
+    row->height = height;
+    row->item = item;
+    row->category = category;
+    row->app = app;
+    return 1;
+}
+
+int max_launcher_scroll() {
+    int max = app_launcher.list_height - launcher_viewport_height();
+    return max > 0 ? max : 0;
+}
+
+// Headers are 25 pixels, apps 20, and each category ends with a 5 pixel gap.
+// Item numbers count only non-empty categories, like handle_app_launcher_click.
+void layout_launcher_rows() {
+    int top = 0, category_index = 0;
+
+    app_launcher.row_count = 0;
+    for (int i = 0; i < app_launcher.category_count; i++) {
+        AppCategory *cat = &app_launcher.categories[i];
+        if (cat->app_count == 0) continue;
+
+        if (cat->expanded) {
+            if (!add_launcher_row(top, 25, category_index << 16, i, -1)) break;
+            top += 25;
+            for (int j = 0; j < cat->app_count; j++) {
+                if (!add_launcher_row(top, 20, (category_index << 16) | (j + 1), i, j)) break;
+                top += 20;
+            }
+            app_launcher.rows[app_launcher.row_count - 1].height += 5;
+            top += 5;
+        }
+        category_index++;
+    }
+
+    app_launcher.list_height = top;
+    app_launcher.rows_valid = 1;
+    app_launcher.list_painted = 0;
+    if (app_launcher.scroll > max_launcher_scroll()) app_launcher.scroll = max_launcher_scroll();
+}
+
+// Index of the row at list offset y, or -1
+int launcher_row_at(int y) {
+    int low = 0, high = app_launcher.row_count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        LauncherRow *row = &app_launcher.rows[mid];
+        if (y < row->top) {
+            high = mid - 1;
+        } else if (y >= row->top + row->height) {
+            low = mid + 1;
+        } else {
+            return mid;
+        }
+    }
+    return -1;
+}
+
+void paint_launcher_row(Surface *list, LauncherRow *row) {
+    AppCategory *cat = &app_launcher.categories[row->category];
+    int baseline = row->top - app_launcher.scroll + 15;
+    int hover = app_launcher.hover_item == row->item;
+
+    list->backend->fill_rect(list, 0, row->top - app_launcher.scroll, list->width, row->height,
+                             background_dark);
+    if (row->app < 0) {
+        char category_text[100];
+        snprintf(category_text, sizeof(category_text), "%s (%d)", cat->category_name, cat->app_count);
+        if (hover) {
+            draw_rounded_rectangle(list, 15, baseline - 15, app_launcher.width - 30, 20, 4, menu_hover_bg);
+        }
+        list->backend->text(list, 20, baseline, category_text, FONT_FIXED, text_primary);
+    } else {
+        if (hover) {
+            draw_rounded_rectangle(list, 35, baseline - 15, app_launcher.width - 45, 20, 4, menu_hover_bg);
+        }
+        // Icon in the gutter left of the name
+        draw_atlas_icon(list, 18, baseline - 13, cat->apps[row->app].icon, LAUNCHER_ICON_SIZE);
+        list->backend->text(list, 40, baseline, cat->apps[row->app].name, FONT_FIXED, text_secondary);
+    }
+}
+
+// Repaint the viewport band [y0, y1); rows crossing its edges are redrawn whole
+void paint_launcher_rows(int y0, int y1) {
+    Surface *list = &app_launcher.list_surface;
+    list->backend->fill_rect(list, 0, y0, list->width, y1 - y0, background_dark);
+
+    int r = launcher_row_at(app_launcher.scroll + y0);
+    for (; r >= 0 && r < app_launcher.row_count; r++) {
+        if (app_launcher.rows[r].top - app_launcher.scroll >= y1) break;
+        paint_launcher_row(list, &app_launcher.rows[r]);
+    }
+}
+
+// Repaint the visible row showing item, if any
+void repaint_launcher_item(int item) {
+    if (item < 0) return;
+    int r = launcher_row_at(app_launcher.scroll);
+    for (; r >= 0 && r < app_launcher.row_count; r++) {
+        LauncherRow *row = &app_launcher.rows[r];
+        if (row->top - app_launcher.scroll >= app_launcher.list_surface.height) break;
+        if (row->item == item) {
+            paint_launcher_row(&app_launcher.list_surface, row);
+            break;
+        }
+    }
+}
+
+int init_launcher_list_surface() {
+    Surface *list = &app_launcher.list_surface;
+    int w = app_launcher.width, h = launcher_viewport_height();
+    if (renderer->argb_surfaces) return surface_init_argb(list, w, h);
+
+    Pixmap pixmap = XCreatePixmap(dpy, root, w, h, DefaultDepth(dpy, screen));
+    if (!surface_init(list, pixmap, 0, w, h, background_dark)) {
+        XFreePixmap(dpy, pixmap);
+        return 0;
+    }
+    return 1;
+}
+
+// Bring list_surface up to date with the rows, scroll position and hover
+void draw_launcher_list() {
+    Surface *list = &app_launcher.list_surface;
+    if (!list->backend && !init_launcher_list_surface()) return;
+    if (!app_launcher.rows_valid) layout_launcher_rows();
+    surface_begin_batch(list);
+
+    int view = list->height;
+    int delta = app_launcher.scroll - app_launcher.painted_scroll;
+    if (!app_launcher.list_painted || abs(delta) >= view) {
+        paint_launcher_rows(0, view);
+    } else {
+        if (delta > 0) {
+            list->backend->scroll_area(list, 0, 0, list->width, view, -delta);
+            paint_launcher_rows(view - delta, view);
+        } else if (delta < 0) {
+            list->backend->scroll_area(list, 0, 0, list->width, view, -delta);
+            paint_launcher_rows(0, -delta);
+        }
+        if (app_launcher.painted_hover != app_launcher.hover_item) {
+            repaint_launcher_item(app_launcher.painted_hover);
+            repaint_launcher_item(app_launcher.hover_item);
+        }
+    }
+
+    surface_end_batch(list);
+    app_launcher.list_painted = 1;
+    app_launcher.painted_scroll = app_launcher.scroll;
+    app_launcher.painted_hover = app_launcher.hover_item;
+}
+
+// Returns 1 if the list moved
+int scroll_app_launcher(int amount) {
+    if (!app_launcher.rows_valid) layout_launcher_rows();
+    int scroll = app_launcher.scroll + amount;
+    if (scroll > max_launcher_scroll()) scroll = max_launcher_scroll();
+    if (scroll < 0) scroll = 0;
+    if (scroll == app_launcher.scroll) return 0;
+    app_launcher.scroll = scroll;
+    return 1;
+}
+
+void draw_app_launcher() {
+    if (!app_launcher.visible) return;
+
+    Surface *s = &app_launcher.surface;
+    shape_window(&app_launcher.window_surface, app_launcher.width,
+                 app_launcher.height, CORNER_RADIUS, SHAPE_ALL);
+    s->backend->clear(s);
+    surface_begin_batch(s);
+
+    // Modern background with rounded corners
+    draw_rounded_rectangle(s, 0, 0, app_launcher.width, app_launcher.height, CORNER_RADIUS, background_dark);
+
+    // Only rows in view; the chrome below is drawn over the list's edges
+    draw_launcher_list();
+    s->backend->blit(s, &app_launcher.list_surface, 0, 0, app_launcher.list_surface.width,
+                     app_launcher.list_surface.height, 0, LAUNCHER_LIST_TOP);
+
+    // Draw border with accent color
+    s->backend->stroke_rect(s, 1, 1, app_launcher.width - 3, app_launcher.height - 3, 1, accent_color);
+
+    // Draw search bar
+    s->backend->fill_rect(s, 10, 10, app_launcher.width-20, 30,
+                          app_launcher.search_mode ? accent_color : 0x3D3D4D);
+    s->backend->stroke_rect(s, 10, 10, app_launcher.width-20, 30, 1,
+                            app_launcher.search_mode ? accent_color : 0x555555);
+
+    if (app_launcher.search_text[0] == '\0') {
+        s->backend->text(s, 20, 30, "Search applications...", FONT_FIXED, text_primary);
+    } else {
+        s->backend->text(s, 20, 30, app_launcher.search_text, FONT_FIXED, text_primary);
+
+        // Show cursor when in search mode
+        if (app_launcher.search_mode) {
+            int width = text_width(FONT_FIXED, app_launcher.search_text);
+            s->backend->draw_line(s, 20 + width, 15, 20 + width, 25, text_primary);
+        }
+    }
+
+    // Draw title with search info - FIXED TRUNCATION
+    if (app_launcher.search_text[0] != '\0') {
+        char title[256];  // INCREASED BUFFER SIZE
+        // Truncate search text if too long for display
+        char display_search[50];
+        strncpy(display_search, app_launcher.search_text, sizeof(display_search)-1);
+        display_search[sizeof(display_search)-1] = '\0';
+        if (strlen(app_launcher.search_text) > sizeof(display_search)-1) {
+            strcpy(display_search + sizeof(display_search)-4, "...");
+        }
+        snprintf(title, sizeof(title), "Search: '%s'", display_search);
+        s->backend->text(s, 10, 55, title, FONT_FIXED, text_primary);
+    } else {
+        s->backend->text(s, 10, 55, "Applications", FONT_FIXED, text_primary);
+    }
+
+    s->backend->draw_line(s, 0, 60, app_launcher.width, 60, 0x404040);
+
+    // Show search instructions
+    if (app_launcher.search_mode) {
+        s->backend->text(s, 10, app_launcher.height - 10,
+                         "Press Enter to launch first result, Esc to cancel", FONT_FIXED, text_secondary);
+    }
+
+    surface_end_batch(s);
+    present_popup(&app_launcher.window_surface, s, app_launcher.alpha);
+}
+
+int is_in_app_launcher_area(int x, int y) {
+    if (!app_launcher.visible) return 0;
+
+    int result = (x >= app_launcher.x && x <= app_launcher.x + app_launcher.width &&
+                 y >= app_launcher.y && y <= app_launcher.y + app_launcher.height);
+
+    debug_log("is_in_app_launcher_area: checking %d,%d against [%d,%d - %d,%d] -> %d",
+             x, y, app_launcher.x, app_launcher.y,
+             app_launcher.x + app_launcher.width, app_launcher.y + app_launcher.height,
+             result);
+
+    return result;
+}
+
+int get_app_launcher_item_at(int x, int y) {
+    if (!app_launcher.visible) return -1;
+
+    int relative_x = x - app_launcher.x;
+    int relative_y = y - app_launcher.y;
+
+    debug_log("get_app_launcher_item_at: abs(%d,%d) -> rel(%d,%d) in window %dx%d",
+             x, y, relative_x, relative_y, app_launcher.width, app_launcher.height);
+
+    if (relative_x < 0 || relative_x > app_launcher.width ||
+        relative_y < 0 || relative_y > app_launcher.height) {
+        debug_log("  -> Outside app launcher bounds");
+        return -1;
+    }
+
+    // Check if click is in search area
+    if (relative_y >= 10 && relative_y <= 40) {
+        debug_log("  -> In search area");
+        return -2; // Special value for search area
+    }
+
+    int view_y = relative_y - LAUNCHER_LIST_TOP;
+    if (view_y < 0 || view_y >= launcher_viewport_height()) {
+        debug_log("  -> Outside the list (y=%d)", relative_y);
+        return -1;
+    }
+
+    if (!app_launcher.rows_valid) layout_launcher_rows();
+    int r = launcher_row_at(app_launcher.scroll + view_y);
+    if (r < 0) {
+        debug_log("  -> No item found at relative_y=%d", relative_y);
+        return -1;
+    }
+
+    debug_log("  -> Row %d, item 0x%x", r, app_launcher.rows[r].item);
+    return app_launcher.rows[r].item;
+}
+
+void handle_app_launcher_click(int x, int y) {
+    int item = get_app_launcher_item_at(x, y);
+
+    debug_log("App launcher click: item=0x%x at %d,%d", item, x, y);
+
+    if (item == -1) {
+        hide_app_launcher();
+        return;
+    }
+
+    if (item == -2) {
+        // Clicked search area - toggle search mode
+        app_launcher.search_mode = !app_launcher.search_mode;
+        if (app_launcher.search_mode) {
+            show_operation_feedback("Search mode activated - type to search");
+        }
+        draw_app_launcher();
+        return;
+    }
+
+    if (item < 0x10000) {
+        int cat_index = item;
+        int actual_cat_index = -1;
+        int count = 0;
+
+        for (int i = 0; i < app_launcher.category_count; i++) {
+            if (app_launcher.categories[i].app_count > 0) {
+                if (count == cat_index) {
+                    actual_cat_index = i;
+                    break;
+                }
+                count++;
+            }
+        }
+
+        if (actual_cat_index != -1) {
+            app_launcher.categories[actual_cat_index].expanded =
+                !app_launcher.categories[actual_cat_index].expanded;
+            invalidate_launcher_rows();
+            debug_log("Toggled category %s (index %d, expanded=%d)",
+                     app_launcher.categories[actual_cat_index].category_name,
+                     actual_cat_index, app_launcher.categories[actual_cat_index].expanded);
+            draw_app_launcher();
+        } else {
+            debug_log("ERROR: Could not find category for index %d", cat_index);
+        }
+    } else {
+        int cat_index = (item >> 16) & 0xFFFF;
+        int app_index = (item & 0xFFFF) - 1;
+
+        debug_log("App clicked: category=%d, app=%d", cat_index, app_index);
+
+        int actual_cat_index = -1;
+        int count = 0;
+        for (int i = 0; i < app_launcher.category_count; i++) {
+            if (app_launcher.categories[i].app_count > 0) {
+                if (count == cat_index) {
+                    actual_cat_index = i;
+                    break;
+                }
+                count++;
+            }
+        }
+
+        if (actual_cat_index != -1 &&
+            app_index >= 0 &&
+            app_index < app_launcher.categories[actual_cat_index].app_count) {
+
+            AppInfo *app = &app_launcher.categories[actual_cat_index].apps[app_index];
+            debug_log("Launching: %s -> %s", app->name, app->exec);
+
+            pid_t pid = fork();
+            if (pid == 0) {
+                setsid();
+                execl("/bin/sh", "sh", "-c", app->exec, NULL);
+                exit(0);
+            } else if (pid > 0) {
+                show_operation_feedback("Application launched");
+                hide_app_launcher();
+            } else {
+                debug_log("ERROR: Failed to fork for application launch");
+                show_operation_feedback("Failed to launch application");
+            }
+        } else {
+            debug_log("ERROR: Invalid app selection: cat_index=%d, actual_cat_index=%d, app_index=%d",
+                     cat_index, actual_cat_index, app_index);
+        }
+    }
+}
+
+void free_applications() {
+    for (int i = 0; i < app_launcher.category_count; i++) {
+        AppCategory *cat = &app_launcher.categories[i];
+
+        free(cat->category_name);
+
+        for (int j = 0; j < cat->app_count; j++) {
+            free(cat->apps[j].name);
+            free(cat->apps[j].exec);
+            free(cat->apps[j].categories);
+            if (cat->apps[j].comment) free(cat->apps[j].comment);
+            if (cat->apps[j].icon) free(cat->apps[j].icon);
+            free(cat->apps[j].wm_class);
+        }
+
+        if (cat->apps) free(cat->apps);
+    }
+
+    if (app_launcher.categories) free(app_launcher.categories);
+
+    free(app_launcher.rows);
+    app_launcher.rows = NULL;
+    app_launcher.row_count = app_launcher.row_capacity = 0;
+    invalidate_launcher_rows();
+}
+
+// Pinned Apps Functions Implementation
+
+char* get_panel_config_path() {
+    static char path[512];
+    struct passwd *pw = getpwuid(getuid());
+    const char *home = pw ? pw->pw_dir : getenv("HOME");
+
+    snprintf(path, sizeof(path), "%s/.diamondwm/pinned_apps.conf", home);
+    return path;
+}
+
+void ensure_config_dir() {
+    struct passwd *pw = getpwuid(getuid());
+    const char *home = pw ? pw->pw_dir : getenv("HOME");
+    char dir_path[512];
+
+    snprintf(dir_path, sizeof(dir_path), "%s/.diamondwm", home);
+    mkdir(dir_path, 0755);
+}
+
+void save_pinned_apps() {
+    ensure_config_dir();
+    FILE *file = fopen(get_panel_config_path(), "w");
+    if (!file) {
+        debug_log("ERROR: Could not save pinned apps to %s", get_panel_config_path());
+        return;
+    }
+
+    for (int i = 0; i < pinned_apps.app_count; i++) {
+        fprintf(file, "%s|%s|%s|%s\n",
+                pinned_apps.apps[i].name ? pinned_apps.apps[i].name : "",
+                pinned_apps.apps[i].exec ? pinned_apps.apps[i].exec : "",
+                pinned_apps.apps[i].icon_path ? pinned_apps.apps[i].icon_path : "",
+                pinned_apps.apps[i].wm_class ? pinned_apps.apps[i].wm_class : "");
+
+        debug_log("Saved pinned app: %s -> %s",
+                 pinned_apps.apps[i].name ? pinned_apps.apps[i].name : "NULL",
+                 pinned_apps.apps[i].exec ? pinned_apps.apps[i].exec : "NULL");
+    }
+
+    fclose(file);
+    debug_log("Saved %d pinned apps to %s", pinned_apps.app_count, get_panel_config_path());
+}
+
+void load_pinned_apps() {
+    FILE *file = fopen(get_panel_config_path(), "r");
+    if (!file) {
+        debug_log("No pinned apps config found at %s", get_panel_config_path());
+        return;
+    }
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = 0;
+
+        // Skip empty lines
+        if (strlen(line) == 0) continue;
+
+        debug_log("Reading pinned app line: '%s'", line);
+
+        // name|exec|icon_path|wm_class; fields may be empty
+        char *rest = line;
+        char *name = strsep(&rest, "|");
+        char *exec = strsep(&rest, "|");
+        char *icon_path = strsep(&rest, "|");
+        char *wm_class = strsep(&rest, "|");
+        if (icon_path && !*icon_path) icon_path = NULL;
+
+        debug_log("Parsed: name='%s', exec='%s', icon_path='%s'",
+                 name ? name : "NULL",
+                 exec ? exec : "NULL",
+                 icon_path ? icon_path : "NULL");
+
+        if (name && strlen(name) > 0) {
+            // Add to pinned apps
+            if (pinned_apps.app_count >= pinned_apps.max_apps) {
+                pinned_apps.max_apps += 10;
+                pinned_apps.apps = realloc(pinned_apps.apps, sizeof(PinnedApp) * pinned_apps.max_apps);
+            }
+
+            PinnedApp *app = &pinned_apps.apps[pinned_apps.app_count++];
+            app->name = strdup(name);
+
+            // If exec is empty, try to guess it from the name
+            if (exec && strlen(exec) > 0) {
+                app->exec = strdup(exec);
+            } else {
+                // Guess the command from the app name
+                if (strstr(name, "Firefox") || strstr(name, "Mozilla")) {
+                    app->exec = strdup("firefox");
+                } else if (strstr(name, "Pulsar")) {
+                    app->exec = strdup("pulsar");
+                } else if (strstr(name, "xterm") || strstr(name, "XTerm")) {
+                    app->exec = strdup("xterm");
+                } else if (strstr(name, "Terminal")) {
+                    app->exec = strdup("xterm");
+                } else {
+                    // Fallback: use the name in lowercase
+                    app->exec = malloc(strlen(name) + 1);
+                    if (app->exec) {
+                        strcpy(app->exec, name);
+                        // Convert to lowercase and remove spaces
+                        for (char *p = app->exec; *p; p++) {
+                            *p = tolower(*p);
+                            if (*p == ' ') *p = '-';
+                        }
+                    }
+                }
+                debug_log("Guessed exec for '%s': %s", name, app->exec);
+            }
+
+            app->icon_path = icon_path ? strdup(icon_path) : NULL;
+            app->icon_win = 0;
+            app->x_position = 0;
+            app->key = NULL;
+            app->wm_class = wm_class && *wm_class ? strdup(wm_class) : NULL;
+            app->class_key = NULL;
+            app->pid = 0;
+            app->clients = NULL;
+            app->client_count = 0;
+
+            debug_log("Loaded pinned app: '%s' -> '%s'", name, app->exec);
+        }
+    }
+
+    fclose(file);
+    rebuild_pinned_associations();
+    debug_log("Loaded %d pinned apps total", pinned_apps.app_count);
+}
+
+
+// ---- Interned strings ----
+//
+// Titles, WM_CLASS names and pinned app names are interned, so two equal
+// strings are the same pointer. Matching windows to pinned apps is then a
+// pointer comparison, and whether an app is running is a counter on its
+// name instead of a scan over every window title.
+
+unsigned int string_hash(const char *text) {
+    unsigned int hash = 2166136261u; // FNV-1a
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+// The interned copy of text, or NULL if nothing holds one
+InternedString *find_interned(const char *text) {
+    if (!string_table.size) return NULL;
+    unsigned int hash = string_hash(text);
+    for (InternedString *s = string_table.buckets[hash & (string_table.size - 1)]; s; s = s->next) {
+        if (s->hash == hash && strcmp(s->text, text) == 0) return s;
+    }
+    return NULL;
+}
+
+int string_table_grow() {
+    int size = string_table.size ? string_table.size * 2 : STRING_TABLE_MIN;
+    InternedString **buckets = calloc(size, sizeof(InternedString *));
+    if (!buckets) return 0;
+
+    for (int i = 0; i < string_table.size; i++) {
+        InternedString *s = string_table.buckets[i];
+        while (s) {
+            InternedString *next = s->next;
+            s->next = buckets[s->hash & (size - 1)];
+            buckets[s->hash & (size - 1)] = s;
+            s = next;
+        }
+    }
+    free(string_table.buckets);
+    string_table.buckets = buckets;
+    string_table.size = size;
+    return 1;
+}
+
+// Take a reference to the interned copy of text, creating it if needed
+InternedString *intern_string(const char *text) {
+    if (!text) return NULL;
+
+    InternedString *s = find_interned(text);
+    if (s) {
+        s->refs++;
+        return s;
+    }
+
+    if (string_table.count >= string_table.size && !string_table_grow() &&
+        !string_table.size) {
+        return NULL;
+    }
+    s = calloc(1, sizeof(InternedString));
+    if (!s || !(s->text = strdup(text))) {
+        free(s);
+        return NULL;
+    }
+    s->hash = string_hash(text);
+    s->refs = 1;
+    InternedString **bucket = &string_table.buckets[s->hash & (string_table.size - 1)];
+    s->next = *bucket;
+    *bucket = s;
+    string_table.count++;
+    return s;
+}
+
+void release_string(InternedString *s) {
+    if (!s || --s->refs > 0) return;
+
+    InternedString **link = &string_table.buckets[s->hash & (string_table.size - 1)];
+    while (*link != s) link = &(*link)->next;
+    *link = s->next;
+    string_table.count--;
+    free(s->text);
+    free(s);
+}
+
+void free_string_table() {
+    for (int i = 0; i < string_table.size; i++) {
+        InternedString *s = string_table.buckets[i];
+        while (s) {
+            InternedString *next = s->next;
+            free(s->text);
+            free(s);
+            s = next;
+        }
+    }
+    free(string_table.buckets);
+    memset(&string_table, 0, sizeof(string_table));
+}
+
+// Replace c's title, taking over the caller's reference
+void set_client_title(Client *c, InternedString *title) {
+    release_string(c->title);
+    c->title = title;
+}
+
+// Interned lowercase copy of text, for case-blind class matching
+InternedString *intern_lowercase(const char *text) {
+    if (!text) return NULL;
+    char lower[256];
+    size_t i;
+    for (i = 0; text[i] && i < sizeof(lower) - 1; i++) lower[i] = tolower((unsigned char)text[i]);
+    lower[i] = '\0';
+    return intern_string(lower);
+}
+
+InternedString *pinned_app_key(PinnedApp *app) {
+    if (!app->key && app->name) app->key = intern_string(app->name);
+    return app->key;
+}
+
+// ---- Pinned app windows ----
+//
+// Each pinned app keeps the list of its live windows. A window joins one
+// when it is managed or its WM_CLASS changes, and leaves when unmanaged, so
+// asking whether an app runs or which window to show is a field read. A
+// window belongs to the app that launched it (_NET_WM_PID), else to the
+// app whose class it carries; only windows without WM_CLASS fall back to
+// matching the title.
+
+// First word of exec without its directory, e.g. "firefox" for "/usr/bin/firefox %u"
+void exec_command_name(const char *exec, char *command, size_t size) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", exec);
+    buffer[strcspn(buffer, " \t")] = '\0';
+    char *base = strrchr(buffer, '/');
+    snprintf(command, size, "%s", base ? base + 1 : buffer);
+}
+
+// The class an app's windows carry: from the config or the app's
+// StartupWMClass (see adopt_startup_wm_classes), else the command name
+InternedString *pinned_app_class(PinnedApp *app) {
+    if (app->class_key) return app->class_key;
+
+    if (app->wm_class && *app->wm_class) {
+        app->class_key = intern_lowercase(app->wm_class);
+    } else if (app->exec && *app->exec) {
+        char command[256];
+        exec_command_name(app->exec, command, sizeof(command));
+        app->class_key = intern_lowercase(command);
+    }
+    return app->class_key;
+}
+
+// Pinned apps saved without a class take the StartupWMClass of the
+// installed application that runs the same command
+void adopt_startup_wm_classes() {
+    int changed = 0;
+    for (int i = 0; i < pinned_apps.app_count; i++) {
+        PinnedApp *app = &pinned_apps.apps[i];
+        if ((app->wm_class && *app->wm_class) || !app->exec || !*app->exec) continue;
+
+        char command[256];
+        exec_command_name(app->exec, command, sizeof(command));
+        for (int j = 0; j < app_launcher.category_count && !app->wm_class; j++) {
+            AppCategory *cat = &app_launcher.categories[j];
+            for (int k = 0; k < cat->app_count; k++) {
+                AppInfo *info = &cat->apps[k];
+                char info_command[256];
+                if (!info->wm_class || !*info->wm_class) continue;
+                exec_command_name(info->exec, info_command, sizeof(info_command));
+                if (strcmp(command, info_command) != 0) continue;
+
+                free(app->wm_class);
+                app->wm_class = strdup(info->wm_class);
+                release_string(app->class_key);
+                app->class_key = NULL;
+                changed = 1;
+                break;
+            }
+        }
+    }
+    if (changed) rebuild_pinned_associations();
+}
+
+PinnedApp *match_pinned_app(Client *c) {
+    // Launch PID first, across every app: pinned apps may share a class
+    if (c->pid) {
+        for (int i = 0; i < pinned_apps.app_count; i++) {
+            if (pinned_apps.apps[i].pid == c->pid) return &pinned_apps.apps[i];
+        }
+    }
+
+    PinnedApp *by_title = NULL;
+    for (int i = 0; i < pinned_apps.app_count; i++) {
+        PinnedApp *app = &pinned_apps.apps[i];
+        InternedString *class_key = pinned_app_class(app);
+        if (class_key && (class_key == c->wm_class || class_key == c->wm_instance)) return app;
+
+        if (!c->wm_class && !by_title && c->title && c->title == pinned_app_key(app)) {
+            by_title = app;
+        }
+    }
+    return by_title;
+}
+
+// An app keeps its launch PID while a window with that PID is alive, then
+// drops it so a reused PID can't claim an unrelated window
+void release_launch_pid(PinnedApp *app, pid_t pid) {
+    if (!app || !pid || app->pid != pid) return;
+    for (Client *c = app->clients; c; c = c->pinned_next) {
+        if (c->pid == pid) return;
+    }
+    app->pid = 0;
+}
+
+void dissociate_client(Client *c) {
+    PinnedApp *app = c->pinned_app;
+    if (!app) return;
+
+    Client **link = &app->clients;
+    while (*link && *link != c) link = &(*link)->pinned_next;
+    if (*link) *link = c->pinned_next;
+    app->client_count--;
+    c->pinned_app = NULL;
+    c->pinned_next = NULL;
+}
+
+// Attach c to the pinned app it belongs to, if any
+void associate_client(Client *c) {
+    dissociate_client(c);
+    PinnedApp *app = match_pinned_app(c);
+    if (!app) return;
+
+    c->pinned_app = app;
+    c->pinned_next = app->clients;
+    app->clients = c;
+    app->client_count++;
+}
+
+// After pinned_apps itself changed: entries moved, appeared or went away
+void rebuild_pinned_associations() {
+    for (int i = 0; i < pinned_apps.app_count; i++) {
+        pinned_apps.apps[i].clients = NULL;
+        pinned_apps.apps[i].client_count = 0;
+    }
+    for (Client *c = client_registry.head; c; c = c->next) {
+        c->pinned_app = NULL;
+        c->pinned_next = NULL;
+        associate_client(c);
+    }
+}
+
+// WM_CLASS and _NET_WM_PID, which decide the pinned app a window belongs to
+void read_client_class(Client *c) {
+    release_string(c->wm_instance);
+    release_string(c->wm_class);
+    c->wm_instance = c->wm_class = NULL;
+
+    XClassHint class_hint;
+    if (XGetClassHint(dpy, c->win, &class_hint)) {
+        c->wm_instance = intern_lowercase(class_hint.res_name);
+        c->wm_class = intern_lowercase(class_hint.res_class);
+        if (class_hint.res_name) XFree(class_hint.res_name);
+        if (class_hint.res_class) XFree(class_hint.res_class);
+    }
+
+    Atom type;
+    int format;
+    unsigned long count, after;
+    unsigned char *data = NULL;
+    c->pid = 0;
+    if (XGetWindowProperty(dpy, c->win, atoms[ATOM_NET_WM_PID], 0, 1, False,
+                           XA_CARDINAL, &type, &format, &count, &after, &data) == Success && data) {
+        if (count > 0 && format == 32) c->pid = (pid_t)*(unsigned long *)data;
+        XFree(data);
+    }
+}
+
+Client *find_pinned_app_client(PinnedApp *app) {
+    return app->clients;
+}
+
+int is_app_pinned(Client *c) {
+    return c && c->pinned_app;
+}
+
+void pin_app_to_panel(Client *c) {
+    if (!c || !c->title || is_app_pinned(c)) {
+        debug_log("App already pinned or invalid client");
+        return;
+    }
+    const char *title = c->title->text;
+
+    // Try to get the executable command from the window
+    char *exec_cmd = NULL;
+
+    // Method 1: Try to get _NET_WM_PID and then get command from /proc
+    Atom net_wm_pid = atoms[ATOM_NET_WM_PID];
+    Atom type;
+    int format;
+    unsigned long nitems, bytes_after;
+    unsigned char *data = NULL;
+
+    if (XGetWindowProperty(dpy, c->win, net_wm_pid, 0, 1, False,
+                          XA_CARDINAL, &type, &format, &nitems, &bytes_after, &data) == Success) {
+        if (data && nitems > 0) {
+            pid_t pid = *(pid_t*)data;
+            debug_log("Found PID for window: %d", pid);
+
+            // Try to get command from /proc
+            char proc_path[256];
+            snprintf(proc_path, sizeof(proc_path), "/proc/%d/cmdline", pid);
+            FILE *proc_file = fopen(proc_path, "r");
+            if (proc_file) {
+                char cmdline[1024];
+                if (fgets(cmdline, sizeof(cmdline), proc_file)) {
+                    // cmdline is null-separated, get the first part (executable name)
+                    exec_cmd = strdup(cmdline);
+                    // Extract just the basename
+                    char *basename = strrchr(exec_cmd, '/');
+                    if (basename) {
+                        basename++; // Skip the '/'
+                        free(exec_cmd);
+                        exec_cmd = strdup(basename);
+                    }
+                    debug_log("Found command from PID: %s", exec_cmd);
+                }
+                fclose(proc_file);
+            }
+            XFree(data);
+        }
+    }
+
+    // Method 2: If we couldn't get from PID, try to guess from window title
+    if (!exec_cmd) {
+        // Common application mappings
+        if (strstr(title, "Firefox") || strstr(title, "Mozilla")) {
+            exec_cmd = strdup("firefox");
+        } else if (strstr(title, "Pulsar")) {
+            exec_cmd = strdup("pulsar");
+        } else if (strstr(title, "xterm") || strstr(title, "XTerm")) {
+            exec_cmd = strdup("xterm");
+        } else if (strstr(title, "Terminal")) {
+            exec_cmd = strdup("xterm");
+        } else {
+            // Fallback: use the title in lowercase as command
+            exec_cmd = malloc(strlen(title) + 1);
+            if (exec_cmd) {
+                strcpy(exec_cmd, title);
+                // Convert to lowercase and remove spaces
+                for (char *p = exec_cmd; *p; p++) {
+                    *p = tolower(*p);
+                    if (*p == ' ') *p = '-';
+                }
+            }
+        }
+        debug_log("Guessed command from title: %s", exec_cmd);
+    }
+
+    // Method 3: If all else fails, use a safe default
+    if (!exec_cmd) {
+        exec_cmd = strdup(title);
+        debug_log("Using title as fallback command: %s", exec_cmd);
+    }
+
+    // Add to pinned apps
+    if (pinned_apps.app_count >= pinned_apps.max_apps) {
+        pinned_apps.max_apps += 10;
+        pinned_apps.apps = realloc(pinned_apps.apps, sizeof(PinnedApp) * pinned_apps.max_apps);
+    }
+
+    PinnedApp *app = &pinned_apps.apps[pinned_apps.app_count++];
+    app->name = strdup(title);
+    app->exec = exec_cmd;
+    app->icon_path = NULL;
+    app->icon_win = 0;
+    app->x_position = 0;
+    app->key = NULL;
+    app->wm_class = c->wm_class ? strdup(c->wm_class->text) : NULL;
+    app->class_key = NULL;
+    app->pid = 0;
+    rebuild_pinned_associations();
+
+    // Save to config
+    save_pinned_apps();
+
+    // Redraw panel to show new pinned app
+    draw_panel();
+
+    debug_log("Pinned app to panel: %s -> %s", title, exec_cmd);
+}
+
+void unpin_app(PinnedApp *app) {
+    // Find and remove the app
+    for (int i = 0; i < pinned_apps.app_count; i++) {
+        if (&pinned_apps.apps[i] == app) {
+            debug_log("Unpinning app at index %d: %s", i, app->name);
+
+            free(pinned_apps.apps[i].name);
+            free(pinned_apps.apps[i].exec);
+            free(pinned_apps.apps[i].icon_path);
+            release_string(pinned_apps.apps[i].key);
+            free(pinned_apps.apps[i].wm_class);
+            release_string(pinned_apps.apps[i].class_key);
+
+            // Shift remaining apps
+            for (int j = i; j < pinned_apps.app_count - 1; j++) {
+                pinned_apps.apps[j] = pinned_apps.apps[j + 1];
+            }
+            pinned_apps.app_count--;
+            rebuild_pinned_associations();
+
+            save_pinned_apps();
+            draw_panel();
+            debug_log("Unpinned app: %s, new count: %d", app->name, pinned_apps.app_count);
+            return;
+        }
+    }
+    debug_log("ERROR: App not found for unpinning: %s", app->name);
+}
+
+int is_app_running(PinnedApp *app) {
+    return app->client_count > 0;
+}
+
+// Show every window of app: the first one's desktop becomes current, and
+// the app's windows there come back from minimized and go on top, the
+// first one last, with the focus
+void show_pinned_app_windows(PinnedApp *app) {
+    Client *first = app->clients;
+    if (!first) return;
+
+    restore_client(first);
+    for (Client *c = first->pinned_next; c; c = c->pinned_next) {
+        if (!client_on_current_desktop(c)) continue;
+        restore_client(c);
+        raise_client(c);
+    }
+    raise_client(first);
+    focus_client(first);
+}
+
+void create_pinned_app_menu() {
+    pinned_app_menu.width = MENU_WIDTH;
+    pinned_app_menu.height = MENU_ITEM_HEIGHT * 5;
+    pinned_app_menu.x = 0;
+    pinned_app_menu.y = 0;
+    pinned_app_menu.hover_item = -1;
+    pinned_app_menu.alpha = 0.0f;
+    pinned_app_menu.target_pinned_app = NULL;
+
+    pinned_app_menu.win = create_popup_window(pinned_app_menu.x,
+                                              pinned_app_menu.y,
+                                              pinned_app_menu.width,
+                                              pinned_app_menu.height,
+                                              &pinned_app_menu.window_surface,
+                                              &pinned_app_menu.surface);
+
+    XSelectInput(dpy, pinned_app_menu.win, ButtonPressMask | ExposureMask | PointerMotionMask);
+    pinned_app_menu.visible = 0;
+}
+
+void show_pinned_app_menu(int x, int y, PinnedApp *app) {
+    if (!pinned_app_menu.visible && app) {
+        pinned_app_menu.target_pinned_app = app;
+
+        // Position ABOVE the pinned app icon
+        pinned_app_menu.x = x;
+        pinned_app_menu.y = panel.y - pinned_app_menu.height - 5;
+
+        // Keep menu on screen horizontally
+        if (pinned_app_menu.x + pinned_app_menu.width > DisplayWidth(dpy, screen)) {
+            pinned_app_menu.x = DisplayWidth(dpy, screen) - pinned_app_menu.width;
+        }
+        if (pinned_app_menu.x < 0) {
+            pinned_app_menu.x = 0;
+        }
+
+        XMoveWindow(dpy, pinned_app_menu.win, pinned_app_menu.x, pinned_app_menu.y);
+        pinned_app_menu.visible = 1;
+        pinned_app_menu.alpha = 0.0f;
+        draw_pinned_app_menu();
+        XMapWindow(dpy, pinned_app_menu.win);
+        raise_window(pinned_app_menu.win, LAYER_POPUP);
+
+        // Fade-in: the content is drawn once, each step only presents it
+        fade_popup(&pinned_app_menu.window_surface, &pinned_app_menu.surface,
+                   &pinned_app_menu.alpha, 1);
+
+        XGrabPointer(dpy, root, False, ButtonPressMask, GrabModeAsync,
+                    GrabModeAsync, None, None, CurrentTime);
+    }
+}
+
+
+void hide_pinned_app_menu() {
+    if (pinned_app_menu.visible) {
+        // Fade-out animation
+        fade_popup(&pinned_app_menu.window_surface, &pinned_app_menu.surface,
+                   &pinned_app_menu.alpha, 0);
+
+        XUnmapWindow(dpy, pinned_app_menu.win);
+        pinned_app_menu.visible = 0;
+        pinned_app_menu.hover_item = -1;
+        pinned_app_menu.target_pinned_app = NULL;
+        XUngrabPointer(dpy, CurrentTime);
+    }
+}
+
+void draw_pinned_app_menu() {
+    if (!pinned_app_menu.visible) return;
+
+    Surface *s = &pinned_app_menu.surface;
+    shape_window(&pinned_app_menu.window_surface, pinned_app_menu.width,
+                 pinned_app_menu.height, CORNER_RADIUS, SHAPE_ALL);
+    s->backend->clear(s);
+    surface_begin_batch(s);
+
+    // Draw rounded background with gradient
+    draw_rounded_rectangle(s, 0, 0, pinned_app_menu.width, pinned_app_menu.height,
+                          CORNER_RADIUS, menu_bg);
+
+    // Draw subtle border
+    s->backend->stroke_rect(s, 1, 1, pinned_app_menu.width - 3, pinned_app_menu.height - 3,
+                            1, accent_color);
+
+    // Check if app is already running and find its window
+    Client *target_client = NULL;
+    if (pinned_app_menu.target_pinned_app) {
+        target_client = find_pinned_app_client(pinned_app_menu.target_pinned_app);
+    }
+
+    int is_running = (target_client != NULL);
+    char *items[5];
+
+    if (is_running) {
+        items[0] = "Show Windows";
+        items[1] = "Maximize";
+        items[2] = "Minimize";
+        items[3] = "Close";
+        items[4] = "Unpin from Panel";
+    } else {
+        items[0] = "Launch";
+        items[1] = ""; // Empty for non-running apps
+        items[2] = ""; // Empty for non-running apps
+        items[3] = ""; // Empty for non-running apps
+        items[4] = "Unpin from Panel";
+    }
+
+    for (int i = 0; i < 5; i++) {
+        // Skip empty menu items for non-running apps
+        if (!is_running && (i == 1 || i == 2 || i == 3)) continue;
+
+        int y = i * MENU_ITEM_HEIGHT;
+
+        // Hover effect
+        if (pinned_app_menu.hover_item == i) {
+            draw_rounded_rectangle(s, 2, y + 2, pinned_app_menu.width - 4, MENU_ITEM_HEIGHT - 4,
+                                  4, menu_hover_bg);
+        }
+
+        if (i > 0 && strlen(items[i]) > 0 && strlen(items[i-1]) > 0) {
+            s->backend->draw_line(s, 10, y, pinned_app_menu.width - 10, y, 0x404040);
+        }
+
+        int width = text_width(FONT_FIXED, items[i]);
+        int text_x = (pinned_app_menu.width - width) / 2;
+        int text_y = y + (MENU_ITEM_HEIGHT / 2) + 5;
+
+        s->backend->text(s, text_x, text_y, items[i], FONT_FIXED, text_primary);
+    }
+
+    surface_end_batch(s);
+    present_popup(&pinned_app_menu.window_surface, s, pinned_app_menu.alpha);
+}
+
+void free_pinned_apps() {
+    for (int i = 0; i < pinned_apps.app_count; i++) {
+        free(pinned_apps.apps[i].name);
+        free(pinned_apps.apps[i].exec);
+        free(pinned_apps.apps[i].icon_path);
+    }
+    free(pinned_apps.apps);
+}
+
+void create_panel() {
+    int screen_width = DisplayWidth(dpy, screen);
+    int screen_height = DisplayHeight(dpy, screen);
+
+    debug_log("Screen dimensions: %dx%d", screen_width, screen_height);
+
+    panel.width = screen_width;
+    panel.height = PANEL_HEIGHT;
+    panel.x = 0;
+    panel.y = screen_height - PANEL_HEIGHT;
+
+    panel.win = XCreateSimpleWindow(dpy, root, panel.x, panel.y,
+                                   panel.width, panel.height, 0,
+                                   dark_blue, dark_blue);
+    debug_log("Panel window created: %lu", panel.win);
+
+    XSelectInput(dpy, panel.win, ButtonPressMask | ButtonReleaseMask |
+                 PointerMotionMask | ExposureMask);
+    surface_init(&panel.surface, panel.win, 1, panel.width, panel.height, dark_blue);
+    XMapWindow(dpy, panel.win);
+    debug_log("Panel window mapped");
+
+    // Above ordinary windows, below fullscreen ones and popups
+    raise_window(panel.win, LAYER_PANEL);
+}
+
+void setup_mouse_cursor() {
+    debug_log("Setting up mouse cursor");
+
+    Cursor cursor = XCreateFontCursor(dpy, XC_left_ptr);
+
+    XDefineCursor(dpy, root, cursor);
+    XDefineCursor(dpy, panel.win, cursor);
+    XDefineCursor(dpy, menu.win, cursor);
+    XDefineCursor(dpy, app_launcher.win, cursor);
+    XDefineCursor(dpy, window_control_menu.win, cursor);
+    XDefineCursor(dpy, pinned_app_menu.win, cursor);
+
+    debug_log("Mouse cursor initialization complete");
+}
+
+// Task buttons from x onwards; returns where they end
+int draw_panel_tasks(Surface *s, int x) {
+    int window_index = 1;
+    for (Client *c = client_registry.head; c; c = c->next) {
+        if (client_viewable(c) && !is_app_pinned(c)) {
+            // Draw window identifier
+            char label[12];
+            snprintf(label, sizeof(label), "%d", window_index++);
+
+            // Faces with an icon belong to one window; numbered ones are shared
+            const unsigned int *icon = client_icon(c);
+            char key[64];
+            if (icon) {
+                snprintf(key, sizeof(key), "task:%d:%lu:%u", c->is_active,
+                         c->win, c->icon_serial);
+            } else {
+                snprintf(key, sizeof(key), "task:%d:%s", c->is_active, label);
+            }
+            int fresh;
+            int cell = icon_atlas_lookup(key, &fresh);
+            if (cell < 0) {
+                paint_task_face(s, x, 10, label, c->is_active, icon);
+            } else {
+                if (fresh) {
+                    int cx, cy;
+                    icon_atlas_origin(cell, &cx, &cy);
+                    paint_task_face(&icon_atlas.surface, cx + 1, cy + 1, label,
+                                    c->is_active, icon);
+                    icon_atlas_commit(cell);
+                }
+                icon_atlas_draw(s, cell, x, 10);
+            }
+            x += 50;
+        }
+    }
+    return x;
+}
+
+// Repaint just the task buttons, for changes that keep the panel layout,
+// such as focus moving between windows
+void draw_panel_task_region() {
+    if (panel.tasks_end <= panel.tasks_x) return;
+
+    // The active button's border is stroked across its edge
+    int x = panel.tasks_x - 1;
+    Surface *s = &panel.surface;
+    surface_begin_batch(s);
+    draw_gradient_rect(s, x, 0, panel.tasks_end - x, panel.height,
+                      background_dark, background_light, 1);
+    draw_panel_tasks(s, panel.tasks_x);
+    surface_end_batch(s);
+}
+
+void draw_panel() {
+    panel_pending = PANEL_CURRENT;
+    Surface *s = &panel.surface;
+    surface_begin_batch(s);
+    s->backend->clear(s);
+
+    // Modern panel with gradient
+    draw_gradient_rect(s, 0, 0, panel.width, panel.height,
+                      background_dark, background_light, 1);
+
+    int x = 10;
+
+    // Draw pinned apps first - FIXED VERSION
+    debug_log("Drawing %d pinned apps", pinned_apps.app_count);
+    for (int i = 0; i < pinned_apps.app_count; i++) {
+        if (!pinned_apps.apps[i].name) continue;
+
+        pinned_apps.apps[i].x_position = x;
+
+        // Check if app is running
+        int is_running = is_app_running(&pinned_apps.apps[i]);
+
+        // Running apps get their own face, so both states stay cached, and
+        // the face is repainted once the icon service delivers the icon
+        PinnedApp *app = &pinned_apps.apps[i];
+        const unsigned int *icon = icon_service_get(app->icon_path, PANEL_ICON_SIZE);
+        char key[256];
+        snprintf(key, sizeof(key), "pinned:%d:%d:%s:%s", is_running, icon != NULL, app->name,
+                 app->icon_path ? app->icon_path : "");
+        int fresh;
+        int cell = icon_atlas_lookup(key, &fresh);
+        if (cell < 0) {
+            paint_pinned_face(s, x, 10, app, is_running, icon);
+        } else {
+            if (fresh) {
+                int cx, cy;
+                icon_atlas_origin(cell, &cx, &cy);
+                paint_pinned_face(&icon_atlas.surface, cx + 1, cy + 1, app, is_running, icon);
+                icon_atlas_commit(cell);
+            }
+            icon_atlas_draw(s, cell, x, 10);
+        }
+
+        x += 40;
+    }
+
+    // Draw separator if there are both pinned apps and window buttons
+    if (pinned_apps.app_count > 0) {
+        s->backend->draw_line(s, x, 15, x, 35, 0x555555);
+        x += 10;
+    }
+
+    // Draw client icons/buttons with modern styling
+    panel.tasks_x = x;
+    panel.tasks_end = draw_panel_tasks(s, x);
+
+    // Draw DiamondWM area with modern styling
+    int diamond_size = 15;
+    int diamond_x = panel.width - 120;
+    int diamond_y = (PANEL_HEIGHT - diamond_size) / 2;
+
+    draw_logo(s, diamond_x, diamond_y, diamond_size);
+
+    // Draw "DiamondWM" text with proper positioning
+    int text_x = diamond_x + diamond_size + 10;
+    int text_y = 17; // Better vertical alignment
+
+    // Use regular font instead of title font for proper size
+    if (has_font(FONT_REGULAR)) {
+        s->backend->text(s, text_x, text_y + font_ascent(FONT_REGULAR), "DiamondWM", FONT_REGULAR, text_primary);
+    } else {
+      // Fallback to original font if Xft not available
+      s->backend->text(s, text_x, 30, "DiamondWM", FONT_FIXED, text_primary);
+  }
+
+  draw_clock(s);
+  surface_end_batch(s);
+}
+
+// Titlebar gradient across columns x to x + w, frame outline and separator
+void draw_titlebar_background(Surface *s, Client *c, int x, int w) {
+  // Enhanced window activation feedback
+  if (c->is_active) {
+      // Brighter gradient and border for active window
+      draw_gradient_rect(s, x, 0, w, TITLEBAR_HEIGHT, accent_color, 0x5D5D7D, 1);
+      s->backend->stroke_rect(s, 0, 0, c->width - 1, c->height - 1, 2, accent_color);
+  } else {
+      // More subtle for inactive windows
+      draw_gradient_rect(s, x, 0, w, TITLEBAR_HEIGHT, titlebar_gray, 0x2D2D2D, 1);
+      s->backend->stroke_rect(s, 0, 0, c->width - 1, c->height - 1, 1, 0x606060);
+  }
+
+  // Draw separator between titlebar and content
+  s->backend->draw_line(s, 0, TITLEBAR_HEIGHT, c->width, TITLEBAR_HEIGHT, 0x404040);
+}
+
+void draw_window_title_text(Surface *s, Client *c) {
+  unsigned long title_color = c->is_active ? text_primary : text_secondary;
+  if (c->title) {
+      const char *title = c->title->text;
+      char display_title[256];
+      if (strlen(title) > 30) {
+          strncpy(display_title, title, 27);
+          strcpy(display_title + 27, "...");
+      } else {
+          strcpy(display_title, title);
+      }
+
+      int width = text_width(FONT_FIXED, display_title);
+      int title_x = TITLE_LEFT;
+      int title_available_width = c->width - 100;
+
+      if (width < title_available_width) {
+          title_x = TITLE_LEFT + (title_available_width - width) / 2;
+      }
+
+      int title_y = TITLEBAR_HEIGHT / 2 + 5;
+
+      s->backend->text(s, title_x, title_y, display_title, FONT_FIXED, title_color);
+  } else {
+      s->backend->text(s, TITLE_LEFT, TITLEBAR_HEIGHT / 2 + 5, "Untitled", FONT_FIXED, title_color);
+  }
+}
+
+// Repaint only the title text area, for title changes
+void draw_window_title(Client *c) {
+  if (!c || !c->frame || c->width <= TITLE_LEFT) return;
+
+  Surface *s = &c->surface;
+  surface_begin_batch(s);
+  draw_titlebar_background(s, c, TITLE_LEFT, c->width - TITLE_LEFT);
+  draw_window_title_text(s, c);
+  surface_end_batch(s);
+}
+
+void draw_window_decorations(Client *c) {
+  if (!c || !c->frame) return;
+  c->frame_stale = 0;
+
+  debug_log("Drawing modern decorations for window %lu", c->win);
+
+  Surface *s = &c->surface;
+  surface_resize(s, c->width, c->height);
+  update_frame_shape(c);
+  surface_begin_batch(s);
+  s->backend->clear(s);
+
+  // Shadow cast by the client onto the frame border, kept below the titlebar
+  draw_shadow(s, FRAME_BORDER, TITLEBAR_HEIGHT + FRAME_BORDER,
+              c->width - 2 * FRAME_BORDER, c->height - TITLEBAR_HEIGHT - 2 * FRAME_BORDER);
+
+  draw_titlebar_background(s, c, 0, c->width);
+  draw_window_title_text(s, c);
+
+  // Draw modern glow buttons with hover effects
+  int button_y = (TITLEBAR_HEIGHT - BUTTON_SIZE) / 2;
+
+  // Close button with hover effect
+  draw_glow_button(s, 15, button_y, BUTTON_SIZE, button_red, c->button_hover == 1);
+
+  // Minimize button with hover effect
+  draw_glow_button(s, 15 + BUTTON_SIZE + BUTTON_SPACING, button_y, BUTTON_SIZE, button_yellow, c->button_hover == 2);
+
+  // Maximize button with hover effect
+  draw_glow_button(s, 15 + 2*(BUTTON_SIZE + BUTTON_SPACING), button_y, BUTTON_SIZE, button_green, c->button_hover == 3);
+  surface_end_batch(s);
+}
+
+int is_in_close_button(Client *c, int x, int y) {
+  int button_y = (TITLEBAR_HEIGHT - BUTTON_SIZE) / 2;
+  return (x >= 15 && x <= 15 + BUTTON_SIZE &&
+          y >= button_y && y <= button_y + BUTTON_SIZE);
+}
+
+int is_in_minimize_button(Client *c, int x, int y) {
+  int button_y = (TITLEBAR_HEIGHT - BUTTON_SIZE) / 2;
+  int button_x = 15 + BUTTON_SIZE + BUTTON_SPACING;
+  return (x >= button_x && x <= button_x + BUTTON_SIZE &&
+          y >= button_y && y <= button_y + BUTTON_SIZE);
+}
+
+int is_in_maximize_button(Client *c, int x, int y) {
+  int button_y = (TITLEBAR_HEIGHT - BUTTON_SIZE) / 2;
+  int button_x = 15 + 2*(BUTTON_SIZE + BUTTON_SPACING);
+  return (x >= button_x && x <= button_x + BUTTON_SIZE &&
+          y >= button_y && y <= button_y + BUTTON_SIZE);
+}
+
+int is_in_titlebar(Client *c, int x, int y) {
+  return (y >= 0 && y <= TITLEBAR_HEIGHT);
+}
+
+int get_resize_edge(Client *c, int x, int y) {
+  if (!c) return -1;
+
+  // Check corners first
+  if (x < RESIZE_HANDLE_SIZE && y < RESIZE_HANDLE_SIZE) return 4; // top-left
+  if (x >= c->width - RESIZE_HANDLE_SIZE && y < RESIZE_HANDLE_SIZE) return 5; // top-right
+  if (x < RESIZE_HANDLE_SIZE && y >= c->height - RESIZE_HANDLE_SIZE) return 6; // bottom-left
+  if (x >= c->width - RESIZE_HANDLE_SIZE && y >= c->height - RESIZE_HANDLE_SIZE) return 7; // bottom-right
+
+  // Check edges
+  if (x < RESIZE_HANDLE_SIZE) return 0; // left
+  if (x >= c->width - RESIZE_HANDLE_SIZE) return 1; // right
+  if (y < RESIZE_HANDLE_SIZE) return 2; // top
+  if (y >= c->height - RESIZE_HANDLE_SIZE) return 3; // bottom
+
+  return -1; // not on resize edge
+}
+
+void send_wm_delete(Window w) {
+  Atom wm_protocols = atoms[ATOM_WM_PROTOCOLS];
+  Atom wm_delete_window = atoms[ATOM_WM_DELETE_WINDOW];
+  Atom *protocols;
+  int num_protocols;  // Changed from unsigned long to int
+
+  if (XGetWMProtocols(dpy, w, &protocols, &num_protocols)) {
+      for (int i = 0; i < num_protocols; i++) {  // Changed from unsigned long to int
+          if (protocols[i] == wm_delete_window) {
+              XEvent ev;
+              ev.type = ClientMessage;
+              ev.xclient.window = w;
+              ev.xclient.message_type = wm_protocols;
+              ev.xclient.format = 32;
+              ev.xclient.data.l[0] = wm_delete_window;
+              ev.xclient.data.l[1] = CurrentTime;
+              XSendEvent(dpy, w, False, NoEventMask, &ev);
+              XFree(protocols);
+              return;
+          }
+      }
+      XFree(protocols);
+  }
+
+  // Fallback: kill the client
+  XKillClient(dpy, w);
+}
+
+void handle_button_press(XButtonEvent *e) {
+    debug_log("Button press on window %lu (button=%d) at screen coords %d,%d",
+             e->window, e->button, e->x_root, e->y_root);
+
+    // Handle app launcher visibility FIRST
+    if (app_launcher.visible) {
+        debug_log("App launcher visible, checking if click is inside...");
+        if (is_in_app_launcher_area(e->x_root, e->y_root)) {
+            debug_log("Click INSIDE app launcher at %d,%d", e->x_root, e->y_root);
+            if (e->button == Button4 || e->button == Button5) {
+                int amount = e->button == Button4 ? -LAUNCHER_SCROLL_STEP : LAUNCHER_SCROLL_STEP;
+                if (scroll_app_launcher(amount)) {
+                    app_launcher.hover_item = get_app_launcher_item_at(e->x_root, e->y_root);
+                    draw_app_launcher();
+                }
+                return;
+            }
+            handle_app_launcher_click(e->x_root, e->y_root);
+            return;
+        } else {
+            debug_log("Click OUTSIDE app launcher at %d,%d", e->x_root, e->y_root);
+            hide_app_launcher();
+        }
+    }
+
+    // ===== Check for pinned app menu =====
+    if (pinned_app_menu.visible) {
+        if (e->x_root >= pinned_app_menu.x &&
+            e->x_root <= pinned_app_menu.x + pinned_app_menu.width &&
+            e->y_root >= pinned_app_menu.y &&
+            e->y_root <= pinned_app_menu.y + pinned_app_menu.height) {
+
+            int relative_y = e->y_root - pinned_app_menu.y;
+            int item = relative_y / MENU_ITEM_HEIGHT;
+
+            debug_log("Pinned app menu clicked: item=%d", item);
+
+            if (item >= 0 && item < 5 && pinned_app_menu.target_pinned_app) {
+                PinnedApp *app = pinned_app_menu.target_pinned_app;
+
+                // Find the client window for this app
+                Client *target_client = find_pinned_app_client(app);
+
+                int is_running = (target_client != NULL);
+
+                // Adjust item index for non-running apps (skip empty slots)
+                int actual_item = item;
+                if (!is_running) {
+                    if (item >= 1 && item <= 3) {
+                        // Skip empty slots for non-running apps
+                        hide_pinned_app_menu();
+                        return;
+                    } else if (item == 4) {
+                        actual_item = 1; // Unpin is the only option after Launch
+                    }
+                }
+
+                switch (actual_item) {
+                    case 0: // Launch/Show Windows
+                        if (is_running) {
+                            show_pinned_app_windows(app);
+                            show_operation_feedback("App windows shown");
+                        } else {
+                            // Launch the app
+                            if (app->exec && strlen(app->exec) > 0) {
+                                debug_log("Launching pinned app: %s", app->exec);
+                                pid_t pid = fork();
+                                if (pid == 0) {
+                                    setsid();
+                                    execl("/bin/sh", "sh", "-c", app->exec, NULL);
+                                    exit(0);
+                                } else if (pid > 0) {
+                                    app->pid = pid;
+                                    show_operation_feedback("App launched");
+                                } else {
+                                    debug_log("ERROR: Failed to fork for pinned app launch");
+                                    show_operation_feedback("Failed to launch app");
+                                }
+                            }
+                        }
+                        break;
+
+                    case 1: // Maximize (only for running apps)
+                        if (is_running && target_client) {
+                            debug_log("Maximizing window from pinned app menu");
+                            show_operation_feedback(target_client->is_maximized ? "Window restored" : "Window maximized");
+                            toggle_maximize(target_client);
+                        }
+                        break;
+
+                    case 2: // Minimize (only for running apps)
+                        if (is_running && target_client) {
+                            debug_log("Minimizing window from pinned app menu");
+                            show_operation_feedback("Window minimized");
+                            lower_window(target_client);
+                        }
+                        break;
+
+                    case 3: // Close (only for running apps)
+                        if (is_running && target_client) {
+                            debug_log("Closing window from pinned app menu");
+                            show_operation_feedback("Window closed");
+                            close_window(target_client);
+                        }
+                        break;
+
+                    case 4: // Unpin from Panel
+                        debug_log("Unpinning app: %s", app->name);
+                        unpin_app(app);
+                        show_operation_feedback("App unpinned");
+                        break;
+                }
+            }
+            hide_pinned_app_menu();
+            return;
+        } else {
+            // Click outside menu - hide it
+            hide_pinned_app_menu();
+        }
+    }
+
+    // ===== Check if click is on a WINDOW FRAME first =====
+    {
+        Client *c = find_client(e->window);
+        if (c && c->frame == e->window) {
+            debug_log("Click on frame %lu at %d,%d", c->frame, e->x, e->y);
+
+            // Check for resize edges first
+            int edge = get_resize_edge(c, e->x, e->y);
+            if (edge != -1 && e->button == Button1) {
+                debug_log("Resize edge %d clicked", edge);
+                window_resizing = 1;
+                resized_client = c;
+                resize_start_x = e->x_root;
+                resize_start_y = e->y_root;
+                resize_start_width = c->width;
+                resize_start_height = c->height;
+                resize_edge = edge;
+
+                Cursor resize_cursor;
+                switch (edge) {
+                    case 0: case 1: resize_cursor = XCreateFontCursor(dpy, XC_sb_h_double_arrow); break;
+                    case 2: case 3: resize_cursor = XCreateFontCursor(dpy, XC_sb_v_double_arrow); break;
+                    case 4: case 7: resize_cursor = XCreateFontCursor(dpy, XC_top_left_corner); break;
+                    case 5: case 6: resize_cursor = XCreateFontCursor(dpy, XC_top_right_corner); break;
+                    default: resize_cursor = XCreateFontCursor(dpy, XC_left_ptr);
+                }
+                XDefineCursor(dpy, c->frame, resize_cursor);
+                return;
+            }
+
+            // Check for titlebar buttons
+            if (is_in_titlebar(c, e->x, e->y)) {
+                // Handle close button
+                if (is_in_close_button(c, e->x, e->y)) {
+                    if (e->button == Button1) {
+                        debug_log("Close button clicked for window: %s", c->title ? c->title->text : "");
+                        show_operation_feedback("Closing window...");
+                        close_window(c);
+                        return;
+                    }
+                    return;
+                }
+
+                // Handle minimize button
+                if (is_in_minimize_button(c, e->x, e->y)) {
+                    if (e->button == Button1) {
+                        debug_log("Minimize button clicked for window: %s", c->title ? c->title->text : "");
+                        show_operation_feedback("Window minimized");
+                        lower_window(c);
+                        return;
+                    }
+                    return;
+                }
+
+                // Handle maximize button
+                if (is_in_maximize_button(c, e->x, e->y)) {
+                    if (e->button == Button1) {
+                        debug_log("Maximize button clicked for window: %s", c->title ? c->title->text : "");
+                        show_operation_feedback(c->is_maximized ? "Window restored" : "Window maximized");
+                        toggle_maximize(c);
+                        return;
+                    }
+                    return;
+                }
+
+                // If we get here, it's a click on the titlebar but not on any button
+                if (e->button == Button1) {
+                    debug_log("Titlebar clicked (not on buttons) - starting window drag");
+                    raise_client(c);
+                    focus_client(c);
+
+                    window_dragging = 1;
+                    dragged_client = c;
+                    drag_win_start_x = c->x;
+                    drag_win_start_y = c->y;
+                    drag_offset_x = e->x_root - c->x;
+                    drag_offset_y = e->y_root - c->y;
+
+                    debug_log("Window drag started: client=%lu, start_pos=%d,%d, offset=%d,%d",
+                             c->win, drag_win_start_x, drag_win_start_y, drag_offset_x, drag_offset_y);
+
+                    Cursor move_cursor = XCreateFontCursor(dpy, XC_fleur);
+                    XDefineCursor(dpy, c->frame, move_cursor);
+                    return;
+                }
+            }
+        }
+    }
+
+    // ===== THEN check if click is on panel =====
+    if (e->window == panel.win) {
+        debug_log("Click on panel at %d,%d", e->x, e->y);
+
+        // FIRST: Check if click is on DiamondWM area (this should be checked before pinned apps)
+        if (is_in_diamondwm_area(e->x, e->y)) {
+            debug_log("DiamondWM area clicked - toggling menu (currently visible=%d)", menu.visible);
+            if (menu.visible) {
+                hide_menu();
+            } else {
+                show_menu();
+            }
+            return; // Return immediately after handling DiamondWM area click
+        }
+
+        // SECOND: Check pinned apps on panel
+        for (int i = 0; i < pinned_apps.app_count; i++) {
+            if (e->x >= pinned_apps.apps[i].x_position &&
+                e->x <= pinned_apps.apps[i].x_position + 30 &&
+                e->y >= 10 && e->y <= 40) {
+
+                debug_log("Pinned app clicked: %s", pinned_apps.apps[i].name);
+                hide_tooltip(); // Hide tooltip on click
+
+                if (e->button == Button3) {
+                    // Right click - show menu
+                    show_pinned_app_menu(panel.x + pinned_apps.apps[i].x_position,
+                                        panel.y + 10, &pinned_apps.apps[i]);
+                    return;
+                } else if (e->button == Button1) {
+                    // Left click - check if app is running
+                    PinnedApp *app = &pinned_apps.apps[i];
+                    Client *c = find_pinned_app_client(app);
+                    int is_running = c != NULL;
+
+                    if (c) {
+                        show_pinned_app_windows(app);
+                        show_operation_feedback("App windows shown");
+                    }
+
+                    // If not running, launch it
+                    if (!is_running && app->exec && strlen(app->exec) > 0) {
+                        debug_log("Launching pinned app: %s", app->exec);
+                        pid_t pid = fork();
+                        if (pid == 0) {
+                            setsid();
+                            execl("/bin/sh", "sh", "-c", app->exec, NULL);
+                            exit(0);
+                        } else if (pid > 0) {
+                            app->pid = pid;
+                            show_operation_feedback("App launched");
+                        } else {
+                            debug_log("ERROR: Failed to fork for pinned app launch");
+                            show_operation_feedback("Failed to launch app");
+                        }
+                    }
+                }
+                return;
+            }
+        }
+
+        // THIRD: Check for window control menu (non-pinned apps)
+        // Check window buttons for non-pinned apps
+        int x = 10 + pinned_apps.app_count * 40;
+        if (pinned_apps.app_count > 0) x += 10; // Add separator space
+
+        int window_index = 1;
+        for (Client *c = client_registry.head; c; c = c->next) {
+            if (client_viewable(c) && !is_app_pinned(c)) {
+                if (e->x >= x && e->x <= x + 40 && e->y >= 10 && e->y <= 40) {
+                    debug_log("Panel button clicked for window %d", window_index);
+
+                    // RIGHT click - show control menu ABOVE this specific button
+                    if (e->button == Button3) {
+                        int menu_x = panel.x + x;
+                        int menu_y = panel.y;
+                        show_window_control_menu(menu_x, menu_y, c);
+                        return;
+                    }
+
+                    // LEFT click - activate and show window
+                    if (!is_window_visible(c)) {
+                        debug_log("Window %lu is not visible, repositioning to 10,10", c->win);
+
+                        int screen_width = DisplayWidth(dpy, screen);
+                        int screen_height = DisplayHeight(dpy, screen);
+
+                        int max_width = screen_width - 20;
+                        int max_height = screen_height - PANEL_HEIGHT - 20;
+
+                        if (c->width > max_width || c->height > max_height) {
+                            int new_width = (c->width > max_width) ? max_width : c->width;
+                            int new_height = (c->height > max_height) ? max_height : c->height;
+
+                            debug_log("Resizing window from %dx%d to %dx%d",
+                                     c->width, c->height, new_width, new_height);
+
+                            resize_window(c, new_width, new_height);
+                        }
+
+                        move_window(c, 10, 10);
+                        debug_log("Window repositioned to 10,10 with size %dx%d",
+                                 c->width, c->height);
+                    }
+
+                    raise_client(c);
+                    focus_client(c);
+                    show_operation_feedback("Window activated");
+                    break;
+                }
+                x += 50;
+                window_index++;
+            }
+        }
+
+        // Start panel drag if clicked on empty area
+        if (e->button == Button1 && !menu.visible && !app_launcher.visible && !window_control_menu.visible && !pinned_app_menu.visible) {
+            panel_dragging = 1;
+            drag_start_x = e->x_root;
+            drag_start_y = e->y_root;
+            debug_log("Panel dragging started at %d,%d", drag_start_x, drag_start_y);
+        }
+        return;
+    }
+
+    // ===== Check for window control menu =====
+    if (window_control_menu.visible) {
+        if (e->x_root >= window_control_menu.x &&
+            e->x_root <= window_control_menu.x + window_control_menu.width &&
+            e->y_root >= window_control_menu.y &&
+            e->y_root <= window_control_menu.y + window_control_menu.height) {
+
+            int relative_y = e->y_root - window_control_menu.y;
+            int item = relative_y / MENU_ITEM_HEIGHT;
+
+            debug_log("Window control menu clicked: item=%d", item);
+
+            if (item >= 0 && item < 4 && window_control_menu.target_client) {
+                Client *c = window_control_menu.target_client;
+                switch (item) {
+                    case 0: // Pin to Panel
+                        debug_log("Pin to Panel clicked");
+                        hide_window_control_menu();
+                        pin_app_to_panel(c);
+                        show_operation_feedback("App pinned to panel");
+                        return;
+                    case 1: // Maximize
+                        debug_log("Maximize clicked");
+                        hide_window_control_menu();
+                        toggle_maximize(c);
+                        show_operation_feedback(c->is_maximized ? "Window maximized" : "Window restored");
+                        return;
+                    case 2: // Minimize
+                        debug_log("Minimize clicked");
+                        hide_window_control_menu();
+                        lower_window(c);
+                        show_operation_feedback("Window minimized");
+                        return;
+                    case 3: // Close
+                        debug_log("Close clicked");
+                        hide_window_control_menu();
+                        close_window(c);
+                        show_operation_feedback("Window closed");
+                        return;
+                }
+            }
+            hide_window_control_menu();
+            return;
+        } else {
+            hide_window_control_menu();
+        }
+    }
+
+    // ===== Check for system menu =====
+    if (menu.visible) {
+        // Check if click is inside menu area using root coordinates
+        if (e->x_root >= menu.x && e->x_root <= menu.x + menu.width &&
+            e->y_root >= menu.y && e->y_root <= menu.y + menu.height) {
+
+            // Calculate which menu item was clicked
+            int relative_y = e->y_root - menu.y;
+            int item = relative_y / MENU_ITEM_HEIGHT;
+
+            debug_log("System menu clicked: relative_y=%d, item=%d", relative_y, item);
+
+            // Check if item is valid (0-3)
+            if (item >= 0 && item < 4) {
+                switch (item) {
+                    case 0: // Terminal
+                        debug_log("Terminal clicked - launching xterm");
+                        hide_menu();
+                        system("xterm &");
+                        show_operation_feedback("Terminal launched");
+                        return;
+                    case 1: // Lock
+                        debug_log("Lock clicked - locking screen");
+                        hide_menu();
+                        lock_screen();
+                        return;
+                    case 2: // Logout
+                        debug_log("Logout clicked - exiting window manager");
+                        hide_menu();
+                        show_operation_feedback("Logging out...");
+                        for (Client *c = client_registry.head; c; c = c->next) {
+                            XUnmapWindow(dpy, c->frame);
+                            XReparentWindow(dpy, c->win, root, 0, 0);
+                            XMapWindow(dpy, c->win);
+                        }
+                        XCloseDisplay(dpy);
+                        exit(0);
+                        return;
+                    case 3: // Shutdown
+                        debug_log("Shutdown clicked - calling system shutdown");
+                        hide_menu();
+                        show_operation_feedback("Shutting down...");
+                        system("shutdown -h now");
+                        return;
+                }
+            } else {
+                debug_log("Invalid menu item: %d", item);
+                hide_menu();
+                return;
+            }
+        } else {
+            // Click outside menu - hide it
+            debug_log("Click outside system menu area - hiding it");
+            hide_menu();
+            // Don't return - let the click be processed
+        }
+    }
+
+    // ===== Check for right-click on desktop =====
+    if (e->window == root && e->button == Button3) {
+        debug_log("Right click on desktop - showing app launcher");
+        show_app_launcher(e->x_root, e->y_root);
+        return;
+    }
+}
+
+void handle_button_release(XButtonEvent *e) {
+  debug_log("Button release on window %lu", e->window);
+
+  if (panel_dragging) {
+      panel_dragging = 0;
+      debug_log("Panel dragging ended");
+  }
+
+  if (window_dragging && dragged_client) {
+      debug_log("Window dragging ended for client %lu", dragged_client->win);
+
+      // Add window snapping
+      int snap_threshold = 20;
+      int screen_width = DisplayWidth(dpy, screen);
+      int screen_height = DisplayHeight(dpy, screen);
+
+      if (dragged_client->x < snap_threshold) dragged_client->x = 0;
+      if (dragged_client->y < snap_threshold) dragged_client->y = 0;
+      if (screen_width - (dragged_client->x + dragged_client->width) < snap_threshold)
+          dragged_client->x = screen_width - dragged_client->width;
+      if (screen_height - (dragged_client->y + dragged_client->height) < snap_threshold)
+          dragged_client->y = screen_height - dragged_client->height - PANEL_HEIGHT;
+
+      XMoveWindow(dpy, dragged_client->frame, dragged_client->x, dragged_client->y);
+
+      // Tiled windows go back to their place
+      if (client_tiled(dragged_client)) mark_layout_dirty(dragged_client->desktop);
+
+      window_dragging = 0;
+
+      // Restore normal cursor
+      Cursor normal_cursor = XCreateFontCursor(dpy, XC_left_ptr);
+      XDefineCursor(dpy, dragged_client->frame, normal_cursor);
+
+      dragged_client = NULL;
+  }
+
+  if (window_resizing && resized_client) {
+      debug_log("Window resizing ended for client %lu", resized_client->win);
+      window_resizing = 0;
+
+      // Catch up on any reshape skipped by the live-resize rate limit
+      update_frame_shape(resized_client);
+      if (client_tiled(resized_client)) mark_layout_dirty(resized_client->desktop);
+
+      // Restore normal cursor
+      Cursor normal_cursor = XCreateFontCursor(dpy, XC_left_ptr);
+      XDefineCursor(dpy, resized_client->frame, normal_cursor);
+
+      resized_client = NULL;
+  }
+}
+
+void handle_motion_notify(XMotionEvent *e) {
+    static int last_x = 0, last_y = 0;
+    static int panel_hover_index = -1;
+    static int last_hover_check_time = 0;
+
+    // Throttle hover checks to reduce redrawing
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int current_time = now.tv_sec * 1000 + now.tv_usec / 1000;
+    int time_since_last_check = current_time - last_hover_check_time;
+
+    // Handle panel hover effects (throttled)
+    if (e->window == panel.win && time_since_last_check > 50) { // Only check every 50ms
+        last_hover_check_time = current_time;
+
+        int new_hover_index = -1;
+        int x = 10;
+        int hovering_pinned_app = -1;
+
+        // Check pinned apps hover
+        for (int i = 0; i < pinned_apps.app_count; i++) {
+            if (e->x >= pinned_apps.apps[i].x_position &&
+                e->x <= pinned_apps.apps[i].x_position + 30 &&
+                e->y >= 10 && e->y <= 40) {
+                new_hover_index = i + 1000;
+                hovering_pinned_app = i;
+                break;
+            }
+            x += 40;
+        }
+
+        // Show/hide tooltip based on hover
+        static int last_tooltip_app = -1;
+        if (hovering_pinned_app != -1) {
+            if (last_tooltip_app != hovering_pinned_app) {
+                hide_tooltip();
+                show_tooltip(pinned_apps.apps[hovering_pinned_app].x_position + 15,
+                            panel.y, &pinned_apps.apps[hovering_pinned_app]);
+                last_tooltip_app = hovering_pinned_app;
+            }
+        } else if (last_tooltip_app != -1) {
+            hide_tooltip();
+            last_tooltip_app = -1;
+        }
+
+        // Check window buttons hover if no pinned app hovered
+        if (new_hover_index == -1) {
+            x = 10 + pinned_apps.app_count * 40;
+            if (pinned_apps.app_count > 0) x += 10;
+
+            int window_index = 0;
+            for (Client *c = client_registry.head; c; c = c->next) {
+                if (client_viewable(c) && !is_app_pinned(c)) {
+                    if (e->x >= x && e->x <= x + 40 && e->y >= 10 && e->y <= 40) {
+                        new_hover_index = window_index;
+                        break;
+                    }
+                    x += 50;
+                    window_index++;
+                }
+            }
+        }
+
+        if (new_hover_index != panel_hover_index) {
+            panel_hover_index = new_hover_index;
+            draw_panel();
+        }
+    }
+
+    // Handle window dragging
+    if (window_dragging && dragged_client) {
+        if (last_x == 0 && last_y == 0) {
+            // First motion event - initialize last positions
+            last_x = e->x_root;
+            last_y = e->y_root;
+        }
+
+        // Calculate movement delta
+        int delta_x = e->x_root - last_x;
+        int delta_y = e->y_root - last_y;
+
+        // Only process if there's significant movement (reduce flickering)
+        if (abs(delta_x) > 1 || abs(delta_y) > 1) {
+            // Calculate new position
+            int new_x = dragged_client->x + delta_x;
+            int new_y = dragged_client->y + delta_y;
+
+            debug_log("Window dragging: delta=%d,%d, new_pos=%d,%d", delta_x, delta_y, new_x, new_y);
+
+            // Constrain to screen boundaries
+            int screen_width = DisplayWidth(dpy, screen);
+            int screen_height = DisplayHeight(dpy, screen);
+
+            // Keep window within screen bounds
+            if (new_x < 0) new_x = 0;
+            if (new_y < 0) new_y = 0;
+            if (new_x + dragged_client->width > screen_width)
+                new_x = screen_width - dragged_client->width;
+            if (new_y + dragged_client->height > screen_height - PANEL_HEIGHT)
+                new_y = screen_height - PANEL_HEIGHT - dragged_client->height;
+
+            // Only move if position changed
+            if (new_x != dragged_client->x || new_y != dragged_client->y) {
+                // Move the window
+                XMoveWindow(dpy, dragged_client->frame, new_x, new_y);
+
+                // Update client position
+                dragged_client->x = new_x;
+                dragged_client->y = new_y;
+
+                debug_log("Window moved to %d,%d", new_x, new_y);
+            }
+
+            // Update last positions
+            last_x = e->x_root;
+            last_y = e->y_root;
+        }
+    } else {
+        // Reset last positions when not dragging
+        last_x = 0;
+        last_y = 0;
+    }
+
+    // Handle window resizing
+    if (window_resizing && resized_client) {
+        int delta_x = e->x_root - resize_start_x;
+        int delta_y = e->y_root - resize_start_y;
+
+        // Only resize if there's significant movement
+        if (abs(delta_x) > 2 || abs(delta_y) > 2) {
+            int new_width = resize_start_width;
+            int new_height = resize_start_height;
+            int new_x = resized_client->x;
+            int new_y = resized_client->y;
+
+            // Minimum window size
+            int min_width = 100;
+            int min_height = 80;
+
+            switch (resize_edge) {
+                case 0: // left
+                    new_width = resize_start_width - delta_x;
+                    new_x = resized_client->x + delta_x;
+                    if (new_width < min_width) {
+                        new_width = min_width;
+                        new_x = resized_client->x + resize_start_width - min_width;
+                    }
+                    break;
+                case 1: // right
+                    new_width = resize_start_width + delta_x;
+                    if (new_width < min_width) new_width = min_width;
+                    break;
+                case 2: // top
+                    new_height = resize_start_height - delta_y;
+                    new_y = resized_client->y + delta_y;
+                    if (new_height < min_height) {
+                        new_height = min_height;
+                        new_y = resized_client->y + resize_start_height - min_height;
+                    }
+                    break;
+                case 3: // bottom
+                    new_height = resize_start_height + delta_y;
+                    if (new_height < min_height) new_height = min_height;
+                    break;
+                case 4: // top-left
+                    new_width = resize_start_width - delta_x;
+                    new_height = resize_start_height - delta_y;
+                    new_x = resized_client->x + delta_x;
+                    new_y = resized_client->y + delta_y;
+                    if (new_width < min_width) {
+                        new_width = min_width;
+                        new_x = resized_client->x + resize_start_width - min_width;
+                    }
+                    if (new_height < min_height) {
+                        new_height = min_height;
+                        new_y = resized_client->y + resize_start_height - min_height;
+                    }
+                    break;
+                case 5: // top-right
+                    new_width = resize_start_width + delta_x;
+                    new_height = resize_start_height - delta_y;
+                    new_y = resized_client->y + delta_y;
+                    if (new_width < min_width) new_width = min_width;
+                    if (new_height < min_height) {
+                        new_height = min_height;
+                        new_y = resized_client->y + resize_start_height - min_height;
+                    }
+                    break;
+                case 6: // bottom-left
+                    new_width = resize_start_width - delta_x;
+                    new_height = resize_start_height + delta_y;
+                    new_x = resized_client->x + delta_x;
+                    if (new_width < min_width) {
+                        new_width = min_width;
+                        new_x = resized_client->x + resize_start_width - min_width;
+                    }
+                    if (new_height < min_height) new_height = min_height;
+                    break;
+                case 7: // bottom-right
+                    new_width = resize_start_width + delta_x;
+                    new_height = resize_start_height + delta_y;
+                    if (new_width < min_width) new_width = min_width;
+                    if (new_height < min_height) new_height = min_height;
+                    break;
+            }
+
+            // Apply the resize
+            if (new_x != resized_client->x || new_y != resized_client->y) {
+                XMoveWindow(dpy, resized_client->frame, new_x, new_y);
+                resized_client->x = new_x;
+                resized_client->y = new_y;
+            }
+
+            if (new_width != resized_client->width || new_height != resized_client->height) {
+                resize_window(resized_client, new_width, new_height);
+            }
+
+            debug_log("Window resized to %dx%d at %d,%d", new_width, new_height, new_x, new_y);
+        }
+    }
+
+    // Handle hover effects for windows (throttled)
+    Client *hovered = find_client(e->window);
+    if (hovered && hovered->frame == e->window && time_since_last_check > 50) {
+        update_button_hover(hovered, e->x, e->y);
+    }
+
+    // Handle hover effects for menu
+    if (menu.visible && e->window == menu.win) {
+        int relative_y = e->y;
+        int new_hover_item = relative_y / MENU_ITEM_HEIGHT;
+
+        if (new_hover_item >= 0 && new_hover_item < 4) {
+            if (menu.hover_item != new_hover_item) {
+                menu.hover_item = new_hover_item;
+                draw_menu();
+            }
+        } else if (menu.hover_item != -1) {
+            menu.hover_item = -1;
+            draw_menu();
+        }
+    }
+
+    // Handle hover effects for window control menu
+    if (window_control_menu.visible && e->window == window_control_menu.win) {
+        int relative_y = e->y;
+        int new_hover_item = relative_y / MENU_ITEM_HEIGHT;
+
+        if (new_hover_item >= 0 && new_hover_item < 4) {
+            if (window_control_menu.hover_item != new_hover_item) {
+                window_control_menu.hover_item = new_hover_item;
+                draw_window_control_menu();
+            }
+        } else if (window_control_menu.hover_item != -1) {
+            window_control_menu.hover_item = -1;
+            draw_window_control_menu();
+        }
+    }
+
+    // Handle hover effects for pinned app menu
+    if (pinned_app_menu.visible && e->window == pinned_app_menu.win) {
+        int relative_y = e->y;
+        int new_hover_item = relative_y / MENU_ITEM_HEIGHT;
+
+        // Check if app is running to determine valid menu items
+        int is_running = pinned_app_menu.target_pinned_app &&
+                         is_app_running(pinned_app_menu.target_pinned_app);
+
+        // Adjust hover item for non-running apps (skip empty slots)
+        if (!is_running) {
+            if (new_hover_item >= 1 && new_hover_item <= 3) {
+                new_hover_item = -1; // Skip empty slots
+            } else if (new_hover_item == 4) {
+                new_hover_item = 1; // Unpin is the only option after Launch
+            }
+        }
+
+        if (new_hover_item >= 0 && new_hover_item < 5) {
+            if (pinned_app_menu.hover_item != new_hover_item) {
+                pinned_app_menu.hover_item = new_hover_item;
+                draw_pinned_app_menu();
+            }
+        } else if (pinned_app_menu.hover_item != -1) {
+            pinned_app_menu.hover_item = -1;
+            draw_pinned_app_menu();
+        }
+    }
+
+    // Handle hover effects for app launcher (throttled)
+    if (app_launcher.visible && time_since_last_check > 50) {
+        int new_hover_item = get_app_launcher_item_at(e->x_root, e->y_root);
+        if (app_launcher.hover_item != new_hover_item) {
+            app_launcher.hover_item = new_hover_item;
+            draw_app_launcher();
+        }
+    }
+}
+
+void handle_key_press(XKeyEvent *e) {
+  // Handle app launcher search first
+  if (app_launcher.visible && app_launcher.search_mode) {
+      KeySym keysym;
+      char buffer[10];
+      int count = XLookupString(e, buffer, sizeof(buffer), &keysym, NULL);
+
+      if (keysym == XK_Escape) {
+          // Exit search mode
+          app_launcher.search_mode = 0;
+          app_launcher.search_text[0] = '\0';
+          filter_applications_by_search();
+          draw_app_launcher();
+      } else if (keysym == XK_Return) {
+          // Execute search - launch first matching app if any
+          if (strlen(app_launcher.search_text) > 0) {
+              // Find first matching application
+              for (int i = 0; i < app_launcher.category_count; i++) {
+                  AppCategory *cat = &app_launcher.categories[i];
+                  for (int j = 0; j < cat->app_count; j++) {
+                      char app_name_lower[256];
+                      strcpy(app_name_lower, cat->apps[j].name);
+                      for (char *p = app_name_lower; *p; p++) *p = tolower(*p);
+
+                      char search_lower[256];
+                      strcpy(search_lower, app_launcher.search_text);
+                      for (char *p = search_lower; *p; p++) *p = tolower(*p);
+
+                      if (strstr(app_name_lower, search_lower) != NULL) {
+                          // Launch the first matching app
+                          AppInfo *app = &cat->apps[j];
+                          debug_log("Launching search result: %s -> %s", app->name, app->exec);
+
+                          pid_t pid = fork();
+                          if (pid == 0) {
+                              setsid();
+                              execl("/bin/sh", "sh", "-c", app->exec, NULL);
+                              exit(0);
+                          } else if (pid > 0) {
+                              show_operation_feedback("Launched application");
+                              hide_app_launcher();
+                              return;
+                          }
+                          break;
+                      }
+                  }
+              }
+              show_operation_feedback("No matching applications found");
+          }
+      } else if (keysym == XK_BackSpace) {
+          // Handle backspace
+          int len = strlen(app_launcher.search_text);
+          if (len > 0) {
+              app_launcher.search_text[len - 1] = '\0';
+              filter_applications_by_search();
+              draw_app_launcher();
+          }
+      } else if (count > 0 && buffer[0] >= 32 && buffer[0] <= 126) {
+          // Handle regular character input
+          int len = strlen(app_launcher.search_text);
+          if (len < sizeof(app_launcher.search_text) - 1) {
+              app_launcher.search_text[len] = buffer[0];
+              app_launcher.search_text[len + 1] = '\0';
+              filter_applications_by_search();
+              draw_app_launcher();
+          }
+      }
+      return;
+  }
+
+  // Use XLookupString instead of deprecated XKeycodeToKeysym
+  KeySym keysym;
+  char buffer[10];
+  int count = XLookupString(e, buffer, sizeof(buffer), &keysym, NULL);
+
+  // Ctrl+Alt+Space picks the next layout for this desktop
+  if ((e->state & (ControlMask | Mod1Mask)) == (ControlMask | Mod1Mask) && keysym == XK_space) {
+      cycle_layout();
+      return;
+  }
+
+  // Ctrl+Alt+Left/Right change desktop; with Shift the focused window comes along
+  if ((e->state & (ControlMask | Mod1Mask)) == (ControlMask | Mod1Mask) &&
+      (keysym == XK_Left || keysym == XK_Right)) {
+      int d = (desktops.current + (keysym == XK_Left ? -1 : 1) + DESKTOP_COUNT) % DESKTOP_COUNT;
+      Client *moving = (e->state & ShiftMask) ? focus.focused : NULL;
+      // Already mapped, so it is neither unmapped nor mapped by the switch
+      if (moving && moving->desktop != DESKTOP_ALL) relink_client_desktop(moving, d);
+      switch_desktop(d);
+
+      char feedback[32];
+      snprintf(feedback, sizeof(feedback), "Desktop %d", d + 1);
+      show_operation_feedback(feedback);
+      return;
+  }
+
+  // Window shortcuts act on the focused window
+  Client *c = focus.focused;
+
+  if (!c) return;
+
+  switch (keysym) {
+      case XK_F11:
+          debug_log("F11 pressed - toggling fullscreen");
+          show_operation_feedback(c->is_fullscreen ? "Exiting fullscreen" : "Entering fullscreen");
+          toggle_fullscreen(c);
+          break;
+      case XK_F12:
+          debug_log("F12 pressed - lowering window");
+          show_operation_feedback("Window lowered");
+          lower_window(c);
+          break;
+      case XK_Escape:
+          if (e->state & ControlMask) {
+              debug_log("Ctrl+Esc pressed - closing window");
+              show_operation_feedback("Closing window");
+              XKillClient(dpy, c->win);
+          }
+          break;
+  }
+}
+
+// ---- Client registry ----
+
+// Clients come from blocks of CLIENT_POOL_BLOCK and go back on a free list
+Client *client_alloc() {
+    if (!client_registry.free_clients) {
+        ClientBlock *block = calloc(1, sizeof(ClientBlock));
+        if (!block) return NULL;
+        block->next = client_registry.blocks;
+        client_registry.blocks = block;
+        for (int i = CLIENT_POOL_BLOCK - 1; i >= 0; i--) {
+            block->clients[i].next = client_registry.free_clients;
+            client_registry.free_clients = &block->clients[i];
         }
     }
+    Client *c = client_registry.free_clients;
+    client_registry.free_clients = c->next;
+    memset(c, 0, sizeof(*c));
+    return c;
+}
 
-    // ===== Check for system menu =====
-    if (menu.visible) {
-        // Check if click is inside menu area using root coordinates
-        if (e->x_root >= menu.x && e->x_root <= menu.x + menu.width &&
-            e->y_root >= menu.y && e->y_root <= menu.y + menu.height) {
-
-            // Calculate which menu item was clicked
-            int relative_y = e->y_root - menu.y;
-            int item = relative_y / MENU_ITEM_HEIGHT;
+void client_release(Client *c) {
+    c->next = client_registry.free_clients;
+    client_registry.free_clients = c;
+}
 
-            debug_log("System menu clicked: relative_y=%d, item=%d", relative_y, item);
+unsigned long client_index_slot(Window key, int size) {
+    // Fibonacci hashing spreads the sequential XIDs of one client connection
+    return (unsigned long)((key * 11400714819323198485ull) >> 32) & (size - 1);
+}
 
-            // Check if item is valid (0-3)
-            if (item >= 0 && item < 4) {
-                switch (item) {
-                    case 0: // Terminal
-                        debug_log("Terminal clicked - launching xterm");
-                        hide_menu();
-                        system("xterm &");
-                        show_operation_feedback("Terminal launched");
-                        return;
-                    case 1: // Lock
-                        debug_log("Lock clicked - locking screen");
-                        hide_menu();
-                        lock_screen();
-                        return;
-                    case 2: // Logout
-                        debug_log("Logout clicked - exiting window manager");
-                        hide_menu();
-                        show_operation_feedback("Logging out...");
-                        for (int i = 0; i < client_count; i++) {
-                            if (clients[i]) {
-                                XUnmapWindow(dpy, clients[i]->frame);
-                                XReparentWindow(dpy, clients[i]->win, root, 0, 0);
-                                XMapWindow(dpy, clients[i]->win);
-                            }
-                        }
-                        XCloseDisplay(dpy);
-                        exit(0);
-                        return;
-                    case 3: // Shutdown
-                        debug_log("Shutdown clicked - calling system shutdown");
-                        hide_menu();
-                        show_operation_feedback("Shutting down...");
-                        system("shutdown -h now");
-                        return;
-                }
-            } else {
-                debug_log("Invalid menu item: %d", item);
-                hide_menu();
-                return;
-            }
-        } else {
-            // Click outside menu - hide it
-            debug_log("Click outside system menu area - hiding it");
-            hide_menu();
-            // Don't return - let the click be processed
-        }
+int client_index_grow() {
+    int size = client_registry.index_size ? client_registry.index_size * 2 : CLIENT_INDEX_MIN;
+    ClientIndexSlot *index = calloc(size, sizeof(ClientIndexSlot));
+    if (!index) return 0;
+
+    for (int i = 0; i < client_registry.index_size; i++) {
+        ClientIndexSlot *old = &client_registry.index[i];
+        if (old->key == None) continue;
+        unsigned long slot = client_index_slot(old->key, size);
+        while (index[slot].key != None) slot = (slot + 1) & (size - 1);
+        index[slot] = *old;
     }
+    free(client_registry.index);
+    client_registry.index = index;
+    client_registry.index_size = size;
+    return 1;
+}
 
-    // ===== Check for right-click on desktop =====
-    if (e->window == root && e->button == Button3) {
-        debug_log("Right click on desktop - showing app launcher");
-        show_app_launcher(e->x_root, e->y_root);
-        return;
+// Linear probing, kept under 3/4 full
+int client_index_insert(Window key, Client *c) {
+    if (key == None) return 1;
+    if ((client_registry.index_used + 1) * 4 > client_registry.index_size * 3 &&
+        !client_index_grow()) {
+        return 0;
+    }
+    int mask = client_registry.index_size - 1;
+    unsigned long slot = client_index_slot(key, client_registry.index_size);
+    while (client_registry.index[slot].key != None && client_registry.index[slot].key != key) {
+        slot = (slot + 1) & mask;
     }
+    if (client_registry.index[slot].key == None) client_registry.index_used++;
+    client_registry.index[slot].key = key;
+    client_registry.index[slot].client = c;
+    return 1;
 }
 
-void handle_button_release(XButtonEvent *e) {
-  debug_log("Button release on window %lu", e->window);
-
-  if (panel_dragging) {
-      panel_dragging = 0;
-      debug_log("Panel dragging ended");
-  }
+// Backward-shift deletion: no tombstones, so lookups never slow down
+void client_index_remove(Window key) {
+    if (key == None || !client_registry.index_size) return;
+    int mask = client_registry.index_size - 1;
+    unsigned long slot = client_index_slot(key, client_registry.index_size);
+    while (client_registry.index[slot].key != key) {
+        if (client_registry.index[slot].key == None) return;
+        slot = (slot + 1) & mask;
+    }
 
-  if (window_dragging && dragged_client) {
-      debug_log("Window dragging ended for client %lu", dragged_client->win);
+    unsigned long hole = slot;
+    for (;;) {
+        slot = (slot + 1) & mask;
+        ClientIndexSlot *next = &client_registry.index[slot];
+        if (next->key == None) break;
+        // Move next back only if the hole lies between its home slot and it
+        unsigned long home = client_index_slot(next->key, client_registry.index_size);
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            client_registry.index[hole] = *next;
+            hole = slot;
+        }
+    }
+    client_registry.index[hole].key = None;
+    client_registry.index[hole].client = NULL;
+    client_registry.index_used--;
+}
 
-      // Add window snapping
-      int snap_threshold = 20;
-      int screen_width = DisplayWidth(dpy, screen);
-      int screen_height = DisplayHeight(dpy, screen);
+// Index c under its window and frame and append it to the registry order
+int register_client(Client *c) {
+    if (!client_index_insert(c->win, c)) return 0;
+    if (!client_index_insert(c->frame, c)) {
+        client_index_remove(c->win);
+        return 0;
+    }
+    c->prev = client_registry.tail;
+    c->next = NULL;
+    if (client_registry.tail) {
+        client_registry.tail->next = c;
+    } else {
+        client_registry.head = c;
+    }
+    client_registry.tail = c;
+    client_registry.count++;
+    return 1;
+}
 
-      if (dragged_client->x < snap_threshold) dragged_client->x = 0;
-      if (dragged_client->y < snap_threshold) dragged_client->y = 0;
-      if (screen_width - (dragged_client->x + dragged_client->width) < snap_threshold)
-          dragged_client->x = screen_width - dragged_client->width;
-      if (screen_height - (dragged_client->y + dragged_client->height) < snap_threshold)
-          dragged_client->y = screen_height - dragged_client->height - PANEL_HEIGHT;
+void unregister_client(Client *c) {
+    client_index_remove(c->win);
+    client_index_remove(c->frame);
+    if (c->prev) {
+        c->prev->next = c->next;
+    } else {
+        client_registry.head = c->next;
+    }
+    if (c->next) {
+        c->next->prev = c->prev;
+    } else {
+        client_registry.tail = c->prev;
+    }
+    c->prev = c->next = NULL;
+    client_registry.count--;
+}
 
-      XMoveWindow(dpy, dragged_client->frame, dragged_client->x, dragged_client->y);
+void free_client_registry() {
+    while (client_registry.blocks) {
+        ClientBlock *next = client_registry.blocks->next;
+        free(client_registry.blocks);
+        client_registry.blocks = next;
+    }
+    free(client_registry.index);
+    memset(&client_registry, 0, sizeof(client_registry));
+}
 
-      window_dragging = 0;
+// ---- Stacking ----
+//
+// The WM keeps its own bottom-to-top list of frames, the panel and popups,
+// each in a layer. Raising or lowering only edits that list; restack then
+// sends the whole order in one XRestackWindows, and nothing if it is
+// unchanged, so the server is never asked what the order is.
 
-      // Restore normal cursor
-      Cursor normal_cursor = XCreateFontCursor(dpy, XC_left_ptr);
-      XDefineCursor(dpy, dragged_client->frame, normal_cursor);
+int stack_find(Window w) {
+    for (int i = 0; i < stacking.count; i++) {
+        if (stacking.entries[i].win == w) return i;
+    }
+    return -1;
+}
 
-      dragged_client = NULL;
-  }
+void unstack_window(Window w) {
+    int i = stack_find(w);
+    if (i < 0) return;
+    memmove(&stacking.entries[i], &stacking.entries[i + 1],
+            (stacking.count - i - 1) * sizeof(StackEntry));
+    stacking.count--;
+}
 
-  if (window_resizing && resized_client) {
-      debug_log("Window resizing ended for client %lu", resized_client->win);
-      window_resizing = 0;
+// Insert w at position i, growing the list if needed
+int stack_insert_at(int i, Window w, int layer) {
+    if (stacking.count == stacking.capacity) {
+        int capacity = stacking.capacity ? stacking.capacity * 2 : 32;
+        StackEntry *entries = realloc(stacking.entries, capacity * sizeof(StackEntry));
+        Window *applied = realloc(stacking.applied, capacity * sizeof(Window));
+        if (entries) stacking.entries = entries;
+        if (applied) stacking.applied = applied;
+        if (!entries || !applied) return 0;
+        stacking.capacity = capacity;
+    }
+    memmove(&stacking.entries[i + 1], &stacking.entries[i],
+            (stacking.count - i) * sizeof(StackEntry));
+    stacking.entries[i].win = w;
+    stacking.entries[i].layer = layer;
+    stacking.count++;
+    return 1;
+}
 
-      // Restore normal cursor
-      Cursor normal_cursor = XCreateFontCursor(dpy, XC_left_ptr);
-      XDefineCursor(dpy, resized_client->frame, normal_cursor);
+// Put w on top of its layer, adding it or moving it between layers
+void stack_window(Window w, int layer) {
+    unstack_window(w);
+    int i = stacking.count;
+    while (i > 0 && stacking.entries[i - 1].layer > layer) i--;
+    stack_insert_at(i, w, layer);
+}
 
-      resized_client = NULL;
-  }
+// Put w at the bottom of its layer
+void stack_window_bottom(Window w) {
+    int i = stack_find(w);
+    if (i < 0) return;
+    int layer = stacking.entries[i].layer;
+    unstack_window(w);
+    i = 0;
+    while (i < stacking.count && stacking.entries[i].layer < layer) i++;
+    stack_insert_at(i, w, layer);
 }
 
-void handle_motion_notify(XMotionEvent *e) {
-    static int last_x = 0, last_y = 0;
-    static int panel_hover_index = -1;
-    static int last_hover_check_time = 0;
+// Tell the server the order, if it changed since last time
+void restack() {
+    if (!dpy) return;
+
+    Window *order = stacking.applied;
+    int n = stacking.count;
+    int changed = n != stacking.applied_count;
+    for (int i = 0; i < n; i++) {
+        Window w = stacking.entries[n - 1 - i].win;
+        if (!changed && order[i] == w) continue;
+        order[i] = w;
+        changed = 1;
+    }
+    stacking.applied_count = n;
+    if (changed && n > 0) XRestackWindows(dpy, order, n);
+    if (changed) ewmh.stacking_stale = 1;
+}
 
-    // Throttle hover checks to reduce redrawing
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    int current_time = now.tv_sec * 1000 + now.tv_usec / 1000;
-    int time_since_last_check = current_time - last_hover_check_time;
+void raise_window(Window w, int layer) {
+    stack_window(w, layer);
+    restack();
+}
 
-    // Handle panel hover effects (throttled)
-    if (e->window == panel.win && time_since_last_check > 50) { // Only check every 50ms
-        last_hover_check_time = current_time;
+int client_layer(Client *c) {
+    return c->is_fullscreen ? LAYER_FULLSCREEN : c->layer;
+}
 
-        int new_hover_index = -1;
-        int x = 10;
-        int hovering_pinned_app = -1;
+void raise_client(Client *c) {
+    raise_window(c->frame, client_layer(c));
+}
 
-        // Check pinned apps hover
-        for (int i = 0; i < pinned_apps.app_count; i++) {
-            if (e->x >= pinned_apps.apps[i].x_position &&
-                e->x <= pinned_apps.apps[i].x_position + 30 &&
-                e->y >= 10 && e->y <= 40) {
-                new_hover_index = i + 1000;
-                hovering_pinned_app = i;
-                break;
-            }
-            x += 40;
+// Which layer a new client asks for through its EWMH type and state, and
+// whether it wants to start fullscreen
+int initial_client_layer(Window w, int *fullscreen, int *floating) {
+    Atom type;
+    int format;
+    unsigned long count, after;
+    unsigned char *data = NULL;
+    int layer = LAYER_NORMAL;
+    Window parent;
+
+    // Dialogs and other transients keep their own size and place
+    *floating = XGetTransientForHint(dpy, w, &parent) != 0;
+    if (XGetWindowProperty(dpy, w, atoms[ATOM_NET_WM_WINDOW_TYPE], 0, 16, False, XA_ATOM,
+                           &type, &format, &count, &after, &data) == Success && data) {
+        Atom *types = (Atom *)data;
+        for (unsigned long i = 0; i < count; i++) {
+            if (types[i] == atoms[ATOM_NET_WM_WINDOW_TYPE_DESKTOP]) layer = LAYER_DESKTOP;
+            if (types[i] == atoms[ATOM_NET_WM_WINDOW_TYPE_DOCK]) layer = LAYER_PANEL;
+            if (types[i] == atoms[ATOM_NET_WM_WINDOW_TYPE_DIALOG] ||
+                types[i] == atoms[ATOM_NET_WM_WINDOW_TYPE_UTILITY] ||
+                types[i] == atoms[ATOM_NET_WM_WINDOW_TYPE_SPLASH]) *floating = 1;
         }
+        XFree(data);
+        data = NULL;
+    }
 
-        // Show/hide tooltip based on hover
-        static int last_tooltip_app = -1;
-        if (hovering_pinned_app != -1) {
-            if (last_tooltip_app != hovering_pinned_app) {
-                hide_tooltip();
-                show_tooltip(pinned_apps.apps[hovering_pinned_app].x_position + 15,
-                            panel.y, &pinned_apps.apps[hovering_pinned_app]);
-                last_tooltip_app = hovering_pinned_app;
-            }
-        } else if (last_tooltip_app != -1) {
-            hide_tooltip();
-            last_tooltip_app = -1;
+    *fullscreen = 0;
+    if (XGetWindowProperty(dpy, w, atoms[ATOM_NET_WM_STATE], 0, 32, False, XA_ATOM,
+                           &type, &format, &count, &after, &data) == Success && data) {
+        Atom *states = (Atom *)data;
+        int normal = layer == LAYER_NORMAL;
+        for (unsigned long i = 0; i < count; i++) {
+            if (states[i] == atoms[ATOM_NET_WM_STATE_ABOVE] && normal) layer = LAYER_ABOVE;
+            if (states[i] == atoms[ATOM_NET_WM_STATE_BELOW] && normal) layer = LAYER_BELOW;
+            if (states[i] == atoms[ATOM_NET_WM_STATE_FULLSCREEN]) *fullscreen = 1;
         }
+        XFree(data);
+    }
+    return layer;
+}
 
-        // Check window buttons hover if no pinned app hovered
-        if (new_hover_index == -1) {
-            x = 10 + pinned_apps.app_count * 40;
-            if (pinned_apps.app_count > 0) x += 10;
+void free_stacking() {
+    free(stacking.entries);
+    free(stacking.applied);
+    memset(&stacking, 0, sizeof(stacking));
+}
 
-            int window_index = 0;
-            for (int i = 0; i < client_count; i++) {
-                if (clients[i] && clients[i]->is_mapped && !is_app_pinned(clients[i])) {
-                    if (e->x >= x && e->x <= x + 40 && e->y >= 10 && e->y <= 40) {
-                        new_hover_index = i;
-                        break;
-                    }
-                    x += 50;
-                    window_index++;
-                }
-            }
-        }
+// ---- Focus ----
+//
+// One client at most holds the focus. FocusIn and FocusOut move it, and so
+// do the WM's own focus requests, ahead of their events. Every change
+// marks exactly the two frames involved and the panel's task buttons, and
+// flush_repaints paints them once the event queue is drained.
+// The most recently focused order decides who is focused next.
+
+void mark_frame_stale(Client *c) {
+    c->frame_stale = 1;
+    frames_pending = 1;
+}
 
-        if (new_hover_index != panel_hover_index) {
-            panel_hover_index = new_hover_index;
-            draw_panel();
+void mark_panel_stale(int what) {
+    if (what > panel_pending) panel_pending = what;
+}
+
+// Frames that went out of view meanwhile are skipped; mapping them again
+// brings an Expose
+void flush_repaints() {
+    if (frames_pending) {
+        frames_pending = 0;
+        for (Client *c = client_registry.head; c; c = c->next) {
+            if (!c->frame_stale) continue;
+            c->frame_stale = 0;
+            if (client_viewable(c)) draw_window_decorations(c);
         }
     }
+    if (panel_pending == PANEL_STALE) {
+        draw_panel();
+    } else if (panel_pending == PANEL_TASKS_STALE) {
+        draw_panel_task_region();
+        panel_pending = PANEL_CURRENT;
+    }
+}
 
-    // Handle window dragging
-    if (window_dragging && dragged_client) {
-        if (last_x == 0 && last_y == 0) {
-            // First motion event - initialize last positions
-            last_x = e->x_root;
-            last_y = e->y_root;
-        }
+void mru_unlink(Client *c) {
+    if (c->mru_prev) {
+        c->mru_prev->mru_next = c->mru_next;
+    } else if (focus.mru_head == c) {
+        focus.mru_head = c->mru_next;
+    }
+    if (c->mru_next) {
+        c->mru_next->mru_prev = c->mru_prev;
+    } else if (focus.mru_tail == c) {
+        focus.mru_tail = c->mru_prev;
+    }
+    c->mru_prev = c->mru_next = NULL;
+}
 
-        // Calculate movement delta
-        int delta_x = e->x_root - last_x;
-        int delta_y = e->y_root - last_y;
+void mru_push(Client *c) {
+    mru_unlink(c);
+    c->mru_next = focus.mru_head;
+    if (focus.mru_head) {
+        focus.mru_head->mru_prev = c;
+    } else {
+        focus.mru_tail = c;
+    }
+    focus.mru_head = c;
+}
 
-        // Only process if there's significant movement (reduce flickering)
-        if (abs(delta_x) > 1 || abs(delta_y) > 1) {
-            // Calculate new position
-            int new_x = dragged_client->x + delta_x;
-            int new_y = dragged_client->y + delta_y;
+// Record that c (or nobody) has the focus
+void set_focused_client(Client *c) {
+    Client *old = focus.focused;
+    if (c == old) return;
 
-            debug_log("Window dragging: delta=%d,%d, new_pos=%d,%d", delta_x, delta_y, new_x, new_y);
+    focus.focused = c;
+    ewmh.active_stale = 1;
+    if (old) {
+        old->is_active = 0;
+        mark_frame_stale(old);
+    }
+    if (c) {
+        c->is_active = 1;
+        mru_push(c);
+        mark_frame_stale(c);
+    }
+    mark_panel_stale(PANEL_TASKS_STALE);
+}
 
-            // Constrain to screen boundaries
-            int screen_width = DisplayWidth(dpy, screen);
-            int screen_height = DisplayHeight(dpy, screen);
+// Give c the keyboard focus; c must be mapped
+void focus_client(Client *c) {
+    if (!c) return;
+    XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
+    set_focused_client(c);
+}
 
-            // Keep window within screen bounds
-            if (new_x < 0) new_x = 0;
-            if (new_y < 0) new_y = 0;
-            if (new_x + dragged_client->width > screen_width)
-                new_x = screen_width - dragged_client->width;
-            if (new_y + dragged_client->height > screen_height - PANEL_HEIGHT)
-                new_y = screen_height - PANEL_HEIGHT - dragged_client->height;
+// Move the focus to the most recently used viewable client other than skip
+void focus_next_client(Client *skip) {
+    for (Client *c = focus.mru_head; c; c = c->mru_next) {
+        if (c != skip && client_viewable(c)) {
+            focus_client(c);
+            return;
+        }
+    }
+    XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
+    set_focused_client(NULL);
+}
 
-            // Only move if position changed
-            if (new_x != dragged_client->x || new_y != dragged_client->y) {
-                // Move the window
-                XMoveWindow(dpy, dragged_client->frame, new_x, new_y);
+void handle_focus_change(XFocusChangeEvent *e) {
+    // Keyboard grabs (the launcher, the lock screen) don't move the focus
+    if (e->mode == NotifyGrab || e->mode == NotifyUngrab) return;
+    if (e->detail == NotifyInferior || e->detail == NotifyPointer) return;
 
-                // Update client position
-                dragged_client->x = new_x;
-                dragged_client->y = new_y;
+    Client *c = find_client(e->window);
+    if (!c || c->win != e->window) return;
 
-                debug_log("Window moved to %d,%d", new_x, new_y);
-            }
+    if (e->type == FocusIn) {
+        set_focused_client(c);
+    } else if (c == focus.focused) {
+        set_focused_client(NULL);
+    }
+}
 
-            // Update last positions
-            last_x = e->x_root;
-            last_y = e->y_root;
-        }
-    } else {
-        // Reset last positions when not dragging
-        last_x = 0;
-        last_y = 0;
+// Forget c before it goes away, handing the focus on if it had it
+void unfocus_client(Client *c) {
+    int had_focus = c == focus.focused;
+    if (had_focus) {
+        focus.focused = NULL;
+        ewmh.active_stale = 1;
     }
+    mru_unlink(c);
+    if (had_focus) focus_next_client(c);
+}
 
-    // Handle window resizing
-    if (window_resizing && resized_client) {
-        int delta_x = e->x_root - resize_start_x;
-        int delta_y = e->y_root - resize_start_y;
+// ---- EWMH ----
+//
+// Root window properties for pagers, docks and wmctrl. Changes only mark
+// what is stale; flush_ewmh writes it once the event queue is drained, so
+// a burst of new windows or restacks costs one write per property. New
+// clients are appended to _NET_CLIENT_LIST, and the list is rewritten only
+// after a client leaves.
+
+// One x, y, width, height per desktop; every desktop has the same panel
+void ewmh_set_workarea() {
+    long workarea[DESKTOP_COUNT][4];
+    for (int d = 0; d < DESKTOP_COUNT; d++) {
+        workarea[d][0] = 0;
+        workarea[d][1] = 0;
+        workarea[d][2] = DisplayWidth(dpy, screen);
+        workarea[d][3] = panel.y;
+    }
+    XChangeProperty(dpy, root, atoms[ATOM_NET_WORKAREA], XA_CARDINAL, 32, PropModeReplace,
+                    (unsigned char *)workarea, DESKTOP_COUNT * 4);
+}
 
-        // Only resize if there's significant movement
-        if (abs(delta_x) > 2 || abs(delta_y) > 2) {
-            int new_width = resize_start_width;
-            int new_height = resize_start_height;
-            int new_x = resized_client->x;
-            int new_y = resized_client->y;
+void ewmh_init() {
+    Atom supported[] = {
+        atoms[ATOM_NET_SUPPORTED], atoms[ATOM_NET_SUPPORTING_WM_CHECK],
+        atoms[ATOM_NET_CLIENT_LIST], atoms[ATOM_NET_CLIENT_LIST_STACKING],
+        atoms[ATOM_NET_ACTIVE_WINDOW], atoms[ATOM_NET_CLOSE_WINDOW], atoms[ATOM_NET_WORKAREA],
+        atoms[ATOM_NET_WM_NAME], atoms[ATOM_NET_WM_ICON], atoms[ATOM_NET_WM_PID],
+        atoms[ATOM_NET_WM_STATE], atoms[ATOM_NET_WM_STATE_FULLSCREEN],
+        atoms[ATOM_NET_WM_STATE_MAXIMIZED_VERT], atoms[ATOM_NET_WM_STATE_MAXIMIZED_HORZ],
+        atoms[ATOM_NET_WM_STATE_HIDDEN], atoms[ATOM_NET_WM_STATE_ABOVE],
+        atoms[ATOM_NET_WM_STATE_BELOW], atoms[ATOM_NET_WM_WINDOW_TYPE],
+        atoms[ATOM_NET_WM_WINDOW_TYPE_DESKTOP], atoms[ATOM_NET_WM_WINDOW_TYPE_DOCK],
+        atoms[ATOM_NET_WM_WINDOW_TYPE_DIALOG], atoms[ATOM_NET_WM_WINDOW_TYPE_UTILITY],
+        atoms[ATOM_NET_WM_WINDOW_TYPE_SPLASH], atoms[ATOM_NET_WM_WINDOW_TYPE_NORMAL],
+        atoms[ATOM_NET_NUMBER_OF_DESKTOPS], atoms[ATOM_NET_CURRENT_DESKTOP],
+        atoms[ATOM_NET_DESKTOP_NAMES], atoms[ATOM_NET_WM_DESKTOP],
+    };
+    XChangeProperty(dpy, root, atoms[ATOM_NET_SUPPORTED], XA_ATOM, 32, PropModeReplace,
+                    (unsigned char *)supported, sizeof(supported) / sizeof(supported[0]));
+
+    // The check window names the WM and proves it is still running
+    ewmh.check = XCreateSimpleWindow(dpy, root, -1, -1, 1, 1, 0, 0, 0);
+    XChangeProperty(dpy, ewmh.check, atoms[ATOM_NET_SUPPORTING_WM_CHECK], XA_WINDOW, 32,
+                    PropModeReplace, (unsigned char *)&ewmh.check, 1);
+    XChangeProperty(dpy, ewmh.check, atoms[ATOM_NET_WM_NAME], atoms[ATOM_UTF8_STRING], 8,
+                    PropModeReplace, (unsigned char *)"DiamondWM", 9);
+    XChangeProperty(dpy, root, atoms[ATOM_NET_SUPPORTING_WM_CHECK], XA_WINDOW, 32,
+                    PropModeReplace, (unsigned char *)&ewmh.check, 1);
+
+    XDeleteProperty(dpy, root, atoms[ATOM_NET_CLIENT_LIST]);
+    XDeleteProperty(dpy, root, atoms[ATOM_NET_CLIENT_LIST_STACKING]);
+    ewmh_set_workarea();
+
+    long count = DESKTOP_COUNT;
+    XChangeProperty(dpy, root, atoms[ATOM_NET_NUMBER_OF_DESKTOPS], XA_CARDINAL, 32,
+                    PropModeReplace, (unsigned char *)&count, 1);
+    char names[DESKTOP_COUNT * 12];
+    int length = 0;
+    for (int i = 0; i < DESKTOP_COUNT; i++) {
+        length += snprintf(names + length, sizeof(names) - length, "Desktop %d", i + 1) + 1;
+    }
+    XChangeProperty(dpy, root, atoms[ATOM_NET_DESKTOP_NAMES], atoms[ATOM_UTF8_STRING], 8,
+                    PropModeReplace, (unsigned char *)names, length);
 
-            // Minimum window size
-            int min_width = 100;
-            int min_height = 80;
+    ewmh.active_stale = 1;
+    ewmh.desktop_stale = 1;
+}
 
-            switch (resize_edge) {
-                case 0: // left
-                    new_width = resize_start_width - delta_x;
-                    new_x = resized_client->x + delta_x;
-                    if (new_width < min_width) {
-                        new_width = min_width;
-                        new_x = resized_client->x + resize_start_width - min_width;
-                    }
-                    break;
-                case 1: // right
-                    new_width = resize_start_width + delta_x;
-                    if (new_width < min_width) new_width = min_width;
-                    break;
-                case 2: // top
-                    new_height = resize_start_height - delta_y;
-                    new_y = resized_client->y + delta_y;
-                    if (new_height < min_height) {
-                        new_height = min_height;
-                        new_y = resized_client->y + resize_start_height - min_height;
-                    }
-                    break;
-                case 3: // bottom
-                    new_height = resize_start_height + delta_y;
-                    if (new_height < min_height) new_height = min_height;
-                    break;
-                case 4: // top-left
-                    new_width = resize_start_width - delta_x;
-                    new_height = resize_start_height - delta_y;
-                    new_x = resized_client->x + delta_x;
-                    new_y = resized_client->y + delta_y;
-                    if (new_width < min_width) {
-                        new_width = min_width;
-                        new_x = resized_client->x + resize_start_width - min_width;
-                    }
-                    if (new_height < min_height) {
-                        new_height = min_height;
-                        new_y = resized_client->y + resize_start_height - min_height;
-                    }
-                    break;
-                case 5: // top-right
-                    new_width = resize_start_width + delta_x;
-                    new_height = resize_start_height - delta_y;
-                    new_y = resized_client->y + delta_y;
-                    if (new_width < min_width) new_width = min_width;
-                    if (new_height < min_height) {
-                        new_height = min_height;
-                        new_y = resized_client->y + resize_start_height - min_height;
-                    }
-                    break;
-                case 6: // bottom-left
-                    new_width = resize_start_width - delta_x;
-                    new_height = resize_start_height + delta_y;
-                    new_x = resized_client->x + delta_x;
-                    if (new_width < min_width) {
-                        new_width = min_width;
-                        new_x = resized_client->x + resize_start_width - min_width;
-                    }
-                    if (new_height < min_height) new_height = min_height;
-                    break;
-                case 7: // bottom-right
-                    new_width = resize_start_width + delta_x;
-                    new_height = resize_start_height + delta_y;
-                    if (new_width < min_width) new_width = min_width;
-                    if (new_height < min_height) new_height = min_height;
-                    break;
-            }
+void ewmh_client_added(Client *c) {
+    // Appended by flush_ewmh, unless a removal forces a rewrite anyway
+    c->state_stale = 1;
+    ewmh.states_stale = 1;
+    ewmh.stacking_stale = 1;
+}
 
-            // Apply the resize
-            if (new_x != resized_client->x || new_y != resized_client->y) {
-                XMoveWindow(dpy, resized_client->frame, new_x, new_y);
-                resized_client->x = new_x;
-                resized_client->y = new_y;
-            }
+void ewmh_client_removed() {
+    ewmh.client_list_stale = 1;
+    ewmh.stacking_stale = 1;
+}
 
-            if (new_width != resized_client->width || new_height != resized_client->height) {
-                resize_window(resized_client, new_width, new_height);
-            }
+void ewmh_client_state_changed(Client *c) {
+    c->state_stale = 1;
+    ewmh.states_stale = 1;
+}
 
-            debug_log("Window resized to %dx%d at %d,%d", new_width, new_height, new_x, new_y);
-        }
+void ewmh_write_state(Client *c) {
+    Atom state[6];
+    int n = 0;
+    if (c->is_fullscreen) state[n++] = atoms[ATOM_NET_WM_STATE_FULLSCREEN];
+    if (c->is_maximized) {
+        state[n++] = atoms[ATOM_NET_WM_STATE_MAXIMIZED_VERT];
+        state[n++] = atoms[ATOM_NET_WM_STATE_MAXIMIZED_HORZ];
     }
+    if (!c->is_mapped) state[n++] = atoms[ATOM_NET_WM_STATE_HIDDEN];
+    if (c->layer == LAYER_ABOVE) state[n++] = atoms[ATOM_NET_WM_STATE_ABOVE];
+    if (c->layer == LAYER_BELOW) state[n++] = atoms[ATOM_NET_WM_STATE_BELOW];
+    XChangeProperty(dpy, c->win, atoms[ATOM_NET_WM_STATE], XA_ATOM, 32, PropModeReplace,
+                    (unsigned char *)state, n);
+
+    long desktop = c->desktop;
+    XChangeProperty(dpy, c->win, atoms[ATOM_NET_WM_DESKTOP], XA_CARDINAL, 32, PropModeReplace,
+                    (unsigned char *)&desktop, 1);
+}
 
-    // Handle hover effects for windows (throttled)
-    for (int i = 0; i < client_count; i++) {
-        if (clients[i] && clients[i]->frame == e->window && time_since_last_check > 50) {
-            update_button_hover(clients[i], e->x, e->y);
-            break;
+void flush_ewmh() {
+    int count = client_registry.count;
+
+    if (ewmh.client_list_stale || count < ewmh.client_list_count) {
+        Window *list = malloc((count ? count : 1) * sizeof(Window));
+        if (list) {
+            int n = 0;
+            for (Client *c = client_registry.head; c; c = c->next) list[n++] = c->win;
+            XChangeProperty(dpy, root, atoms[ATOM_NET_CLIENT_LIST], XA_WINDOW, 32,
+                            PropModeReplace, (unsigned char *)list, n);
+            free(list);
+            ewmh.client_list_count = n;
+            ewmh.client_list_stale = 0;
         }
+    } else if (count > ewmh.client_list_count) {
+        // Only the newest clients are missing; they sit at the registry's tail
+        Window added[count - ewmh.client_list_count];
+        int n = count - ewmh.client_list_count;
+        Client *c = client_registry.tail;
+        for (int i = n - 1; i >= 0; i--, c = c->prev) added[i] = c->win;
+        XChangeProperty(dpy, root, atoms[ATOM_NET_CLIENT_LIST], XA_WINDOW, 32,
+                        PropModeAppend, (unsigned char *)added, n);
+        ewmh.client_list_count = count;
     }
 
-    // Handle hover effects for menu
-    if (menu.visible && e->window == menu.win) {
-        int relative_y = e->y;
-        int new_hover_item = relative_y / MENU_ITEM_HEIGHT;
-
-        if (new_hover_item >= 0 && new_hover_item < 4) {
-            if (menu.hover_item != new_hover_item) {
-                menu.hover_item = new_hover_item;
-                draw_menu();
+    if (ewmh.stacking_stale) {
+        // Bottom to top, from the WM's own stacking list
+        Window *list = malloc((count ? count : 1) * sizeof(Window));
+        if (list) {
+            int n = 0;
+            for (int i = 0; i < stacking.count && n < count; i++) {
+                Client *c = find_client(stacking.entries[i].win);
+                if (c && c->frame == stacking.entries[i].win) list[n++] = c->win;
             }
-        } else if (menu.hover_item != -1) {
-            menu.hover_item = -1;
-            draw_menu();
+            XChangeProperty(dpy, root, atoms[ATOM_NET_CLIENT_LIST_STACKING], XA_WINDOW, 32,
+                            PropModeReplace, (unsigned char *)list, n);
+            free(list);
+            ewmh.stacking_stale = 0;
         }
     }
 
-    // Handle hover effects for window control menu
-    if (window_control_menu.visible && e->window == window_control_menu.win) {
-        int relative_y = e->y;
-        int new_hover_item = relative_y / MENU_ITEM_HEIGHT;
+    if (ewmh.active_stale) {
+        Window active = focus.focused ? focus.focused->win : None;
+        XChangeProperty(dpy, root, atoms[ATOM_NET_ACTIVE_WINDOW], XA_WINDOW, 32,
+                        PropModeReplace, (unsigned char *)&active, 1);
+        ewmh.active_stale = 0;
+    }
 
-        if (new_hover_item >= 0 && new_hover_item < 4) {
-            if (window_control_menu.hover_item != new_hover_item) {
-                window_control_menu.hover_item = new_hover_item;
-                draw_window_control_menu();
-            }
-        } else if (window_control_menu.hover_item != -1) {
-            window_control_menu.hover_item = -1;
-            draw_window_control_menu();
+    if (ewmh.desktop_stale) {
+        long current = desktops.current;
+        XChangeProperty(dpy, root, atoms[ATOM_NET_CURRENT_DESKTOP], XA_CARDINAL, 32,
+                        PropModeReplace, (unsigned char *)&current, 1);
+        ewmh.desktop_stale = 0;
+    }
+
+    if (ewmh.states_stale) {
+        for (Client *c = client_registry.head; c; c = c->next) {
+            if (!c->state_stale) continue;
+            c->state_stale = 0;
+            ewmh_write_state(c);
         }
+        ewmh.states_stale = 0;
     }
+}
 
-    // Handle hover effects for pinned app menu
-    if (pinned_app_menu.visible && e->window == pinned_app_menu.win) {
-        int relative_y = e->y;
-        int new_hover_item = relative_y / MENU_ITEM_HEIGHT;
+// Requests from pagers and clients: _NET_CURRENT_DESKTOP on the root,
+// _NET_WM_STATE, _NET_ACTIVE_WINDOW, _NET_CLOSE_WINDOW and _NET_WM_DESKTOP
+void handle_client_message(XClientMessageEvent *e) {
+    if (e->window == root) {
+        if (e->message_type == atoms[ATOM_NET_CURRENT_DESKTOP]) switch_desktop(e->data.l[0]);
+        return;
+    }
 
-        // Check if app is running to determine valid menu items
-        int is_running = 0;
-        if (pinned_app_menu.target_pinned_app && pinned_app_menu.target_pinned_app->name) {
-            for (int i = 0; i < client_count; i++) {
-                if (clients[i] && clients[i]->title &&
-                    strcmp(clients[i]->title, pinned_app_menu.target_pinned_app->name) == 0) {
-                    is_running = 1;
-                    break;
+    Client *c = find_client(e->window);
+    if (!c || c->win != e->window) return;
+
+    if (e->message_type == atoms[ATOM_NET_WM_STATE]) {
+        // data.l[0]: 0 remove, 1 add, 2 toggle; l[1] and l[2] name the states
+        long action = e->data.l[0];
+        int maximize = 0, fullscreen = 0;
+        for (int i = 1; i <= 2; i++) {
+            Atom state = (Atom)e->data.l[i];
+            if (state == atoms[ATOM_NET_WM_STATE_FULLSCREEN]) {
+                fullscreen = 1;
+            } else if (state == atoms[ATOM_NET_WM_STATE_MAXIMIZED_VERT] ||
+                       state == atoms[ATOM_NET_WM_STATE_MAXIMIZED_HORZ]) {
+                // Maximizing is both directions at once, applied once below
+                maximize = 1;
+            } else if (state == atoms[ATOM_NET_WM_STATE_ABOVE] ||
+                       state == atoms[ATOM_NET_WM_STATE_BELOW]) {
+                int layer = state == atoms[ATOM_NET_WM_STATE_ABOVE] ? LAYER_ABOVE : LAYER_BELOW;
+                int want = action == 2 ? c->layer != layer : action == 1;
+                if (want) {
+                    c->layer = layer;
+                } else if (c->layer == layer) {
+                    c->layer = LAYER_NORMAL;
                 }
+                raise_client(c);
+                ewmh_client_state_changed(c);
+                mark_layout_dirty(c->desktop);
             }
         }
 
-        // Adjust hover item for non-running apps (skip empty slots)
-        if (!is_running) {
-            if (new_hover_item >= 1 && new_hover_item <= 3) {
-                new_hover_item = -1; // Skip empty slots
-            } else if (new_hover_item == 4) {
-                new_hover_item = 1; // Unpin is the only option after Launch
-            }
+        // Both halves of a maximize toggle arrive in one message: flip once
+        if (maximize) {
+            int want = action == 2 ? !c->is_maximized : action == 1;
+            if (want != c->is_maximized) toggle_maximize(c);
         }
-
-        if (new_hover_item >= 0 && new_hover_item < 5) {
-            if (pinned_app_menu.hover_item != new_hover_item) {
-                pinned_app_menu.hover_item = new_hover_item;
-                draw_pinned_app_menu();
-            }
-        } else if (pinned_app_menu.hover_item != -1) {
-            pinned_app_menu.hover_item = -1;
-            draw_pinned_app_menu();
+        if (fullscreen) {
+            int want = action == 2 ? !c->is_fullscreen : action == 1;
+            if (want != c->is_fullscreen) toggle_fullscreen(c);
         }
+    } else if (e->message_type == atoms[ATOM_NET_ACTIVE_WINDOW]) {
+        restore_client(c);
+        raise_client(c);
+        focus_client(c);
+    } else if (e->message_type == atoms[ATOM_NET_CLOSE_WINDOW]) {
+        send_wm_delete(c->win);
+    } else if (e->message_type == atoms[ATOM_NET_WM_DESKTOP]) {
+        // CARD32 on the wire; DESKTOP_ALL arrives sign-extended
+        set_client_desktop(c, (unsigned long)e->data.l[0] & 0xFFFFFFFFUL);
     }
+}
 
-    // Handle hover effects for app launcher (throttled)
-    if (app_launcher.visible && time_since_last_check > 50) {
-        int new_hover_item = get_app_launcher_item_at(e->x_root, e->y_root);
-        if (app_launcher.hover_item != new_hover_item) {
-            app_launcher.hover_item = new_hover_item;
-            draw_app_launcher();
+// ---- Layouts ----
+//
+// Each desktop has a layout that places its tiled clients. Adding,
+// removing, minimizing or moving a client only marks its desktop;
+// flush_layouts arranges the marked desktops once the event queue is
+// drained, in one O(n) pass each, and touches only frames whose
+// rectangle changed.
+
+void arrange_master_stack(int n, LayoutRect area, LayoutRect *out) {
+    if (n == 1) {
+        out[0] = area;
+        return;
+    }
+
+    // The newest client is the master; the rest share the column beside it
+    int master_width = area.width * LAYOUT_MASTER_PERCENT / 100;
+    out[0] = (LayoutRect){area.x, area.y, master_width, area.height};
+    for (int i = 1; i < n; i++) {
+        int top = area.height * (i - 1) / (n - 1), bottom = area.height * i / (n - 1);
+        out[i] = (LayoutRect){area.x + master_width, area.y + top,
+                              area.width - master_width, bottom - top};
+    }
+}
+
+void arrange_grid(int n, LayoutRect area, LayoutRect *out) {
+    int columns = 1;
+    while (columns * columns < n) columns++;
+    int rows = (n + columns - 1) / columns;
+
+    for (int i = 0; i < n; i++) {
+        int row = i / columns, column = i % columns;
+        // A short last row shares the full width
+        int across = row == rows - 1 ? n - row * columns : columns;
+        int left = area.width * column / across, right = area.width * (column + 1) / across;
+        int top = area.height * row / rows, bottom = area.height * (row + 1) / rows;
+        out[i] = (LayoutRect){area.x + left, area.y + top, right - left, bottom - top};
+    }
+}
+
+// The newest client in the middle, the others dealt round the top, right,
+// bottom and left. A side nobody was dealt to is given to the middle.
+void arrange_diamond(int n, LayoutRect area, LayoutRect *out) {
+    int count[4];
+    for (int side = 0; side < 4; side++) count[side] = (n - 1) / 4 + ((n - 1) % 4 > side);
+
+    int left = count[3] ? area.width / 4 : 0;
+    int right = count[1] ? area.width * 3 / 4 : area.width;
+    int top = count[0] ? area.height / 4 : 0;
+    int bottom = count[2] ? area.height * 3 / 4 : area.height;
+    out[0] = (LayoutRect){area.x + left, area.y + top, right - left, bottom - top};
+
+    for (int i = 1; i < n; i++) {
+        int side = (i - 1) % 4, k = (i - 1) / 4, m = count[side];
+        if (side == 0 || side == 2) {
+            // Top and bottom span the middle column
+            int from = left + (right - left) * k / m, to = left + (right - left) * (k + 1) / m;
+            out[i] = side == 0 ?
+                     (LayoutRect){area.x + from, area.y, to - from, top} :
+                     (LayoutRect){area.x + from, area.y + bottom, to - from, area.height - bottom};
+        } else {
+            // Left and right run the full height
+            int from = area.height * k / m, to = area.height * (k + 1) / m;
+            out[i] = side == 1 ?
+                     (LayoutRect){area.x + right, area.y + from, area.width - right, to - from} :
+                     (LayoutRect){area.x, area.y + from, left, to - from};
         }
     }
 }
 
-void handle_key_press(XKeyEvent *e) {
-  // Handle app launcher search first
-  if (app_launcher.visible && app_launcher.search_mode) {
-      KeySym keysym;
-      char buffer[10];
-      int count = XLookupString(e, buffer, sizeof(buffer), &keysym, NULL);
+Layout layouts[LAYOUT_COUNT] = {
+    [LAYOUT_FLOATING] = {"Floating", NULL},
+    [LAYOUT_MASTER_STACK] = {"Master and stack", arrange_master_stack},
+    [LAYOUT_GRID] = {"Grid", arrange_grid},
+    [LAYOUT_DIAMOND] = {"Diamond", arrange_diamond},
+};
+
+int client_tiled(Client *c) {
+    return c->is_mapped && !c->is_fullscreen && !c->is_maximized && !c->is_floating &&
+           c->layer == LAYER_NORMAL &&
+           c->desktop < DESKTOP_COUNT && layouts[desktops.layout[c->desktop]].arrange;
+}
 
-      if (keysym == XK_Escape) {
-          // Exit search mode
-          app_launcher.search_mode = 0;
-          app_launcher.search_text[0] = '\0';
-          filter_applications_by_search();
-          draw_app_launcher();
-      } else if (keysym == XK_Return) {
-          // Execute search - launch first matching app if any
-          if (strlen(app_launcher.search_text) > 0) {
-              // Find first matching application
-              for (int i = 0; i < app_launcher.category_count; i++) {
-                  AppCategory *cat = &app_launcher.categories[i];
-                  for (int j = 0; j < cat->app_count; j++) {
-                      char app_name_lower[256];
-                      strcpy(app_name_lower, cat->apps[j].name);
-                      for (char *p = app_name_lower; *p; p++) *p = tolower(*p);
+void mark_layout_dirty(unsigned long d) {
+    if (d >= DESKTOP_COUNT) return;
+    desktops.layout_dirty[d] = 1;
+    layouts_pending = 1;
+}
+
+// Give c the frame rectangle r, sending only what changed
+void place_client(Client *c, LayoutRect r) {
+    // The frame's X border lies outside its size. Keep the titlebar buttons
+    // and at least one row of the client, as apply_configure_request does.
+    int width = r.width - 2 * BORDER_WIDTH, height = r.height - 2 * BORDER_WIDTH;
+    if (width < TITLE_LEFT + 2 * FRAME_BORDER) width = TITLE_LEFT + 2 * FRAME_BORDER;
+    if (height < TITLEBAR_HEIGHT + 2 * FRAME_BORDER + 1) height = TITLEBAR_HEIGHT + 2 * FRAME_BORDER + 1;
+
+    int resized = width != c->width || height != c->height;
+    if (!resized && r.x == c->x && r.y == c->y) return;
+
+    c->x = r.x;
+    c->y = r.y;
+    if (resized) {
+        c->width = width;
+        c->height = height;
+        XMoveResizeWindow(dpy, c->frame, c->x, c->y, width, height);
+        XResizeWindow(dpy, c->win, width - 2 * FRAME_BORDER,
+                      height - TITLEBAR_HEIGHT - 2 * FRAME_BORDER);
+        draw_window_decorations(c);
+    } else {
+        XMoveWindow(dpy, c->frame, c->x, c->y);
+    }
+    // The server's ConfigureNotify, if any, is relative to the frame
+    send_configure_notify(c);
+}
+
+void arrange_desktop(int d) {
+    const Layout *layout = &layouts[desktops.layout[d]];
+    if (!layout->arrange) return;
+
+    int n = 0;
+    for (Client *c = desktops.heads[d]; c; c = c->desktop_next) {
+        if (client_tiled(c)) n++;
+    }
+    if (!n) return;
+
+    LayoutRect area = {0, 0, DisplayWidth(dpy, screen), panel.y};
+    LayoutRect rects[n];
+    layout->arrange(n, area, rects);
+
+    int i = 0;
+    for (Client *c = desktops.heads[d]; c; c = c->desktop_next) {
+        if (client_tiled(c)) place_client(c, rects[i++]);
+    }
+}
+
+void flush_layouts() {
+    if (!layouts_pending) return;
+    layouts_pending = 0;
+
+    for (int d = 0; d < DESKTOP_COUNT; d++) {
+        if (!desktops.layout_dirty[d]) continue;
+        desktops.layout_dirty[d] = 0;
+        arrange_desktop(d);
+    }
+}
+
+void cycle_layout() {
+    int d = desktops.current;
+    desktops.layout[d] = (desktops.layout[d] + 1) % LAYOUT_COUNT;
+    mark_layout_dirty(d);
+    show_operation_feedback(layouts[desktops.layout[d]].name);
+}
+
+// ---- Virtual desktops ----
+//
+// Each desktop keeps its own client list, so a switch touches only the
+// windows leaving and arriving. Their maps and unmaps go out as one batch
+// with no round trips, and nothing repaints until the event queue drains.
+// The WM's own unmaps are counted in ignore_unmaps, so an UnmapNotify can
+// still be told apart from a client withdrawing its window.
+
+int client_on_current_desktop(Client *c) {
+    return c->desktop == DESKTOP_ALL || c->desktop == (unsigned long)desktops.current;
+}
+
+// Mapped by the WM right now: not minimized and on this desktop
+int client_viewable(Client *c) {
+    return c->is_mapped && client_on_current_desktop(c);
+}
+
+Client **desktop_list(unsigned long d) {
+    return &desktops.heads[d == DESKTOP_ALL ? DESKTOP_COUNT : d];
+}
+
+void desktop_link(Client *c) {
+    Client **head = desktop_list(c->desktop);
+    mark_layout_dirty(c->desktop);
+    c->desktop_prev = NULL;
+    c->desktop_next = *head;
+    if (*head) (*head)->desktop_prev = c;
+    *head = c;
+}
+
+void desktop_unlink(Client *c) {
+    mark_layout_dirty(c->desktop);
+    if (c->desktop_prev) {
+        c->desktop_prev->desktop_next = c->desktop_next;
+    } else {
+        *desktop_list(c->desktop) = c->desktop_next;
+    }
+    if (c->desktop_next) c->desktop_next->desktop_prev = c->desktop_prev;
+    c->desktop_prev = c->desktop_next = NULL;
+}
+
+// Desktop to open w on: the one it asked for, else the current one
+unsigned long initial_client_desktop(Window w) {
+    unsigned long d = desktops.current;
+    Atom type;
+    int format;
+    unsigned long nitems, bytes_after;
+    unsigned char *data = NULL;
+    if (XGetWindowProperty(dpy, w, atoms[ATOM_NET_WM_DESKTOP], 0, 1, False, XA_CARDINAL,
+                           &type, &format, &nitems, &bytes_after, &data) == Success && data) {
+        unsigned long requested = *(unsigned long *)data & 0xFFFFFFFFUL;
+        if (nitems == 1 && (requested < DESKTOP_COUNT || requested == DESKTOP_ALL)) d = requested;
+        XFree(data);
+    }
+    return d;
+}
+
+void map_client(Client *c) {
+    XMapWindow(dpy, c->frame);
+    XMapWindow(dpy, c->win);
+}
+
+// c must be viewable; its UnmapNotify is expected and ignored
+void unmap_client(Client *c) {
+    c->ignore_unmaps++;
+    XUnmapWindow(dpy, c->frame);
+    XUnmapWindow(dpy, c->win);
+}
+
+// The client unmapped its own window: give it back to the root. It may be
+// on its way to being destroyed; x_error_handler absorbs the BadWindow.
+void withdraw_client(Client *c) {
+    Window win = c->win, frame = c->frame;
+    XReparentWindow(dpy, win, root, c->x + BORDER_WIDTH + FRAME_BORDER,
+                    c->y + BORDER_WIDTH + TITLEBAR_HEIGHT + FRAME_BORDER);
+    unmanage_window(win);
+    XDestroyWindow(dpy, frame);
+}
+
+void switch_desktop(int d) {
+    if (d < 0 || d >= DESKTOP_COUNT || d == desktops.current) return;
+    debug_log("Switching to desktop %d", d);
+
+    // Map the arrivals before unmapping the departures, so windows that
+    // overlap go straight from one to the other
+    for (Client *c = desktops.heads[d]; c; c = c->desktop_next) {
+        if (c->is_mapped) map_client(c);
+    }
+    for (Client *c = desktops.heads[desktops.current]; c; c = c->desktop_next) {
+        if (c->is_mapped) unmap_client(c);
+    }
+    desktops.current = d;
+    ewmh.desktop_stale = 1;
+
+    focus_next_client(NULL);
+    mark_panel_stale(PANEL_STALE);
+}
+
+// Moves c between lists only; callers map or unmap it
+void relink_client_desktop(Client *c, unsigned long d) {
+    desktop_unlink(c);
+    c->desktop = d;
+    desktop_link(c);
+    ewmh_client_state_changed(c);
+}
 
-                      char search_lower[256];
-                      strcpy(search_lower, app_launcher.search_text);
-                      for (char *p = search_lower; *p; p++) *p = tolower(*p);
+void set_client_desktop(Client *c, unsigned long d) {
+    if ((d >= DESKTOP_COUNT && d != DESKTOP_ALL) || d == c->desktop) return;
 
-                      if (strstr(app_name_lower, search_lower) != NULL) {
-                          // Launch the first matching app
-                          AppInfo *app = &cat->apps[j];
-                          debug_log("Launching search result: %s -> %s", app->name, app->exec);
+    int was_viewable = client_viewable(c);
+    relink_client_desktop(c, d);
+    if (was_viewable && !client_viewable(c)) {
+        unmap_client(c);
+        if (c == focus.focused) focus_next_client(c);
+    } else if (!was_viewable && client_viewable(c)) {
+        map_client(c);
+    }
+    draw_panel();
+}
 
-                          pid_t pid = fork();
-                          if (pid == 0) {
-                              setsid();
-                              execl("/bin/sh", "sh", "-c", app->exec, NULL);
-                              exit(0);
-                          } else if (pid > 0) {
-                              show_operation_feedback("Launched application");
-                              hide_app_launcher();
-                              return;
-                          }
-                          break;
-                      }
-                  }
-              }
-              show_operation_feedback("No matching applications found");
-          }
-      } else if (keysym == XK_BackSpace) {
-          // Handle backspace
-          int len = strlen(app_launcher.search_text);
-          if (len > 0) {
-              app_launcher.search_text[len - 1] = '\0';
-              filter_applications_by_search();
-              draw_app_launcher();
-          }
-      } else if (count > 0 && buffer[0] >= 32 && buffer[0] <= 126) {
-          // Handle regular character input
-          int len = strlen(app_launcher.search_text);
-          if (len < sizeof(app_launcher.search_text) - 1) {
-              app_launcher.search_text[len] = buffer[0];
-              app_launcher.search_text[len + 1] = '\0';
-              filter_applications_by_search();
-              draw_app_launcher();
-          }
-      }
-      return;
-  }
+// Show c again if it is minimized or on another desktop; callers raise and focus it
+void restore_client(Client *c) {
+    if (!client_on_current_desktop(c)) switch_desktop(c->desktop);
+    if (!c->is_mapped) {
+        c->is_mapped = 1;
+        map_client(c);
+        ewmh_client_state_changed(c);
+        mark_layout_dirty(c->desktop);
+    }
+}
 
-  Client *c = NULL;
-  if (client_count > 0) {
-      // Get the most recently managed window as fallback
-      c = clients[client_count - 1];
-  }
+// ---- Configure requests ----
+//
+// A managed client's ConfigureRequest describes its own window, but what
+// moves is the frame. Requests are merged per client until the event queue
+// is drained, then applied to the frame within WM policy and answered with
+// one synthetic ConfigureNotify, so a client resizing itself in a loop
+// costs one frame update per pass.
+
+void queue_configure_request(Client *c, XConfigureRequestEvent *e) {
+    if (e->value_mask & CWX) c->configure_x = e->x;
+    if (e->value_mask & CWY) c->configure_y = e->y;
+    if (e->value_mask & CWWidth) c->configure_width = e->width;
+    if (e->value_mask & CWHeight) c->configure_height = e->height;
+    if (e->value_mask & CWStackMode) c->configure_stack = e->detail;
+    // Border width is the frame's business; the request is still answered
+    c->configure_mask |= e->value_mask | CWBorderWidth;
+    configures_pending = 1;
+}
 
-  if (!c) return;
+// Tell c where its window is, in root coordinates (ICCCM 4.1.5)
+void send_configure_notify(Client *c) {
+    XConfigureEvent ce;
+    memset(&ce, 0, sizeof(ce));
+    ce.type = ConfigureNotify;
+    ce.display = dpy;
+    ce.event = c->win;
+    ce.window = c->win;
+    // Past the frame's own X border, then the decorations
+    ce.x = c->x + BORDER_WIDTH + FRAME_BORDER;
+    ce.y = c->y + BORDER_WIDTH + TITLEBAR_HEIGHT + FRAME_BORDER;
+    ce.width = c->width - 2 * FRAME_BORDER;
+    ce.height = c->height - TITLEBAR_HEIGHT - 2 * FRAME_BORDER;
+    ce.border_width = 0;
+    ce.above = None;
+    ce.override_redirect = False;
+    XSendEvent(dpy, c->win, False, StructureNotifyMask, (XEvent *)&ce);
+}
 
-  // Use XLookupString instead of deprecated XKeycodeToKeysym
-  KeySym keysym;
-  char buffer[10];
-  int count = XLookupString(e, buffer, sizeof(buffer), &keysym, NULL);
+void apply_configure_request(Client *c) {
+    unsigned long mask = c->configure_mask;
+    c->configure_mask = 0;
 
-  switch (keysym) {
-      case XK_F11:
-          debug_log("F11 pressed - toggling fullscreen");
-          show_operation_feedback(c->is_fullscreen ? "Exiting fullscreen" : "Entering fullscreen");
-          toggle_fullscreen(c);
-          break;
-      case XK_F12:
-          debug_log("F12 pressed - lowering window");
-          show_operation_feedback("Window lowered");
-          lower_window(c);
-          break;
-      case XK_Escape:
-          if (e->state & ControlMask) {
-              debug_log("Ctrl+Esc pressed - closing window");
-              show_operation_feedback("Closing window");
-              XKillClient(dpy, c->win);
-          }
-          break;
-  }
+    // Fullscreen, maximized and tiled windows, and windows under the user's mouse,
+    // keep their geometry; the client is only told where it is
+    int locked = c->is_fullscreen || c->is_maximized || client_tiled(c) || (window_dragging && dragged_client == c) ||
+                 (window_resizing && resized_client == c);
+    if (!locked && (mask & (CWX | CWY | CWWidth | CWHeight))) {
+        int screen_width = DisplayWidth(dpy, screen);
+        int usable_height = panel.y;
+
+        // Requested sizes are for the client window; the frame adds its decorations
+        int width = (mask & CWWidth) ? c->configure_width + 2 * FRAME_BORDER : c->width;
+        int height = (mask & CWHeight) ?
+                     c->configure_height + TITLEBAR_HEIGHT + 2 * FRAME_BORDER : c->height;
+        if (width < TITLE_LEFT + 2 * FRAME_BORDER) width = TITLE_LEFT + 2 * FRAME_BORDER;
+        if (height < TITLEBAR_HEIGHT + 2 * FRAME_BORDER + 1) height = TITLEBAR_HEIGHT + 2 * FRAME_BORDER + 1;
+        if (width > screen_width) width = screen_width;
+        if (height > usable_height) height = usable_height;
+
+        // With the default NorthWest gravity, x and y place the frame itself.
+        // Keep the titlebar reachable.
+        int x = (mask & CWX) ? c->configure_x : c->x;
+        int y = (mask & CWY) ? c->configure_y : c->y;
+        if (x > screen_width - TITLE_LEFT) x = screen_width - TITLE_LEFT;
+        if (x < TITLE_LEFT - width) x = TITLE_LEFT - width;
+        if (y > usable_height - TITLEBAR_HEIGHT) y = usable_height - TITLEBAR_HEIGHT;
+        if (y < 0) y = 0;
+
+        if (x != c->x || y != c->y) move_window(c, x, y);
+        if (width != c->width || height != c->height) resize_window(c, width, height);
+    }
+
+    if (mask & CWStackMode) {
+        if (c->configure_stack == Above) {
+            raise_client(c);
+        } else if (c->configure_stack == Below) {
+            stack_window_bottom(c->frame);
+            restack();
+        }
+    }
+
+    send_configure_notify(c);
 }
 
-void manage_window(Window w) {
-  debug_log("Managing window %lu, current client count: %d", w, client_count);
+void flush_configure_requests() {
+    if (!configures_pending) return;
+    configures_pending = 0;
 
-  if (client_count >= 100) {
-      debug_log("ERROR: Too many clients");
-      return;
-  }
+    for (Client *c = client_registry.head; c; c = c->next) {
+        if (c->configure_mask) apply_configure_request(c);
+    }
+}
+
+void manage_window(Window w) {
+  debug_log("Managing window %lu, current client count: %d", w, client_registry.count);
 
-  Client *c = malloc(sizeof(Client));
+  Client *c = client_alloc();
   if (!c) {
       debug_log("ERROR: Failed to allocate client memory");
       return;
@@ -3559,8 +9174,12 @@ void manage_window(Window w) {
   c->win = w;
   c->is_mapped = 1;
   c->is_fullscreen = 0;
-  c->is_active = 1; // New window is active by default
+  c->is_maximized = 0;
+  c->is_active = 0; // focused once mapped, see MapRequest
   c->button_hover = 0;
+  c->icon = NULL;
+  c->icon_fetched = 0;
+  c->icon_serial = 0;
 
   // Get window attributes
   XWindowAttributes wa;
@@ -3596,11 +9215,18 @@ void manage_window(Window w) {
   // Set up frame window events
   XSelectInput(dpy, c->frame, ExposureMask | ButtonPressMask | ButtonReleaseMask |
                PointerMotionMask | SubstructureRedirectMask);
+  surface_init(&c->surface, c->frame, 1, c->width, c->height, black);
 
   // Set cursor for frame
   Cursor frame_cursor = XCreateFontCursor(dpy, XC_left_ptr);
   XDefineCursor(dpy, c->frame, frame_cursor);
 
+  // The frame draws the border
+  XSetWindowBorderWidth(dpy, w, 0);
+
+  // Hear about icon changes, focus moves and the client unmapping itself
+  XSelectInput(dpy, w, PropertyChangeMask | FocusChangeMask | StructureNotifyMask);
+
   // Reparent the client window into the frame
   XReparentWindow(dpy, w, c->frame, FRAME_BORDER, TITLEBAR_HEIGHT + FRAME_BORDER);
   debug_log("Window reparented into frame");
@@ -3610,18 +9236,44 @@ void manage_window(Window w) {
                 c->height - TITLEBAR_HEIGHT - 2 * FRAME_BORDER);
 
   // Try to get window title
-  c->title = get_window_title(w);
-  debug_log("Window title: '%s'", c->title);
+  char *title = get_window_title(w);
+  set_client_title(c, intern_string(title));
+  debug_log("Window title: '%s'", title);
+  free(title);
+
+  // WM_CLASS and PID, for matching windows to pinned apps
+  read_client_class(c);
+
+  // New windows open on top of their layer
+  int fullscreen;
+  c->layer = initial_client_layer(w, &fullscreen, &c->is_floating);
+  stack_window(c->frame, c->layer);
+  restack();
+
+  if (!register_client(c)) {
+      debug_log("ERROR: Failed to register client %lu", w);
+      XReparentWindow(dpy, w, root, c->x, c->y);
+      surface_free(&c->surface);
+      unstack_window(c->frame);
+      XDestroyWindow(dpy, c->frame);
+      set_client_title(c, NULL);
+      release_string(c->wm_instance);
+      release_string(c->wm_class);
+      client_release(c);
+      return;
+  }
+  debug_log("Client added to list, new count: %d", client_registry.count);
+  associate_client(c);
 
-  // Map the frame
-  XMapWindow(dpy, c->frame);
-  debug_log("Frame window mapped");
+  // Mapped by the MapRequest handler, if its desktop is showing
+  c->desktop = initial_client_desktop(w);
+  desktop_link(c);
 
-  clients[client_count++] = c;
-  debug_log("Client added to list, new count: %d", client_count);
+  ewmh_client_added(c);
 
   // Draw decorations
   draw_window_decorations(c);
+  if (fullscreen) toggle_fullscreen(c);
 
   // Redraw panel to show new window
   draw_panel();
@@ -3632,35 +9284,38 @@ void manage_window(Window w) {
 void unmanage_window(Window w) {
   debug_log("Unmanaging window %lu", w);
 
-  for (int i = 0; i < client_count; i++) {
-      if (clients[i] && clients[i]->win == w) {
-          debug_log("Found client at index %d", i);
-
-          if (clients[i]->title) {
-              free(clients[i]->title);
-          }
-
-          free(clients[i]);
-
-          // Shift remaining clients
-          for (int j = i; j < client_count - 1; j++) {
-              clients[j] = clients[j + 1];
-          }
-          clients[client_count - 1] = NULL;
-          client_count--;
-          debug_log("Client removed, new count: %d", client_count);
-
-          // Redraw panel
-          draw_panel();
-          return;
-      }
-  }
+  Client *c = find_client(w);
+  if (!c || c->win != w) return;
+
+  // Take c out of every list before handing the focus on, since that
+  // repaints the task buttons from the registry
+  surface_free(&c->surface);
+  unstack_window(c->frame);
+  desktop_unlink(c);
+  PinnedApp *app = c->pinned_app;
+  dissociate_client(c);
+  release_launch_pid(app, c->pid);
+  unregister_client(c);
+  unfocus_client(c);
+  ewmh_client_removed();
+
+  set_client_title(c, NULL);
+  release_string(c->wm_instance);
+  release_string(c->wm_class);
+  free(c->icon);
+  c->icon = NULL;
+  c->icon_fetched = 0;
+  client_release(c);
+  debug_log("Client removed, new count: %d", client_registry.count);
+
+  // Redraw panel
+  draw_panel();
 }
 
 char* get_window_title(Window w) {
-  Atom net_wm_name = XInternAtom(dpy, "_NET_WM_NAME", False);
-  Atom wm_name = XInternAtom(dpy, "WM_NAME", False);
-  Atom utf8_string = XInternAtom(dpy, "UTF8_STRING", False);
+  Atom net_wm_name = atoms[ATOM_NET_WM_NAME];
+  Atom wm_name = XA_WM_NAME;
+  Atom utf8_string = atoms[ATOM_UTF8_STRING];
 
   Atom type;
   int format;
@@ -3706,44 +9361,100 @@ char* get_window_title(Window w) {
   return strdup("Untitled");
 }
 
-void toggle_fullscreen(Client *c) {
-  if (!c->is_fullscreen) {
-      // Save original position and size
-      c->original_x = c->x;
-      c->original_y = c->y;
-      c->original_width = c->width;
-      c->original_height = c->height;
+// Re-read the titles that changed since the last pass. However many
+// PropertyNotify events a client sent, it costs one read and one repaint
+// of its title text; the panel is only redrawn if a window without a
+// WM_CLASS moved to another pinned app because of it.
+void flush_title_updates() {
+  if (!titles_dirty) return;
+  titles_dirty = 0;
+
+  int panel_changed = 0;
+  for (Client *c = client_registry.head; c; c = c->next) {
+      if (!c->title_dirty) continue;
+      c->title_dirty = 0;
+
+      char *text = get_window_title(c->win);
+      InternedString *title = intern_string(text);
+      free(text);
+      if (title == c->title) {
+          release_string(title);
+          continue;
+      }
+      set_client_title(c, title);
+      draw_window_title(c);
 
-      // Move to fullscreen (account for panel)
-      int screen_width = DisplayWidth(dpy, screen);
-      int screen_height = DisplayHeight(dpy, screen);
+      if (!c->wm_class) {
+          PinnedApp *app = c->pinned_app;
+          associate_client(c);
+          if (c->pinned_app != app) panel_changed = 1;
+      }
+  }
+  if (panel_changed) draw_panel();
+}
 
-      // Resize the FRAME to full screen width
-      c->width = screen_width;
-      c->height = screen_height - PANEL_HEIGHT;
+// Give c's frame a new geometry and tell the client where it now is
+void set_client_geometry(Client *c, int x, int y, int width, int height) {
+  c->x = x;
+  c->y = y;
+  c->width = width;
+  c->height = height;
+  XMoveResizeWindow(dpy, c->frame, c->x, c->y, c->width, c->height);
+  XResizeWindow(dpy, c->win, c->width - 2 * FRAME_BORDER,
+                c->height - TITLEBAR_HEIGHT - 2 * FRAME_BORDER);
+  send_configure_notify(c);
+}
+
+// Remember the geometry to go back to, unless c is already away from it
+void save_client_geometry(Client *c) {
+  if (c->is_maximized || c->is_fullscreen) return;
+  c->original_x = c->x;
+  c->original_y = c->y;
+  c->original_width = c->width;
+  c->original_height = c->height;
+}
 
-      XMoveResizeWindow(dpy, c->frame, 0, 0, c->width, c->height);
-      XResizeWindow(dpy, c->win, c->width - 2 * FRAME_BORDER,
-                    c->height - TITLEBAR_HEIGHT - 2 * FRAME_BORDER);
-      c->is_fullscreen = 1;
-      debug_log("Entered fullscreen mode: %dx%d", c->width, c->height);
+// Put c where its current state says: fullscreen, maximized or as it was
+void apply_client_state(Client *c) {
+  if (c->is_fullscreen) {
+      // The client window covers the screen; the frame's border and
+      // titlebar lie outside it
+      set_client_geometry(c, -(BORDER_WIDTH + FRAME_BORDER),
+                          -(BORDER_WIDTH + TITLEBAR_HEIGHT + FRAME_BORDER),
+                          DisplayWidth(dpy, screen) + 2 * FRAME_BORDER,
+                          DisplayHeight(dpy, screen) + TITLEBAR_HEIGHT + 2 * FRAME_BORDER);
+  } else if (c->is_maximized) {
+      // The work area, above the panel
+      set_client_geometry(c, 0, 0, DisplayWidth(dpy, screen) - 2 * BORDER_WIDTH,
+                          panel.y - 2 * BORDER_WIDTH);
   } else {
-      // Restore original size and position
-      c->width = c->original_width;
-      c->height = c->original_height;
-
-      XMoveResizeWindow(dpy, c->frame, c->original_x, c->original_y,
-                       c->width, c->height);
-      XResizeWindow(dpy, c->win, c->width - 2 * FRAME_BORDER,
-                   c->height - TITLEBAR_HEIGHT - 2 * FRAME_BORDER);
-      c->is_fullscreen = 0;
-      debug_log("Exited fullscreen mode");
+      set_client_geometry(c, c->original_x, c->original_y,
+                          c->original_width, c->original_height);
   }
 
+  // Fullscreen windows stack above the panel; both states leave the tiling
+  raise_client(c);
+  ewmh_client_state_changed(c);
+  mark_layout_dirty(c->desktop);
+
   // Force redraw of decorations with new dimensions
   draw_window_decorations(c);
 }
 
+void toggle_maximize(Client *c) {
+  save_client_geometry(c);
+  c->is_maximized = !c->is_maximized;
+  debug_log(c->is_maximized ? "Maximized window" : "Unmaximized window");
+  apply_client_state(c);
+}
+
+void toggle_fullscreen(Client *c) {
+  save_client_geometry(c);
+  c->is_fullscreen = !c->is_fullscreen;
+  debug_log(c->is_fullscreen ? "Entered fullscreen mode" : "Exited fullscreen mode");
+  apply_client_state(c);
+}
+
 void resize_window(Client *c, int width, int height) {
   // Update client dimensions first
   c->width = width;
@@ -3769,21 +9480,21 @@ void move_window(Client *c, int x, int y) {
 }
 
 void lower_window(Client *c) {
-  XLowerWindow(dpy, c->frame);
-  c->is_active = 0;
-  draw_window_decorations(c);
-  draw_panel();
+  stack_window_bottom(c->frame);
+  restack();
+  if (c == focus.focused) focus_next_client(c);
 }
 
 void close_window(Client *c) {
   debug_log("Closing window %lu", c->win);
 
   // Unmap and hide the frame
-  XUnmapWindow(dpy, c->frame);
-  XUnmapWindow(dpy, c->win);
+  if (client_viewable(c)) unmap_client(c);
 
   // Mark as unmapped
   c->is_mapped = 0;
+  ewmh_client_state_changed(c);
+  mark_layout_dirty(c->desktop);
 
   // Redraw panel to remove it
   draw_panel();
@@ -3794,10 +9505,13 @@ void close_window(Client *c) {
 }
 
 Client* find_client(Window w) {
-  for (int i = 0; i < client_count; i++) {
-      if (clients[i] && (clients[i]->win == w || clients[i]->frame == w)) {
-          return clients[i];
-      }
+  if (w == None || !client_registry.index_size) return NULL;
+
+  int mask = client_registry.index_size - 1;
+  unsigned long slot = client_index_slot(w, client_registry.index_size);
+  while (client_registry.index[slot].key != None) {
+      if (client_registry.index[slot].key == w) return client_registry.index[slot].client;
+      slot = (slot + 1) & mask;
   }
   return NULL;
 }
@@ -3811,12 +9525,12 @@ void create_window_control_menu() {
   window_control_menu.alpha = 0.0f;
   window_control_menu.target_client = NULL;
 
-  window_control_menu.win = XCreateSimpleWindow(dpy, root,
-                                                 window_control_menu.x,
+  window_control_menu.win = create_popup_window(window_control_menu.x,
                                                  window_control_menu.y,
                                                  window_control_menu.width,
                                                  window_control_menu.height,
-                                                 0, white, dark_blue);
+                                                 &window_control_menu.window_surface,
+                                                 &window_control_menu.surface);
 
   XSelectInput(dpy, window_control_menu.win, ButtonPressMask | ExposureMask | PointerMotionMask);
   window_control_menu.visible = 0;
@@ -3839,17 +9553,15 @@ void show_window_control_menu(int x, int y, Client *c) {
       }
 
       XMoveWindow(dpy, window_control_menu.win, window_control_menu.x, window_control_menu.y);
-      XMapWindow(dpy, window_control_menu.win);
-      XRaiseWindow(dpy, window_control_menu.win);
       window_control_menu.visible = 1;
+      window_control_menu.alpha = 0.0f;
+      draw_window_control_menu();
+      XMapWindow(dpy, window_control_menu.win);
+      raise_window(window_control_menu.win, LAYER_POPUP);
 
-      // Fade-in animation
-      for (int i = 0; i <= 10; i++) {
-          window_control_menu.alpha = (float)i / 10.0f;
-          draw_window_control_menu();
-          XFlush(dpy);
-          usleep(10000);
-      }
+      // Fade-in: the content is drawn once, each step only presents it
+      fade_popup(&window_control_menu.window_surface, &window_control_menu.surface,
+                 &window_control_menu.alpha, 1);
 
       XGrabPointer(dpy, root, False, ButtonPressMask, GrabModeAsync,
                   GrabModeAsync, None, None, CurrentTime);
@@ -3859,12 +9571,8 @@ void show_window_control_menu(int x, int y, Client *c) {
 void hide_window_control_menu() {
   if (window_control_menu.visible) {
       // Fade-out animation
-      for (int i = 10; i >= 0; i--) {
-          window_control_menu.alpha = (float)i / 10.0f;
-          draw_window_control_menu();
-          XFlush(dpy);
-          usleep(8000);
-      }
+      fade_popup(&window_control_menu.window_surface, &window_control_menu.surface,
+                 &window_control_menu.alpha, 0);
 
       XUnmapWindow(dpy, window_control_menu.win);
       window_control_menu.visible = 0;
@@ -3877,18 +9585,19 @@ void hide_window_control_menu() {
 void draw_window_control_menu() {
   if (!window_control_menu.visible) return;
 
-  XClearWindow(dpy, window_control_menu.win);
+  Surface *s = &window_control_menu.surface;
+  shape_window(&window_control_menu.window_surface, window_control_menu.width,
+               window_control_menu.height, CORNER_RADIUS, SHAPE_ALL);
+  s->backend->clear(s);
+  surface_begin_batch(s);
 
   // Draw rounded background with gradient
-  XSetForeground(dpy, menu_gc, menu_bg);
-  draw_rounded_rectangle(window_control_menu.win, menu_gc, 0, 0,
-                        window_control_menu.width, window_control_menu.height,
-                        CORNER_RADIUS);
+  draw_rounded_rectangle(s, 0, 0, window_control_menu.width, window_control_menu.height,
+                        CORNER_RADIUS, menu_bg);
 
   // Draw subtle border
-  XSetForeground(dpy, menu_gc, accent_color);
-  XDrawRectangle(dpy, window_control_menu.win, menu_gc, 1, 1,
-                 window_control_menu.width - 3, window_control_menu.height - 3);
+  s->backend->stroke_rect(s, 1, 1, window_control_menu.width - 3, window_control_menu.height - 3,
+                          1, accent_color);
 
   char *items[] = {"Pin to Panel", "Maximize", "Minimize", "Close"};
 
@@ -3897,28 +9606,368 @@ void draw_window_control_menu() {
 
       // Hover effect
       if (window_control_menu.hover_item == i) {
-          XSetForeground(dpy, menu_gc, menu_hover_bg);
-          draw_rounded_rectangle(window_control_menu.win, menu_gc, 2, y + 2,
-                                window_control_menu.width - 4, MENU_ITEM_HEIGHT - 4, 4);
+          draw_rounded_rectangle(s, 2, y + 2, window_control_menu.width - 4, MENU_ITEM_HEIGHT - 4,
+                                4, menu_hover_bg);
       }
 
       if (i > 0) {
-          XSetForeground(dpy, menu_gc, 0x404040);
-          XDrawLine(dpy, window_control_menu.win, menu_gc, 10, y,
-                   window_control_menu.width - 10, y);
+          s->backend->draw_line(s, 10, y, window_control_menu.width - 10, y, 0x404040);
       }
 
-      XSetForeground(dpy, menu_gc, text_primary);
-      int text_width = XTextWidth(XLoadQueryFont(dpy, "fixed"), items[i], strlen(items[i]));
-      int text_x = (window_control_menu.width - text_width) / 2;
+      int width = text_width(FONT_FIXED, items[i]);
+      int text_x = (window_control_menu.width - width) / 2;
       int text_y = y + (MENU_ITEM_HEIGHT / 2) + 5;
 
-      XDrawString(dpy, window_control_menu.win, menu_gc, text_x, text_y,
-                 items[i], strlen(items[i]));
+      s->backend->text(s, text_x, text_y, items[i], FONT_FIXED, text_primary);
+  }
+
+  surface_end_batch(s);
+  present_popup(&window_control_menu.window_surface, s, window_control_menu.alpha);
+}
+
+// ---- Render check mode ----
+//
+// diamondwm --render-check DIR renders every scene below with the headless
+// backend, compares each frame against DIR/<scene>.png and reports the mean
+// render time. --render-update DIR rewrites the golden images instead.
+// Exits non-zero if any frame differs.
+
+#define RENDER_CHECK_RUNS 50
+#define RENDER_CHECK_TOLERANCE 2 // per channel, absorbs rounding differences
+
+typedef struct {
+    const char *name;
+    Surface *surface;
+    void (*draw)();
+} RenderScene;
+
+Client render_clients[3];
+
+void render_active_frame() {
+    draw_window_decorations(&render_clients[0]);
+}
+
+void render_inactive_frame() {
+    draw_window_decorations(&render_clients[1]);
+}
+
+// Fixed state so every run produces the same pixels
+void render_check_fixtures() {
+    static PinnedApp pinned[2] = {
+        {"Terminal", "xterm", NULL, None, 0},
+        {"Firefox", "firefox", NULL, None, 0}
+    };
+    static AppInfo utilities[] = {
+        {"Calculator", "gnome-calculator", NULL, "Utility;", NULL},
+        {"Files", "nautilus", NULL, "Utility;", NULL},
+        {"Text Editor", "gedit", NULL, "Utility;", NULL}
+    };
+    static AppInfo internet[] = {
+        {"Firefox", "firefox", NULL, "Network;", NULL},
+        {"Thunderbird", "thunderbird", NULL, "Network;", NULL}
+    };
+    static AppCategory categories[] = {
+        {"Internet", internet, 2, 1},
+        {"Utilities", utilities, 3, 1}
+    };
+    static char *titles[] = {"Terminal", "Documents - Files", "Untitled Document 1 - Text Editor"};
+
+    render_clock_time = 1700000000; // 22:13 UTC
+
+    panel.win = 1;
+    panel.width = 1280;
+    panel.height = PANEL_HEIGHT;
+    panel.y = 1024 - PANEL_HEIGHT;
+    surface_init(&panel.surface, None, 1, panel.width, panel.height, dark_blue);
+
+    pinned_apps.apps = pinned;
+    pinned_apps.app_count = 2;
+    pinned_apps.max_apps = 2;
+
+    for (int i = 0; i < 3; i++) {
+        Client *c = &render_clients[i];
+        memset(c, 0, sizeof(*c));
+        c->win = 10 + i;
+        c->frame = 20 + i;
+        c->width = 480 + 40 * i;
+        c->height = 320;
+        c->is_mapped = 1;
+        set_client_title(c, intern_string(titles[i]));
+        c->is_active = i == 0;
+        c->button_hover = i == 0 ? 1 : 0;
+        surface_init(&c->surface, None, 1, c->width, c->height, black);
+        register_client(c);
+    }
+    rebuild_pinned_associations();
+
+    menu.visible = 1;
+    menu.width = MENU_WIDTH;
+    menu.height = MENU_ITEM_HEIGHT * 4;
+    menu.hover_item = 1;
+    surface_init(&menu.surface, None, 1, menu.width, menu.height, dark_blue);
+
+    app_launcher.visible = 1;
+    app_launcher.width = 350;
+    app_launcher.height = 600;
+    app_launcher.categories = categories;
+    app_launcher.category_count = 2;
+    app_launcher.hover_item = (1 << 16) | 2;
+    strcpy(app_launcher.search_text, "fi");
+    app_launcher.search_mode = 1;
+    surface_init(&app_launcher.surface, None, 1, app_launcher.width, app_launcher.height, dark_blue);
+
+    window_control_menu.visible = 1;
+    window_control_menu.width = MENU_WIDTH;
+    window_control_menu.height = MENU_ITEM_HEIGHT * 4;
+    window_control_menu.hover_item = 2;
+    window_control_menu.target_client = &render_clients[0];
+    surface_init(&window_control_menu.surface, None, 1, window_control_menu.width,
+                 window_control_menu.height, dark_blue);
+
+    pinned_app_menu.visible = 1;
+    pinned_app_menu.width = MENU_WIDTH;
+    pinned_app_menu.height = MENU_ITEM_HEIGHT * 5;
+    pinned_app_menu.hover_item = 0;
+    pinned_app_menu.target_pinned_app = &pinned[0];
+    surface_init(&pinned_app_menu.surface, None, 1, pinned_app_menu.width,
+                 pinned_app_menu.height, dark_blue);
+
+    tooltip.visible = 1;
+    tooltip.face = get_tooltip_face("Firefox");
+    tooltip.width = tooltip.face->width;
+    tooltip.height = tooltip.face->height;
+    strcpy(tooltip.text, "Firefox");
+    surface_init(&tooltip.surface, None, 1, tooltip.width, tooltip.height, dark_blue);
+}
+
+// Premultiplied ARGB to straight RGBA bytes
+void unpremultiply_row(const unsigned int *src, unsigned char *dst, int width) {
+    for (int x = 0; x < width; x++) {
+        unsigned int p = src[x];
+        unsigned int a = p >> 24;
+        unsigned int r = (p >> 16) & 0xFF, g = (p >> 8) & 0xFF, b = p & 0xFF;
+        if (a && a < 255) {
+            r = r * 255 / a;
+            g = g * 255 / a;
+            b = b * 255 / a;
+        }
+        dst[4 * x] = r;
+        dst[4 * x + 1] = g;
+        dst[4 * x + 2] = b;
+        dst[4 * x + 3] = a;
+    }
+}
+
+int write_png(const char *path, Surface *s) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return 0;
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png ? png_create_info_struct(png) : NULL;
+    unsigned char *row = malloc(4 * s->pixels_width);
+    if (!png || !info || !row || setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        free(row);
+        fclose(file);
+        return 0;
+    }
+
+    png_init_io(png, file);
+    png_set_IHDR(png, info, s->pixels_width, s->pixels_height, 8, PNG_COLOR_TYPE_RGBA,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    for (int y = 0; y < s->pixels_height; y++) {
+        unpremultiply_row(s->pixels + y * s->pixels_width, row, s->pixels_width);
+        png_write_row(png, row);
+    }
+    png_write_end(png, NULL);
+
+    png_destroy_write_struct(&png, &info);
+    free(row);
+    fclose(file);
+    return 1;
+}
+
+// Returns the number of pixels outside the tolerance, or -1 on a size mismatch
+int compare_with_golden(Surface *s, const unsigned char *golden, int width, int height) {
+    if (width != s->pixels_width || height != s->pixels_height) return -1;
+
+    unsigned char *row = malloc(4 * width);
+    if (!row) return -1;
+    int differing = 0;
+    for (int y = 0; y < height; y++) {
+        unpremultiply_row(s->pixels + y * width, row, width);
+        const unsigned char *expected = golden + (size_t)4 * y * width;
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < 4; c++) {
+                if (abs(row[4 * x + c] - expected[4 * x + c]) > RENDER_CHECK_TOLERANCE) {
+                    differing++;
+                    break;
+                }
+            }
+        }
+    }
+    free(row);
+    return differing;
+}
+
+int render_check(const char *dir, int update) {
+    // No display: palette and fonts come from constants and fontconfig
+    setenv("TZ", "UTC", 1);
+    tzset();
+    black = 0x000000;
+    white = 0xFFFFFF;
+    init_palette();
+
+    renderer = &headless_backend;
+    if (!headless_load_fonts()) {
+        fprintf(stderr, "render check: needs DejaVu Sans and DejaVu Sans Mono (fonts-dejavu-core)\n");
+        return 1;
+    }
+    render_check_fixtures();
+
+    RenderScene scenes[] = {
+        {"panel", &panel.surface, draw_panel},
+        {"frame-active", &render_clients[0].surface, render_active_frame},
+        {"frame-inactive", &render_clients[1].surface, render_inactive_frame},
+        {"menu", &menu.surface, draw_menu},
+        {"launcher", &app_launcher.surface, draw_app_launcher},
+        {"window-menu", &window_control_menu.surface, draw_window_control_menu},
+        {"pinned-menu", &pinned_app_menu.surface, draw_pinned_app_menu},
+        {"tooltip", &tooltip.surface, draw_tooltip},
+    };
+    int scene_count = sizeof(scenes) / sizeof(scenes[0]);
+    int failures = 0;
+
+    printf("%-16s %10s  %s\n", "scene", "ms/frame", "result");
+    for (int i = 0; i < scene_count; i++) {
+        RenderScene *scene = &scenes[i];
+
+        // First frame fills the caches; the timed runs measure steady state
+        scene->draw();
+        struct timeval start, end;
+        gettimeofday(&start, NULL);
+        for (int run = 0; run < RENDER_CHECK_RUNS; run++) scene->draw();
+        gettimeofday(&end, NULL);
+        double ms = ((end.tv_sec - start.tv_sec) * 1000.0 +
+                     (end.tv_usec - start.tv_usec) / 1000.0) / RENDER_CHECK_RUNS;
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s.png", dir, scene->name);
+
+        const char *result;
+        char detail[64];
+        int width, height;
+        unsigned char *golden = update ? NULL : read_png(path, &width, &height);
+
+        if (update) {
+            result = write_png(path, scene->surface) ? "written" : "write failed";
+            if (strcmp(result, "written") != 0) failures++;
+        } else if (!golden) {
+            result = "missing golden";
+            failures++;
+        } else {
+            int differing = compare_with_golden(scene->surface, golden, width, height);
+            if (differing == 0) {
+                result = "ok";
+            } else if (differing < 0) {
+                snprintf(detail, sizeof(detail), "size %dx%d, golden %dx%d",
+                         scene->surface->pixels_width, scene->surface->pixels_height, width, height);
+                result = detail;
+                failures++;
+            } else {
+                snprintf(detail, sizeof(detail), "%d pixels differ", differing);
+                result = detail;
+                failures++;
+            }
+        }
+        free(golden);
+        printf("%-16s %10.3f  %s\n", scene->name, ms, result);
+    }
+
+    free_theme_textures();
+    free_logo_assets();
+    free_icon_atlas();
+    free_tooltip_faces();
+    headless_free_fonts();
+    return failures ? 1 : 0;
+}
+
+// Enhanced modern color palette (black and white come from the screen)
+void init_palette() {
+    dark_gray = 0x202020;
+    light_gray = 0x404040;
+    red = 0xFF4444;
+    dark_blue = 0x1b1b2c;
+    titlebar_gray = 0x2D2D2D;
+    titlebar_active = 0x3D3D3D;
+    button_red = 0xFF4444;
+    button_yellow = 0xFFAA00;
+    button_green = 0x44FF44;
+    purple_color = 0x8A2BE2;
+    menu_bg = 0x2D2D3D;
+    menu_hover_bg = 0x3D3D4D;
+    accent_color = 0x6C5CE7;
+    shadow_color = 0x101010;
+    bg_gradient_start = 0x0a0a1a;
+    bg_gradient_end = 0x1a1a2a;
+
+    // New enhanced colors
+    accent_light = 0x897DEA;
+    background_dark = 0x0F0F1A;
+    background_light = 0x1E1E2E;
+    text_primary = 0xE0E0E0;
+    text_secondary = 0x888888;
+}
+
+// Work held back until the event queue is drained, so bursts coalesce
+void flush_deferred() {
+  flush_layouts();
+  flush_configure_requests();
+  flush_title_updates();
+  flush_repaints();
+  flush_ewmh();
+}
+
+// One round trip for every atom in atom_names
+void init_atoms() {
+  char *names[ATOM_COUNT];
+  char cm_selection[32];
+  for (int i = 0; i < ATOM_COUNT; i++) names[i] = (char *)atom_names[i];
+  snprintf(cm_selection, sizeof(cm_selection), atom_names[ATOM_NET_WM_CM_S], screen);
+  names[ATOM_NET_WM_CM_S] = cm_selection;
+
+  if (!XInternAtoms(dpy, names, ATOM_COUNT, False, atoms)) {
+      debug_log("WARNING: Some atoms could not be interned");
   }
 }
 
-int main() {
+// Clients can vanish between an event, or a deferred update, and our
+// request for their window; that is expected and must not take the window
+// manager down the way Xlib's default handler would
+int x_error_handler(Display *d, XErrorEvent *e) {
+    debug_log("X error %d (request %d.%d) on resource %lu",
+              e->error_code, e->request_code, e->minor_code, e->resourceid);
+    return 0;
+}
+
+// Only one client may select SubstructureRedirect on the root; a BadAccess
+// on that request means another window manager already owns the screen
+int wm_detect_error_handler(Display *d, XErrorEvent *e) {
+    if (e->error_code == BadAccess && e->request_code == X_ChangeWindowAttributes) {
+        debug_log("ERROR: Another window manager is running");
+        fprintf(stderr, "diamondwm: another window manager is running\n");
+        exit(1);
+    }
+    return x_error_handler(d, e);
+}
+
+int main(int argc, char **argv) {
+  // Headless modes never touch the display
+  if (argc == 3 && (strcmp(argv[1], "--render-check") == 0 || strcmp(argv[1], "--render-update") == 0)) {
+      return render_check(argv[2], strcmp(argv[1], "--render-update") == 0);
+  }
+
   remove("/tmp/diamondwm_debug.log");
   debug_log("=== Modern DiamondWM Starting ===");
 
@@ -3932,85 +9981,22 @@ int main() {
   screen = DefaultScreen(dpy);
   root = RootWindow(dpy, screen);
 
-  // Enhanced modern color palette
+  // Claim the root before relaxing error handling, so a second window
+  // manager exits instead of running without redirection
+  XSetErrorHandler(wm_detect_error_handler);
+  XSelectInput(dpy, root,
+      SubstructureRedirectMask | SubstructureNotifyMask |
+      ButtonPressMask | ButtonReleaseMask | PointerMotionMask | KeyPressMask);
+  XSync(dpy, False);
+  XSetErrorHandler(x_error_handler);
+  init_atoms();
+
   black = BlackPixel(dpy, screen);
   white = WhitePixel(dpy, screen);
-  dark_gray = 0x202020;
-  light_gray = 0x404040;
-  red = 0xFF4444;
-  dark_blue = 0x1b1b2c;
-  titlebar_gray = 0x2D2D2D;
-  titlebar_active = 0x3D3D3D;
-  button_red = 0xFF4444;
-  button_yellow = 0xFFAA00;
-  button_green = 0x44FF44;
-  purple_color = 0x8A2BE2;
-  menu_bg = 0x2D2D3D;
-  menu_hover_bg = 0x3D3D4D;
-  accent_color = 0x6C5CE7;
-  shadow_color = 0x101010;
-  bg_gradient_start = 0x0a0a1a;
-  bg_gradient_end = 0x1a1a2a;
-
-  // New enhanced colors
-  accent_light = 0x897DEA;
-  background_dark = 0x0F0F1A;
-  background_light = 0x1E1E2E;
-  text_primary = 0xE0E0E0;
-  text_secondary = 0x888888;
-
-  // Create GCs with modern colors
-  XGCValues gv;
-  gv.foreground = light_gray;
-  gv.background = black;
-  gv.line_width = BORDER_WIDTH;
-  gc = XCreateGC(dpy, root, GCForeground | GCBackground | GCLineWidth, &gv);
-
-  XGCValues title_gv;
-  title_gv.foreground = titlebar_gray;
-  title_gv.background = titlebar_gray;
-  title_gc = XCreateGC(dpy, root, GCForeground | GCBackground, &title_gv);
+  init_palette();
 
   set_background();
 
-  XGCValues text_gv;
-  text_gv.foreground = text_primary;
-  text_gv.background = titlebar_gray;
-  text_gv.font = XLoadFont(dpy, "fixed");
-  text_gc = XCreateGC(dpy, root, GCForeground | GCBackground | GCFont, &text_gv);
-
-  XGCValues panel_gv;
-  panel_gv.foreground = text_primary;
-  panel_gv.background = dark_blue;
-  panel_gv.font = XLoadFont(dpy, "fixed");
-  panel_gc = XCreateGC(dpy, root, GCForeground | GCBackground | GCFont, &panel_gv);
-
-  XGCValues menu_gv;
-  menu_gv.foreground = text_primary;
-  menu_gv.background = menu_bg;
-  menu_gv.font = XLoadFont(dpy, "fixed");
-  menu_gc = XCreateGC(dpy, root, GCForeground | GCBackground | GCFont, &menu_gv);
-
-  XGCValues close_gv;
-  close_gv.foreground = button_red;
-  close_gv.background = titlebar_gray;
-  close_gc = XCreateGC(dpy, root, GCForeground | GCBackground, &close_gv);
-
-  XGCValues minimize_gv;
-  minimize_gv.foreground = button_yellow;
-  minimize_gv.background = titlebar_gray;
-  minimize_gc = XCreateGC(dpy, root, GCForeground | GCBackground, &minimize_gv);
-
-  XGCValues maximize_gv;
-  maximize_gv.foreground = button_green;
-  maximize_gv.background = titlebar_gray;
-  maximize_gc = XCreateGC(dpy, root, GCForeground | GCBackground, &maximize_gv);
-
-  XGCValues button_gv;
-  button_gv.foreground = light_gray;
-  button_gv.background = titlebar_gray;
-  button_gc = XCreateGC(dpy, root, GCForeground | GCBackground, &button_gv);
-
   // Initialize Xft colors
   XRenderColor render_color;
   render_color.red = ((text_primary >> 16) & 0xFF) * 257;
@@ -4040,11 +10026,16 @@ int main() {
   // Load Xft fonts
   load_xft_fonts();
 
-  XSelectInput(dpy, root,
-      SubstructureRedirectMask | SubstructureNotifyMask |
-      ButtonPressMask | ButtonReleaseMask | PointerMotionMask | KeyPressMask);
+  // Choose core X or XRender drawing before any surface is created
+  select_render_backend();
+
+
+  int shape_event_base, shape_error_base;
+  has_shape = XShapeQueryExtension(dpy, &shape_event_base, &shape_error_base);
+  debug_log("Shape extension: %s", has_shape ? "yes" : "no");
 
   create_panel();
+  ewmh_init();
 
   // Initialize pinned apps
   pinned_apps.max_apps = 20;
@@ -4075,13 +10066,14 @@ int main() {
 
   // Create tooltip window
   tooltip.width = 100;
-  tooltip.height = 30;
+  tooltip.height = TOOLTIP_HEIGHT;
   tooltip.visible = 0;
   tooltip.target_app = NULL;
   tooltip.win = XCreateSimpleWindow(dpy, root, 0, 0,
                                    tooltip.width, tooltip.height,
                                    0, white, dark_blue);
   XSelectInput(dpy, tooltip.win, ExposureMask);
+  surface_init(&tooltip.surface, tooltip.win, 1, tooltip.width, tooltip.height, dark_blue);
 
   debug_log("App launcher created with %d categories", app_launcher.category_count);
   for (int i = 0; i < app_launcher.category_count; i++) {
@@ -4103,9 +10095,19 @@ int main() {
 
   setup_mouse_cursor();
 
+  // Opt-in compositing, once every WM window exists
+  compositor_init();
+
   XGrabKey(dpy, XKeysymToKeycode(dpy, XK_F11), 0, root, True, GrabModeAsync, GrabModeAsync);
   XGrabKey(dpy, XKeysymToKeycode(dpy, XK_F12), 0, root, True, GrabModeAsync, GrabModeAsync);
   XGrabKey(dpy, XKeysymToKeycode(dpy, XK_Escape), ControlMask, root, True, GrabModeAsync, GrabModeAsync);
+  XGrabKey(dpy, XKeysymToKeycode(dpy, XK_space), ControlMask | Mod1Mask, root, True,
+           GrabModeAsync, GrabModeAsync);
+  for (int shift = 0; shift <= 1; shift++) {
+      unsigned int mods = ControlMask | Mod1Mask | (shift ? ShiftMask : 0);
+      XGrabKey(dpy, XKeysymToKeycode(dpy, XK_Left), mods, root, True, GrabModeAsync, GrabModeAsync);
+      XGrabKey(dpy, XKeysymToKeycode(dpy, XK_Right), mods, root, True, GrabModeAsync, GrabModeAsync);
+  }
 
   debug_log("Modern DiamondWM initialization complete");
   printf("Modern DiamondWM v1 with Pin to Panel feature started!\n");
@@ -4128,6 +10130,12 @@ int main() {
   while (1) {
       check_clock_update();
 
+      // Icons decoded in the background since the last pass
+      if (icon_service_poll()) {
+          draw_panel();
+          draw_app_launcher();
+      }
+
       if (XPending(dpy)) {
           XNextEvent(dpy, &ev);
           event_count++;
@@ -4136,29 +10144,70 @@ int main() {
               debug_log("Event #%d: type=%d", event_count, ev.type);
           }
 
+          if (compositing) compositor_handle_event(&ev);
+
           switch (ev.type) {
               case MapRequest:
                   debug_log("MapRequest event for window %lu", ev.xmaprequest.window);
-                  manage_window(ev.xmaprequest.window);
-                  XMapWindow(dpy, ev.xmaprequest.window);
+                  {
+                      Window w = ev.xmaprequest.window;
+                      Client *c = find_client(w);
+                      if (!c || c->win != w) {
+                          manage_window(w);
+                          c = find_client(w);
+                          if (!c || c->win != w) {
+                              XMapWindow(dpy, w);
+                              break;
+                          }
+                      } else if (!c->is_mapped) {
+                          // A minimized client asking to be shown again
+                          c->is_mapped = 1;
+                          ewmh_client_state_changed(c);
+                          mark_layout_dirty(c->desktop);
+                      }
+
+                      // New windows take the focus, unless their desktop is hidden
+                      if (client_on_current_desktop(c)) {
+                          map_client(c);
+                          focus_client(c);
+                      }
+                  }
+                  break;
+
+              case FocusIn:
+              case FocusOut:
+                  handle_focus_change(&ev.xfocus);
+                  break;
+
+              case ClientMessage:
+                  handle_client_message(&ev.xclient);
                   break;
 
               case UnmapNotify:
                   debug_log("UnmapNotify event for window %lu", ev.xunmap.window);
-                  unmanage_window(ev.xunmap.window);
+                  {
+                      // Frames are ours; only a client's own unmap withdraws it
+                      Client *c = find_client(ev.xunmap.window);
+                      if (!c || c->win != ev.xunmap.window) break;
+                      if (c->ignore_unmaps > 0 && !ev.xunmap.send_event) {
+                          c->ignore_unmaps--;
+                          break;
+                      }
+                      withdraw_client(c);
+                  }
                   break;
 
               case DestroyNotify:
                   debug_log("DestroyNotify event for window %lu", ev.xdestroywindow.window);
-                  for (int i = 0; i < client_count; i++) {
-                      if (clients[i] && clients[i]->win == ev.xdestroywindow.window) {
+                  {
+                      Client *c = find_client(ev.xdestroywindow.window);
+                      if (c && c->win == ev.xdestroywindow.window) {
                           debug_log("Client window %lu destroyed, destroying frame %lu",
-                                   clients[i]->win, clients[i]->frame);
-                          Window frame = clients[i]->frame;
-                          unmanage_window(clients[i]->win);
+                                   c->win, c->frame);
+                          Window frame = c->frame;
+                          unmanage_window(c->win);
                           XDestroyWindow(dpy, frame);
                           XFlush(dpy);
-                          break;
                       }
                   }
                   break;
@@ -4193,9 +10242,43 @@ int main() {
                 }
                 break;
 
+              case PropertyNotify:
+                  // Icons are refetched on the next paint, never eagerly
+                  if (ev.xproperty.atom == atoms[ATOM_NET_WM_ICON]) {
+                      Client *c = find_client(ev.xproperty.window);
+                      if (c && c->win == ev.xproperty.window) {
+                          invalidate_client_icon(c);
+                          draw_panel();
+                      }
+                  } else if (ev.xproperty.atom == atoms[ATOM_NET_WM_NAME] ||
+                             ev.xproperty.atom == XA_WM_NAME) {
+                      // Read once the queue is drained, however often it changed
+                      Client *c = find_client(ev.xproperty.window);
+                      if (c && c->win == ev.xproperty.window) {
+                          c->title_dirty = 1;
+                          titles_dirty = 1;
+                      }
+                  } else if (ev.xproperty.atom == XA_WM_CLASS) {
+                      // A new class can move the window to another pinned app
+                      Client *c = find_client(ev.xproperty.window);
+                      if (c && c->win == ev.xproperty.window) {
+                          read_client_class(c);
+                          associate_client(c);
+                          draw_panel();
+                      }
+                  }
+                  break;
+
               case ConfigureRequest:
                   {
                       XConfigureRequestEvent *cre = &ev.xconfigurerequest;
+                      Client *c = find_client(cre->window);
+                      if (c && c->win == cre->window) {
+                          queue_configure_request(c, cre);
+                          break;
+                      }
+
+                      // Not ours to manage: let it have what it asked for
                       XWindowChanges wc;
                       wc.x = cre->x;
                       wc.y = cre->y;
@@ -4212,21 +10295,22 @@ int main() {
                   if (ev.xexpose.window == panel.win) {
                       draw_panel();
                   } else if (ev.xexpose.window == menu.win) {
-                      draw_menu();
+                      present_popup(&menu.window_surface, &menu.surface, menu.alpha);
                   } else if (ev.xexpose.window == app_launcher.win) {
-                      draw_app_launcher();
+                      present_popup(&app_launcher.window_surface, &app_launcher.surface,
+                                    app_launcher.alpha);
                   } else if (ev.xexpose.window == window_control_menu.win) {
-                      draw_window_control_menu();
+                      present_popup(&window_control_menu.window_surface, &window_control_menu.surface,
+                                    window_control_menu.alpha);
                   } else if (ev.xexpose.window == pinned_app_menu.win) {
-                      draw_pinned_app_menu();
+                      present_popup(&pinned_app_menu.window_surface, &pinned_app_menu.surface,
+                                    pinned_app_menu.alpha);
                   } else if (ev.xexpose.window == tooltip.win) {
                       draw_tooltip();
                   } else {
-                      for (int i = 0; i < client_count; i++) {
-                          if (clients[i] && clients[i]->frame == ev.xexpose.window) {
-                              draw_window_decorations(clients[i]);
-                              break;
-                          }
+                      Client *c = find_client(ev.xexpose.window);
+                      if (c && c->frame == ev.xexpose.window) {
+                          draw_window_decorations(c);
                       }
                   }
                   break;
@@ -4234,7 +10318,18 @@ int main() {
               default:
                   break;
           }
+      } else if (compositing) {
+          // Queue drained: paint the accumulated damage as one frame, then
+          // sleep until the server has something new for us
+          flush_deferred();
+          compositor_paint();
+          fd_set fds;
+          struct timeval timeout = {0, 50000};
+          FD_ZERO(&fds);
+          FD_SET(ConnectionNumber(dpy), &fds);
+          select(ConnectionNumber(dpy) + 1, &fds, NULL, NULL, &timeout);
       } else {
+          flush_deferred();
           usleep(50000);
       }
   }
@@ -4247,7 +10342,18 @@ int main() {
   if (xft_fonts.regular) XftFontClose(dpy, xft_fonts.regular);
   if (xft_fonts.bold) XftFontClose(dpy, xft_fonts.bold);
   if (xft_fonts.title) XftFontClose(dpy, xft_fonts.title);
-  if (xft_draw) XftDrawDestroy(xft_draw);
+
+  compositor_shutdown();
+  free_theme_textures();
+  free_logo_assets();
+  free_icon_atlas();
+  free_tooltip_faces();
+  free_gc_pool();
+  free_client_registry();
+  free_stacking();
+  if (ewmh.check) XDestroyWindow(dpy, ewmh.check);
+  free_string_table();
+  icon_service_shutdown();
 
   debug_log("=== Modern DiamondWM Exiting ===");
   XCloseDisplay(dpy);